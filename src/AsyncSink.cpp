@@ -0,0 +1,396 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "AsyncSink.h"
+#include "Helpers.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <ctime>
+
+using std::endl;
+
+void* asyncsink_writer(void* p);
+
+
+/**
+ * Wrap a data sink.
+ * @param settings Pointer to the global settings
+ * @param sink     The sink to write to, owned by the AsyncSink from now on
+ */
+AsyncSink::AsyncSink(swspect_settings_t* settings, DataSink* sink)
+{
+   this->settings = settings;
+   this->sink = sink;
+   queue.resize((settings->sink_queue_len > 0) ? settings->sink_queue_len : 1, NULL);
+   queue_head = 0;
+   queue_count = 0;
+   writing = 0;
+   running = false;
+   terminate_writer = false;
+   flush_requested = false;
+   queue_full_events = 0;
+   queue_full_wait = 0.0;
+   written_since_flush = 0;
+   last_flush = 0.0;
+   pthread_mutex_init(&qmutex, NULL);
+   pthread_cond_init(&cond_data, NULL);
+   pthread_cond_init(&cond_space, NULL);
+}
+
+AsyncSink::~AsyncSink()
+{
+   close();
+   for (size_t i=0; i<queue.size(); i++) {
+      delete queue[i];
+   }
+   delete sink;
+   pthread_cond_destroy(&cond_space);
+   pthread_cond_destroy(&cond_data);
+   pthread_mutex_destroy(&qmutex);
+}
+
+
+/**
+ * Open the wrapped sink and start the writer thread
+ * @return int Returns 0 on success
+ * @param  uri Location of the sink e.g. file path.
+ */
+int AsyncSink::open(std::string uri)
+{
+   if (running) {
+      close();
+   }
+   if (sink->open(uri) != 0) {
+      return -1;
+   }
+   sinkuri = uri;
+   queue_head = 0;
+   queue_count = 0;
+   writing = 0;
+   terminate_writer = false;
+   flush_requested = false;
+   queue_full_events = 0;
+   queue_full_wait = 0.0;
+   written_since_flush = 0;
+   last_flush = Helpers::getSysSeconds();
+   if (pthread_create(&wthread, NULL, asyncsink_writer, (void*)this) != 0) {
+      std::cerr << "AsyncSink: could not start the writer thread for " << uri << ", writing synchronously" << endl;
+      return 0;
+   }
+   running = true;
+   return 0;
+}
+
+
+/**
+ * Queue a copy of the data for writing. Waits only when the queue is full.
+ * @return Returns the number of bytes queued
+ * @param  buf Pointer to the buffer to write out.
+ */
+size_t AsyncSink::write(Buffer *buf)
+{
+   if (NULL == buf || buf->getLength() <= 0) {
+      return 0;
+   }
+   if (!running) {
+      return sink->write(buf);
+   }
+
+   /* wait for a free entry only under real backpressure */
+   pthread_mutex_lock(&qmutex);
+   if (queue_count == queue.size()) {
+      double t0 = Helpers::getSysSeconds();
+      if (queue_full_events == 0) {
+         *(settings->tlog) << "AsyncSink: output queue of " << sinkuri << " is full, waiting for the writer" << endl;
+      }
+      queue_full_events++;
+      while (queue_count == queue.size()) {
+         pthread_cond_wait(&cond_space, &qmutex);
+      }
+      queue_full_wait += Helpers::getSysSeconds() - t0;
+   }
+   size_t slot = (queue_head + queue_count) % queue.size();
+   pthread_mutex_unlock(&qmutex);
+
+   /* the free entry is not touched by the writer thread, copy without the lock */
+   size_t len = buf->getLength();
+   if ((queue[slot] == NULL) || (queue[slot]->getAllocated() < len)) {
+      delete queue[slot];
+      queue[slot] = new Buffer(len);
+   }
+   memcpy(queue[slot]->getData(), buf->getData(), len);
+   queue[slot]->setLength(len);
+   queue[slot]->getRecords() = buf->getRecords();
+
+   pthread_mutex_lock(&qmutex);
+   queue_count++;
+   pthread_cond_signal(&cond_data);
+   pthread_mutex_unlock(&qmutex);
+   return len;
+}
+
+
+/**
+ * Write out all queued data and flush the wrapped sink.
+ * @return int Returns 0 on success
+ */
+int AsyncSink::flush()
+{
+   if (!running) {
+      return sink->flush();
+   }
+   pthread_mutex_lock(&qmutex);
+   flush_requested = true;
+   pthread_cond_signal(&cond_data);
+   while (flush_requested || (queue_count > 0)) {
+      pthread_cond_wait(&cond_space, &qmutex);
+   }
+   pthread_mutex_unlock(&qmutex);
+   return 0;
+}
+
+
+/**
+ * Write out all queued data, stop the writer thread and close the wrapped sink.
+ * @return int Returns 0 on success
+ */
+int AsyncSink::close()
+{
+   if (running) {
+      pthread_mutex_lock(&qmutex);
+      terminate_writer = true;
+      pthread_cond_signal(&cond_data);
+      pthread_mutex_unlock(&qmutex);
+      pthread_join(wthread, NULL);
+      running = false;
+
+      if (queue_full_events > 0) {
+         *(settings->tlog) << "AsyncSink: output queue of " << sinkuri << " was full "
+                           << queue_full_events << " times, compute waited "
+                           << queue_full_wait << "s in total" << endl;
+      }
+   }
+   return sink->close();
+}
+
+
+/**
+ * Pass the data description on to the wrapped sink. The description
+ * is not queued, call this before writing data.
+ * @param key   Name of the property
+ * @param value Value of the property
+ */
+void AsyncSink::setMetadata(std::string const& key, std::string const& value)
+{
+   sink->setMetadata(key, value);
+}
+
+
+/**
+ * Body of the writer thread. Call only from the writer thread.
+ */
+void AsyncSink::writerLoop()
+{
+   pthread_mutex_lock(&qmutex);
+   while (1) {
+
+      /* sleep until there is data, a request, or unflushed data is due */
+      while ((queue_count == 0) && !terminate_writer && !flush_requested) {
+         if ((written_since_flush > 0) && (settings->sink_flush_seconds > 0)) {
+            double due = last_flush + settings->sink_flush_seconds;
+            struct timespec ts;
+            ts.tv_sec  = time_t(floor(due));
+            ts.tv_nsec = long((due - floor(due)) * 1e9);
+            if (pthread_cond_timedwait(&cond_data, &qmutex, &ts) != 0) {
+               break;
+            }
+         } else {
+            pthread_cond_wait(&cond_data, &qmutex);
+         }
+      }
+      writing = queue_count;
+      size_t first = queue_head;
+      bool requested = flush_requested;
+      pthread_mutex_unlock(&qmutex);
+
+      /* write out the whole batch without holding the lock */
+      for (size_t i=0; i<writing; i++) {
+         sink->write(queue[(first + i) % queue.size()]);
+      }
+      written_since_flush += writing;
+
+      /* flush according to the policy */
+      double now = Helpers::getSysSeconds();
+      bool due = (settings->sink_flush_writes > 0) && (written_since_flush >= settings->sink_flush_writes);
+      due = due || ((settings->sink_flush_seconds > 0) && (written_since_flush > 0)
+                    && ((now - last_flush) >= settings->sink_flush_seconds));
+      if (requested || due) {
+         sink->flush();
+         written_since_flush = 0;
+         last_flush = now;
+      }
+
+      pthread_mutex_lock(&qmutex);
+      queue_head   = (queue_head + writing) % queue.size();
+      queue_count -= writing;
+      writing      = 0;
+      if (requested) {
+         flush_requested = false;
+      }
+      pthread_cond_broadcast(&cond_space);
+      if (terminate_writer && (queue_count == 0)) {
+         break;
+      }
+   }
+   pthread_mutex_unlock(&qmutex);
+}
+
+
+/**
+ * Writer thread. Calls back to the AsyncSink that created it.
+ * @param  p   Pointer to the AsyncSink
+ */
+void* asyncsink_writer(void* p)
+{
+   AsyncSink* host = (AsyncSink*)p;
+   host->writerLoop();
+   pthread_exit((void*) 0);
+}
+
+
+#ifdef UNIT_TEST_ASINK
+// g++ -Wall -DUNIT_TEST_ASINK=1 AsyncSink.cpp Buffer.cpp Helpers.cpp LogFile.cpp -o asinktest -lpthread
+#include "LogFile.h"
+#include <sstream>
+#include <unistd.h>
+
+/* what the wrapped sink saw, kept outside because the AsyncSink deletes its sink */
+struct SlowSinkLog {
+   std::vector<int> seq;      // first float of every write, in the order written
+   std::vector<int> bad;      // sequence numbers whose data or records were not intact
+   int  flushes;
+   int  writes_at_flush;
+   bool closed;
+   int  writes_at_close;
+};
+
+class SlowSink : public DataSink {
+  public:
+   SlowSink(SlowSinkLog* log) : log(log) { }
+   int open(std::string uri) { return 0; }
+   size_t write(Buffer* buf) {
+      usleep(2000);
+      float const* v = (float const*)buf->getData();
+      size_t n = buf->getLength() / sizeof(float);
+      int s = int(v[0]);
+      bool ok = (n == size_t(1 + s % 7)) && (buf->getRecords().size() == 1) && (buf->getRecords()[0].ffts == s);
+      for (size_t i=0; i<n; i++) {
+         ok = ok && (v[i] == float(s));
+      }
+      log->seq.push_back(s);
+      if (!ok) { log->bad.push_back(s); }
+      return buf->getLength();
+   }
+   int flush() {
+      log->flushes++;
+      log->writes_at_flush = log->seq.size();
+      return 0;
+   }
+   int close() {
+      log->closed = true;
+      log->writes_at_close = log->seq.size();
+      return 0;
+   }
+  private:
+   SlowSinkLog* log;
+};
+
+/* write spectra first..first+num-1, each with a length and contents that tell it apart */
+static void asink_test_write(AsyncSink& as, Buffer& buf, int first, int num)
+{
+   for (int s=first; s<first+num; s++) {
+      float* v = (float*)buf.getData();
+      size_t n = 1 + s % 7;
+      for (size_t i=0; i<n; i++) {
+         v[i] = float(s);
+      }
+      buf.setLength(n * sizeof(float));
+      bufrecord_t rec = { double(s), 0, s, false };
+      buf.getRecords().assign(1, rec);
+      as.write(&buf);
+   }
+}
+
+int main(int argc, char** argv)
+{
+   int errors = 0;
+   std::ostringstream logtext, logcopy;
+   TeeStream tlog(logtext, logcopy);
+
+   swspect_settings_t s;
+   s.tlog               = &tlog;
+   s.sink_queue_len     = 4;
+   s.sink_flush_writes  = 0;
+   s.sink_flush_seconds = 0;
+
+   SlowSinkLog log = { std::vector<int>(), std::vector<int>(), 0, 0, false, 0 };
+   AsyncSink* as = new AsyncSink(&s, new SlowSink(&log));
+   as->open("slow");
+   Buffer buf(8 * sizeof(float));
+
+   /* flush() returns only after everything queued so far was written and flushed */
+   asink_test_write(*as, buf, 0, 10);
+   as->flush();
+   if ((log.seq.size() != 10) || (log.flushes != 1) || (log.writes_at_flush != 10)) {
+      std::cerr << "flush() returned after " << log.seq.size() << " of 10 writes, with "
+                << log.flushes << " flushes" << std::endl;
+      errors++;
+   }
+
+   /* many more writes than the queue holds, then close() writes out the rest before closing */
+   asink_test_write(*as, buf, 10, 100);
+   as->close();
+   if (logtext.str().find("is full") == std::string::npos) {
+      std::cerr << "the queue of the slow sink never filled up" << std::endl;
+      errors++;
+   }
+   if (!log.closed || (log.writes_at_close != 110)) {
+      std::cerr << "the wrapped sink was closed after " << log.writes_at_close << " of 110 writes" << std::endl;
+      errors++;
+   }
+   for (size_t i=0; i<log.seq.size(); i++) {
+      if (log.seq[i] != int(i)) {
+         std::cerr << "write " << i << " carried spectrum " << log.seq[i] << std::endl;
+         errors++;
+         break;
+      }
+   }
+   if (!log.bad.empty()) {
+      std::cerr << log.bad.size() << " writes arrived with wrong data, the first was spectrum " << log.bad[0] << std::endl;
+      errors++;
+   }
+   delete as;
+
+   std::cerr << "AsyncSink test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,113 @@
+#ifndef ASYNCSINK_H
+#define ASYNCSINK_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "DataSink.h"
+#include "Buffer.h"
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+/**
+  * class AsyncSink
+  * Wraps another data sink and writes to it from a separate writer thread.
+  * write() only copies the data into a bounded queue, so that the
+  * TaskDispatcher does not wait on disk I/O. It waits only when the queue
+  * is full. The writer thread writes out everything queued in one batch
+  * and flushes the wrapped sink every N writes and/or every N seconds.
+  */
+
+class AsyncSink : public DataSink
+{
+public:
+   /**
+    * Wrap a data sink.
+    * @param settings Pointer to the global settings
+    * @param sink     The sink to write to, owned by the AsyncSink from now on
+    */
+   AsyncSink(swspect_settings_t* settings, DataSink* sink);
+   ~AsyncSink();
+
+   /**
+    * Open the wrapped sink and start the writer thread
+    * @return int Returns 0 on success
+    * @param  uri Location of the sink e.g. file path.
+    */
+   int open(std::string uri);
+
+   /**
+    * Queue a copy of the data for writing. Waits only when the queue is full.
+    * @return Returns the number of bytes queued
+    * @param  buf Pointer to the buffer to write out.
+    */
+   size_t write(Buffer *buf);
+
+   /**
+    * Write out all queued data and flush the wrapped sink.
+    * @return int Returns 0 on success
+    */
+   int flush();
+
+   /**
+    * Write out all queued data, stop the writer thread and close the wrapped sink.
+    * @return int Returns 0 on success
+    */
+   int close();
+
+   /**
+    * Pass the data description on to the wrapped sink. The description
+    * is not queued, call this before writing data.
+    * @param key   Name of the property
+    * @param value Value of the property
+    */
+   void setMetadata(std::string const& key, std::string const& value);
+
+   /**
+    * Body of the writer thread. Call only from the writer thread.
+    */
+   void writerLoop();
+
+private:
+   swspect_settings_t* settings;
+   DataSink*           sink;            // wrapped sink, only the writer thread writes to it
+   std::string         sinkuri;
+
+   std::vector<Buffer*> queue;          // ring of buffer copies, allocated on first use
+   size_t              queue_head;      // oldest queued entry
+   size_t              queue_count;     // number of queued entries
+   size_t              writing;         // entries at the head that the writer thread is busy with
+
+   pthread_t           wthread;         // writer thread ID
+   pthread_mutex_t     qmutex;          // protects the queue state and the flags below
+   pthread_cond_t      cond_data;       // signals the writer thread: new data or a request
+   pthread_cond_t      cond_space;      // signals write() and flush(): entries were written out
+   bool                running;
+   bool                terminate_writer;
+   bool                flush_requested;
+
+   long                queue_full_events; // number of write() calls that had to wait for space
+   double              queue_full_wait;   // seconds spent waiting in those calls
+   long                written_since_flush;
+   double              last_flush;
+};
+
+#endif // ASYNCSINK_H
@@ -0,0 +1,126 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "BinSelection.h"
+#include "Helpers.h"
+
+#include <cstring>
+#include <sstream>
+
+/**
+ * Build the selection from a list of FFT bin ranges.
+ * @param settings Pointer to the global settings
+ * @param ranges   Comma-separated bins and from-to bin ranges, e.g. "0-100,2000-2100"
+ */
+BinSelection::BinSelection(swspect_settings_t* settings, std::string const& ranges)
+{
+   std::vector<double> from, to;
+   valid = (Helpers::parse_Ranges(ranges.c_str(), from, to) >= 0);
+
+   /* the full spectrum is either all bins or the sparse bins */
+   in_points = settings->out_points;
+   bins.resize(in_points);
+   for (int i=0; i<in_points; i++) {
+      bins[i] = settings->sparse_bins.empty() ? i : settings->sparse_bins[i];
+   }
+
+   /* mark the kept points, then collect them into runs */
+   std::vector<bool> keep(in_points, false);
+   for (size_t r=0; r<from.size(); r++) {
+      for (int i=0; i<in_points; i++) {
+         if ((bins[i] >= from[r]) && (bins[i] <= to[r])) { keep[i] = true; }
+      }
+   }
+   out_points = 0;
+   for (int i=0; i<in_points; i++) {
+      if (!keep[i]) { continue; }
+      if ((i > 0) && keep[i-1]) {
+         run_length.back()++;
+      } else {
+         run_start.push_back(i);
+         run_length.push_back(1);
+      }
+      out_points++;
+   }
+}
+
+/**
+ * @return Comma-separated FFT bin ranges that are actually kept
+ */
+std::string BinSelection::describe() const
+{
+   std::ostringstream s;
+   for (size_t r=0; r<run_start.size(); r++) {
+      int first = bins[run_start[r]];
+      int last  = bins[run_start[r] + run_length[r] - 1];
+      if (r > 0) { s << ","; }
+      s << first;
+      if (last != first) { s << "-" << last; }
+   }
+   return s.str();
+}
+
+/**
+ * Reduce a series of spectra in place to the kept points.
+ * @return Number of floats per spectrum after the reduction
+ * @param  data      First spectrum, later spectra follow back to back
+ * @param  nspectra  Number of spectra
+ * @param  floats_per_point  1 for power spectra, 2 for complex cross spectra
+ */
+size_t BinSelection::reduce(swsfloat_t* data, int nspectra, int floats_per_point) const
+{
+   /* the destination never runs ahead of the source, so in-place moves are safe */
+   swsfloat_t* dst = data;
+   for (int s=0; s<nspectra; s++) {
+      swsfloat_t const* src = data + size_t(s) * in_points * floats_per_point;
+      for (size_t r=0; r<run_start.size(); r++) {
+         size_t n = size_t(run_length[r]) * floats_per_point;
+         memmove(dst, src + size_t(run_start[r]) * floats_per_point, n * sizeof(swsfloat_t));
+         dst += n;
+      }
+   }
+   return size_t(out_points) * floats_per_point;
+}
+
+/**
+ * @return true if the kept points are one gapless range of FFT bins
+ */
+bool BinSelection::isContiguous() const
+{
+   if (run_start.size() != 1) {
+      return false;
+   }
+   return (bins[run_start[0] + run_length[0] - 1] - bins[run_start[0]]) == (run_length[0] - 1);
+}
+
+/**
+ * @return FFT bin of a kept point
+ * @param  point  Index of the point in a reduced spectrum
+ */
+int BinSelection::getBin(int point) const
+{
+   for (size_t r=0; r<run_start.size(); r++) {
+      if (point < run_length[r]) {
+         return bins[run_start[r] + point];
+      }
+      point -= run_length[r];
+   }
+   return -1;
+}
@@ -0,0 +1,88 @@
+#ifndef BINSELECTION_H
+#define BINSELECTION_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include <string>
+#include <vector>
+
+/**
+  * class BinSelection
+  * The subset of spectral points that one output sink keeps, given as
+  * ranges of FFT bins. Integrated spectra are reduced to this subset in
+  * place, before they are written out.
+  */
+
+class BinSelection
+{
+public:
+   /**
+    * Build the selection from a list of FFT bin ranges.
+    * @param settings Pointer to the global settings
+    * @param ranges   Comma-separated bins and from-to bin ranges, e.g. "0-100,2000-2100"
+    */
+   BinSelection(swspect_settings_t* settings, std::string const& ranges);
+
+   /**
+    * @return false if the list of ranges could not be parsed
+    */
+   bool isValid() const { return valid; }
+
+   /**
+    * @return Number of points that are kept from each spectrum
+    */
+   int getLength() const { return out_points; }
+
+   /**
+    * @return Comma-separated FFT bin ranges that are actually kept
+    */
+   std::string describe() const;
+
+   /**
+    * Reduce a series of spectra in place to the kept points.
+    * @return Number of floats per spectrum after the reduction
+    * @param  data      First spectrum, later spectra follow back to back
+    * @param  nspectra  Number of spectra
+    * @param  floats_per_point  1 for power spectra, 2 for complex cross spectra
+    */
+   size_t reduce(swsfloat_t* data, int nspectra, int floats_per_point) const;
+
+   /**
+    * @return true if the kept points are one gapless range of FFT bins
+    */
+   bool isContiguous() const;
+
+   /**
+    * @return FFT bin of a kept point
+    * @param  point  Index of the point in a reduced spectrum
+    */
+   int getBin(int point) const;
+
+private:
+   std::vector<int> run_start;   // consecutive runs of kept points, as indices into the full spectrum
+   std::vector<int> run_length;
+   std::vector<int> bins;        // FFT bin of every full-spectrum point
+   int in_points;                // points in a full spectrum
+   int out_points;               // points kept
+   bool valid;                   // the list of ranges was parsed completely
+};
+
+#endif // BINSELECTION_H
@@ -26,23 +26,99 @@
 #include <iostream>
 #include <cstring>
 
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
 using std::cerr;
 using std::endl;
 
+#define HUGEPAGE_BYTES         (size_t(2)*1024*1024)
+#define BUFFER_MPOL_PREFERRED  1    // MPOL_PREFERRED of <numaif.h>, without needing libnuma
+
+bool Buffer::use_hugepages = false;
+
+/**
+ * Map anonymous memory, on huge pages if possible, and prefer the given NUMA node
+ * for its pages. The pages are placed when they are first touched.
+ * @return char*    Start of the memory, or NULL on failure
+ * @param  bytes    Amount of bytes to map
+ * @param  node     NUMA node, or -1 for no preference
+ * @param  huge     true to try explicit huge pages, then transparent huge pages
+ * @param  mapped   Output, amount of bytes actually mapped
+ */
+static char* map_pages(size_t bytes, int node, bool huge, size_t& mapped)
+{
+   void* p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+   /* explicit huge pages only exist if the administrator reserved some */
+   if (huge) {
+      mapped = (bytes + HUGEPAGE_BYTES - 1) & ~(HUGEPAGE_BYTES - 1);
+      p = mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+   }
+#endif
+   if (p == MAP_FAILED) {
+      size_t page = sysconf(_SC_PAGESIZE);
+      mapped = (bytes + page - 1) & ~(page - 1);
+      p = mmap(NULL, mapped, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (huge && (p != MAP_FAILED)) {
+         madvise(p, mapped, MADV_HUGEPAGE);
+      }
+#endif
+   }
+   if (p == MAP_FAILED) {
+      mapped = 0;
+      return NULL;
+   }
+
+#ifdef SYS_mbind
+   if (node >= 0) {
+      unsigned long mask[16];
+      const size_t bits = 8 * sizeof(unsigned long);
+      memset(mask, 0, sizeof(mask));
+      if (size_t(node) < 8*sizeof(mask)) {
+         mask[node / bits] = 1UL << (node % bits);
+         syscall(SYS_mbind, p, mapped, BUFFER_MPOL_PREFERRED, mask, 8*sizeof(mask), 0);
+      }
+   }
+#endif
+   return (char*)p;
+}
+
 
 /**
  * Initialize buffer by allocating memory-aligned bytes.
- * @param bytes Amount of bytes to allocate
+ * @param bytes    Amount of bytes to allocate
+ * @param headroom Amount of bytes to allocate in front of the data
+ * @param node     NUMA node where the memory should be placed, or -1 for anywhere
  */
-Buffer::Buffer(size_t bytes)
+Buffer::Buffer(size_t bytes, size_t headroom, int node)
 {
+   /* the data stays 128-byte aligned, the head room sits right before it */
+   size_t pad    = (headroom + 127) & ~size_t(127);
    len_allocated = 0;
    length        = 0;
-   data = (char*)memalign(128, bytes);
-   if (NULL == data) {
-      cerr << "Failed to allocate " << bytes << " bytes." << endl;
+   len_headroom  = 0;
+   len_mapped    = 0;
+   data          = NULL;
+   base          = NULL;
+
+   /* large buffers on huge pages, and buffers of a known core on its NUMA node */
+   bool huge = use_hugepages && ((pad + bytes) >= HUGEPAGE_BYTES/2);
+   if (huge || (node >= 0)) {
+      base = map_pages(pad + bytes, node, huge, len_mapped);
+   }
+   if (NULL == base) {
+      base = (char*)memalign(128, pad + bytes);
+   }
+   if (NULL == base) {
+      cerr << "Failed to allocate " << (pad + bytes) << " bytes." << endl;
    } else {
+      data          = base + pad;
       len_allocated = bytes;
+      len_headroom  = headroom;
    }
 }
 
@@ -51,10 +127,13 @@ Buffer::Buffer(size_t bytes)
  */
 Buffer::~Buffer() 
 {
-   if (NULL != data) {
-      free(data);
-      data = NULL;
+   if ((NULL != base) && (len_mapped > 0)) {
+      munmap(base, len_mapped);
+   } else if (NULL != base) {
+      free(base);
    }
+   base = NULL;
+   data = NULL;
 }
 
 /**
@@ -84,6 +163,24 @@ size_t Buffer::getAllocated()
    return len_allocated;
 }
 
+/**
+ * Returns how many bytes directly in front of getData() belong to the buffer.
+ * @return size_t
+ */
+size_t Buffer::getHeadroom()
+{
+   return len_headroom;
+}
+
+/**
+ * Select whether large buffers allocated from now on use 2 MB huge pages.
+ * @param on  true to use huge pages where available
+ */
+void Buffer::setUseHugePages(bool on)
+{
+   use_hugepages = on;
+}
+
 /**
  * Externally set the length of contained data.
  * @param len New length
@@ -98,6 +195,24 @@ void Buffer::setLength(size_t len)
    }
 }
 
+/**
+ * Return the time marks of raw data, sorted by their offset.
+ * @return Runs of samples, empty if the source did not mark the data
+ */
+std::vector<buftimemark_t>& Buffer::getTimeMarks()
+{
+   return marks;
+}
+
+/**
+ * Return the time and integration of each record of results in the buffer.
+ * @return Records, empty if not known
+ */
+std::vector<bufrecord_t>& Buffer::getRecords()
+{
+   return records;
+}
+
 #ifdef UNIT_TEST_BUF
 int main(int argc, char** argv)
 {
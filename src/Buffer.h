@@ -23,20 +23,52 @@
 **************************************************************************/
 
 #include <cstring>
+#include <vector>
+
+/**
+ * Time of a run of raw input samples. A data source starts a new run
+ * where the time of the data jumps, or where the data becomes invalid.
+ */
+typedef struct buftimemark_tt {
+   size_t offset;         // first byte of the run in the buffer data
+   double time_s;         // time of that byte after the time reference of the run, negative if not known
+   bool   valid;          // false if the source flagged the data of the run as invalid
+} buftimemark_t;
+
+/**
+ * Time and integration of one record of results, e.g. one spectrum.
+ */
+typedef struct bufrecord_tt {
+   double time_s;         // start time after the time reference of the run, negative if not known
+   size_t valid_samples;  // valid input samples integrated into the record
+   int    ffts;           // non-overlapped FFTs integrated into the record, 0 if not known
+   bool   partial;        // spectrum cut short at the end of the data, not scaled to an average
+} bufrecord_t;
 
 class Buffer
 {
 private:
+   char* base;
    char* data;
    size_t len_allocated;
+   size_t len_headroom;
+   size_t len_mapped;           // size of the mmap()ed memory, 0 if it came from memalign()
    size_t length;
 
+   std::vector<buftimemark_t> marks;   // raw data: runs of samples with their time
+   std::vector<bufrecord_t> records;   // results: time and integration of each record
+
+   static bool use_hugepages;
+
 public:
    /**
     * Initialize buffer by allocating memory-aligned bytes.
-    * @param bytes Amount of bytes to allocate
+    * @param bytes    Amount of bytes to allocate
+    * @param headroom Amount of bytes to allocate in front of the data,
+    *                 for prepending data without moving the contents
+    * @param node     NUMA node where the memory should be placed, or -1 for anywhere
     */
-   Buffer(size_t bytes);
+   Buffer(size_t bytes, size_t headroom = 0, int node = -1);
 
    /**
     * Release the buffer
@@ -61,12 +93,40 @@ public:
     */
    size_t getAllocated();
 
+   /**
+    * Returns how many bytes directly in front of getData() belong to the buffer.
+    * @return size_t
+    */
+   size_t getHeadroom();
+
+   /**
+    * Select whether large buffers allocated from now on use 2 MB huge pages.
+    * @param on  true to use huge pages where available
+    */
+   static void setUseHugePages(bool on);
+
     /**
      * Externally set the length of contained data.
      * @param len New length
      */
    void setLength(size_t len);
 
+   /**
+    * Return the time marks of raw data, sorted by their offset. The times
+    * are in seconds after the time reference of the run (set by the data
+    * sources from the frame headers, or the start of the input file for
+    * data without time stamps).
+    * @return Runs of samples, empty if the source did not mark the data
+    */
+   std::vector<buftimemark_t>& getTimeMarks();
+
+   /**
+    * Return the time and integration of each record of results that
+    * are in the buffer, in the order of the records.
+    * @return Records, empty if not known
+    */
+   std::vector<bufrecord_t>& getRecords();
+
 };
 
 #endif // BUFFER_H
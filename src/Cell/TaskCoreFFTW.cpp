@@ -222,6 +222,7 @@ void TaskCoreFFTW::reset_spectrum()
 void TaskCoreFFTW::resetBuffer(Buffer* buf) 
 { 
    vecZero((fftw_real*) buf->getData(), buf->getLength() / sizeof(fftw_real));
+   buf->getRecords().clear();
 }
 
 
@@ -0,0 +1,216 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "CostasLoop.h"
+#include <cmath>
+
+#define COSTAS_DAMPING  0.7071  // loop damping factor zeta, critically damped
+
+/**
+ * Prepare the loop filter from the settings.
+ * @param settings Pointer to the global settings
+ */
+CostasLoop::CostasLoop(swspect_settings_t* settings)
+{
+   cfg = settings;
+
+   /* Standard 2nd order loop with noise bandwidth Bn, update interval T */
+   double T     = double(cfg->costas_block_len) / cfg->samplingfreq;
+   double zeta  = COSTAS_DAMPING;
+   double theta = (cfg->costas_loop_bw_hz * T) / (zeta + 1.0/(4.0*zeta));
+   double denom = 1.0 + 2.0*zeta*theta + theta*theta;
+   k1 = (4.0 * zeta * theta) / denom;
+   k2 = (4.0 * theta * theta) / denom;
+
+   block_scale = 1.0 / double(cfg->costas_block_len);
+   block_time  = T;
+   reset();
+}
+
+/**
+ * Reset the loop to the a-priori carrier frequency.
+ */
+void CostasLoop::reset()
+{
+   nco_phase = 0.0;
+   nco_rate  = 0.0;
+   nblocks   = 0;
+   acc_I2    = 0.0;
+   acc_Q2    = 0.0;
+   acc_count = 0;
+}
+
+/**
+ * Track the carrier through a series of downconverted blocks.
+ * @return int      Number of output points placed into the output buffer
+ * @param  blocks   Buffer with swscomplex_t integrate-and-dump results from a TaskCore
+ * @param  points   Buffer to receive swscostas_point_t output points
+ */
+int CostasLoop::track(Buffer* blocks, Buffer* points)
+{
+   swscomplex_t const* z   = (swscomplex_t const*)blocks->getData();
+   swscostas_point_t*  out = (swscostas_point_t*)points->getData();
+   size_t nin  = blocks->getLength() / sizeof(swscomplex_t);
+   size_t nmax = points->getAllocated() / sizeof(swscostas_point_t);
+   size_t nout = 0;
+
+   for (size_t k=0; k<nin; k++) {
+
+      /* de-rotate the block by the loop NCO */
+      double c  = cos(nco_phase);
+      double s  = sin(nco_phase);
+      double zr = block_scale * z[k].re;
+      double zi = block_scale * z[k].im;
+      double I  = zr*c + zi*s;
+      double Q  = zi*c - zr*s;
+      double P  = I*I + Q*Q;
+
+      /* phase detector: amplitude-normalized Costas I*Q, or PLL arctangent */
+      double err = 0.0;
+      if (cfg->costas_suppressed_carrier) {
+         if (P > 0.0) { err = (I*Q) / P; }
+      } else {
+         err = atan2(Q, I);
+      }
+
+      /* loop filter and NCO update */
+      nco_rate  += k2 * err;
+      nco_phase += nco_rate + k1 * err;
+      nblocks++;
+
+      /* average into the next output point */
+      acc_I2 += I*I;
+      acc_Q2 += Q*Q;
+      acc_count++;
+      if ((acc_count >= cfg->costas_output_decim) && (nout < nmax)) {
+         double Ptot = acc_I2 + acc_Q2;
+         out[nout].time      = (double(nblocks) - 0.5*acc_count) * block_time;
+         out[nout].freq      = cfg->costas_carrier_hz + nco_rate / (2*M_PI*block_time);
+         out[nout].phase     = nco_phase;
+         out[nout].amplitude = swsfloat_t(sqrt(Ptot / acc_count));
+         out[nout].lock      = (Ptot > 0.0) ? swsfloat_t((acc_I2 - acc_Q2) / Ptot) : 0.0f;
+         nout++;
+         acc_I2 = 0.0;
+         acc_Q2 = 0.0;
+         acc_count = 0;
+      }
+   }
+
+   points->setLength(nout * sizeof(swscostas_point_t));
+   return nout;
+}
+
+
+#ifdef UNIT_TEST_COSTAS
+// g++ -Wall -DUNIT_TEST_COSTAS=1 CostasLoop.cpp Buffer.cpp Helpers.cpp -o costastest
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+
+static double costas_test_gauss()
+{
+   double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   return sqrt(-2.0*log(u1)) * cos(2*M_PI*u2);
+}
+
+/**
+ * Track a carrier offset from the a-priori frequency, in noise, and check the
+ * frequency and phase of the loop after it settled.
+ * @return int  Number of errors
+ * @param  suppressed  true for a BPSK carrier and the Costas detector, false for a residual carrier and the PLL
+ */
+static int costas_test_track(bool suppressed)
+{
+   const int    blocklen = 1000, decim = 100, nblocks = 6000, per_call = 250;
+   const double fs = 1e6, offset = 3.0, phase0 = 1.0, sigma = 0.1;
+   const double settled = 2.0;    // seconds, several times 1/Bn
+   const char*  name = suppressed ? "Costas" : "PLL";
+   int errors = 0;
+
+   swspect_settings_t s;
+   s.samplingfreq              = fs;
+   s.costas_block_len          = blocklen;
+   s.costas_output_decim       = decim;
+   s.costas_loop_bw_hz         = 10.0;
+   s.costas_carrier_hz         = 1e5;
+   s.costas_suppressed_carrier = suppressed;
+   CostasLoop loop(&s);
+
+   /* integrate-and-dump blocks as the TaskCore makes them: the carrier left after the
+    * a-priori NCO, random BPSK symbols of one block each, and noise of sigma per component */
+   const double T = blocklen / fs;
+   Buffer blocks(per_call * sizeof(swscomplex_t));
+   Buffer points((per_call/decim + 1) * sizeof(swscostas_point_t));
+   srand(1);
+   double max_df = 0.0, max_dph = 0.0, min_lock = 1.0;
+   int total = 0;
+   for (int k0=0; k0<nblocks; k0+=per_call) {
+      swscomplex_t* z = (swscomplex_t*)blocks.getData();
+      for (int k=0; k<per_call; k++) {
+         double ph = phase0 + 2*M_PI*offset*T*(k0 + k);
+         double d  = (suppressed && (rand() & 1)) ? -1.0 : 1.0;
+         z[k].re = swsfloat_t(blocklen * (d*cos(ph) + sigma*costas_test_gauss()));
+         z[k].im = swsfloat_t(blocklen * (d*sin(ph) + sigma*costas_test_gauss()));
+      }
+      blocks.setLength(per_call * sizeof(swscomplex_t));
+      int n = loop.track(&blocks, &points);
+      total += n;
+
+      /* the loop NCO has the phase of the next block, Costas loops lock modulo pi */
+      swscostas_point_t const* p = (swscostas_point_t const*)points.getData();
+      for (int i=0; i<n; i++) {
+         if (p[i].time < settled) {
+            continue;
+         }
+         double next = (p[i].time + 0.5*decim*T) / T;
+         double dph  = p[i].phase - (phase0 + 2*M_PI*offset*T*next);
+         double wrap = suppressed ? M_PI : 2*M_PI;
+         dph = dph - wrap*floor(dph/wrap + 0.5);
+         max_df   = std::max(max_df, fabs(p[i].freq - (s.costas_carrier_hz + offset)));
+         max_dph  = std::max(max_dph, fabs(dph));
+         min_lock = std::min(min_lock, double(p[i].lock));
+      }
+   }
+
+   /* output points continue across calls that end in the middle of a point */
+   if (total != nblocks/decim) {
+      std::cerr << name << ": " << total << " output points from " << nblocks << " blocks" << std::endl;
+      errors++;
+   }
+
+   /* with Bn*T = 0.01 the rms phase jitter is about sigma*sqrt(2*Bn*T) = 0.014 rad */
+   if ((max_df > 0.2) || (max_dph > 0.1) || (min_lock < 0.9)) {
+      std::cerr << name << ": after settling the frequency is off by up to " << max_df << " Hz, the phase by up to "
+                << max_dph << " rad, and the lock indicator went down to " << min_lock << std::endl;
+      errors++;
+   }
+   return errors;
+}
+
+int main(int argc, char** argv)
+{
+   int errors = 0;
+   errors += costas_test_track(true);
+   errors += costas_test_track(false);
+   std::cerr << "CostasLoop test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
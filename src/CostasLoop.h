@@ -0,0 +1,86 @@
+#ifndef COSTASLOOP_H
+#define COSTASLOOP_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+
+/**
+ * One output point of the carrier tracking loop.
+ */
+typedef struct swscostas_point_tt {
+   double     time;       // seconds since the first processed sample, middle of the averaging interval
+   double     freq;       // tracked carrier frequency in Hz
+   double     phase;      // unwrapped carrier phase in radians relative to the a-priori NCO
+   swsfloat_t amplitude;  // rms amplitude of the downconverted carrier
+   swsfloat_t lock;       // lock indicator (I^2-Q^2)/(I^2+Q^2), near 1.0 when in lock
+} swscostas_point_t;
+
+/**
+  * class CostasLoop
+  * Second-order carrier tracking loop, either as a Costas loop for
+  * suppressed-carrier BPSK signals or as a plain PLL for residual carriers.
+  *
+  * The TaskCore does the expensive part: it mixes the unpacked samples
+  * with a fixed a-priori NCO and integrates-and-dumps them into short
+  * complex blocks (see TaskCoreIPP::downconvert_carrier()). The loop then
+  * runs on this decimated stream in the TaskDispatcher, in buffer order,
+  * so that loop state is continuous across all cores and buffers.
+  */
+
+class CostasLoop
+{
+public:
+   /**
+    * Prepare the loop filter from the settings.
+    * @param settings Pointer to the global settings
+    */
+   CostasLoop(swspect_settings_t* settings);
+
+   /**
+    * Reset the loop to the a-priori carrier frequency.
+    */
+   void reset();
+
+   /**
+    * Track the carrier through a series of downconverted blocks.
+    * @return int      Number of output points placed into the output buffer
+    * @param  blocks   Buffer with swscomplex_t integrate-and-dump results from a TaskCore
+    * @param  points   Buffer to receive swscostas_point_t output points
+    */
+   int track(Buffer* blocks, Buffer* points);
+
+private:
+   swspect_settings_t* cfg;
+
+   double k1, k2;          // proportional and integral loop filter gains
+   double block_scale;     // normalization of integrated blocks
+   double block_time;      // duration of one block in seconds
+
+   double nco_phase;       // residual phase of the loop NCO in radians, unwrapped
+   double nco_rate;        // residual phase rate of the loop NCO in radians per block
+   swsint64_t nblocks;     // total number of blocks tracked so far
+
+   double acc_I2, acc_Q2;  // accumulated arm powers for the current output point
+   int    acc_count;
+};
+
+#endif // COSTASLOOP_H
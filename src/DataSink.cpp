@@ -20,6 +20,7 @@
 
 #include "DataSink.h"
 #include "FileSink.h"
+#include "AsyncSink.h"
 #include <string>
 
 /**
@@ -39,6 +40,11 @@ DataSink* DataSink::getDataSink(std::string const& uri, swspect_settings_t* sett
       ds = new FileSink(settings);
    }
 
+   /* decouple the disk writes from the computation */
+   if ((ds != NULL) && (settings->sink_queue_len > 0)) {
+      ds = new AsyncSink(settings, ds);
+   }
+
    return ds;
 }
 
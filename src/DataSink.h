@@ -46,12 +46,27 @@ public:
     */
    virtual size_t write(Buffer *buf) = 0;
 
+   /**
+    * Push all data written so far through to the resource
+    * @return int Returns 0 on success
+    */
+   virtual int flush() { return 0; }
+
    /**
     * Close the resource
     * @return int Returns 0 on success
     */
    virtual int close() = 0;
 
+   /**
+    * Describe the data that is written to the resource, for example
+    * the number of points or the bin ranges of each output record.
+    * Sinks that cannot store such metadata ignore it.
+    * @param key   Name of the property
+    * @param value Value of the property
+    */
+   virtual void setMetadata(std::string const& key, std::string const& value) { return; }
+
    /**
     * Return a new data sink object corresponding to the URI.
     * @return DataSink*   A data sink that can be FileSink, etc
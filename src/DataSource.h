@@ -41,11 +41,12 @@ public:
    virtual int open(std::string uri) = 0;
 
    /**
-    * Try to fill the entire buffer with new data and return the number of bytes actually read
+    * Try to fill the buffer with new data and return the number of bytes actually read
     * @return int    Returns the amount of bytes read
     * @param  buf    Pointer to Buffer to fill out
+    * @param  nbytes Number of bytes to read, at most the allocated size of the buffer
     */
-   virtual int read(Buffer *buf) = 0;
+   virtual int read(Buffer *buf, size_t nbytes) = 0;
 
    /**
     * Close the resource
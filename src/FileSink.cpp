@@ -19,6 +19,12 @@
 **************************************************************************/
 
 #include "FileSink.h"
+#include "Helpers.h"
+#include "OutputCodec.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -34,8 +40,16 @@ int FileSink::open(std::string uri)
       ofile.close();
    }
    ofile.open(uri.c_str(), /*std::ios::binary |*/ std::ofstream::trunc | std::ios::out);
+   fileuri = uri;
+   file_pos = 0;
+   records_written = 0;
+   index.clear();
    if (ofile.is_open()) {
-      ofile.precision(12);
+      if ((NULL != settings) && (settings->sinkformat == Container)) {
+         /* reserve the header page, it is rewritten whenever the metadata changes */
+         writeContainerHeader(0);
+         file_pos = SWSC_HEADER_BYTES;
+      }
       return 0;
    } else {
       std::cerr << "Could not open output file " << uri << std::endl;
@@ -63,34 +77,86 @@ size_t FileSink::write(Buffer *buf)
       return 0;
    }
 
-   float* src = (float*) buf->getData();
-   size_t len = buf->getLength() / (2*sizeof(float));
+   /* a buffer may carry several records, e.g. several spectra of a core */
+   size_t rec_bytes = getRecordBytes();
+   if ((rec_bytes == 0) || ((buf->getLength() % rec_bytes) != 0)) {
+      rec_bytes = buf->getLength();
+   }
+   size_t nrecords = buf->getLength() / rec_bytes;
+   double interval = getMetadataValue("integration_s", settings->fft_integ_seconds);
+   double start    = settings->seconds_to_skip + double(records_written) * interval;
+
+   /* the records are timed by the data sources when the buffer describes them, else counted from the start */
+   std::vector<bufrecord_t> const& recinfo = buf->getRecords();
+   bool described = (recinfo.size() == nrecords);
 
    /* Write according to the output format specified in the INI/Settings */
    if (this->settings->sinkformat == Binary) {
-      ofile.write(buf->getData(), buf->getLength());
-   } else {
-      ofile << "// --------------------- DATA SET TIMESTAMP xxxx ---------------------" << std::endl;
-      #if 0
-      ofile << "// complex points = " << len << std::endl;
-      for (int i=0; i<len; i++) {
-         ofile << *(src+0) << "\t" << *(src+1) << std::endl; // Re,Im
-         src += 2;
+      size_t bytes = buf->getLength();
+      char const* data = encodeRecord(buf->getData(), bytes, false);
+      ofile.write(data, bytes);
+   } else if (this->settings->sinkformat == Container) {
+      double weight   = getMetadataValue("ffts_per_spectrum", 1.0);
+      double expected = interval * settings->samplingfreq;
+      char const* rec = buf->getData();
+      for (size_t r=0; r<nrecords; r++) {
+         size_t bytes = rec_bytes;
+         char const* data = encodeRecord(rec, bytes, settings->sink_compress);
+
+         /* records of half a page or more start on a page of their own */
+         swsint64_t pad = 0;
+         if (bytes >= (SWSC_PAGE_BYTES/2)) {
+            pad = (SWSC_PAGE_BYTES - (file_pos % SWSC_PAGE_BYTES)) % SWSC_PAGE_BYTES;
+         }
+         for (swsint64_t i=0; i<pad; i++) {
+            ofile.put(0);
+         }
+         file_pos += pad;
+
+         swscontainer_index_t entry;
+         entry.offset = file_pos;
+         entry.bytes  = bytes;
+         entry.time_s = start + double(r) * interval;
+         entry.weight = weight;
+         if (described && (recinfo[r].time_s >= 0)) {
+            entry.time_s = recinfo[r].time_s;
+         }
+
+         /* fewer valid input samples than the integration time holds, e.g. invalid frames or switching */
+         if (described && (recinfo[r].ffts > 0) && (expected > 0)) {
+            entry.weight *= std::min(1.0, double(recinfo[r].valid_samples) / expected);
+         }
+         index.push_back(entry);
+
+         ofile.write(data, bytes);
+         file_pos += bytes;
+         rec += rec_bytes;
       }
-      #else
-      ofile << "// FFT bins 0.." << (len-1) << " + Nyquist" << std::endl;
-      float mrNyquist = *(src+1);
-      for (size_t i=0; i<len; i++) {
-         // ofile << i << "\t\t" << *(src+0) << std::endl; // Re only
-         ofile << *(src+0) << std::endl; // Re only
-         src += 2;
+   } else {
+      /* format each record into one text block, complex points as "re<TAB>im" lines */
+      std::map<std::string, std::string>::const_iterator dt = metadata.find("datatype");
+      int columns = ((dt != metadata.end()) && (dt->second == "complex64")) ? 2 : 1;
+      size_t npoints = rec_bytes / (columns * sizeof(float));
+      float const* src = (float const*)buf->getData();
+      textbuf.resize(256 + npoints * columns * (HELPERS_FLOAT_CHARS + 1));
+      for (size_t r=0; r<nrecords; r++) {
+         char* out = &textbuf[0];
+         out += snprintf(out, 256, "// --------------------- DATA SET %llu TIMESTAMP %.12g s ---------------------\n"
+                                   "// %lu points\n",
+                         records_written + r, (described && (recinfo[r].time_s >= 0)) ? recinfo[r].time_s : (start + double(r) * interval),
+                         (unsigned long)npoints);
+         for (size_t i=0; i<npoints; i++) {
+            out += Helpers::format_float(*src++, out);
+            if (columns == 2) {
+               *out++ = '\t';
+               out += Helpers::format_float(*src++, out);
+            }
+            *out++ = '\n';
+         }
+         ofile.write(&textbuf[0], out - &textbuf[0]);
       }
-      // ofile << len << "\t\t" << mrNyquist << std::endl;
-      ofile << mrNyquist << std::endl;
-      #endif
    }
-   ofile.flush();
-
+   records_written += nrecords;
    if (!ofile.good()) {
       std::cerr << "Write I/O error!" << std::endl << std::flush;
    }
@@ -99,17 +165,245 @@ size_t FileSink::write(Buffer *buf)
 }
 
 
+/**
+ * Flush the file buffers
+ * @return int Returns 0 on success
+ */
+int FileSink::flush()
+{
+   if (!ofile.is_open()) {
+      return -1;
+   }
+   ofile.flush();
+   return ofile.good() ? 0 : -1;
+}
+
+
 /**
  * Close the resource
  * @return int Returns 0 on success
  */
 int FileSink::close() 
 {
+   if (!ofile.is_open()) {
+      return 0;
+   }
+
+   /* append the record index and point the header to it */
+   if ((NULL != settings) && (settings->sinkformat == Container)) {
+      if (!index.empty()) {
+         ofile.write((char const*)&index[0], index.size() * sizeof(swscontainer_index_t));
+      }
+      writeContainerHeader(file_pos);
+      file_pos += index.size() * sizeof(swscontainer_index_t);
+   }
    ofile.close();
    return 0;
 }
 
 
+/**
+ * Describe the data that is written to the file. The properties are
+ * kept in a "key = value" text file next to the output file (<uri>.info).
+ * @param key   Name of the property
+ * @param value Value of the property
+ */
+void FileSink::setMetadata(std::string const& key, std::string const& value)
+{
+   metadata[key] = value;
+   if (reducesPrecision()) {
+      metadata["precision"] = (settings->sink_precision == Float16) ? "float16" : "bfloat16";
+   }
+   if ((NULL != settings) && (settings->sinkformat == Container) && settings->sink_compress) {
+      metadata["codec"] = "byteshuffle+lz4";
+   }
+   if (ofile.is_open() && (NULL != settings) && (settings->sinkformat == Container)) {
+      writeContainerHeader(0);
+   }
+
+   /* the set is small, simply rewrite it completely */
+   std::ofstream info((fileuri + ".info").c_str(), std::ofstream::trunc | std::ios::out);
+   std::map<std::string, std::string>::const_iterator it;
+   for (it=metadata.begin(); it!=metadata.end(); it++) {
+      info << it->first << " = " << it->second << std::endl;
+   }
+   if (!info.good()) {
+      std::cerr << "Could not write metadata file " << fileuri << ".info" << std::endl;
+   }
+}
+
+
+/**
+ * @return Bytes per record as described by the metadata, 0 if every write is one record
+ */
+size_t FileSink::getRecordBytes() const
+{
+   std::map<std::string, std::string>::const_iterator dt = metadata.find("datatype");
+   size_t points = size_t(getMetadataValue("points_per_spectrum", 0));
+   if ((dt != metadata.end()) && (points > 0)) {
+      if (dt->second == "float32")   { return points * sizeof(float); }
+      if (dt->second == "complex64") { return points * 2*sizeof(float); }
+   }
+   return size_t(getMetadataValue("record_bytes", 0));
+}
+
+
+/**
+ * @return true if the records are float or complex data that is written with reduced precision
+ */
+bool FileSink::reducesPrecision() const
+{
+   if ((NULL == settings) || (settings->sink_precision == Float32)) {
+      return false;
+   }
+   std::map<std::string, std::string>::const_iterator dt = metadata.find("datatype");
+   return (dt != metadata.end()) && ((dt->second == "float32") || (dt->second == "complex64"));
+}
+
+
+/**
+ * Convert a record to the output precision and compress it as configured.
+ * @return Pointer to the data to write, the record itself or one of the scratch buffers
+ * @param  rec    record data
+ * @param  bytes  in: record size, out: size of the data to write
+ * @param  pack   true to compress
+ */
+char const* FileSink::encodeRecord(char const* rec, size_t& bytes, bool pack)
+{
+   char const* data = rec;
+   size_t elembytes = 1;
+
+   if (reducesPrecision()) {
+      size_t n = bytes / sizeof(float);
+      convbuf.resize(n * sizeof(uint16_t));
+      if (settings->sink_precision == Float16) {
+         OutputCodec::to_float16((float const*)rec, (uint16_t*)&convbuf[0], n);
+      } else {
+         OutputCodec::to_bfloat16((float const*)rec, (uint16_t*)&convbuf[0], n);
+      }
+      data = &convbuf[0];
+      bytes = n * sizeof(uint16_t);
+      elembytes = sizeof(uint16_t);
+   } else {
+      std::map<std::string, std::string>::const_iterator dt = metadata.find("datatype");
+      if ((dt != metadata.end()) && ((dt->second == "float32") || (dt->second == "complex64"))) {
+         elembytes = sizeof(float);
+      }
+   }
+
+   if (pack && (bytes > 0)) {
+      char const* src = data;
+      if (elembytes > 1) {
+         shufbuf.resize(bytes);
+         OutputCodec::shuffle(data, &shufbuf[0], bytes / elembytes, elembytes);
+         src = &shufbuf[0];
+      }
+      packbuf.resize(OutputCodec::compress_bound(bytes));
+      size_t packed = OutputCodec::compress(src, &packbuf[0], bytes);
+      if (packed > 0) {
+         data = &packbuf[0];
+         bytes = packed;
+      }
+   }
+   return data;
+}
+
+
+/**
+ * @return The numeric value of a metadata property, or dflt if it is not set
+ */
+double FileSink::getMetadataValue(std::string const& key, double dflt) const
+{
+   std::map<std::string, std::string>::const_iterator it = metadata.find(key);
+   if (it == metadata.end()) {
+      return dflt;
+   }
+   return atof(it->second.c_str());
+}
+
+
+/**
+ * Write or rewrite the Container header page from the settings and the metadata.
+ * @param index_offset  file offset of the record index, 0 while the file is open
+ */
+void FileSink::writeContainerHeader(swsint64_t index_offset)
+{
+   char page[SWSC_HEADER_BYTES];
+   memset(page, 0, sizeof(page));
+   swscontainer_header_t* hdr = (swscontainer_header_t*)page;
+
+   /* records have a fixed size and stride unless they were written otherwise; compressed
+    * records are smaller, the header keeps the uncompressed size to tell them apart */
+   size_t rec_bytes = getRecordBytes();
+   if (reducesPrecision()) {
+      rec_bytes /= 2;
+   }
+   bool sized = (rec_bytes > 0);
+   bool fixed = sized;
+   for (size_t i=0; sized && (i<index.size()); i++) {
+      fixed = fixed && (index[i].bytes == rec_bytes);
+      sized = (index[i].bytes == rec_bytes) || (settings->sink_compress && (index[i].bytes < rec_bytes));
+   }
+   fixed = fixed && sized;
+   swsint64_t stride = rec_bytes;
+   if (rec_bytes >= (SWSC_PAGE_BYTES/2)) {
+      stride = ((rec_bytes + SWSC_PAGE_BYTES - 1) / SWSC_PAGE_BYTES) * SWSC_PAGE_BYTES;
+   }
+
+   std::map<std::string, std::string>::const_iterator dt = metadata.find("datatype");
+   hdr->datatype = SWSC_UNKNOWN;
+   if (dt != metadata.end()) {
+      if (dt->second == "float32")        { hdr->datatype = SWSC_FLOAT32; }
+      else if (dt->second == "complex64") { hdr->datatype = SWSC_COMPLEX64; }
+      else                                { hdr->datatype = SWSC_STRUCT; }
+   }
+
+   memcpy(hdr->magic, SWSC_MAGIC, sizeof(hdr->magic));
+   hdr->version            = SWSC_VERSION;
+   hdr->header_bytes       = SWSC_HEADER_BYTES;
+   hdr->index_offset       = index_offset;
+   hdr->num_records        = (index_offset != 0) ? index.size() : 0;
+   hdr->record_bytes       = sized ? rec_bytes : 0;
+   hdr->record_stride      = fixed ? stride : 0;
+   hdr->points             = swsint64_t(getMetadataValue("points_per_spectrum", 0));
+   hdr->source             = int(getMetadataValue("source", 1));
+   hdr->channel            = int(getMetadataValue("channel", settings->use_channel_file1 + 1));
+   hdr->window_type        = settings->wf_type;
+   hdr->fft_points         = settings->fft_points;
+   hdr->samplingfreq       = settings->samplingfreq;
+   hdr->integration_s      = getMetadataValue("integration_s", settings->fft_integ_seconds);
+   hdr->start_s            = settings->seconds_to_skip;
+   hdr->ffts_per_record    = int(getMetadataValue("ffts_per_spectrum", 0));
+   hdr->fft_overlap_factor = settings->fft_overlap_factor;
+   hdr->bits_per_sample    = settings->bits_per_sample;
+   hdr->precision          = reducesPrecision() ? settings->sink_precision : Float32;
+   hdr->codec              = settings->sink_compress ? SWSC_CODEC_SHUFFLE_LZ4 : SWSC_CODEC_NONE;
+
+   /* the metadata text fills the rest of the page */
+   std::string text;
+   std::map<std::string, std::string>::const_iterator it;
+   for (it=metadata.begin(); it!=metadata.end(); it++) {
+      text += it->first + " = " + it->second + "\n";
+   }
+   size_t room = sizeof(page) - sizeof(swscontainer_header_t) - 1;
+   if (text.length() > room) {
+      std::cerr << "FileSink: metadata of " << fileuri << " truncated to the header page" << std::endl;
+      text.resize(room);
+   }
+   memcpy(page + sizeof(swscontainer_header_t), text.c_str(), text.length());
+
+   /* the header sits in front of the records, return to the end of the file afterwards */
+   ofile.seekp(0, std::ios::beg);
+   ofile.write(page, sizeof(page));
+   if (file_pos > 0) {
+      ofile.seekp(file_pos, std::ios::beg);
+   }
+   if (!ofile.good()) {
+      std::cerr << "FileSink: could not write the header of " << fileuri << std::endl;
+   }
+}
+
+
 #ifdef UNIT_TEST_FSINK
 int main(int argc, char** argv)
 {
@@ -25,12 +25,66 @@
 
 #include <string>
 #include <fstream>
+#include <map>
+#include <vector>
+
+/*
+ * Layout of the "Container" output format. The file starts with one page that
+ * holds the swscontainer_header_t and, after it, the "key = value" metadata lines
+ * as NUL-terminated text. The records follow from SWSC_HEADER_BYTES on. Records
+ * of at least half a page start on a page boundary, so that a reader can mmap()
+ * any single spectrum. On close the record index, an array of swscontainer_index_t,
+ * is appended and the header is updated to point to it. All values are little endian.
+ * With reduced precision the float and complex records hold 16-bit values. With the
+ * LZ4 codec each record is byte-shuffled and compressed on its own, records that did
+ * not get smaller are stored as they are. record_bytes keeps the uncompressed size,
+ * a record with fewer bytes in the index is compressed.
+ */
+#define SWSC_MAGIC          "SWSPEC\0\0"
+#define SWSC_VERSION        2
+#define SWSC_HEADER_BYTES   4096
+#define SWSC_PAGE_BYTES     4096
+
+enum ContainerDataType { SWSC_UNKNOWN=0, SWSC_FLOAT32=1, SWSC_COMPLEX64=2, SWSC_STRUCT=3 };
+enum ContainerCodec { SWSC_CODEC_NONE=0, SWSC_CODEC_SHUFFLE_LZ4=1 };
+
+typedef struct swscontainer_header_tt {
+   char       magic[8];          // SWSC_MAGIC
+   int        version;           // SWSC_VERSION
+   int        header_bytes;      // file offset of the first record
+   swsint64_t index_offset;      // file offset of the record index, 0 if the file was not closed
+   swsint64_t num_records;       // number of entries in the record index
+   swsint64_t record_bytes;      // data bytes of every uncompressed record, 0 if records differ in size
+   swsint64_t record_stride;     // distance between two records, 0 if records differ in size or are compressed
+   swsint64_t points;            // points per record, 0 if not an array of points
+   int        datatype;          // ContainerDataType, SWSC_STRUCT is described in the "datatype" metadata
+   int        source;            // input file 1 or 2, 0 for the cross-pol of both
+   int        channel;           // channel used from the input file (1..CH), 0 for the cross-pol
+   int        window_type;       // WindowFunctionType
+   swsint64_t fft_points;
+   double     samplingfreq;      // Hz
+   double     integration_s;     // time covered by one record
+   double     start_s;           // time of the first record from the start of the input file
+   int        ffts_per_record;   // overlapped FFTs integrated into each record
+   int        fft_overlap_factor;
+   int        bits_per_sample;
+   int        precision;         // SamplePrecision of float32 and complex64 records, Float32 for others
+   int        codec;             // SWSC_CODEC_NONE, or SWSC_CODEC_SHUFFLE_LZ4 when a record is smaller than record_bytes
+   int        reserved;
+} swscontainer_header_t;
+
+typedef struct swscontainer_index_tt {
+   swsint64_t offset;            // file offset of the record
+   swsint64_t bytes;             // data bytes of the record
+   double     time_s;            // start time of the record from the start of the input file
+   double     weight;            // integration weight, the number of FFTs in the record
+} swscontainer_index_t;
 
 class FileSink : public DataSink
 {
 public:
-   FileSink(swspect_settings_t* settings) { this->settings = settings; return; }
-   FileSink(std::string uri) { open(uri); }
+   FileSink(swspect_settings_t* settings) : settings(settings), file_pos(0), records_written(0) { return; }
+   FileSink(std::string uri) : settings(NULL), file_pos(0), records_written(0) { open(uri); }
    ~FileSink() { close(); }
 
    /**
@@ -47,16 +101,71 @@ public:
     */
    size_t write(Buffer *buf);
 
+   /**
+    * Flush the file buffers
+    * @return int Returns 0 on success
+    */
+   int flush();
+
    /**
     * Close the resource
     * @return int Returns 0 on success
     */
    int close();
 
+   /**
+    * Describe the data that is written to the file. The properties are
+    * kept in a "key = value" text file next to the output file (<uri>.info),
+    * and in the Container format also in the file header.
+    * @param key   Name of the property
+    * @param value Value of the property
+    */
+   void setMetadata(std::string const& key, std::string const& value);
+
 private:
    std::ofstream ofile;
+   std::string fileuri;
+   std::map<std::string, std::string> metadata;
    swspect_settings_t* settings;
 
+   swsint64_t file_pos;                        // Container: current end of the file
+   swsint64_t records_written;                 // records written since open()
+   std::vector<swscontainer_index_t> index;    // Container: index of the records written so far
+   std::vector<char> textbuf;                  // ASCII: one record formatted as text
+   std::vector<char> convbuf;                  // record converted to reduced precision
+   std::vector<char> shufbuf;                  // record after the byte-shuffle
+   std::vector<char> packbuf;                  // record after the compression
+
+   /**
+    * @return Bytes per record as described by the metadata, 0 if every write is one record
+    */
+   size_t getRecordBytes() const;
+
+   /**
+    * @return true if the records are float or complex data that is written with reduced precision
+    */
+   bool reducesPrecision() const;
+
+   /**
+    * Convert a record to the output precision and compress it as configured.
+    * @return Pointer to the data to write, the record itself or one of the scratch buffers
+    * @param  rec    record data
+    * @param  bytes  in: record size, out: size of the data to write
+    * @param  pack   true to compress
+    */
+   char const* encodeRecord(char const* rec, size_t& bytes, bool pack);
+
+   /**
+    * @return The numeric value of a metadata property, or dflt if it is not set
+    */
+   double getMetadataValue(std::string const& key, double dflt) const;
+
+   /**
+    * Write or rewrite the Container header page from the settings and the metadata.
+    * @param index_offset  file offset of the record index, 0 while the file is open
+    */
+   void writeContainerHeader(swsint64_t index_offset);
+
 };
 
 #endif // FILESINK_H
@@ -21,13 +21,21 @@
 #include <string>
 #include <iostream>
 #include <iomanip>
+#include <algorithm>
 #include <cmath>
 #include <stdlib.h>
+#include <ctime>
+#include <sys/stat.h>
 #include "FileSource.h"
 #include "Helpers.h"
 using std::cerr;
 using std::endl;
 
+static bool is_leap_year(int y)
+{
+   return ((y % 4) == 0) && (((y % 100) != 0) || ((y % 400) == 0));
+}
+
 /**
  * Open the file
  * @return int Returns 0 on success
@@ -40,6 +48,22 @@ int FileSource::open(std::string uri)
    this->_uri = std::string(uri);
    this->_format = std::string(cfg->sourceformat_str);
    cfg->sourceformat = Unknown;
+   bytes_per_sec  = (cfg->bits_per_sample * cfg->source_channels * cfg->samplingfreq) / 8.0;
+   next_time      = -1.0;
+   frame_invalid  = false;
+   time_jumped    = false;
+   time_gaps      = 0;
+   invalid_frames = 0;
+
+   /* Approximate date of the recording, to complete truncated MJDs in the frame headers */
+   struct stat st;
+   if (cfg->source_date_mjd > 0) {
+      mjd_reference = cfg->source_date_mjd;
+   } else if (stat(_uri.c_str(), &st) == 0) {
+      mjd_reference = 40587 + int(st.st_mtime / 86400); // 1970-01-01
+   } else {
+      mjd_reference = 40587 + int(time(NULL) / 86400);
+   }
    if (Helpers::cicompare(cfg->sourceformat_str, "Mk5B") == Helpers::FullMatch) {
       cfg->sourceformat = Mk5B;
       sourceformat_uses_frames = true;
@@ -156,6 +180,18 @@ int FileSource::open(std::string uri)
    if (sourceformat_uses_frames) {
        this->inspectAndConsumeHeader();
        ifile.seekg(-frame_header_length, std::ios_base::cur);
+       invalid_frames = 0; // counted again when read
+   }
+
+   /* Time of the first sample: from the frame headers, from mark5access, else the skipped seconds */
+   if ((cfg->sourceformat == VLBA || cfg->sourceformat == MKIV || cfg->sourceformat == Mark5B) && (_mk5s != NULL)) {
+       int mjd = 0, sec = 0;
+       double ns = 0;
+       mark5_stream_get_sample_time(_mk5s, &mjd, &sec, &ns);
+       this->updateTime(mjd, sec + 1e-9*ns, true);
+   }
+   if (next_time < 0) {
+       next_time = cfg->seconds_to_skip;
    }
 
    got_eof = false;
@@ -163,11 +199,12 @@ int FileSource::open(std::string uri)
 }
 
 /**
- * Try to fill the entire bufferspace with new data and return the number of bytes actually read
+ * Try to fill the bufferspace with new data and return the number of bytes actually read
  * @return int    Returns the amount of bytes read
  * @param  bspace Pointer to Buffer to fill out
+ * @param  nbytes Number of bytes to read, at most the allocated size of the buffer
  */
-int FileSource::read(Buffer* buf)
+int FileSource::read(Buffer* buf, size_t nbytes)
 {
    int nread;
    std::ostream* log = cfg->tlog;
@@ -183,9 +220,10 @@ int FileSource::read(Buffer* buf)
    /* Formats with headers that do not overwrite data */
    if (sourceformat_uses_frames) {
 
-       int nreq  = buf->getAllocated();
+       int nreq  = std::min(nbytes, buf->getAllocated());
        char* dst = buf->getData();
        const int framesize = frame_header_length + frame_payload_length;
+       buf->getTimeMarks().clear();
 
        while ((nreq > 0) && !got_eof) {
 
@@ -198,6 +236,7 @@ int FileSource::read(Buffer* buf)
 
           /* Within frame: grab all data before start of next frame */
           int available = framesize - (curr % framesize);
+          this->markTime(buf, dst - buf->getData());
           ifile.read(dst, available);
           if (ifile.fail() && !ifile.eof()) {
              *log << "Read I/O error!" << std::endl << std::flush;
@@ -206,12 +245,15 @@ int FileSource::read(Buffer* buf)
              got_eof = true;
           }
           nread = ifile.gcount();
+          if (next_time >= 0) {
+             next_time += nread / bytes_per_sec;
+          }
 
           /* Advance */
           dst  += nread;
           nreq -= nread;
        }
-       nread = buf->getAllocated();
+       nread = std::min(nbytes, buf->getAllocated());
    }
 
    /* Formats without headers or with headers that overwrite data */
@@ -231,7 +273,10 @@ int FileSource::read(Buffer* buf)
               got_eof = true;
            }
        } else {
-           ifile.read(buf->getData(), buf->getAllocated());
+           buf->getTimeMarks().clear();
+           this->markTime(buf, 0);
+           nbytes = std::min(nbytes, buf->getAllocated());
+           ifile.read(buf->getData(), nbytes);
            if (ifile.fail() && !ifile.eof()) {
               *log << "Read I/O error!" << std::endl << std::flush;
            }
@@ -239,8 +284,11 @@ int FileSource::read(Buffer* buf)
               got_eof = true;
            }
            nread = ifile.gcount();
-           if ((size_t)nread != buf->getAllocated() && !got_eof) {
-              *log << "Read " << nread << " bytes instead of " << buf->getAllocated() << std::endl;
+           if ((size_t)nread != nbytes && !got_eof) {
+              *log << "Read " << nread << " bytes instead of " << nbytes << std::endl;
+           }
+           if (next_time >= 0) {
+              next_time += nread / bytes_per_sec;
            }
        }
    }
@@ -255,6 +303,12 @@ int FileSource::read(Buffer* buf)
  */
 int FileSource::close() 
 {
+   if ((cfg != NULL) && ((time_gaps > 0) || (invalid_frames > 0))) {
+      *(cfg->tlog) << "FileSource   : " << _uri << " had " << time_gaps << " jumps in the frame time and "
+                   << invalid_frames << " frames flagged invalid" << std::endl;
+   }
+   time_gaps = 0;
+   invalid_frames = 0;
    ifile.close();
    return 0;
 }
@@ -319,11 +373,10 @@ void FileSource::locateFirstHeader()
           // we keep life simple and assume a smart recording tool
           // has been used, such that the first header always
           // begins at byte 0!
-          // MJD_0 is the 0 position of the truncated MJD
+          // the header has only the last three digits of the MJD
           first_header_offset = 0;
           int mjd = 0, sec = 0;
           double ns = 0;
-          int MJD_0 = 56000;
           unsigned char header[frame_header_length+1];
 
           if (!ifile.is_open()) { return; }
@@ -335,7 +388,7 @@ void FileSource::locateFirstHeader()
               return;
           }
 
-          mjd = MJD_0 + int(header[2*4+3]>>4)*100 + int(header[2*4+3]&0x0F)*10 + int(header[2*4+2]>>4);
+          mjd = resolveTruncatedMJD(int(header[2*4+3]>>4)*100 + int(header[2*4+3]&0x0F)*10 + int(header[2*4+2]>>4));
           sec = int(header[2*4+2]&0x0F)*10000 + int(header[2*4+1]>>4)*1000 + int(header[2*4+1]&0x0F)*100 + int(header[2*4+0]>>4)*10 + int(header[2*4+0]&0x0F);
 
           *log << "Mark5B       : starting at " << mjd << " MJD " << sec << " sec + " << ns << " ns" << std::endl;
@@ -428,11 +481,150 @@ void FileSource::inspectAndConsumeHeader()
    } else if (cfg->sourceformat == iBOB) {
          // Sergei format: 4 bytes Unix timestamp, 4 bytes packet seq nr starting from 1
          long second = (((long)header[0])<<24) + (((long)header[1])<<16) + (((long)header[2])<<8) + header[3];
-         long frame = (((long)header[4])<<24) + (((long)header[5])<<16) + (((long)header[6])<<8) + header[7];
+         long frame = 0;
+         if (frame_header_length >= 8) {
+             frame = (((long)header[4])<<24) + (((long)header[5])<<16) + (((long)header[6])<<8) + header[7];
+         }
          if (frame==1) {
              std::cerr << "iBOB sec=" << second << " frame=" << frame << std::endl;
          }
    }
+
+   /* Continue the time of the data; VDIF word 0 bit 31 flags the frame data as invalid */
+   int mjd = 0;
+   double sec = 0.0;
+   bool exact = false;
+   if (this->decodeHeaderTime(header, mjd, sec, exact)) {
+      this->updateTime(mjd, sec, exact);
+   }
+   frame_invalid = (cfg->sourceformat == VDIF) && ((header[0*4+3] & 0x80) != 0);
+   if (frame_invalid) {
+      invalid_frames++;
+   }
+}
+
+
+/**
+ * Decode the time of the first sample after a frame header.
+ * @return bool   True if the header carries a time
+ * @param  header The frame header
+ * @param  mjd    Returns the MJD day
+ * @param  sec    Returns the seconds into the day
+ * @param  exact  Returns false if the time has only a whole-second resolution
+ */
+bool FileSource::decodeHeaderTime(unsigned char const* header, int& mjd, double& sec, bool& exact)
+{
+   exact = true;
+   if (cfg->sourceformat == Mk5B) {
+      // VLBA BCD time code JJJSSSSS in word 2 with the MJD truncated to three digits,
+      // the data frame number within the second in bits 14-0 of word 1
+      int sec_of_day = int(header[2*4+2]&0x0F)*10000 + int(header[2*4+1]>>4)*1000 + int(header[2*4+1]&0x0F)*100
+                     + int(header[2*4+0]>>4)*10 + int(header[2*4+0]&0x0F);
+      long frame = (long(header[1*4+1] & 0x7F) << 8) + header[1*4+0];
+      mjd = resolveTruncatedMJD(int(header[2*4+3]>>4)*100 + int(header[2*4+3]&0x0F)*10 + int(header[2*4+2]>>4));
+      sec = sec_of_day + frame * (frame_payload_length / bytes_per_sec);
+      return true;
+   } else if (cfg->sourceformat == VDIF) {
+      // Little-endian words. Word 0 bits 29-0: seconds from the reference epoch.
+      // Word 1 bits 23-0: data frame number within the second, bits 29-24: reference
+      // epoch in half years since 2000-01-01.
+      long secs  = (long(header[0*4+3] & 0x3F) << 24) + (long(header[0*4+2]) << 16) + (long(header[0*4+1]) << 8) + header[0*4+0];
+      long frame = (long(header[1*4+2]) << 16) + (long(header[1*4+1]) << 8) + header[1*4+0];
+      int  epoch = header[1*4+3] & 0x3F;
+      int  year  = 2000 + epoch/2;
+      mjd = 51544; // 2000-01-01
+      for (int y=2000; y<year; y++) {
+         mjd += is_leap_year(y) ? 366 : 365;
+      }
+      if (epoch % 2) {
+         mjd += is_leap_year(year) ? 182 : 181; // 1st of July
+      }
+      mjd += int(secs / 86400);
+      sec  = (secs % 86400) + frame * (frame_payload_length / bytes_per_sec);
+      return true;
+   } else if (cfg->sourceformat == iBOB) {
+      // Unix time in whole seconds, the packet sequence number gives no finer time
+      long second = (((long)header[0])<<24) + (((long)header[1])<<16) + (((long)header[2])<<8) + header[3];
+      mjd   = 40587 + int(second / 86400); // 1970-01-01
+      sec   = second % 86400;
+      exact = false;
+      return true;
+   }
+   return false;
+}
+
+
+/**
+ * Complete an MJD that was truncated to its last three digits, with
+ * the full MJD closest to the approximate date of the recording.
+ * @return int   Full MJD
+ * @param  tmjd  MJD modulo 1000
+ */
+int FileSource::resolveTruncatedMJD(int tmjd) const
+{
+   int mjd = mjd_reference - (mjd_reference % 1000) + tmjd;
+   if (mjd > (mjd_reference + 500)) {
+      mjd -= 1000;
+   } else if (mjd < (mjd_reference - 500)) {
+      mjd += 1000;
+   }
+   return mjd;
+}
+
+
+/**
+ * Continue the time of the data from a decoded absolute time. The first
+ * time sets the time reference of the run, such that the first sample
+ * after the skipped seconds is at 'seconds_to_skip'. Later times are
+ * checked against the data read in between, to detect missing frames.
+ * @param mjd    MJD day
+ * @param sec    Seconds into the day
+ * @param exact  False if only good for starting the time
+ */
+void FileSource::updateTime(int mjd, double sec, bool exact)
+{
+   if (cfg->time_ref_mjd < 0) {
+      cfg->time_ref_mjd = mjd;
+      cfg->time_ref_sec = sec - cfg->seconds_to_skip;
+   }
+   double t = (mjd - cfg->time_ref_mjd) * 86400.0 + (sec - cfg->time_ref_sec);
+   if (next_time < 0) {
+      next_time = t;
+      return;
+   }
+   if (!exact) {
+      return;
+   }
+   if (std::fabs(t - next_time) > 0.5 / cfg->samplingfreq) {
+      time_jumped = true;
+      if (time_gaps < 10) {
+         *(cfg->tlog) << "FileSource   : frame time " << std::fixed << t << "s does not continue the data at "
+                      << next_time << "s, frames missing or out of order" << std::endl;
+         cfg->tlog->unsetf(std::ios::floatfield);
+      }
+      time_gaps++;
+   }
+   next_time = t;
+}
+
+
+/**
+ * Start a new run of samples in the time marks of a buffer, if the data
+ * at this offset does not continue the time or validity of the last run.
+ * @param buf     Buffer that is being filled
+ * @param offset  Byte offset of the next data in the buffer
+ */
+void FileSource::markTime(Buffer* buf, size_t offset)
+{
+   std::vector<buftimemark_t>& marks = buf->getTimeMarks();
+   if (marks.empty() || time_jumped || (marks.back().valid == frame_invalid)) {
+      buftimemark_t m;
+      m.offset = offset;
+      m.time_s = next_time;
+      m.valid  = !frame_invalid;
+      marks.push_back(m);
+   }
+   time_jumped = false;
 }
 
 
@@ -36,8 +36,8 @@ extern "C" {
 class FileSource : public DataSource
 {
 public:
-   FileSource() : first_header_offset(0),got_eof(true)  { return; };
-   FileSource(std::string uri) : first_header_offset(0) { open(uri); }
+   FileSource() : first_header_offset(0),got_eof(true),time_gaps(0),invalid_frames(0)  { return; };
+   FileSource(std::string uri) : first_header_offset(0),time_gaps(0),invalid_frames(0) { open(uri); }
    ~FileSource() { close(); }
 
 public:
@@ -49,11 +49,12 @@ public:
    int open(std::string uri);
 
    /**
-    * Tries to fill the entire buffer with new data and return the number of bytes actually read
+    * Tries to fill the buffer with new data and return the number of bytes actually read
     * @return int    Returns number of bytes read
     * @param  bspace Try to read enough data to fill buffer, return amount of bytes read
+    * @param  nbytes Number of bytes to read, at most the allocated size of the buffer
     */
-   int read(Buffer *buf);
+   int read(Buffer *buf, size_t nbytes);
 
    /**
     * Close the file
@@ -82,6 +83,42 @@ private:
     */
    void inspectAndConsumeHeader();
 
+   /**
+    * Decode the time of the first sample after a frame header.
+    * @return bool   True if the header carries a time
+    * @param  header The frame header
+    * @param  mjd    Returns the MJD day
+    * @param  sec    Returns the seconds into the day
+    * @param  exact  Returns false if the time has only a whole-second resolution
+    */
+   bool decodeHeaderTime(unsigned char const* header, int& mjd, double& sec, bool& exact);
+
+   /**
+    * Continue the time of the data from a decoded absolute time. The first
+    * time sets the time reference of the run, later times are checked
+    * against the data read in between, to detect missing frames.
+    * @param mjd    MJD day
+    * @param sec    Seconds into the day
+    * @param exact  False if only good for starting the time
+    */
+   void updateTime(int mjd, double sec, bool exact);
+
+   /**
+    * Complete an MJD that was truncated to its last three digits, with
+    * the full MJD closest to the approximate date of the recording.
+    * @return int   Full MJD
+    * @param  tmjd  MJD modulo 1000
+    */
+   int resolveTruncatedMJD(int tmjd) const;
+
+   /**
+    * Start a new run of samples in the time marks of a buffer, if the data
+    * at this offset does not continue the time or validity of the last run.
+    * @param buf     Buffer that is being filled
+    * @param offset  Byte offset of the next data in the buffer
+    */
+   void markTime(Buffer* buf, size_t offset);
+
 private:
    std::string _uri;
    std::string _format;
@@ -94,6 +131,14 @@ private:
    size_t frame_header_length;
    size_t frame_payload_length;
 
+   double bytes_per_sec;        // input data rate
+   double next_time;            // time of the next data byte to read, negative if not known
+   bool   frame_invalid;        // the header of the current frame flags its data invalid
+   bool   time_jumped;          // the last frame header did not continue the time of the data
+   long   time_gaps;            // frame headers that did not continue the time of the data before
+   long   invalid_frames;       // frames flagged invalid
+   int    mjd_reference;        // approximate MJD of the recording
+
    /* mark5access library */
    struct mark5_stream* _mk5s;
    off64_t mk5fileoffset;
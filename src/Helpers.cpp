@@ -21,6 +21,14 @@
 #include "Helpers.h"
 #include <string>
 #include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include <cstdio>
+#include <dirent.h>
 using std::cerr;
 using std::endl;
 
@@ -105,6 +113,47 @@ WindowFunctionType Helpers::parse_Windowing(const char* str)
 }
 
 
+/**
+ * Reinterpret a comma-separated list of values and "from-to" ranges,
+ * for example "100,2000-2100,3e6-3.1e6". A single value is returned as
+ * a range with from==to.
+ * @return Number of ranges found, or -1 if the string was malformed
+ */
+int Helpers::parse_Ranges(const char* str, std::vector<double>& from, std::vector<double>& to)
+{
+    const char* p = str;
+    char* end;
+    from.clear();
+    to.clear();
+    while (*p != '\0') {
+        double a = strtod(p, &end);
+        if (end == p) {
+            cerr << "Warning: could not parse '" << p << "' as a list of ranges" << endl;
+            return -1;
+        }
+        double b = a;
+        p = end;
+        if (*p == '-') {
+            b = strtod(++p, &end);
+            if (end == p) {
+                cerr << "Warning: range in '" << str << "' is missing its upper limit" << endl;
+                return -1;
+            }
+            p = end;
+        }
+        from.push_back(std::min(a, b));
+        to.push_back(std::max(a, b));
+        if (*p == ',') {
+            p++;
+        } else if (*p != '\0') {
+            cerr << "Warning: unexpected '" << *p << "' in list of ranges '" << str << "'" << endl;
+            return -1;
+        }
+    }
+    return from.size();
+}
+
+
 /**
  * Print out a complex vector. Mainly for debugging.
  */
@@ -144,6 +193,23 @@ Helpers::CicomparisonResult Helpers::cicompare(const std::string& str1, const st
     return BeginningsMatch;
 }
 
+/**
+ * First overlap step of a raw input chunk, in steps of FFT overlap points.
+ * A spectrum that spans several chunks is split into nearly equal chunks.
+ * @return Overlap step at which the chunk starts
+ * @param  cfg    Settings with the derived raw buffer layout
+ * @param  chunk  Number of the chunk, counted over all cores
+ */
+swsint64_t Helpers::chunk_first_hop(swspect_settings_t const* cfg, swsint64_t chunk)
+{
+    if (cfg->max_buffers_per_spectrum <= 1) {
+        return chunk * swsint64_t(cfg->rawbuf_size / cfg->raw_overlap_bytes);
+    }
+    swsint64_t hops = swsint64_t(cfg->fft_overlap_factor) * cfg->averaged_ffts;
+    swsint64_t nb   = cfg->max_buffers_per_spectrum;
+    return (chunk / nb) * hops + (hops * (chunk % nb)) / nb;
+}
+
 /**
  * Calculate and return the greatest common divisor of two integers.
  */
@@ -161,3 +227,162 @@ long long Helpers::gcd(long long a, long long b)
     }
 }
 
+/**
+ * Look up the NUMA node that a CPU belongs to.
+ * @return Node number, or -1 if unknown
+ * @param  cpu  CPU number as used in cpu_set_t
+ */
+int Helpers::cpu_numa_node(int cpu)
+{
+    /* sysfs lists the node as a "nodeN" link in the directory of the CPU */
+    std::string path = std::string("/sys/devices/system/cpu/cpu") + Helpers::itoa(cpu);
+    DIR* dir = opendir(path.c_str());
+    if (dir == NULL) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if ((strncmp(entry->d_name, "node", 4) == 0) && isdigit(entry->d_name[4])) {
+            node = atoi(entry->d_name + 4);
+            break;
+        }
+    }
+    closedir(dir);
+    return node;
+}
+
+
+/* Powers of ten 10^0..10^(POW10_MAX-1) for format_float(), enough for the float range */
+#define POW10_MAX 56
+static double pow10_table[POW10_MAX];
+static struct pow10_init_t {
+    pow10_init_t() {
+        for (int i=0; i<POW10_MAX; i++) { pow10_table[i] = pow(10.0, i); }
+    }
+} pow10_init;
+
+/**
+ * Write the decimal digits*10^-scale in "%g" style.
+ * @return Number of characters written
+ */
+static int format_decimal(bool negative, unsigned int digits, int scale, char* out)
+{
+    char d[24];
+    int  nd = 0;
+    char* p = out;
+
+    /* trailing zeros go into the exponent */
+    while ((digits > 0) && ((digits % 10) == 0)) {
+        digits /= 10;
+        scale--;
+    }
+    do {
+        d[nd++] = '0' + (digits % 10);
+        digits /= 10;
+    } while (digits > 0);
+    int exp10 = nd - 1 - scale;  // decimal exponent of the first digit
+
+    if (negative) { *p++ = '-'; }
+    if ((exp10 >= -5) && (exp10 < 9)) {
+        if (exp10 < 0) {
+            *p++ = '0';
+            *p++ = '.';
+            for (int i=0; i<(-exp10-1); i++) { *p++ = '0'; }
+            for (int i=nd-1; i>=0; i--) { *p++ = d[i]; }
+        } else {
+            for (int i=0; i<=exp10; i++) { *p++ = (i < nd) ? d[nd-1-i] : '0'; }
+            if (nd > (exp10+1)) {
+                *p++ = '.';
+                for (int i=exp10+1; i<nd; i++) { *p++ = d[nd-1-i]; }
+            }
+        }
+    } else {
+        *p++ = d[nd-1];
+        if (nd > 1) {
+            *p++ = '.';
+            for (int i=nd-2; i>=0; i--) { *p++ = d[i]; }
+        }
+        *p++ = 'e';
+        *p++ = (exp10 < 0) ? '-' : '+';
+        int ae = (exp10 < 0) ? -exp10 : exp10;
+        if (ae >= 10) { *p++ = '0' + (ae / 10); }
+        else { *p++ = '0'; }
+        *p++ = '0' + (ae % 10);
+    }
+    return p - out;
+}
+
+/**
+ * Format a float as text with the fewest significant digits that
+ * still read back as exactly the same float, like "%g" otherwise.
+ * @return Number of characters written, without a terminating NUL
+ * @param  v    Value to format
+ * @param  out  Output of at least HELPERS_FLOAT_CHARS characters
+ */
+int Helpers::format_float(float v, char* out)
+{
+    if (v != v) {
+        memcpy(out, "nan", 3);
+        return 3;
+    }
+    bool negative = (v < 0.0f) || ((v == 0.0f) && (1.0f/v < 0.0f));
+    double a = fabs((double)v);
+    if (a > FLT_MAX) {
+        memcpy(out, negative ? "-inf" : "inf", negative ? 4 : 3);
+        return negative ? 4 : 3;
+    }
+    if (a == 0.0) {
+        memcpy(out, negative ? "-0" : "0", negative ? 2 : 1);
+        return negative ? 2 : 1;
+    }
+
+    /* every number in (lo,hi) reads back as v, the spacing below a power of two is halved */
+    int e2;
+    double m = frexp(a, &e2);
+    double ulp_hi = (a < FLT_MIN) ? ldexp(1.0, -149) : ldexp(1.0, e2 - 24);
+    double ulp_lo = ((m == 0.5) && (a > FLT_MIN)) ? 0.5*ulp_hi : ulp_hi;
+
+    /* decimal exponent of the first digit */
+    int e10 = int(floor((e2 - 1) * 0.30102999566398));
+    double ae = (e10 >= 0) ? (a / pow10_table[e10]) : (a * pow10_table[-e10]);
+    if (ae < 1.0) { e10--; }
+    else if (ae >= 10.0) { e10++; }
+
+    /* scale to 9 digits before the decimal point, 9 digits always identify a float */
+    int scale = 8 - e10;
+    double lo = a - 0.5*ulp_lo;
+    double hi = a + 0.5*ulp_hi;
+    double s;
+    if (scale >= 0) {
+        s  = a  * pow10_table[scale];
+        lo = lo * pow10_table[scale];
+        hi = hi * pow10_table[scale];
+    } else {
+        s  = a  / pow10_table[-scale];
+        lo = lo / pow10_table[-scale];
+        hi = hi / pow10_table[-scale];
+    }
+    unsigned int s2 = (unsigned int)(2.0 * s);  // below 2e9, fits 32 bits
+
+    /* try 1..9 digits, the scaled candidates are exact integers */
+    unsigned int q = 100000000;
+    for (int n=1; n<=9; n++, q/=10) {
+        unsigned int digits = (s2 + q) / (2*q);
+        double c = double(digits) * q;
+
+        /* decide with the rounding error bound of s, lo and hi, close to the limits ask strtof() */
+        double margin = c * 8.0 * DBL_EPSILON;
+        if ((c > (lo + margin)) && (c < (hi - margin))) {
+            return format_decimal(negative, digits, scale - (9 - n), out);
+        }
+        if ((c >= (lo - margin)) && (c <= (hi + margin))) {
+            int len = format_decimal(negative, digits, scale - (9 - n), out);
+            out[len] = '\0';
+            if (strtof(out, NULL) == v) {
+                return len;
+            }
+        }
+    }
+    return snprintf(out, HELPERS_FLOAT_CHARS, "%.9g", v);
+}
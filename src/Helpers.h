@@ -23,6 +23,7 @@
 #include "Settings.h"
 #include <sys/time.h>
 #include <string>
+#include <vector>
 
 class Helpers
 {
@@ -46,6 +47,14 @@ class Helpers
      */
     static WindowFunctionType parse_Windowing(const char* str);
 
+    /**
+     * Reinterpret a comma-separated list of values and "from-to" ranges,
+     * for example "100,2000-2100,3e6-3.1e6". A single value is returned as
+     * a range with from==to.
+     * @return Number of ranges found, or -1 if the string was malformed
+     */
+    static int parse_Ranges(const char* str, std::vector<double>& from, std::vector<double>& to);
+
     /**
      * Print out a complex vector. Mainly for debugging.
      */
@@ -61,6 +70,33 @@ class Helpers
     * Calculate and return the greatest common divisor of two integers.
     */
     static long long gcd(long long, long long);
+
+   /**
+    * First overlap step of a raw input chunk, in steps of FFT overlap points.
+    * A spectrum that spans several chunks is split into nearly equal chunks.
+    * @return Overlap step at which the chunk starts
+    * @param  cfg    Settings with the derived raw buffer layout
+    * @param  chunk  Number of the chunk, counted over all cores
+    */
+    static swsint64_t chunk_first_hop(swspect_settings_t const* cfg, swsint64_t chunk);
+
+   /**
+    * Look up the NUMA node that a CPU belongs to.
+    * @return Node number, or -1 if unknown
+    * @param  cpu  CPU number as used in cpu_set_t
+    */
+    static int cpu_numa_node(int cpu);
+
+   /**
+    * Format a float as text with the fewest significant digits that
+    * still read back as exactly the same float, like "%g" otherwise.
+    * @return Number of characters written, without a terminating NUL
+    * @param  v    Value to format
+    * @param  out  Output of at least HELPERS_FLOAT_CHARS characters
+    */
+    static int format_float(float v, char* out);
 };
 
+#define HELPERS_FLOAT_CHARS 24
+
 #endif // HELPERS_H
@@ -22,6 +22,7 @@
 
 #include "Settings.h"
 
+#include <algorithm>
 #include <cstring>
 #include <ippcore.h>
 #include <string>
@@ -35,6 +36,23 @@ class DataUnpacker {
     DataUnpacker(swspect_settings_t const* settings) { return; }
     virtual size_t extract_samples(char const* const src, Ipp32f* dst, const size_t count, const int channel) const = 0;
     static bool canHandleConfig(swspect_settings_t const* settings) { return false; }
+
+    /**
+     * Number of quantisation states that count_states() tells apart:
+     * 2 for 1-bit, 4 for 2-bit, 256 for 8-bit data. Wider data is
+     * counted by its upper 8 bits.
+     */
+    static int num_states(int bits_per_sample) { return 1 << std::min(bits_per_sample, 8); }
+
+    /**
+     * Add the occupancy of each quantisation state in unpacked samples to a histogram,
+     * lowest state first.
+     * @param samples          unpacked samples
+     * @param count            number of samples
+     * @param bits_per_sample  bits of the raw samples
+     * @param states           histogram of num_states() counters
+     */
+    static void count_states(Ipp32f const* samples, size_t count, int bits_per_sample, swsint64_t* states);
 };
 
 #endif // DATAUNPACKER_H
@@ -21,6 +21,7 @@
 #include "Settings.h"
 #include "DataUnpackers.h"
 
+#include <cmath>
 #include <cstdlib>
 #include <iostream>
 using std::cerr;
@@ -36,6 +37,52 @@ using std::endl;
 static std::ofstream fout("dump.bin");
 #endif
 
+///////////////////////////////////////////////////////////////////////////
+// Sampler statistics
+///////////////////////////////////////////////////////////////////////////
+
+/**
+ * Add the occupancy of each quantisation state in unpacked samples to a histogram,
+ * lowest state first.
+ * @param samples          unpacked samples
+ * @param count            number of samples
+ * @param bits_per_sample  bits of the raw samples
+ * @param states           histogram of num_states() counters
+ */
+void DataUnpacker::count_states(Ipp32f const* samples, size_t count, int bits_per_sample, swsint64_t* states)
+{
+    if (bits_per_sample <= 2) {
+        /* the lookup tables and mark5access unpack to -3.3359,-1,+1,+3.3359 (1-bit: -1,+1),
+         * count the samples above each threshold between neighbouring levels */
+        size_t above_lo = 0, above_mid = 0, above_hi = 0;
+        for (size_t i=0; i<count; i++) {
+            above_lo  += (samples[i] >= -2.0f);
+            above_mid += (samples[i] >= 0.0f);
+            above_hi  += (samples[i] >= 2.0f);
+        }
+        if (bits_per_sample == 1) {
+            states[0] += count - above_mid;
+            states[1] += above_mid;
+        } else {
+            states[0] += count - above_lo;
+            states[1] += above_lo - above_mid;
+            states[2] += above_mid - above_hi;
+            states[3] += above_hi;
+        }
+        return;
+    }
+
+    /* integer levels, signed and unsigned data both unpack to -2^(bits-1)..2^(bits-1)-1 */
+    const int offset = 1 << (bits_per_sample - 1);
+    const int shift  = std::max(bits_per_sample - 8, 0);
+    const int top    = num_states(bits_per_sample) - 1;
+    for (size_t i=0; i<count; i++) {
+        int state = (int(floorf(samples[i])) + offset) >> shift;
+        states[std::max(0, std::min(state, top))]++;
+    }
+}
+
+
 ///////////////////////////////////////////////////////////////////////////
 // Simple 8-bit and 16-bit data unpacking
 ///////////////////////////////////////////////////////////////////////////
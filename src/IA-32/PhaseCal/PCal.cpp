@@ -28,6 +28,11 @@
  *   08Oct2009 - added Briskens rotationless method
  *   02Nov2009 - added sub-subintegration sample offset, DFT for f-d results, tone bin coping to user buf
  *   03Nov2009 - added unit test, included DFT in extractAndIntegrate_reference(), fix rotation direction
+ *   2026      - folded accumulation into a long real vector, rotation and fold-down only in getFinalPCal()
+ *   2026      - SSE/AVX kernels with a plain C fallback, kernel choice by measurement in getNew(),
+ *               direct-DFT reference, benchmark mode in the unit test
+ *   2026      - the SIMD kernels need no IPP functions, only the IPP data types: the tone bins of the
+ *               folded accumulator come from a direct DFT, the oscillator table is made in plain C
  *
  ********************************************************************************************************/
 
@@ -35,7 +40,12 @@
 #include "PCal_impl.h"
 #include <ippcore.h>
 #include <ipps.h>
+#include <algorithm>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <map>
+#include <vector>
 #include <cmath>
 using std::cerr;
 using std::endl;
@@ -43,9 +53,28 @@ using std::endl;
 using namespace std;
 
 #include <malloc.h>    // memalign
+#include <pthread.h>
+#include <sys/time.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include <cstring>
 #define UNROLL_BY_4(x) { x }{ x }{ x }{ x }
 #define VALIGN __attribute__((aligned(16)))
 
+// Samples are accumulated into a real vector that is a multiple of the PCal period
+// and at least this long, so that extraction needs one vector add per this many samples
+#define PCAL_MIN_FOLD_LEN 4096
+
+// Samples and repetitions of the timing run in getNew() that picks the kernels
+#define PCAL_TIMING_SAMPLES (1<<16)
+#define PCAL_TIMING_REPS    16
+
+enum PCalExtractorType { PCAL_TRIVIAL, PCAL_SHIFTING, PCAL_IMPLICIT };
+
 void print_f32(const Ipp32f* v, const int len)
 {
    for (int i=0; i<len; i++) cerr << v[i] << " ";
@@ -56,19 +85,26 @@ void print_fc32(const Ipp32fc* v, const int len)
    for (int i=0;i<len; i++) cerr << v[i].re << "+i" << v[i].im << " ";
 }
 
+static size_t fold_length(size_t period)
+{
+    return period * ((PCAL_MIN_FOLD_LEN + period - 1) / period);
+}
+
 class pcal_config_pimpl {
   public:
     pcal_config_pimpl()  {};
     ~pcal_config_pimpl() {};
   public:
     double   dphi;
-    Ipp32fc* rotator;        // pre-cooked oscillator values
+    Ipp32fc const* rotator;  // pre-cooked oscillator values, shared, see acquire_rotator()
     Ipp32fc* rotated;        // temporary
     Ipp32fc* pcal_complex;   // temporary unassembled output, later final output
     Ipp32f*  pcal_real;      // temporary unassembled output for the pcaloffsethz==0.0f case
     size_t   rotatorlen;
-    size_t   pcal_index;     // zero, changes when extract() is called at least once with "leftover" samples
-    size_t   rotator_index;  // zero, changes when extract() is called at least once with "leftover" samples
+    size_t   foldlen;        // length of the folded accumulator, a multiple of the PCal period
+    size_t   pcal_index;     // position of the next sample in the folded accumulator
+    size_t   rotator_index;  // unused
+    bool     simd;           // true to use the SIMD kernels instead of IPP
   public:
     IppsDFTSpec_C_32fc* dftspec;
     Ipp8u* dftworkbuf;
@@ -76,13 +112,337 @@ class pcal_config_pimpl {
 };
 
 
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+// KERNELS: SIMD counterparts of the IPP primitives used by the extractors, with a plain C fallback
+/////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * dst[i] += src[i], like ippsAdd_32f_I(). Pointers need not be aligned.
+ */
+static void simd_add_32f_I(Ipp32f const* src, Ipp32f* dst, size_t len)
+{
+    size_t i = 0;
+#ifdef __AVX__
+    for ( ; i+16 <= len; i += 16) {
+        __m256 a0 = _mm256_loadu_ps(dst + i);
+        __m256 a1 = _mm256_loadu_ps(dst + i + 8);
+        a0 = _mm256_add_ps(a0, _mm256_loadu_ps(src + i));
+        a1 = _mm256_add_ps(a1, _mm256_loadu_ps(src + i + 8));
+        _mm256_storeu_ps(dst + i, a0);
+        _mm256_storeu_ps(dst + i + 8, a1);
+    }
+#endif
+#ifdef __SSE__
+    for ( ; i+8 <= len; i += 8) {
+        __m128 a0 = _mm_loadu_ps(dst + i);
+        __m128 a1 = _mm_loadu_ps(dst + i + 4);
+        a0 = _mm_add_ps(a0, _mm_loadu_ps(src + i));
+        a1 = _mm_add_ps(a1, _mm_loadu_ps(src + i + 4));
+        _mm_storeu_ps(dst + i, a0);
+        _mm_storeu_ps(dst + i + 4, a1);
+    }
+#endif
+    for ( ; i < len; i++) {
+        dst[i] += src[i];
+    }
+}
+
+/**
+ * acc[i] += re[i] * rot[i], the fused form of ippsMul_32f32fc() and ippsAdd_32fc_I().
+ * Pointers need not be aligned.
+ */
+static void simd_mul_add_32f32fc(Ipp32f const* re, Ipp32fc const* rot, Ipp32fc* acc, size_t len)
+{
+    size_t i = 0;
+#if defined(__AVX__) || defined(__SSE__)
+    float*       a = (float*)acc;
+    float const* r = (float const*)rot;
+#endif
+#ifdef __AVX__
+    for ( ; i+8 <= len; i += 8) {
+        __m256 x  = _mm256_loadu_ps(re + i);
+        __m256 lo = _mm256_unpacklo_ps(x, x); // re0 re0 re1 re1 | re4 re4 re5 re5
+        __m256 hi = _mm256_unpackhi_ps(x, x); // re2 re2 re3 re3 | re6 re6 re7 re7
+        __m256 d0 = _mm256_permute2f128_ps(lo, hi, 0x20); // re0..re3 duplicated
+        __m256 d1 = _mm256_permute2f128_ps(lo, hi, 0x31); // re4..re7 duplicated
+        __m256 a0 = _mm256_loadu_ps(a + 2*i);
+        __m256 a1 = _mm256_loadu_ps(a + 2*i + 8);
+        a0 = _mm256_add_ps(a0, _mm256_mul_ps(d0, _mm256_loadu_ps(r + 2*i)));
+        a1 = _mm256_add_ps(a1, _mm256_mul_ps(d1, _mm256_loadu_ps(r + 2*i + 8)));
+        _mm256_storeu_ps(a + 2*i, a0);
+        _mm256_storeu_ps(a + 2*i + 8, a1);
+    }
+#endif
+#ifdef __SSE__
+    for ( ; i+4 <= len; i += 4) {
+        __m128 x  = _mm_loadu_ps(re + i);
+        __m128 lo = _mm_unpacklo_ps(x, x); // re0 re0 re1 re1
+        __m128 hi = _mm_unpackhi_ps(x, x); // re2 re2 re3 re3
+        __m128 a0 = _mm_loadu_ps(a + 2*i);
+        __m128 a1 = _mm_loadu_ps(a + 2*i + 4);
+        a0 = _mm_add_ps(a0, _mm_mul_ps(lo, _mm_loadu_ps(r + 2*i)));
+        a1 = _mm_add_ps(a1, _mm_mul_ps(hi, _mm_loadu_ps(r + 2*i + 4)));
+        _mm_storeu_ps(a + 2*i, a0);
+        _mm_storeu_ps(a + 2*i + 4, a1);
+    }
+#endif
+    for ( ; i < len; i++) {
+        acc[i].re += re[i] * rot[i].re;
+        acc[i].im += re[i] * rot[i].im;
+    }
+}
+
+/**
+ * dst[i] += src[i] with the kernels selected for the extractor.
+ */
+static inline void add_32f_I(pcal_config_pimpl const* cfg, Ipp32f const* src, Ipp32f* dst, size_t len)
+{
+    if (cfg->simd) {
+        simd_add_32f_I(src, dst, len);
+    } else {
+        ippsAdd_32f_I(src, dst, len);
+    }
+}
+
+/**
+ * Add samples into the folded real accumulator pcal_real[2*foldlen]. Writes start
+ * at pcal_index and may run past foldlen, the second half is folded back later.
+ */
+static void fold_accumulate(pcal_config_pimpl* cfg, Ipp32f const* src, size_t len)
+{
+    while (len > 0) {
+        size_t n = std::min(len, cfg->foldlen);
+        add_32f_I(cfg, src, &(cfg->pcal_real[cfg->pcal_index]), n);
+        cfg->pcal_index = (cfg->pcal_index + n) % cfg->foldlen;
+        src += n;
+        len -= n;
+    }
+}
+
+/**
+ * Fold the accumulator pcal_real[2*foldlen] down into its first 'period' samples.
+ */
+static void fold_down(pcal_config_pimpl* cfg, size_t period)
+{
+    add_32f_I(cfg, &(cfg->pcal_real[cfg->foldlen]), cfg->pcal_real, cfg->foldlen);
+    for (size_t n = period; n < cfg->foldlen; n += period) {
+        add_32f_I(cfg, &(cfg->pcal_real[n]), cfg->pcal_real, period);
+    }
+}
+
+/**
+ * Prepare the IPP DFT of the folded accumulator, the SIMD kernels need none.
+ * @return size of the DFT work buffer in bytes
+ */
+static int dft_prepare(pcal_config_pimpl* cfg, int nbins)
+{
+    int wbufsize = 0;
+    cfg->dftspec    = NULL;
+    cfg->dftworkbuf = NULL;
+    if (cfg->simd) {
+        return 0;
+    }
+    // TODO: is IPP_FFT_DIV_FWD_BY_N or is IPP_FFT_DIV_INV_BY_N expected by AIPS&co?
+    IppStatus r;
+    r = ippsDFTInitAlloc_C_32fc(&(cfg->dftspec), nbins, IPP_FFT_DIV_FWD_BY_N, ippAlgHintAccurate);
+    if (r != ippStsNoErr) {
+        cerr << "ippsDFTInitAlloc _N_bins=" << nbins << " error " << ippGetStatusString(r);
+    }
+    r = ippsDFTGetBufSize_C_32fc(cfg->dftspec, &wbufsize);
+    if (r != ippStsNoErr) {
+        cerr << "ippsDFTGetBufSize error " << ippGetStatusString(r);
+    }
+    cfg->dftworkbuf = (Ipp8u*)memalign(128, wbufsize);
+    return wbufsize;
+}
+
+/**
+ * Free the DFT of the folded accumulator.
+ */
+static void dft_release(pcal_config_pimpl* cfg)
+{
+    if (cfg->dftspec != NULL) {
+        ippsDFTFree_C_32fc(cfg->dftspec);
+    }
+    free(cfg->dftworkbuf);
+}
+
+/**
+ * Forward DFT of the folded accumulator into dft_out[], divided by the length. The IPP
+ * kernels transform all bins. The SIMD kernels evaluate only the tone bins first,
+ * first+step, ... below nbins, each as a direct sum in double precision.
+ * @param real   true to transform the real pcal_real[], false for the complex pcal_complex[]
+ * @param nbins  length of the transform
+ * @param first  first tone bin
+ * @param step   bins between tones
+ * @param count  number of tones
+ */
+static void dft_tones(pcal_config_pimpl* cfg, bool real, size_t nbins, size_t first, size_t step, size_t count)
+{
+    if (!cfg->simd) {
+        if (real) {
+            ippsRealToCplx_32f(/*srcRe*/cfg->pcal_real, /*srcIm*/NULL, cfg->pcal_complex, nbins);
+        }
+        IppStatus r = ippsDFTFwd_CToC_32fc(/*src*/cfg->pcal_complex, cfg->dft_out, cfg->dftspec, cfg->dftworkbuf);
+        if (r != ippStsNoErr) {
+            cerr << "ippsDFTFwd error " << ippGetStatusString(r);
+        }
+        return;
+    }
+
+    for (size_t t = 0; t < count; t++) {
+        uint64_t k = first + t*step;
+        if (k >= nbins) {
+            break;
+        }
+        /* the twiddle factor is advanced by a rotation and set exactly every 1024 samples */
+        double dr = cos(-2*M_PI * double(k) / nbins), di = sin(-2*M_PI * double(k) / nbins);
+        double wr = 1.0, wi = 0.0, re = 0.0, im = 0.0;
+        for (size_t n = 0; n < nbins; n++) {
+            if ((n % 1024) == 0) {
+                double phi = -2*M_PI * double((k * n) % nbins) / nbins;
+                wr = cos(phi);
+                wi = sin(phi);
+            }
+            double xr = real ? cfg->pcal_real[n] : cfg->pcal_complex[n].re;
+            double xi = real ? 0.0 : cfg->pcal_complex[n].im;
+            re += xr*wr - xi*wi;
+            im += xr*wi + xi*wr;
+            double tr = wr*dr - wi*di;
+            wi = wr*di + wi*dr;
+            wr = tr;
+        }
+        cfg->dft_out[k].re = Ipp32f(re / nbins);
+        cfg->dft_out[k].im = Ipp32f(im / nbins);
+    }
+}
+
+/**
+ * Oscillator tables exp(i*dphi*n) that are shared by all extractors with the same
+ * parameters, for example the extractors of every source and core, with their users.
+ */
+static pthread_mutex_t rotator_mutex = PTHREAD_MUTEX_INITIALIZER;
+static std::map<std::string, std::pair<Ipp32fc*, int> > rotators;
+
+/**
+ * Get the read-only oscillator table exp(i*dphi*n), n=0..len-1, generating it in
+ * double precision on first use.
+ * @return the table, to be given back with release_rotator()
+ */
+static Ipp32fc const* acquire_rotator(double dphi, size_t len)
+{
+    std::ostringstream key;
+    key.precision(17);
+    key << dphi << "/" << len;
+    pthread_mutex_lock(&rotator_mutex);
+    std::map<std::string, std::pair<Ipp32fc*, int> >::iterator it = rotators.find(key.str());
+    if (it == rotators.end()) {
+        Ipp32fc* rot = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * len);
+        double   cycles = dphi / (2*M_PI);
+        double   rfreq  = cycles - std::floor(cycles);
+        for (size_t n = 0; n < len; n++) {
+            double turns = double(n) * rfreq;
+            double phi   = 2*M_PI * (turns - std::floor(turns));
+            rot[n].re = Ipp32f(cos(phi));
+            rot[n].im = Ipp32f(sin(phi));
+        }
+        it = rotators.insert(std::make_pair(key.str(), std::make_pair(rot, 0))).first;
+    }
+    it->second.second++;
+    Ipp32fc const* rot = it->second.first;
+    pthread_mutex_unlock(&rotator_mutex);
+    return rot;
+}
+
+/**
+ * Give up the use of an oscillator table, the last user frees it.
+ */
+static void release_rotator(Ipp32fc const* rot)
+{
+    pthread_mutex_lock(&rotator_mutex);
+    std::map<std::string, std::pair<Ipp32fc*, int> >::iterator it;
+    for (it = rotators.begin(); it != rotators.end(); it++) {
+        if (it->second.first == rot) {
+            if (--(it->second.second) <= 0) {
+                free(it->second.first);
+                rotators.erase(it);
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&rotator_mutex);
+}
+
+/**
+ * Create an extractor of the given type.
+ */
+static PCal* new_extractor(PCalExtractorType type, bool simd, double bandwidth_hz, double pcal_spacing_hz,
+                           int pcal_offset_hz, const size_t sampleoffset)
+{
+    switch (type) {
+        case PCAL_TRIVIAL:
+            return new PCalExtractorTrivial(bandwidth_hz, pcal_spacing_hz, sampleoffset, simd);
+        case PCAL_IMPLICIT:
+            return new PCalExtractorImplicitShift(bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, sampleoffset, simd);
+        default:
+            return new PCalExtractorShifting(bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, sampleoffset, simd);
+    }
+}
+
+/**
+ * Measure the extraction throughput of an extractor, including one getFinalPCal().
+ * @return throughput in Msamples/s
+ */
+static double measure_Msps(PCal* pc, Ipp32f const* data, size_t len, int reps)
+{
+    Ipp32fc* out = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * pc->getLength());
+    struct timeval t0, t1;
+    pc->clear();
+    pc->extractAndIntegrate(data, len); // warm up caches
+    pc->clear();
+    gettimeofday(&t0, NULL);
+    for (int r = 0; r < reps; r++) {
+        pc->extractAndIntegrate(data, len);
+    }
+    pc->getFinalPCal(out);
+    gettimeofday(&t1, NULL);
+    free(out);
+    double dt = (t1.tv_sec - t0.tv_sec) + 1e-6*(t1.tv_usec - t0.tv_usec);
+    return (dt <= 0.0) ? 0.0 : (1e-6 * double(len) * reps / dt);
+}
+
+/**
+ * Time the IPP and the SIMD kernels of an extractor type on a test signal.
+ * @return true if the SIMD kernels were faster
+ */
+static bool measure_simd_faster(PCalExtractorType type, double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz)
+{
+    Ipp32f* data = (Ipp32f*)memalign(128, sizeof(Ipp32f) * PCAL_TIMING_SAMPLES);
+    for (size_t n = 0; n < PCAL_TIMING_SAMPLES; n++) {
+        data[n] = Ipp32f(sin(M_PI * n * (pcal_offset_hz + pcal_spacing_hz) / bandwidth_hz));
+    }
+    double Msps[2];
+    for (int simd = 0; simd < 2; simd++) {
+        PCal* pc = new_extractor(type, (simd != 0), bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, 0);
+        Msps[simd] = 0.0;
+        for (int trial = 0; trial < 3; trial++) {
+            Msps[simd] = std::max(Msps[simd], measure_Msps(pc, data, PCAL_TIMING_SAMPLES, PCAL_TIMING_REPS));
+        }
+        delete pc;
+    }
+    free(data);
+    return (Msps[1] > Msps[0]);
+}
+
+
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 // BASE CLASS: factory and helpers
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
 /**
- * Factory that returns a new PCal extractor object. The optimal implementation
- * is selected based on the input parameters.
+ * Factory that returns a new PCal extractor object. The extractor type is selected
+ * based on the input parameters. Its vector kernels, IPP or SIMD, are picked by a short
+ * timing run that is done once per parameter set, see usesSimdKernels().
  * @param bandwidth_hz     Bandwidth of the input signal in Hertz
  * @param pcal_spacing_hz  Spacing of the PCal signal, comb spacing, typically 1e6 Hertz
  * @param pcal_offset_hz   Offset of the first PCal signal from 0Hz/DC, typically 10e3 Hertz
@@ -91,24 +451,48 @@ class pcal_config_pimpl {
  */
 PCal* PCal::getNew(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, const size_t sampleoffset) 
 {
+    static pthread_mutex_t choice_mutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::map<std::string, bool> simd_choice;
+
     //NOTE Added for testing
     //return new PCalExtractorDummy(bandwidth_hz, pcal_spacing_hz, sampleoffset);
 
-    //cout << "bandwidth_hz = " << bandwidth_hz << ", pcal_spacing_hz = " << pcal_spacing_hz << ", pcal_offset_hz = " << pcal_offset_hz << ", sampleoffset = " << sampleoffset << endl;
-
+    /* The type also sets the result normalization (getNBins()), so it stays a fixed rule.
+     * All types share the same folded accumulation, only the finalization differs. */
+    PCalExtractorType type = PCAL_SHIFTING;
     if (pcal_offset_hz == 0.0f) {
-        return new PCalExtractorTrivial(bandwidth_hz, pcal_spacing_hz, sampleoffset);
+        type = PCAL_TRIVIAL;
+    } else {
+        int No, Np;
+        No = 2*bandwidth_hz / gcd(pcal_offset_hz, 2*bandwidth_hz);
+        Np = 2*bandwidth_hz / gcd(pcal_spacing_hz, 2*bandwidth_hz);
+        if ((No % Np) == 0 /* && (!want_timedomain_delay) */) {
+            type = PCAL_IMPLICIT;
+        }
     }
-    // if ( __unlikely ((2*bandwidth_hz / gcd(2*bandwidth_hz,pcal_spacing_hz)) > someLengthLimit) ) {
-    //    use oscillator implementation instead
-    // } else {
-    int No, Np;
-    No = 2*bandwidth_hz / gcd(pcal_offset_hz, 2*bandwidth_hz);
-    Np = 2*bandwidth_hz / gcd(pcal_spacing_hz, 2*bandwidth_hz);
-    if ((No % Np) == 0 /* && (!want_timedomain_delay) */) {
-        return new PCalExtractorImplicitShift(bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, sampleoffset);
+
+    /* Kernels are timed once, all cores then get the same choice */
+    std::ostringstream key;
+    key << type << "/" << bandwidth_hz << "/" << pcal_spacing_hz << "/" << pcal_offset_hz;
+    pthread_mutex_lock(&choice_mutex);
+    std::map<std::string, bool>::iterator it = simd_choice.find(key.str());
+    if (it == simd_choice.end()) {
+        bool simd = measure_simd_faster(type, bandwidth_hz, pcal_spacing_hz, pcal_offset_hz);
+        it = simd_choice.insert(std::make_pair(key.str(), simd)).first;
     }
-    return new PCalExtractorShifting(bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, sampleoffset);
+    bool simd = it->second;
+    pthread_mutex_unlock(&choice_mutex);
+
+    return new_extractor(type, simd, bandwidth_hz, pcal_spacing_hz, pcal_offset_hz, sampleoffset);
+}
+
+/**
+ * Tell which vector kernels the extractor was given by getNew().
+ * @return true for the SIMD kernels, false for IPP
+ */
+bool PCal::usesSimdKernels() const
+{
+    return _cfg->simd;
 }
 
 /**
@@ -129,48 +513,31 @@ long long PCal::gcd(long a, long b)
 }
 
 /**
- * Processes samples and accumulates the detected phase calibration tone vector.
- * Computation uses the slowest thinkable direct method. This function is 
- * intended for testing and comparison only!
+ * Processes samples and computes the phase calibration tone vector.
+ * Computation uses the slowest thinkable direct method, a single-bin DFT
+ * of every tone, with the same normalization as getFinalPCal(). This
+ * function is intended for testing and comparison only!
  * @param  data          pointer to input sample vector
  * @param  len           length of input vector
- * @param  pcalout       output array of sufficient size to store extracted PCal
+ * @param  pcalout       output array of getLength() values, overwritten
+ * @param  sampleoffset  offset of the first sample as in adjustSampleOffset()
  */
 bool PCal::extractAndIntegrate_reference(Ipp32f const* data, const size_t len, Ipp32fc* out, const uint64_t sampleoffset)
 {
-    size_t Nbins = 2*_N_tones;
-    size_t maxtoneperiod = _fs_hz/gcd(_pcaloffset_hz,_fs_hz);
-    double dphi = 2*M_PI * (-_pcaloffset_hz/_fs_hz);
-
-    Ipp32fc pcalout[Nbins];
-    ippsZero_32fc(pcalout, Nbins);
-
-    for (size_t n=0; n<len; n++) {
-        size_t no = n + sampleoffset;
-        int bin = (no % Nbins);
-        double phi = dphi * ((_samplecount + no) % maxtoneperiod);
-        pcalout[bin].re += cos(phi) * data[n];
-        pcalout[bin].im += sin(phi) * data[n];
+    for (int t=0; t<_N_tones; t++) {
+        /* phase n*f/fs is kept exact modulo one turn, as an integer fraction of fs */
+        uint64_t f_hz = uint64_t(_pcaloffset_hz + t*_pcalspacing_hz);
+        uint64_t fs   = uint64_t(_fs_hz);
+        double re = 0.0, im = 0.0;
+        for (size_t n=0; n<len; n++) {
+            double phi = -2*M_PI * double(((n + sampleoffset) * f_hz) % fs) / _fs_hz;
+            re += cos(phi) * data[n];
+            im += sin(phi) * data[n];
+        }
+        out[t].re = Ipp32f(re / _N_bins);
+        out[t].im = Ipp32f(im / _N_bins);
     }
     _samplecount += len;
-    cerr << "PCal::extractAndIntegrate_reference Ntones=" << _N_tones << " Nbins=" << Nbins 
-         << " toneperiod=" << maxtoneperiod << endl;
-
-    int wbufsize = 0;
-    IppsDFTSpec_C_32fc* dftspec;
-    IppStatus s = ippsDFTInitAlloc_C_32fc(&dftspec, Nbins, IPP_FFT_DIV_FWD_BY_N, ippAlgHintAccurate);
-    if (s != ippStsNoErr) { cerr << "DFTInitAlloc err " << ippGetStatusString(s); } 
-    s = ippsDFTGetBufSize_C_32fc(dftspec, &wbufsize);
-    if (s != ippStsNoErr) { cerr << "DFTGetBufSize err " << ippGetStatusString(s); }
-    Ipp8u* dftworkbuf = (Ipp8u*)memalign(128, wbufsize);
-
-    Ipp32fc dftout[Nbins];
-    s = ippsDFTFwd_CToC_32fc(pcalout, dftout, dftspec, dftworkbuf);
-    if (s != ippStsNoErr) cerr << "DFTFwd err " << ippGetStatusString(s); 
-    ippsCopy_32fc(dftout, out, _N_tones);
-
-    ippsDFTFree_C_32fc(dftspec);
-    free(dftworkbuf);
     return true;
 }
 
@@ -180,10 +547,11 @@ bool PCal::extractAndIntegrate_reference(Ipp32f const* data, const size_t len, I
 // DERIVED CLASS: extraction of zero-offset PCal signals
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-PCalExtractorTrivial::PCalExtractorTrivial(double bandwidth_hz, int pcal_spacing_hz, const size_t sampleoffset)
+PCalExtractorTrivial::PCalExtractorTrivial(double bandwidth_hz, int pcal_spacing_hz, const size_t sampleoffset, const bool simd)
 {
     /* Derive config */
     _cfg = new pcal_config_pimpl();
+    _cfg->simd = simd;
     _fs_hz   = 2*bandwidth_hz;
     _pcaloffset_hz  = 0;
     _pcalspacing_hz = pcal_spacing_hz;
@@ -191,17 +559,15 @@ PCalExtractorTrivial::PCalExtractorTrivial(double bandwidth_hz, int pcal_spacing
     _N_tones = std::floor(bandwidth_hz / pcal_spacing_hz);
 
     /* Prep for FFT/DFT */
-    // TODO: is IPP_FFT_DIV_FWD_BY_N or is IPP_FFT_DIV_INV_BY_N expected by AIPS&co?
-    int wbufsize = 0;
-    ippsDFTInitAlloc_C_32fc(&(_cfg->dftspec), _N_bins, IPP_FFT_DIV_FWD_BY_N, ippAlgHintAccurate);
-    ippsDFTGetBufSize_C_32fc(_cfg->dftspec, &wbufsize);
-    _cfg->dftworkbuf = (Ipp8u*)memalign(128, wbufsize);
+    int wbufsize = dft_prepare(_cfg, _N_bins);
 
     /* Allocate */
+    _cfg->foldlen      = fold_length(_N_bins);
     _cfg->pcal_complex = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 2);
-    _cfg->pcal_real    = (Ipp32f*)memalign(128, sizeof(Ipp32f) * _N_bins * 2);
+    _cfg->pcal_real    = (Ipp32f*)memalign(128, sizeof(Ipp32f) * _cfg->foldlen * 2);
     _cfg->dft_out      = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 1);
     this->clear();
+    this->adjustSampleOffset(sampleoffset);
     cerr << "PCalExtractorTrivial: _Ntones=" << _N_tones << ", _N_bins=" << _N_bins << ", wbufsize=" << wbufsize << endl;
 }
 
@@ -209,8 +575,7 @@ PCalExtractorTrivial::~PCalExtractorTrivial()
 {
     free(_cfg->pcal_complex);
     free(_cfg->pcal_real);
-    ippsDFTFree_C_32fc(_cfg->dftspec);
-    free(_cfg->dftworkbuf);
+    dft_release(_cfg);
     free(_cfg->dft_out);
     delete _cfg;
 }
@@ -230,8 +595,8 @@ void PCalExtractorTrivial::clear()
 {
     _samplecount = 0;
     _finalized   = false;
-    ippsZero_32fc(_cfg->pcal_complex, _N_bins * 2);
-    ippsZero_32f (_cfg->pcal_real,    _N_bins * 2);
+    memset(_cfg->pcal_complex, 0, sizeof(Ipp32fc) * _N_bins * 2);
+    memset(_cfg->pcal_real,    0, sizeof(Ipp32f)  * _cfg->foldlen * 2);
 }
 
 /**
@@ -243,7 +608,7 @@ void PCalExtractorTrivial::clear()
 void PCalExtractorTrivial::adjustSampleOffset(const size_t sampleoffset)
 {
     _cfg->rotator_index = 0; // unused
-    _cfg->pcal_index = (sampleoffset) % _N_bins;
+    _cfg->pcal_index = (sampleoffset) % _cfg->foldlen;
 }
 
 /**
@@ -266,21 +631,8 @@ bool PCalExtractorTrivial::extractAndIntegrate(Ipp32f const* samples, const size
 {
     if (_finalized) { return false; }
 
-    Ipp32f const* src = samples;
-    Ipp32f* dst = &(_cfg->pcal_real[_cfg->pcal_index]);
-    size_t tail = (len % _N_bins);
-    size_t end  = len - tail;
-
-    /* Process the first part that fits perfectly */
-    for (size_t n = 0; n < end; n+=_N_bins, src+=_N_bins) {
-        ippsAdd_32f_I(src, dst, _N_bins);
-    }
-
-    /* Handle any samples that didn't fit */
-    if (tail != 0) {
-        ippsAdd_32f_I(src, dst, tail);
-        _cfg->pcal_index = (_cfg->pcal_index + tail) % _N_bins;
-    }
+    /* Fold into a long accumulator instead of adding every short _N_bins pulse */
+    fold_accumulate(_cfg, samples, len);
 
     /* Done! */
     _samplecount += len;
@@ -297,19 +649,22 @@ bool PCalExtractorTrivial::extractAndIntegrate(Ipp32f const* samples, const size
  */
 uint64_t PCalExtractorTrivial::getFinalPCal(Ipp32fc* out)
 {
+    // Copy only the tone bins: all bins when the spacing divides
+    // the sampling rate, every step'th bin otherwise
+    size_t step = std::floor(_N_bins*(_pcalspacing_hz/_fs_hz) + 0.5);
     if (!_finalized) {
         _finalized = true;
-        ippsAdd_32f_I(/*src*/&(_cfg->pcal_real[_N_bins]), /*srcdst*/&(_cfg->pcal_real[0]), _N_bins);
-        ippsRealToCplx_32f(/*srcRe*/_cfg->pcal_real, /*srcIm*/NULL, _cfg->pcal_complex, _N_bins);
-        IppStatus r = ippsDFTFwd_CToC_32fc(/*src*/_cfg->pcal_complex, _cfg->dft_out, _cfg->dftspec, _cfg->dftworkbuf);
-        if (r != ippStsNoErr) {
-            cerr << "ippsDFTFwd error " << ippGetStatusString(r);
-        }
+        fold_down(_cfg, _N_bins);
+        dft_tones(_cfg, true, _N_bins, 0, step, _N_tones);
     }
 
-    // Copy only the tone bins: in PCalExtractorTrivial case
-    // this should be all bins... _N_tones==_N_bins/2
-    ippsCopy_32fc(_cfg->dft_out, (Ipp32fc*)out, _N_tones);
+    if (step == 1) {
+        memcpy(out, _cfg->dft_out, sizeof(Ipp32fc) * _N_tones);
+    } else {
+        for (size_t n=0; n<(size_t)_N_tones; n++) {
+            out[n] = _cfg->dft_out[n*step];
+        }
+    }
     return _samplecount;
 }
 
@@ -318,7 +673,7 @@ uint64_t PCalExtractorTrivial::getFinalPCal(Ipp32fc* out)
 // DERIVED CLASS: extraction of PCal signals with non-zero offset
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-PCalExtractorShifting::PCalExtractorShifting(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, const size_t sampleoffset)
+PCalExtractorShifting::PCalExtractorShifting(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, const size_t sampleoffset, const bool simd)
 {
     /* Derive config */
     _fs_hz          = 2 * bandwidth_hz;
@@ -327,37 +682,24 @@ PCalExtractorShifting::PCalExtractorShifting(double bandwidth_hz, double pcal_sp
     _N_bins         = _fs_hz / gcd(std::abs((double)pcal_spacing_hz), _fs_hz);
     _N_tones        = std::floor((bandwidth_hz - pcal_offset_hz) / pcal_spacing_hz) + 1;
     _cfg = new pcal_config_pimpl();
+    _cfg->simd       = simd;
     _cfg->rotatorlen = _fs_hz / gcd(std::abs((double)_pcaloffset_hz), _fs_hz);
+    _cfg->foldlen    = fold_length((_cfg->rotatorlen / gcd(_cfg->rotatorlen, _N_bins)) * _N_bins);
 
     /* Prep for FFT/DFT */
-    // TODO: is IPP_FFT_DIV_FWD_BY_N or is IPP_FFT_DIV_INV_BY_N expected by AIPS&co?
-    int wbufsize = 0;
-    IppStatus r;
-    r = ippsDFTInitAlloc_C_32fc(&(_cfg->dftspec), _N_bins, IPP_FFT_DIV_FWD_BY_N, ippAlgHintAccurate);
-    if (r != ippStsNoErr) {
-        cerr << "ippsDFTInitAlloc _N_bins=" << _N_bins << " error " << ippGetStatusString(r);
-    }
-    r = ippsDFTGetBufSize_C_32fc(_cfg->dftspec, &wbufsize);
-    if (r != ippStsNoErr) {
-        cerr << "ippsDFTGetBufSize error " << ippGetStatusString(r);
-    }
-    _cfg->dftworkbuf = (Ipp8u*)memalign(128, wbufsize);
+    int wbufsize = dft_prepare(_cfg, _N_bins);
 
     /* Allocate */
     _cfg->pcal_complex = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 2);
-    _cfg->pcal_real    = (Ipp32f*)memalign(128, sizeof(Ipp32f) * _N_bins * 2);
-    _cfg->rotator = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _cfg->rotatorlen * 2);
+    _cfg->pcal_real    = (Ipp32f*)memalign(128, sizeof(Ipp32f) * _cfg->foldlen * 2);
     _cfg->rotated = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _cfg->rotatorlen * 2);
     _cfg->dft_out = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 1);
     this->clear();
+    this->adjustSampleOffset(sampleoffset);
 
-    /* Prepare frequency shifter/mixer lookup */
-    _cfg->dphi = 2*M_PI * (-_pcaloffset_hz/_fs_hz);
-    for (size_t n = 0; n < (2 * _cfg->rotatorlen); n++) {
-        double arg = _cfg->dphi * double(n);
-        _cfg->rotator[n].re = Ipp32f(cos(arg));
-        _cfg->rotator[n].im = Ipp32f(sin(arg));
-    }
+    /* Prepare frequency shifter/mixer lookup, shared with the other extractors */
+    _cfg->dphi    = 2*M_PI * (-_pcaloffset_hz/_fs_hz);
+    _cfg->rotator = acquire_rotator(_cfg->dphi, 2 * _cfg->rotatorlen);
     cerr << "PcalExtractorShifting: _Ntones=" << _N_tones << ", _N_bins=" << _N_bins << ", wbufsize=" << wbufsize << endl;
 }
 
@@ -365,10 +707,9 @@ PCalExtractorShifting::~PCalExtractorShifting()
 {
     free(_cfg->pcal_complex);
     free(_cfg->pcal_real);
-    free(_cfg->rotator);
+    release_rotator(_cfg->rotator);
     free(_cfg->rotated);
-    ippsDFTFree_C_32fc(_cfg->dftspec);
-    free(_cfg->dftworkbuf);
+    dft_release(_cfg);
     free(_cfg->dft_out);
     delete _cfg;
 }
@@ -388,9 +729,9 @@ void PCalExtractorShifting::clear()
 {
     _samplecount = 0;
     _finalized   = false;
-    ippsZero_32fc(_cfg->pcal_complex, _N_bins * 2);
-    ippsZero_32f (_cfg->pcal_real,    _N_bins * 2);
-    ippsZero_32fc(_cfg->rotated,      _cfg->rotatorlen * 2);
+    memset(_cfg->pcal_complex, 0, sizeof(Ipp32fc) * _N_bins * 2);
+    memset(_cfg->pcal_real,    0, sizeof(Ipp32f)  * _cfg->foldlen * 2);
+    memset(_cfg->rotated,      0, sizeof(Ipp32fc) * _cfg->rotatorlen * 2);
 }
 
 /**
@@ -402,7 +743,7 @@ void PCalExtractorShifting::clear()
 void PCalExtractorShifting::adjustSampleOffset(const size_t sampleoffset)
 {
     _cfg->rotator_index = (sampleoffset)% _cfg->rotatorlen;
-    _cfg->pcal_index    = (sampleoffset)% _N_bins;
+    _cfg->pcal_index    = (sampleoffset)% _cfg->foldlen;
 }
 
 /**
@@ -425,53 +766,18 @@ bool PCalExtractorShifting::extractAndIntegrate(Ipp32f const* samples, const siz
 {
     if (_finalized) { return false; }
 
-    Ipp32f const* src = samples;
-    Ipp32fc* dst = &(_cfg->pcal_complex[_cfg->pcal_index]);
-    size_t tail  = (len % _cfg->rotatorlen);
-    size_t end   = len - tail;
-
     /* This method is only marginally different from the PCalExtractorTrivial method.
      * Because now our multi-tone PCal signal tones do not reside at integer MHz frequencies,
      * or rather, not at integer multiples of the tone spacing of the comb, the first PCal
      * tone is found at some offset '_pcaloffset_hz' away from 0Hz/DC. 
-     * So we just use a complex oscillator to shift the input signal back into place.
+     * So we use a complex oscillator to shift the signal back into place.
      * The complex oscillator has a period of _fs_hz/gcd(_fs_hz,_pcaloffset_hz).
-     * The period is usually very short, say, 1600 samples. We precomputed those
-     * in the constructor and use them here.
+     *
+     * The oscillator and the comb both repeat after 'foldlen' samples. Rotating
+     * and folding are linear, so the input is only folded into a real 'foldlen'
+     * accumulator here, and getFinalPCal() rotates and folds that down once.
      */
-
-    /* Process the first part that fits perfectly (and note: rotatorlen modulo _N_bins is 0!) */
-    for (size_t n = 0; n < end; n+=_cfg->rotatorlen, src+=_cfg->rotatorlen) {
-        ippsMul_32f32fc(/*A*/src, 
-                        /*B*/&(_cfg->rotator[_cfg->rotator_index]), 
-                        /*dst*/&(_cfg->rotated[_cfg->rotator_index]), 
-                        /*len*/_cfg->rotatorlen);
-        Ipp32fc* pulse = &(_cfg->rotated[_cfg->rotator_index]);
-        for (size_t p = 0; p < (_cfg->rotatorlen/_N_bins); p++) {
-            ippsAdd_32fc_I(/*src*/pulse, /*srcdst*/dst, _N_bins);
-            pulse += _N_bins;
-        }
-    }
-
-    /* Handle any samples that didn't fit */
-    if (tail != 0) {
-        ippsMul_32f32fc(
-            /*A*/src, 
-            /*B*/&(_cfg->rotator[_cfg->rotator_index]),
-            /*dst*/&(_cfg->rotated[_cfg->rotator_index]), 
-            /*len*/tail);
-        Ipp32fc* pulse = &(_cfg->rotated[_cfg->rotator_index]);
-        size_t tail2 = (tail % _N_bins);
-        size_t end2  = tail - tail2;
-        for (size_t p = 0; p < (end2/_N_bins); p++) {
-            ippsAdd_32fc_I(/*src*/pulse, /*srcdst*/dst, _N_bins);
-            pulse += _N_bins;
-        }
-        /* Samples that didn't fit _N_bins */
-        ippsAdd_32fc_I(/*src*/pulse, /*srcdst*/dst, tail2);
-        _cfg->rotator_index = (_cfg->rotator_index + tail) % _cfg->rotatorlen;
-        _cfg->pcal_index    = (_cfg->pcal_index + tail2)   % _N_bins;
-    }
+    fold_accumulate(_cfg, samples, len);
 
     /* Done! */
     _samplecount += len;
@@ -490,17 +796,33 @@ uint64_t PCalExtractorShifting::getFinalPCal(Ipp32fc* out)
 {
     if (!_finalized) {
         _finalized = true;
-        ippsAdd_32fc_I(/*src*/&(_cfg->pcal_complex[_N_bins]), /*srcdst*/&(_cfg->pcal_complex[0]), _N_bins);
-        IppStatus r = ippsDFTFwd_CToC_32fc(/*src*/_cfg->pcal_complex, _cfg->dft_out, _cfg->dftspec, _cfg->dftworkbuf);
-        if (r != ippStsNoErr) {
-            cerr << "ippsDFTFwd error " << ippGetStatusString(r);
+
+        /* Rotate the folded samples by the oscillator and fold them into _N_bins */
+        add_32f_I(_cfg, &(_cfg->pcal_real[_cfg->foldlen]), _cfg->pcal_real, _cfg->foldlen);
+        for (size_t n = 0; n < _cfg->foldlen; n += _cfg->rotatorlen) {
+            if (!_cfg->simd) {
+                ippsMul_32f32fc(&(_cfg->pcal_real[n]), _cfg->rotator, _cfg->rotated, _cfg->rotatorlen);
+            }
+            size_t bin = n % _N_bins;
+            size_t k   = 0;
+            while (k < _cfg->rotatorlen) {
+                size_t m = std::min(_cfg->rotatorlen - k, _N_bins - bin);
+                if (_cfg->simd) {
+                    simd_mul_add_32f32fc(&(_cfg->pcal_real[n+k]), &(_cfg->rotator[k]), &(_cfg->pcal_complex[bin]), m);
+                } else {
+                    ippsAdd_32fc_I(&(_cfg->rotated[k]), &(_cfg->pcal_complex[bin]), m);
+                }
+                k  += m;
+                bin = 0;
+            }
         }
+        dft_tones(_cfg, false, _N_bins, 0, size_t(std::floor(_N_bins*(_pcalspacing_hz/_fs_hz))), _N_tones);
     }
 
     if (false && _pcalspacing_hz == 1e6) {
         // Copy only the tone bins: in PCalExtractorTrivial case
         // this should be all bins... _N_tones==_N_bins/2
-        ippsCopy_32fc(_cfg->dft_out, (Ipp32fc*)out, _N_tones);
+        memcpy(out, _cfg->dft_out, sizeof(Ipp32fc) * _N_tones);
     } else {
         // Copy only the interesting bins
         size_t step = std::floor(_N_bins*(_pcalspacing_hz/_fs_hz));
@@ -518,7 +840,7 @@ uint64_t PCalExtractorShifting::getFinalPCal(Ipp32fc* out)
 // DERIVED CLASS: extraction of PCal signals with non-zero offset and FFT-implicit rotation possible
 /////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-PCalExtractorImplicitShift::PCalExtractorImplicitShift(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, const size_t sampleoffset)
+PCalExtractorImplicitShift::PCalExtractorImplicitShift(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, const size_t sampleoffset, const bool simd)
 {
     /* Derive config */
     _fs_hz          = 2 * bandwidth_hz;
@@ -527,26 +849,18 @@ PCalExtractorImplicitShift::PCalExtractorImplicitShift(double bandwidth_hz, doub
     _N_bins         = _fs_hz / gcd(std::abs((double)_pcaloffset_hz), _fs_hz);
     _N_tones        = std::floor((bandwidth_hz - pcal_offset_hz) / pcal_spacing_hz) + 1;
     _cfg = new pcal_config_pimpl();
+    _cfg->simd      = simd;
 
     /* Prep for FFT/DFT */
-    // TODO: is IPP_FFT_DIV_FWD_BY_N or is IPP_FFT_DIV_INV_BY_N expected by AIPS&co?
-    int wbufsize = 0;
-    IppStatus r;
-    r = ippsDFTInitAlloc_C_32fc(&(_cfg->dftspec), _N_bins, IPP_FFT_DIV_FWD_BY_N, ippAlgHintAccurate);
-    if (r != ippStsNoErr) {
-        cerr << "ippsDFTInitAlloc _N_bins=" << _N_bins << " error " << ippGetStatusString(r);
-    }
-    r = ippsDFTGetBufSize_C_32fc(_cfg->dftspec, &wbufsize);
-    if (r != ippStsNoErr) {
-        cerr << "ippsDFTGetBufSize error " << ippGetStatusString(r);
-    }
-    _cfg->dftworkbuf = (Ipp8u*)memalign(128, wbufsize);
+    int wbufsize = dft_prepare(_cfg, _N_bins);
 
     /* Allocate */
+    _cfg->foldlen      = fold_length(_N_bins);
     _cfg->pcal_complex = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 2);
-    _cfg->pcal_real    = (Ipp32f*) memalign(128, sizeof(Ipp32f)  * _N_bins * 2);
+    _cfg->pcal_real    = (Ipp32f*) memalign(128, sizeof(Ipp32f)  * _cfg->foldlen * 2);
     _cfg->dft_out      = (Ipp32fc*)memalign(128, sizeof(Ipp32fc) * _N_bins * 1);
     this->clear();
+    this->adjustSampleOffset(sampleoffset);
     cerr << "PCalExtractorImplicitShift: _Ntones=" << _N_tones << ", _N_bins=" << _N_bins << ", wbufsize=" << wbufsize << endl;
 }
 
@@ -555,8 +869,7 @@ PCalExtractorImplicitShift::~PCalExtractorImplicitShift()
 {
     free(_cfg->pcal_complex);
     free(_cfg->pcal_real);
-    ippsDFTFree_C_32fc(_cfg->dftspec);
-    free(_cfg->dftworkbuf);
+    dft_release(_cfg);
     free(_cfg->dft_out);
     delete _cfg;
 }
@@ -576,8 +889,8 @@ void PCalExtractorImplicitShift::clear()
 {
     _samplecount = 0;
     _finalized   = false;
-    ippsZero_32fc(_cfg->pcal_complex, _N_bins * 2);
-    ippsZero_32f (_cfg->pcal_real,    _N_bins * 2);
+    memset(_cfg->pcal_complex, 0, sizeof(Ipp32fc) * _N_bins * 2);
+    memset(_cfg->pcal_real,    0, sizeof(Ipp32f)  * _cfg->foldlen * 2);
 }
 
 /**
@@ -588,7 +901,7 @@ void PCalExtractorImplicitShift::clear()
  */
 void PCalExtractorImplicitShift::adjustSampleOffset(const size_t sampleoffset)
 {
-    _cfg->pcal_index = (sampleoffset)% _N_bins;
+    _cfg->pcal_index = (sampleoffset)% _cfg->foldlen;
 }
 
 /**
@@ -614,11 +927,6 @@ bool PCalExtractorImplicitShift::extractAndIntegrate(Ipp32f const* samples, cons
         return false; 
     }
 
-    Ipp32f const* src = samples;
-    Ipp32f* dst = &(_cfg->pcal_real[_cfg->pcal_index]);
-    size_t tail = (len % _N_bins);
-    size_t end  = len - tail;
-
     /* This method is from Walter Brisken, it works perfectly for smallish 'len'
      * and when offset and tone spacing have suitable properties.
      * Instead of rotating the input to counteract the offset, we bin
@@ -626,17 +934,7 @@ bool PCalExtractorImplicitShift::extractAndIntegrate(Ipp32f const* samples, cons
      * buffer wraps). After long-term integration, we copy desired FFT bins
      * into PCal. The time-domain PCal can be derived from inverse FFT.
      */
-
-    /* Process the first part that fits perfectly */
-    for (size_t n = 0; n < end; n+=_N_bins, src+=_N_bins) {
-        ippsAdd_32f_I(src, /*srcdst*/dst, _N_bins);
-    }
-
-    /* Handle any samples that didn't fit */
-    if (tail != 0) {
-        ippsAdd_32f_I(src, /*srcdst*/dst, tail);
-        _cfg->pcal_index = (_cfg->pcal_index + tail) % _N_bins;
-    }
+    fold_accumulate(_cfg, samples, len);
 
     /* Done! */
     _samplecount += len;
@@ -653,20 +951,16 @@ bool PCalExtractorImplicitShift::extractAndIntegrate(Ipp32f const* samples, cons
  */
 uint64_t PCalExtractorImplicitShift::getFinalPCal(Ipp32fc* out)
 {
-   if (!_finalized) {
-        _finalized = true;
-        //print_f32(_cfg->pcal_real, 8);
-        ippsRealToCplx_32f(/*srcRe*/_cfg->pcal_real, /*srcIm*/NULL, _cfg->pcal_complex, 2*_N_bins);
-        ippsAdd_32fc_I(/*src*/&(_cfg->pcal_complex[_N_bins]), /*srcdst*/&(_cfg->pcal_complex[0]), _N_bins);
-        IppStatus r = ippsDFTFwd_CToC_32fc(/*src*/ _cfg->pcal_complex, _cfg->dft_out, _cfg->dftspec, _cfg->dftworkbuf);
-        if (r != ippStsNoErr) {
-            cerr << "ippsDFTFwd error " << ippGetStatusString(r);
-        }
-    }
- 
     /* Copy only the interesting bins */
     size_t step = std::floor(double(_N_bins)*(_pcalspacing_hz/_fs_hz));
     size_t offset = std::floor(double(_N_bins*_pcaloffset_hz)/_fs_hz);
+    if (!_finalized) {
+        _finalized = true;
+        //print_f32(_cfg->pcal_real, 8);
+        fold_down(_cfg, _N_bins);
+        dft_tones(_cfg, true, _N_bins, offset, step, _N_tones);
+    }
+
     // cout << "step=" << step << " offset=" << offset << endl;
     for (size_t n=0; n<(size_t)_N_tones; n++) {
         size_t idx = offset + n*step;
@@ -865,16 +1159,20 @@ g++ -m64 -DUNIT_TEST -Wall -O3 -I$(IPPROOT)/include/ -pthread -I.. pcal.cpp -o t
  -L$(IPPROOT)/sharedlib -L$(IPPROOT)/lib -lippsem64t -lguide -lippvmem64t -lippcoreem64t
 
 ./test 32000 16e6 1e6 510e3 0
+./test bench [samplecount] 2>/dev/null
 */
 
 #include <cmath>
 #include <iostream>
 #include <iomanip>
 #include <stdlib.h>
+#include <string.h>
 void print_32f(const Ipp32f* v, const size_t len);
 void print_32fc(const Ipp32fc* v, const size_t len);
 void print_32fc_phase(const Ipp32fc* v, const size_t len);
 void compare_32fc_phase(const Ipp32fc* v, const size_t len, Ipp32f angle, Ipp32f step);
+double max_rel_error(const Ipp32fc* v, const Ipp32fc* ref, const size_t len);
+int benchmark(long samplecount);
 
 int main(int argc, char** argv)
 {
@@ -883,8 +1181,12 @@ int main(int argc, char** argv)
    const long some_prime = 3;
    uint64_t usedsamplecount;
 
+   if ((argc >= 2) && (strcmp(argv[1], "bench") == 0)) {
+      return benchmark((argc >= 3) ? long(atof(argv[2])) : long(1<<22));
+   }
    if (argc < 6) {
       cerr << "Usage: " << argv[0] << " <samplecount> <bandwidthHz> <spacingHz> <offsetHz> <sampleoffset>" << endl;
+      cerr << "       " << argv[0] << " bench [<samplecount>]" << endl;
       return -1;
    }
    long samplecount = atof(argv[1]);
@@ -935,21 +1237,123 @@ int main(int argc, char** argv)
    print_32fc_phase(out, numtones);
    compare_32fc_phase(out, numtones, -90.0f, (sloping_reference_data) ? 5.0f : 0.0f);
 
-   /* Comparison with the (poorer) "reference" extracted result */
-   extractor->clear();
-   if (skip_some_data) {
-       ippsAdd_32f_I(data+some_prime, data+some_prime, samplecount-some_prime);
-   }
+   /* Comparison with the direct-DFT reference over the same segments */
    extractor->extractAndIntegrate_reference(data, samplecount, ref, sampleoffset);
+   if (skip_some_data && (samplecount > some_prime)) {
+       Ipp32fc* ref2 = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*numtones);
+       extractor->extractAndIntegrate_reference(data + some_prime, samplecount - some_prime, ref2, sampleoffset + samplecount + some_prime);
+       ippsAdd_32fc_I(ref2, ref, numtones);
+       free(ref2);
+   }
    //cerr << "reference PCal reim: ";
    //print_32fc(ref, numtones);
-   cerr << "quasi-reference PCal phase: ";
-   print_32fc_phase(ref, numtones); // should be ~ -90deg
-   compare_32fc_phase(ref, numtones, -90.0f, (sloping_reference_data) ? +5.0f : +0.0f);
+   cerr << "reference PCal phase: ";
+   print_32fc_phase(ref, numtones);
+   cerr << endl;
+   cerr << "Extracted versus reference: max. relative error " << max_rel_error(out, ref, numtones) << endl;
+
+   return 0;
+}
+
+/**
+ * Largest error of a tone vector relative to the strongest reference tone.
+ */
+double max_rel_error(const Ipp32fc* v, const Ipp32fc* ref, const size_t len)
+{
+   double maxerr = 0.0, maxref = 0.0;
+   for (size_t i=0; i<len; i++) {
+      maxerr = std::max(maxerr, (double)std::sqrt(std::pow(v[i].re - ref[i].re, 2) + std::pow(v[i].im - ref[i].im, 2)));
+      maxref = std::max(maxref, (double)std::sqrt(std::pow(ref[i].re, 2) + std::pow(ref[i].im, 2)));
+   }
+   return (maxref > 0.0) ? (maxerr / maxref) : maxerr;
+}
+
+/**
+ * Throughput of every extractor type and kernel set over a range of bandwidths,
+ * tone spacings and offsets, with the error of each against the direct reference.
+ */
+int benchmark(long samplecount)
+{
+   const double bandwidths[] = { 4e6, 8e6, 16e6, 32e6 };
+   const double spacings[]   = { 0.5e6, 1e6 };
+   const int    offsets[]    = { 0, 10000, 130000 };
+   const char*  typenames[]  = { "Trivial", "Shifting", "ImplicitShift" };
+   const size_t checklen     = 8192;
+   const size_t checkoffset  = 7;
+
+   /* Throughput does not depend on the content, accuracy is checked on a short tone signal */
+   Ipp32f* data = (Ipp32f*)memalign(128, sizeof(Ipp32f)*samplecount);
+   Ipp32f* sig  = (Ipp32f*)memalign(128, sizeof(Ipp32f)*checklen);
+   srand(1);
+   for (long n=0; n<samplecount; n++) {
+      data[n] = Ipp32f(rand()) / RAND_MAX - 0.5f;
+   }
+
+   cout << std::setw(10) << "BW[Hz]" << std::setw(10) << "spc[Hz]" << std::setw(10) << "off[Hz]"
+        << std::setw(15) << "extractor" << std::setw(6) << "kern"
+        << std::setw(10) << "Ms/s" << std::setw(12) << "rel.err" << endl;
+   for (size_t b=0; b<sizeof(bandwidths)/sizeof(double); b++) {
+   for (size_t p=0; p<sizeof(spacings)/sizeof(double); p++) {
+   for (size_t o=0; o<sizeof(offsets)/sizeof(int); o++) {
+      double bw = bandwidths[b], spc = spacings[p];
+      int off = offsets[o];
+
+      /* Candidate types: Trivial for zero offset, otherwise Shifting and, if the offset
+       * period is a multiple of the comb period, the rotationless ImplicitShift */
+      std::vector<PCalExtractorType> types;
+      if (off == 0) {
+         types.push_back(PCAL_TRIVIAL);
+      } else {
+         long fs = long(2*bw), No = fs, Np = fs;
+         for (long a=off, c=fs; c != 0; ) { long t = a % c; a = c; c = t; No = fs / a; }
+         for (long a=long(spc), c=fs; c != 0; ) { long t = a % c; a = c; c = t; Np = fs / a; }
+         types.push_back(PCAL_SHIFTING);
+         if ((No % Np) == 0) {
+            types.push_back(PCAL_IMPLICIT);
+         }
+      }
 
+      for (size_t t=0; t<types.size(); t++) {
+         for (int simd=0; simd<2; simd++) {
+            PCal* pc = new_extractor(types[t], (simd != 0), bw, spc, off, 0);
+            int ntones = pc->getLength();
+            Ipp32fc* out = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*ntones);
+            Ipp32fc* ref = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*ntones);
+            for (size_t n=0; n<checklen; n++) {
+               sig[n] = 0.1f * data[n];
+               for (int k=0; k<ntones; k++) {
+                  sig[n] += sin(M_PI*(n+checkoffset)*(off + k*spc)/bw + k*M_PI*5/180);
+               }
+            }
+            pc->clear();
+            pc->adjustSampleOffset(checkoffset);
+            pc->extractAndIntegrate(sig, checklen);
+            pc->getFinalPCal(out);
+            pc->extractAndIntegrate_reference(sig, checklen, ref, checkoffset);
+            double err = max_rel_error(out, ref, ntones);
+
+            double Msps = 0.0;
+            for (int trial=0; trial<3; trial++) {
+               Msps = std::max(Msps, measure_Msps(pc, data, samplecount, 1));
+            }
+            cout << std::setw(10) << long(bw) << std::setw(10) << long(spc) << std::setw(10) << off
+                 << std::setw(15) << typenames[types[t]] << std::setw(6) << (simd ? "SIMD" : "IPP")
+                 << std::setw(10) << std::fixed << std::setprecision(1) << Msps
+                 << std::setw(12) << std::scientific << std::setprecision(2) << err << endl;
+            free(out);
+            free(ref);
+            delete pc;
+         }
+      }
+   }
+   }
+   }
+   free(data);
+   free(sig);
    return 0;
 }
 
+
 void print_32f(const Ipp32f* v, const size_t len) {
    for (size_t i=0; i<len; i++) { cerr << std::scientific << v[i] << " "; }
 }
@@ -28,6 +28,8 @@
  * Changelog:
  *   05Oct2009 - added support for arbitrary input segment lengths
  *   08oct2009 - added Briskens rotationless method
+ *   2026      - SSE/AVX kernels with a plain C fallback that need no IPP functions,
+ *               getNew() picks IPP or SIMD kernels by measurement
  *
  ********************************************************************************************************/
 
@@ -53,15 +55,16 @@ class PCal {
 
    public:
       PCal() {};
-      ~PCal() {};
+      virtual ~PCal() {};
    private:
       PCal(const PCal& o); /* no copy */
       PCal& operator= (const PCal& o); /* no assign */
 
    public:
       /**
-       * Factory that returns a new PCal extractor object. The optimal implementation
-       * is selected based on the input parameters.
+       * Factory that returns a new PCal extractor object. The extractor type is selected
+       * based on the input parameters. Its vector kernels, IPP or SIMD, are picked by a short
+       * timing run that is done once per parameter set, see usesSimdKernels().
        * @param bandwidth_hz     Bandwidth of the input signal in Hertz
        * @param pcal_spacing_hz  Spacing of the PCal signal, comb spacing, typically 1e6 Hertz
        * @param pcal_offset_hz   Offset of the first PCal signal from 0Hz/DC, typically 10e3 Hertz
@@ -131,6 +134,12 @@ class PCal {
        */
       int getNBins() { return _N_bins; }
 
+      /**
+       * Tell which vector kernels the extractor was given by getNew().
+       * @return true for the SIMD kernels, false for IPP
+       */
+      bool usesSimdKernels() const;
+
       /**
        * Performs finalization steps on the internal PCal results if necessary
        * and then copies these PCal results into the specified output array.
@@ -142,13 +151,14 @@ class PCal {
       virtual uint64_t getFinalPCal(Ipp32fc* out) = 0;
 
       /**
-       * Processes samples and accumulates the detected phase calibration tone vector.
-       * Computation uses the slowest thinkable direct method. This function is
-       * intended for testing and comparison only!
+       * Processes samples and computes the phase calibration tone vector.
+       * Computation uses the slowest thinkable direct method, a single-bin DFT
+       * of every tone, with the same normalization as getFinalPCal(). This
+       * function is intended for testing and comparison only!
        * @param  data          pointer to input sample vector
        * @param  len           length of input vector
-       * @param  pcalout       output array of sufficient size to store extracted PCal
-       * @param  sampleoffset
+       * @param  pcalout       output array of getLength() values, overwritten
+       * @param  sampleoffset  offset of the first sample as in adjustSampleOffset()
        */
       bool extractAndIntegrate_reference(Ipp32f const* data, const size_t len, Ipp32fc* pcalout, const uint64_t sampleoffset);
 
@@ -28,6 +28,7 @@
  * Changelog:
  *   05Oct2009 - added support for arbitrary input segment lengths
  *   08oct2009 - added Briskens rotationless method 
+ *   2026      - optional portable SIMD kernels instead of IPP primitives (constructor arg 'simd')
  *
  ********************************************************************************************************/
 
@@ -44,7 +45,8 @@ class pcal_config_pimpl;
 
 class PCalExtractorTrivial : public PCal {
    public:
-      PCalExtractorTrivial(double bandwidth_hz, int pcal_spacing_hz, const size_t sampleoffset);
+      PCalExtractorTrivial(double bandwidth_hz, int pcal_spacing_hz, const size_t sampleoffset,
+                           const bool simd = false);
       ~PCalExtractorTrivial();
    private:
      PCalExtractorTrivial& operator= (const PCalExtractorTrivial& o); /* no copy */
@@ -109,7 +111,7 @@ class PCalExtractorTrivial : public PCal {
 class PCalExtractorShifting : public PCal {
    public:
       PCalExtractorShifting(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, 
-                            const size_t sampleoffset);
+                            const size_t sampleoffset, const bool simd = false);
       ~PCalExtractorShifting();
    private:
       PCalExtractorShifting& operator= (const PCalExtractorShifting& o); /* no copy */
@@ -173,7 +175,7 @@ class PCalExtractorShifting : public PCal {
 class PCalExtractorImplicitShift : public PCal {
    public:
       PCalExtractorImplicitShift(double bandwidth_hz, double pcal_spacing_hz, int pcal_offset_hz, 
-                                const size_t sampleoffset);
+                                const size_t sampleoffset, const bool simd = false);
       ~PCalExtractorImplicitShift();
    private:
      PCalExtractorImplicitShift& operator= (const PCalExtractorImplicitShift& o); /* no copy */
@@ -0,0 +1,262 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "SharedTables.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <malloc.h>
+using std::cerr;
+using std::endl;
+
+// Points of the double precision tone that are generated at a time
+#define SHARED_TABLE_CHUNK  16384
+
+pthread_mutex_t              SharedTables::sets_mutex = PTHREAD_MUTEX_INITIALIZER;
+std::map<int, SharedTables*> SharedTables::sets;
+
+/**
+ * Get the table set of a NUMA node, generating it on first use.
+ * @return SharedTables*  Tables to use until release()
+ * @param  settings       Pointer to the global settings
+ * @param  node           NUMA node of the calling core, or -1 if unknown
+ */
+SharedTables* SharedTables::acquire(swspect_settings_t* settings, int node)
+{
+   pthread_mutex_lock(&sets_mutex);
+   std::map<int, SharedTables*>::iterator it = sets.find(node);
+   if (it == sets.end()) {
+      it = sets.insert(std::make_pair(node, new SharedTables(settings, node))).first;
+   }
+   SharedTables* tables = it->second;
+   tables->users++;
+   pthread_mutex_unlock(&sets_mutex);
+   return tables;
+}
+
+/**
+ * Give up the use of a table set, the last user frees it.
+ * @param tables  Table set from acquire()
+ */
+void SharedTables::release(SharedTables* tables)
+{
+   pthread_mutex_lock(&sets_mutex);
+   if (--(tables->users) <= 0) {
+      sets.erase(tables->node);
+      delete tables;
+   }
+   pthread_mutex_unlock(&sets_mutex);
+}
+
+/**
+ * Generate all tables in memory of the given NUMA node.
+ * @param settings  Pointer to the global settings
+ * @param node      NUMA node, or -1 if unknown
+ */
+SharedTables::SharedTables(swspect_settings_t* settings, int node)
+{
+   this->node  = node;
+   this->users = 0;
+
+   window_buf = new Buffer(sizeof(Ipp32f) * settings->fft_points, 0, node);
+   window     = (Ipp32f*)window_buf->getData();
+   generate_windowfunction(window, settings->wf_type, settings->fft_points);
+
+   nco_buf     = NULL;
+   carrier_nco = NULL;
+   if (settings->costas_loop) {
+      nco_buf     = new Buffer(sizeof(Ipp32fc) * settings->costas_block_len, 0, node);
+      carrier_nco = (Ipp32fc*)nco_buf->getData();
+      generate_tone(NULL, carrier_nco, settings->costas_block_len, settings->costas_carrier_hz / settings->samplingfreq, 0.0);
+   }
+}
+
+/**
+ * Release the tables
+ */
+SharedTables::~SharedTables()
+{
+   delete window_buf;
+   if (nco_buf != NULL) {
+      delete nco_buf;
+   }
+}
+
+/**
+ * Fill out a vector with the specified window function.
+ * @param output where to place the values
+ * @param type   type of window function
+ * @param points how many points
+ */
+void SharedTables::generate_windowfunction(Ipp32f* output, WindowFunctionType type, int points)
+{
+   /* the cosine windows are cos(pi*(i - N/2 + 1/2)/N), a tone of 1/2N cycles per point */
+   const double cycles = 0.5 / double(points);
+   const double phase  = M_PI * (0.5 - 0.5*double(points)) / double(points);
+
+   switch (type) {
+        case None:
+            // no windowing: currently implemented as *1.0 rectangular windowing...
+            ippsSet_32f(1, output, points);
+            break;
+        case Cosine:
+            generate_tone(output, NULL, points, cycles, phase);
+            break;
+        case Cosine2:
+            generate_tone(output, NULL, points, cycles, phase);
+            ippsSqr_32f_I(output, points);
+            break;
+        case Hamming:
+            ippsSet_32f(1, output, points);
+            ippsWinHamming_32f_I(output, points);
+            break;
+        case Blackman:
+            ippsSet_32f(1, output, points);
+            ippsWinBlackman_32f_I(output, points, 0.5 /* alpha, hardcoded for now... */);
+            break;
+        case Hann:
+            ippsSet_32f(1, output, points);
+            ippsWinHann_32f_I(output, points);
+            break;
+        default:
+            ippsSet_32f(1, output, points);
+            cerr << "SharedTables: unsupported window function " << type << ", reverting to None." << endl;
+            break;
+   }
+   return;
+}
+
+/**
+ * Fill out a vector with a unit tone, computed in double precision.
+ * @param output  where to place the real values, or NULL; cycles must then lie in [0,0.5)
+ * @param coutput or where to place the complex values, or NULL
+ * @param points  how many points
+ * @param cycles  frequency in cycles per point
+ * @param phase   phase of the first point in radians
+ */
+void SharedTables::generate_tone(Ipp32f* output, Ipp32fc* coutput, int points, double cycles, double phase)
+{
+   /* IPP wants the frequency in [0,1) and the phase in [0,2pi), it returns the phase of the next point */
+   Ipp64f  rfreq = cycles - floor(cycles);
+   Ipp64f  ph    = fmod(phase, 2*M_PI);
+   if (ph < 0) {
+      ph += 2*M_PI;
+   }
+
+   Ipp64fc* tmp = (Ipp64fc*)memalign(128, sizeof(Ipp64fc) * SHARED_TABLE_CHUNK);
+   for (int n=0; n<points; n+=SHARED_TABLE_CHUNK) {
+      int m = std::min(SHARED_TABLE_CHUNK, points - n);
+      if (coutput != NULL) {
+         ippsTone_Direct_64fc(tmp, m, 1.0, rfreq, &ph, ippAlgHintAccurate);
+         ippsConvert_64f32f((Ipp64f*)tmp, (Ipp32f*)(coutput + n), 2*m);
+      } else {
+         ippsTone_Direct_64f((Ipp64f*)tmp, m, 1.0, rfreq, &ph, ippAlgHintAccurate);
+         ippsConvert_64f32f((Ipp64f*)tmp, output + n, m);
+      }
+   }
+   free(tmp);
+}
+
+
+#ifdef UNIT_TEST_SHAREDTABLES
+// g++ -Wall -DUNIT_TEST_SHAREDTABLES=1 -I.. SharedTables.cpp ../Buffer.cpp ../Helpers.cpp -o tablestest -lipps -lippcore -lpthread
+
+/* compare a window against the closed form cos(pi*(i - N/2 + 1/2)/N), squared for Cosine2 */
+static int tables_test_window(SharedTables const* t, WindowFunctionType type, int points)
+{
+   Ipp32f const* w = t->getWindow();
+   int errors = 0;
+   for (int i=0; i<points; i++) {
+      double c = cos(M_PI * (i - 0.5*points + 0.5) / points);
+      double expect = (type == Cosine2) ? c*c : c;
+      if (fabs(w[i] - expect) > 1e-6) {
+         cerr << "window " << type << " of " << points << " points is " << w[i] << " at " << i
+              << " instead of " << expect << endl;
+         errors++;
+         break;
+      }
+   }
+   return errors;
+}
+
+int main(int argc, char** argv)
+{
+   int errors = 0;
+
+   /* more points than one chunk of the tone, so that the phase carries over between chunks */
+   swspect_settings_t s;
+   s.fft_points        = 2*SHARED_TABLE_CHUNK + 1000;
+   s.wf_type           = Cosine;
+   s.costas_loop       = true;
+   s.costas_block_len  = 3*SHARED_TABLE_CHUNK;
+   s.samplingfreq      = 32e6;
+   s.costas_carrier_hz = 1234567.0;
+
+   SharedTables* a = SharedTables::acquire(&s, 0);
+   errors += tables_test_window(a, Cosine, s.fft_points);
+   Ipp32fc const* nco = a->getCarrierNCO();
+   for (int n=0; n<s.costas_block_len; n++) {
+      double ph = 2*M_PI * fmod(n * (s.costas_carrier_hz / s.samplingfreq), 1.0);
+      if ((fabs(nco[n].re - cos(ph)) > 1e-6) || (fabs(nco[n].im - sin(ph)) > 1e-6)) {
+         cerr << "carrier NCO is " << nco[n].re << "," << nco[n].im << " at " << n
+              << " instead of " << cos(ph) << "," << sin(ph) << endl;
+         errors++;
+         break;
+      }
+   }
+
+   /* cores of a node share one set, other nodes get their own */
+   SharedTables* b = SharedTables::acquire(&s, 0);
+   s.wf_type     = Cosine2;
+   s.fft_points  = 1024;
+   s.costas_loop = false;
+   SharedTables* c = SharedTables::acquire(&s, 1);
+   if ((a != b) || (c == a)) {
+      cerr << "node 0 has sets " << a << " and " << b << ", node 1 has " << c << endl;
+      errors++;
+   }
+   errors += tables_test_window(c, Cosine2, s.fft_points);
+   if (c->getCarrierNCO() != NULL) {
+      cerr << "carrier NCO without carrier tracking" << endl;
+      errors++;
+   }
+
+   /* the set of node 0 lives on while it has users, it is not regenerated for the new settings */
+   SharedTables::release(a);
+   SharedTables* d = SharedTables::acquire(&s, 0);
+   if (d != b) {
+      cerr << "node 0 got a new set while the old one was still in use" << endl;
+      errors++;
+   }
+   errors += tables_test_window(d, Cosine, 2*SHARED_TABLE_CHUNK + 1000);
+
+   /* after the last user of node 0 left, its set was freed and the next one is generated anew */
+   SharedTables::release(b);
+   SharedTables::release(d);
+   SharedTables* e = SharedTables::acquire(&s, 0);
+   errors += tables_test_window(e, Cosine2, s.fft_points);
+   SharedTables::release(e);
+   SharedTables::release(c);
+
+   cerr << "SharedTables test: " << errors << " errors" << endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,101 @@
+#ifndef SHAREDTABLES_H
+#define SHAREDTABLES_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+ **************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+
+#include <ipps.h>
+
+#include <map>
+#include <pthread.h>
+
+/**
+  * class SharedTables
+  * The read-only tables that every TaskCore of a run needs in the same
+  * form: the FFT window function and the a-priori carrier NCO of the
+  * tracking loop. One set is generated per NUMA node with IPP vector
+  * primitives, placed on that node, and shared by the cores there.
+  */
+
+class SharedTables
+{
+public:
+   /**
+    * Get the table set of a NUMA node, generating it on first use.
+    * @return SharedTables*  Tables to use until release()
+    * @param  settings       Pointer to the global settings
+    * @param  node           NUMA node of the calling core, or -1 if unknown
+    */
+   static SharedTables* acquire(swspect_settings_t* settings, int node);
+
+   /**
+    * Give up the use of a table set, the last user frees it.
+    * @param tables  Table set from acquire()
+    */
+   static void release(SharedTables* tables);
+
+   /**
+    * @return The window function, fft_points long
+    */
+   Ipp32f const* getWindow() const { return window; }
+
+   /**
+    * @return The carrier NCO exp(+iwn) of one integrate-and-dump block starting at phase 0,
+    *         costas_block_len long, or NULL without carrier tracking
+    */
+   Ipp32fc const* getCarrierNCO() const { return carrier_nco; }
+
+private:
+   SharedTables(swspect_settings_t* settings, int node);
+   ~SharedTables();
+
+   /**
+    * Fill out a vector with the specified window function.
+    * @param output where to place the values
+    * @param type   type of window function
+    * @param points how many points
+    */
+   static void generate_windowfunction(Ipp32f* output, WindowFunctionType type, int points);
+
+   /**
+    * Fill out a vector with a unit tone, computed in double precision.
+    * @param output  where to place the real values, or NULL
+    * @param coutput or where to place the complex values, or NULL
+    * @param points  how many points
+    * @param cycles  frequency in cycles per point
+    * @param phase   phase of the first point in radians
+    */
+   static void generate_tone(Ipp32f* output, Ipp32fc* coutput, int points, double cycles, double phase);
+
+private:
+   Buffer*  window_buf;
+   Buffer*  nco_buf;
+   Ipp32f*  window;
+   Ipp32fc* carrier_nco;
+   int      node;
+   int      users;
+
+   static pthread_mutex_t                  sets_mutex;
+   static std::map<int, SharedTables*>     sets;       // table sets by NUMA node
+};
+
+#endif // SHAREDTABLES_H
@@ -28,6 +28,7 @@
  **************************************************************************/
 
 #include "TaskCoreIPP.h"
+#include <algorithm>
 #include <cmath>
 #include <iostream>
 #include <sstream>
@@ -36,6 +37,13 @@ using std::endl;
 using std::flush;
 #include <memory.h>
 #include <malloc.h>
+#include <sched.h>
+
+#ifdef DEBUG_ALLOC_CHECK
+#include <cassert>
+#include <cstdlib>
+#include <new>
+#endif
 
 void* taskcoreipp_worker(void* p);
 
@@ -56,6 +64,56 @@ void print_vec32fc(Ipp32fc* v, int pts)
    cerr << endl << flush;
 }
 
+/**
+ * Take the next 64-byte aligned slice out of an arena.
+ * @return void*  Start of the slice, or its offset when the arena starts at NULL
+ * @param  next   Current position in the arena, advanced past the slice
+ * @param  bytes  Size of the slice
+ */
+static void* arena_take(char*& next, size_t bytes)
+{
+   void* slice = next;
+   next += (bytes + 63) & ~size_t(63);
+   return slice;
+}
+
+#ifdef DEBUG_ALLOC_CHECK
+/**
+ * Allocation counter for the steady-state check in doMaths(). Only operator new
+ * is counted, each thread separately, allocations inside IPP are not seen.
+ */
+static __thread long thread_allocs = 0;
+
+#if __cplusplus >= 201103L
+#define ALLOC_THROW
+#else
+#define ALLOC_THROW throw(std::bad_alloc)
+#endif
+
+void* operator new(size_t n) ALLOC_THROW
+{
+   thread_allocs++;
+   void* p = malloc(n ? n : 1);
+   if (p == NULL) { throw std::bad_alloc(); }
+   return p;
+}
+
+void* operator new[](size_t n) ALLOC_THROW
+{
+   return operator new(n);
+}
+
+void operator delete(void* p) throw()
+{
+   free(p);
+}
+
+void operator delete[](void* p) throw()
+{
+   free(p);
+}
+#endif
+
 
 // ------------------------------------------------------------------------
 // ------------------------------------------------------------------------
@@ -75,6 +133,19 @@ void TaskCoreIPP::prepare(swspect_settings_t* settings)
    ippStaticInit();
    std::ostream* log = settings->tlog;
 
+   /* Threads inside IPP: none by default, since the cores already run in parallel, or a
+    * team per core that cooperates on each FFT so that very large FFTs need fewer cores
+    * and less memory. The setting is global, all cores set the same value. */
+   ippSetNumThreads(settings->fft_threads);
+   if (rank == 0) {
+      int nthreads = 1;
+      ippGetNumThreads(&nthreads);
+      if (nthreads != settings->fft_threads) {
+         *log << "IPP runs " << nthreads << " instead of " << settings->fft_threads
+              << " threads per FFT, the IPP library may not be the multithreaded one" << endl;
+      }
+   }
+
    /* get a new raw data unpacker object */
    this->unpacker = DataUnpackerFactory::getDataUnpacker(settings);
    if (this->unpacker == NULL) {
@@ -82,19 +153,45 @@ void TaskCoreIPP::prepare(swspect_settings_t* settings)
        return;
    }
 
-   /* get settings and prepare buffers */
+   /* get settings */
    this->cfg                  = settings;
-   this->windowfct            = (Ipp32f*)memalign(128, sizeof(Ipp32f)*cfg->fft_points);
-   this->windowgct            = (Ipp32fc*)memalign(128, sizeof(Ipp32f)*cfg->fft_points*2);
-   this->unpacked_re          = (Ipp32f*)memalign(128, sizeof(Ipp32f)*cfg->fft_points);
-   this->fft_conj_reim        = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->fft_ssb_points);
-   this->pcal_rotatevec       = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->pcal_rotatorlen);
-   this->pcal_rotated         = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->pcal_rotatorlen);
+
+   /* FFT setup */
+   int fftWorkbufferSize = 0;
+   status = ippsDFTInitAlloc_R_32f(&fftSpecHandle, (int)cfg->fft_points, IPP_FFT_DIV_INV_BY_N, ippAlgHintFast);
+   if (status != ippStsNoErr) {
+      *log << "ippsDFT init failed: " << status << " " << ippGetStatusString(status) << endl;
+   }
+   ippsDFTGetBufSize_R_32f(fftSpecHandle, &fftWorkbufferSize);
+
+   /* per-buffer working state of doMaths() and the FFT buffers in one arena on the NUMA node
+    * of the core, so that no buffer touches the heap: first find the size by carving from a
+    * NULL arena, then allocate and carve for real */
    this->fft_result_reim      = new Ipp32fc*[cfg->num_sources];
    this->fft_powspec          = new Ipp32f*[cfg->num_sources];
-   for (int s=0; s<cfg->num_sources; s++) {
-      this->fft_result_reim[s]  = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->fft_ssb_points);
-      this->fft_powspec[s]      = (Ipp32f*) memalign(128, sizeof(Ipp32f) *cfg->fft_ssb_points);
+   for (int pass=0; pass<2; pass++) {
+      char* next = (pass == 0) ? NULL : this->arena;
+      this->unpacked_re   = (Ipp32f*)  arena_take(next, sizeof(Ipp32f)  * cfg->fft_points);
+      this->fft_conj_reim = (Ipp32fc*) arena_take(next, sizeof(Ipp32fc) * cfg->fft_ssb_points);
+      this->fftWorkbuffer = (Ipp8u*)   arena_take(next, fftWorkbufferSize);
+      for (int s=0; s<cfg->num_sources; s++) {
+         this->fft_result_reim[s] = (Ipp32fc*)arena_take(next, sizeof(Ipp32fc) * cfg->fft_ssb_points);
+         this->fft_powspec[s]     = (Ipp32f*) arena_take(next, sizeof(Ipp32f)  * cfg->fft_ssb_points);
+      }
+      this->src_pos       = (char**)   arena_take(next, sizeof(char*)   * cfg->num_sources);
+      this->out_auto      = (Ipp32f**) arena_take(next, sizeof(Ipp32f*) * cfg->num_sources);
+      this->out_on        = (Ipp32f**) arena_take(next, sizeof(Ipp32f*) * cfg->num_sources);
+      this->out_fold      = (Ipp32f**) arena_take(next, sizeof(Ipp32f*) * cfg->num_sources);
+      this->out_xpol      = (Ipp32fc**)arena_take(next, sizeof(Ipp32fc*)* std::max(cfg->num_xpols, 1));
+      this->out_pcal      = (Ipp32fc**)arena_take(next, sizeof(Ipp32fc*)* cfg->num_sources);
+      this->out_sk        = (Ipp32f**) arena_take(next, sizeof(Ipp32f*) * cfg->num_sources);
+      this->out_states    = (swsint64_t**)arena_take(next, sizeof(swsint64_t*) * cfg->num_sources);
+      this->out_tpow      = (Ipp32f**) arena_take(next, sizeof(Ipp32f*) * cfg->num_sources);
+      this->raw_remaining = (size_t*)  arena_take(next, sizeof(size_t)  * cfg->num_sources);
+      if (pass == 0) {
+         this->arena_buf = new Buffer(size_t(next), 0, cfg->core_numa_node[rank]);
+         this->arena     = arena_buf->getData();
+      }
    }
 
    this->num_ffts_accumulated   = 0;
@@ -102,36 +199,114 @@ void TaskCoreIPP::prepare(swspect_settings_t* settings)
    this->processing_stage       = STAGE_NONE;
    this->total_runtime          = 0.0;
    this->total_ffts             = 0;
+   this->blanked_ffts           = 0;
+   this->num_runs               = 0;
+   this->first_sample           = 0;
    this->buf_out                = NULL;
    this->bufxpol_out            = NULL;
+   this->bufcostas_out          = NULL;
+   this->out_costas             = NULL;
+   this->bufpeak_out            = NULL;
+   this->bufpeakwin_out         = NULL;
+   this->bufsk_out              = NULL;
+   this->bufstates_out          = NULL;
+   this->buftpow_out            = NULL;
+   this->bufon_out              = NULL;
+   this->buffold_out            = NULL;
+   this->fold_scale             = NULL;
+   this->fold_count             = NULL;
+
+   /* the window function and other read-only tables are shared with the cores on the same NUMA node */
+   this->tables    = SharedTables::acquire(cfg, cfg->core_numa_node[rank]);
+   this->windowfct = tables->getWindow();
+
+   /* prepare the sparse-bin evaluation */
+   this->sparse_reim = NULL;
+   if (!cfg->sparse_bins.empty()) {
+      int nb = cfg->sparse_bins.size();
+      this->sparse_reim = new Ipp32fc*[cfg->num_sources];
+      for (int s=0; s<cfg->num_sources; s++) {
+         this->sparse_reim[s] = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*nb);
+      }
+      this->goertzel_coeff = (Ipp64f*)memalign(128, sizeof(Ipp64f)*nb);
+      this->goertzel_cos   = (Ipp64f*)memalign(128, sizeof(Ipp64f)*nb);
+      this->goertzel_sin   = (Ipp64f*)memalign(128, sizeof(Ipp64f)*nb);
+      this->goertzel_s1    = (Ipp64f*)memalign(128, sizeof(Ipp64f)*nb);
+      this->goertzel_s2    = (Ipp64f*)memalign(128, sizeof(Ipp64f)*nb);
+      for (int k=0; k<nb; k++) {
+         double w = 2*M_PI * double(cfg->sparse_bins[k]) / double(cfg->fft_points);
+         goertzel_cos[k]   = cos(w);
+         goertzel_sin[k]   = sin(w);
+         goertzel_coeff[k] = 2.0 * goertzel_cos[k];
+      }
+   }
 
-   /* precompute the windowing function */
-   generate_windowfunction(windowfct, cfg->wf_type, cfg->fft_points);
+   /* prepare the carrier downconversion for the tracking loop */
+   if (cfg->costas_loop) {
+      this->out_costas    = new Ipp32fc*[cfg->num_sources];
+      this->bufcostas_out = cfg->outbuffersCostas[rank];
+   }
 
-   /* precompute the windowing function for the Costas loop */
-   generate_costaswindow(windowgct, cfg->samplingfreq, cfg->fft_points);
+   /* spectral peaks go to own per-core buffers */
+   if (cfg->peak_detect) {
+      this->bufpeak_out    = cfg->outbuffersPeak[rank];
+      this->bufpeakwin_out = cfg->outbuffersPeakWin[rank];
+   }
 
-   /* FFT setup */
-   int fftWorkbufferSize = 0;
-   status = ippsDFTInitAlloc_R_32f(&fftSpecHandle, (int)cfg->fft_points, IPP_FFT_DIV_INV_BY_N, ippAlgHintFast);
-   if (status != ippStsNoErr) {
-      *log << "ippsDFT init failed: " << status << " " << ippGetStatusString(status) << endl;
+   /* sampler statistics go to own per-core buffers */
+   if (cfg->sampler_stats) {
+      this->bufstates_out = cfg->outbuffersStates[rank];
+   }
+   if (cfg->tpow_rate_hz > 0) {
+      this->buftpow_out = cfg->outbuffersTPow[rank];
+   }
+
+   /* spectral kurtosis sums go to own per-core buffers */
+   if (cfg->spectral_kurtosis) {
+      this->bufsk_out = cfg->outbuffersSK[rank];
+   }
+
+   /* with switching, the ON-state spectra go to own per-core buffers and the normal ones keep the OFF state */
+   if (cfg->switch_period_s > 0) {
+      this->bufon_out = cfg->outbuffersOn[rank];
+   }
+
+   /* folded spectra go to own per-core buffers, the per-bin normalization is prepared here */
+   if (cfg->fold_bins > 0) {
+      this->buffold_out = cfg->outbuffersFold[rank];
+      this->fold_scale  = (Ipp32f*)memalign(128, sizeof(Ipp32f)*cfg->fold_bins);
+      this->fold_count  = (int*)memalign(128, sizeof(int)*cfg->fold_bins);
    }
-   ippsDFTGetBufSize_R_32f(fftSpecHandle, &fftWorkbufferSize);
-   fftWorkbuffer = (Ipp8u*)memalign(128, fftWorkbufferSize);
 
    /* prepare the fixed scale/normalization factor for the integrated spectrum */
-   spectrum_scale_Re = Ipp32f(1.0/cfg->core_overlapped_ffts);
+   spectrum_scale_Re = Ipp32f(1.0/cfg->averaged_overlapped_ffts);
    spectrum_scale_ReIm.re = spectrum_scale_Re;
    spectrum_scale_ReIm.im = 0.0;
 
-   /* prepare the detection of phase calibration tones */
-   if (cfg->extract_PCal) {
-      double dphi = 2*M_PI * (-cfg->pcaloffsethz/cfg->samplingfreq);
-      for (int i=0; i<(cfg->pcal_rotatorlen); i++) {
-         double arg = dphi * double(i);
-         this->pcal_rotatevec[i].re = Ipp32f(cos(arg));
-         this->pcal_rotatevec[i].im = Ipp32f(sin(arg));
+   /* prepare the detection of phase calibration tones, in the time domain or from the FFT bins */
+   this->pcal         = NULL;
+   this->pcal_fft_acc = NULL;
+   this->pcal_fft_tmp = NULL;
+   if (cfg->extract_PCal && cfg->pcal_from_fft) {
+      this->pcal_fft_acc = new Ipp32fc*[cfg->num_sources];
+      for (int s=0; s<cfg->num_sources; s++) {
+         this->pcal_fft_acc[s] = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->pcal_tonebins);
+      }
+      this->pcal_fft_tmp = (Ipp32fc*)memalign(128, sizeof(Ipp32fc)*cfg->pcal_tonebins);
+      /* an on-bin tone of the windowed FFT has gain sum(w) instead of fft_points */
+      double wsum = 0.0;
+      for (size_t i=0; i<cfg->fft_points; i++) {
+         wsum += windowfct[i];
+      }
+      this->pcal_fft_scale.re = Ipp32f(double(cfg->fft_points) / (wsum * cfg->pcal_nbins));
+      this->pcal_fft_scale.im = 0.0;
+   } else if (cfg->extract_PCal) {
+      this->pcal = new PCal*[cfg->num_sources];
+      for (int s=0; s<cfg->num_sources; s++) {
+         this->pcal[s] = PCal::getNew(0.5*cfg->samplingfreq, cfg->pcalharmonicshz, int(cfg->pcaloffsethz), 0);
+      }
+      if (rank == 0) {
+         *log << "PCal extraction uses the " << (pcal[0]->usesSimdKernels() ? "SIMD" : "IPP") << " kernels" << endl;
       }
    }
 
@@ -141,6 +316,20 @@ void TaskCoreIPP::prepare(swspect_settings_t* settings)
    pthread_mutex_lock(&mmutex);
    pthread_create(&wthread, NULL, taskcoreipp_worker, (void*)this);
 
+   /* pin the worker thread to the CPU set of this core, near its buffers */
+   if (!cfg->core_cpu_first.empty()) {
+      size_t r = rank % cfg->core_cpu_first.size();
+      cpu_set_t cpus;
+      CPU_ZERO(&cpus);
+      for (int cpu=cfg->core_cpu_first[r]; cpu<=cfg->core_cpu_last[r]; cpu++) {
+         CPU_SET(cpu, &cpus);
+      }
+      if (pthread_setaffinity_np(wthread, sizeof(cpu_set_t), &cpus) != 0) {
+         *log << "IPP core " << rank << " could not be pinned to CPUs "
+              << cfg->core_cpu_first[r] << "-" << cfg->core_cpu_last[r] << endl;
+      }
+   }
+
    return;
 }
 
@@ -161,6 +350,10 @@ int TaskCoreIPP::run(Buffer** inbuf, Buffer** outbuf, Buffer** xpolbuf, Buffer**
    this->bufpcal_out            = pcalbuf;
    this->processing_stage       = STAGE_RAWDATA;
    this->num_spectra_calculated = 0;
+
+   /* cores get raw buffers in round-robin order, all of them full except at EOF */
+   this->first_sample = Helpers::chunk_first_hop(cfg, swsint64_t(num_runs)*cfg->num_cores + rank) * cfg->fft_overlap_points;
+   this->num_runs++;
    pthread_mutex_unlock(&mmutex);
    return 0;
 }
@@ -204,24 +397,52 @@ int TaskCoreIPP::finalize()
    *log << "IPP core " << rank << " completed: " 
         << total_runtime << "s total internal calculation time, " 
         << total_ffts << " FFTs" << endl << flush; 
+   if (cfg->switch_period_s > 0) {
+      *log << "IPP core " << rank << " left out " << blanked_ffts << " of these FFTs, they spanned a switching transition" << endl;
+   }
 
    ippsDFTFree_R_32f(fftSpecHandle);
-   free(fftWorkbuffer);
 
-   free(windowfct);
-   free(windowgct);
-   free(unpacked_re);
-   free(fft_conj_reim);
+   delete arena_buf;
+   SharedTables::release(tables);
 
-   for (int s=0; s<cfg->num_sources; s++) {
-      free(fft_result_reim[s]);
-      free(fft_powspec[s]);
+   delete[] fft_result_reim;
+   delete[] fft_powspec;
+
+   if (pcal != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         delete pcal[s];
+      }
+      delete[] pcal;
+   }
+   if (pcal_fft_acc != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         free(pcal_fft_acc[s]);
+      }
+      delete[] pcal_fft_acc;
+      free(pcal_fft_tmp);
+   }
+
+   if (cfg->costas_loop) {
+      delete[] out_costas;
+   }
+
+   if (cfg->fold_bins > 0) {
+      free(fold_scale);
+      free(fold_count);
    }
-   delete fft_result_reim;
-   delete fft_powspec;
 
-   free(pcal_rotatevec);
-   free(pcal_rotated);
+   if (!cfg->sparse_bins.empty()) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         free(sparse_reim[s]);
+      }
+      delete[] sparse_reim;
+      free(goertzel_coeff);
+      free(goertzel_cos);
+      free(goertzel_sin);
+      free(goertzel_s1);
+      free(goertzel_s2);
+   }
 
    return 0; 
 }
@@ -253,6 +474,7 @@ void* taskcoreipp_worker(void* p)
       /* do the maths */
       if (host->processing_stage == STAGE_RAWDATA) {
           host->doMaths(); 
+          host->reduceResults();
           host->processing_stage = STAGE_FFTDONE;
       }
 
@@ -287,9 +509,130 @@ void TaskCoreIPP::reset_spectrum()
          resetBuffer(this->bufpcal_out[s]);
       }
    }
+   if (this->bufsk_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         resetBuffer(this->bufsk_out[s]);
+      }
+   }
+   if (this->bufstates_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         resetBuffer(this->bufstates_out[s]);
+      }
+   }
+   if (this->bufon_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         resetBuffer(this->bufon_out[s]);
+      }
+   }
+   if (this->buffold_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         resetBuffer(this->buffold_out[s]);
+      }
+   }
    this->num_ffts_accumulated = 0;
 }
 
+/**
+ * Get the part [lo,hi) of a vector of n floats that one core works on.
+ * Parts start on 64-byte boundaries.
+ */
+static void core_share(size_t n, int rank, int ncores, size_t& lo, size_t& hi)
+{
+   size_t per = ((n + ncores - 1) / ncores + 15) & ~size_t(15);
+   lo = std::min(n, rank * per);
+   hi = std::min(n, lo + per);
+}
+
+/**
+ * Sum this core's share of the bins of the sub-spectra from all cores into the
+ * assembled spectra, and finish this core's share of the sinks of the spectra that
+ * were completed. Call only from worker thread, all cores take part.
+ */
+void TaskCoreIPP::reduceResults()
+{
+   if (cfg->max_buffers_per_spectrum <= 1) {
+      return;
+   }
+
+   /* wait until the sub-spectra of all cores are complete */
+   pthread_barrier_wait(cfg->reduce_barrier);
+
+   /* add the sub-spectra in core order, each core to the ring slot of its own spectrum */
+   const int ncores = cfg->num_cores;
+   size_t lo_a, hi_a, lo_x, hi_x, lo_p, hi_p, lo_k, hi_k, lo_q, hi_q, lo_f, hi_f;
+   core_share(cfg->out_points, rank, ncores, lo_a, hi_a);
+   core_share(size_t(cfg->fold_bins)*cfg->out_points, rank, ncores, lo_f, hi_f);
+   core_share(2*cfg->out_points, rank, ncores, lo_k, hi_k);
+   core_share(cfg->sampler_states, rank, ncores, lo_q, hi_q);
+   core_share(2*cfg->out_points, rank, ncores, lo_x, hi_x);
+   core_share(2*cfg->pcal_tonebins, rank, ncores, lo_p, hi_p);
+   for (int c=0; c<ncores; c++) {
+      swsint64_t chunk = swsint64_t(num_runs - 1) * ncores + c;
+      int slot = int((chunk / cfg->max_buffers_per_spectrum) % cfg->combined_slots);
+      Buffer** spectra = cfg->combinedSpectra[slot];
+      Buffer** pcals   = cfg->combinedPCal[slot];
+      Buffer** sksums  = cfg->spectral_kurtosis ? cfg->combinedSK[slot] : NULL;
+      Buffer** states  = cfg->sampler_stats ? cfg->combinedStates[slot] : NULL;
+      Buffer** onspectra = (cfg->switch_period_s > 0) ? cfg->combinedOn[slot] : NULL;
+      Buffer** folded  = (cfg->fold_bins > 0) ? cfg->combinedFold[slot] : NULL;
+      for (int s=0; s<cfg->num_sources; s++) {
+         if (hi_a > lo_a) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffers[c][s]->getData()) + lo_a,
+                           ((Ipp32f*)spectra[s]->getData()) + lo_a, hi_a - lo_a );
+         }
+         if ((onspectra != NULL) && (hi_a > lo_a)) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffersOn[c][s]->getData()) + lo_a,
+                           ((Ipp32f*)onspectra[s]->getData()) + lo_a, hi_a - lo_a );
+         }
+         if ((folded != NULL) && (hi_f > lo_f)) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffersFold[c][s]->getData()) + lo_f,
+                           ((Ipp32f*)folded[s]->getData()) + lo_f, hi_f - lo_f );
+         }
+      }
+      for (int x=0; x<cfg->num_xpols; x++) {
+         if (hi_x > lo_x) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffersXpol[c][x]->getData()) + lo_x,
+                           ((Ipp32f*)spectra[cfg->num_sources + x]->getData()) + lo_x, hi_x - lo_x );
+         }
+      }
+      if (cfg->extract_PCal && (hi_p > lo_p)) {
+         for (int s=0; s<cfg->num_sources; s++) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffersPCal[c][s]->getData()) + lo_p,
+                           ((Ipp32f*)pcals[s]->getData()) + lo_p, hi_p - lo_p );
+         }
+      }
+      if ((sksums != NULL) && (hi_k > lo_k)) {
+         for (int s=0; s<cfg->num_sources; s++) {
+            ippsAdd_32f_I( ((Ipp32f*)cfg->outbuffersSK[c][s]->getData()) + lo_k,
+                           ((Ipp32f*)sksums[s]->getData()) + lo_k, hi_k - lo_k );
+         }
+      }
+      if ((states != NULL) && (hi_q > lo_q)) {
+         for (int s=0; s<cfg->num_sources; s++) {
+            swsint64_t const* src = (swsint64_t const*)cfg->outbuffersStates[c][s]->getData();
+            swsint64_t*       dst = (swsint64_t*)states[s]->getData();
+            for (size_t q=lo_q; q<hi_q; q++) {
+               dst[q] += src[q];
+            }
+         }
+      }
+   }
+
+   /* once all bins are in, each core takes whole sinks and assembles their records in
+    * core order, then finishes the spectra of this round that got their last chunk */
+   pthread_barrier_wait(cfg->reduce_barrier);
+   for (int sk=rank; sk<cfg->num_sinks; sk+=ncores) {
+      for (int c=0; c<ncores; c++) {
+         swsint64_t chunk = swsint64_t(num_runs - 1) * ncores + c;
+         int slot = int((chunk / cfg->max_buffers_per_spectrum) % cfg->combined_slots);
+         assembleRecords(cfg, c, slot, sk);
+         if ((chunk % cfg->max_buffers_per_spectrum) == swsint64_t(cfg->max_buffers_per_spectrum - 1)) {
+            finishSpectrum(cfg, slot, sk);
+         }
+      }
+   }
+}
+
 /**
  * Reset buffer to 0.0 floats
  * @param buf     Buffer to reset
@@ -297,9 +640,81 @@ void TaskCoreIPP::reset_spectrum()
 void TaskCoreIPP::resetBuffer(Buffer* buf) 
 {
    ippsZero_32f((Ipp32f*) buf->getData(), buf->getAllocated() / sizeof(Ipp32f));
+   buf->getRecords().clear();
 }
 
 
+/**
+ * Find the strongest peak in the search band of a complete integrated spectrum.
+ * @param spectrum Power spectrum with all computed points
+ * @param peak     Output peak record
+ * @param window   Output for the points around the peak, or NULL
+ */
+void TaskCoreIPP::detectPeak(swsfloat_t const* spectrum, swspeak_t* peak, swsfloat_t* window)
+{
+   bool sparse = !cfg->sparse_bins.empty();
+   int  lo     = cfg->peak_first_point;
+   int  hi     = cfg->peak_last_point;
+   int  n      = hi - lo + 1;
+
+   /* strongest point in the search band */
+   Ipp32f pmax;
+   int    imax;
+   ippsMaxIndx_32f(spectrum + lo, n, &pmax, &imax);
+   imax += lo;
+   int bin = sparse ? cfg->sparse_bins[imax] : imax;
+
+   /* noise statistics of the search band, leaving out the points next to the peak */
+   int    xlo = std::max(lo, imax - PEAK_EXCLUDE_POINTS);
+   int    xhi = std::min(hi, imax + PEAK_EXCLUDE_POINTS);
+   int    m   = n - (xhi - xlo + 1);
+   Ipp32f sum, xsum;
+   Ipp64f sum2, xsum2;
+   ippsSum_32f(spectrum + lo, n, &sum, ippAlgHintAccurate);
+   ippsDotProd_32f64f(spectrum + lo, spectrum + lo, n, &sum2);
+   ippsSum_32f(spectrum + xlo, xhi - xlo + 1, &xsum, ippAlgHintAccurate);
+   ippsDotProd_32f64f(spectrum + xlo, spectrum + xlo, xhi - xlo + 1, &xsum2);
+   double mean = 0.0, var = 0.0;
+   if (m > 0) {
+      mean = double(sum - xsum) / m;
+      var  = std::max(0.0, (sum2 - xsum2) / m - mean*mean);
+   }
+
+   /* sub-bin interpolation through the peak and its two neighbouring FFT bins */
+   double delta = 0.0;
+   double ppk   = pmax;
+   if ((imax > 0) && (imax < cfg->out_points-1)) {
+      bool adjacent = !sparse || ((cfg->sparse_bins[imax-1] == bin-1) && (cfg->sparse_bins[imax+1] == bin+1));
+      double a = spectrum[imax-1], b = pmax, c = spectrum[imax+1];
+      if (cfg->peak_gaussian) {
+         adjacent = adjacent && (a > 0) && (b > 0) && (c > 0);
+         if (adjacent) { a = log(a); b = log(b); c = log(c); }
+      }
+      double denom = a - 2*b + c;
+      if (adjacent && (denom < 0.0)) {
+         delta = 0.5 * (a - c) / denom;
+         ppk   = b - 0.25 * (a - c) * delta;
+         if (cfg->peak_gaussian) { ppk = exp(ppk); }
+      }
+   }
+
+   peak->freq       = (bin + delta) * cfg->df;
+   peak->bin        = swsfloat_t(bin + delta);
+   peak->power      = swsfloat_t(ppk);
+   peak->noise      = swsfloat_t(mean);
+   peak->noise_rms  = swsfloat_t(sqrt(var));
+   peak->snr        = (var > 0.0) ? swsfloat_t((ppk - mean) / sqrt(var)) : 0.0f;
+   peak->window_bin = -1;
+
+   /* copy out the window around the peak, shifted to stay inside the spectrum */
+   if ((window != NULL) && (cfg->peak_window_points > 0)) {
+      int first = imax - cfg->peak_window_bins;
+      first = std::max(0, std::min(first, cfg->out_points - cfg->peak_window_points));
+      ippsCopy_32f(spectrum + first, window, cfg->peak_window_points);
+      peak->window_bin = sparse ? cfg->sparse_bins[first] : first;
+   }
+}
+
 /**
  * Sum own spectral data to the provided output buffer.
  * @return int     Returns 0
@@ -320,8 +735,8 @@ int TaskCoreIPP::combineResults(Buffer** outbuf, Buffer** pcalbuf)
    for (int s=0; s<cfg->num_sources; s++) {
       ippsAdd_32f_I( (Ipp32f*)buf_out[s]->getData(),
                      (Ipp32f*)outbuf[s]->getData(),
-                      cfg->fft_ssb_points );
-      outbuf[s]->setLength(sizeof(Ipp32f)*cfg->fft_ssb_points);
+                      cfg->out_points );
+      outbuf[s]->setLength(cfg->fft_bytes_ssb);
    }
 
    /* add cross-correlation data to the common result set */
@@ -329,11 +744,12 @@ int TaskCoreIPP::combineResults(Buffer** outbuf, Buffer** pcalbuf)
       int xo = x + cfg->num_sources;
       ippsAdd_32fc_I( (Ipp32fc*)bufxpol_out[x]->getData(), 
                       (Ipp32fc*)outbuf[xo]->getData(), 
-                      cfg->fft_ssb_points );
-      outbuf[xo]->setLength(sizeof(Ipp32f)*cfg->fft_ssb_points);
+                      cfg->out_points );
+      outbuf[xo]->setLength(cfg->fft_bytes_xpol);
    }
 
-   /* add phasecal results to the common result set */
+   /* add phasecal results to the common result set, all cores extract with a phase
+    * reference at absolute sample 0 and the partial tone vectors are already aligned */
    if (cfg->extract_PCal) {
       for (int s=0; s<cfg->num_sources; s++) {
           ippsAdd_32fc_I( (Ipp32fc*)bufpcal_out[s]->getData(),
@@ -356,35 +772,81 @@ void TaskCoreIPP::doMaths()
 {
    double times[4];
    int curr_ffts = 0;
+   int num_peaks = 0;
+   bool sparse   = !cfg->sparse_bins.empty();
+   bool complete = (cfg->max_buffers_per_spectrum <= 1);
    std::ostream* log = cfg->tlog;
+   char** src = src_pos;
+#ifdef DEBUG_ALLOC_CHECK
+   long allocs_before = thread_allocs;
+#endif
 
-   Ipp32f** channels; 
-   channels = new Ipp32f*[1]; 
-   channels[0] = unpacked_re;
-
-   /* get tidier input and output buffer pointers for "ptr++" advancing */
-   char**    src      = new char*   [cfg->num_sources];
-   Ipp32f**  out_auto = new Ipp32f* [cfg->num_sources];
-   Ipp32fc** out_xpol = new Ipp32fc*[cfg->num_xpols];
-   Ipp32fc** out_pcal = new Ipp32fc*[cfg->num_sources];
-
-   size_t*   raw_remaining = new size_t[cfg->num_sources];
+   /* get tidier input and output buffer pointers for "ptr++" advancing,
+    * the data starts with the tail of the preceding raw buffer, carried into the head room */
    for (int s=0; s<cfg->num_sources; s++) {
-      src[s]           = buf_in[s]->getData();
+      src[s]           = buf_in[s]->getData() - cfg->raw_carry_bytes;
       out_auto[s]      = (Ipp32f*) (buf_out[s]->getData());
       out_pcal[s]      = (Ipp32fc*)(bufpcal_out[s]->getData());
-      raw_remaining[s] = buf_in[s]->getLength();
+      raw_remaining[s] = buf_in[s]->getLength() + cfg->raw_carry_bytes;
    }
    for (int x=0; x<cfg->num_xpols; x++) {
       out_xpol[x]      = (Ipp32fc*)(bufxpol_out[x]->getData());
    }
+   if (bufsk_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_sk[s]     = (Ipp32f*)(bufsk_out[s]->getData());
+      }
+   }
+   if (bufstates_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_states[s] = (swsint64_t*)(bufstates_out[s]->getData());
+      }
+   }
+   if (bufon_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_on[s]     = (Ipp32f*)(bufon_out[s]->getData());
+      }
+   }
+   if (buffold_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_fold[s]   = (Ipp32f*)(buffold_out[s]->getData());
+      }
+   }
+   if (buftpow_out != NULL) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_tpow[s]   = (Ipp32f*)(buftpow_out[s]->getData());
+      }
+   }
+   if (cfg->costas_loop) {
+      for (int s=0; s<cfg->num_sources; s++) {
+         out_costas[s] = (Ipp32fc*)(bufcostas_out[s]->getData());
+      }
+   }
    size_t min_raw_remaining = raw_remaining[0];
    for (int s=0; s<cfg->num_sources; s++) {
       min_raw_remaining = std::min(min_raw_remaining, raw_remaining[s]);
    }
 
+   /* overlapped FFTs are numbered continuously over all buffers, the first one here
+    * starts in the carried data; each spectrum has hops_per_spectrum FFT positions
+    * of which the last ones would reach into the next spectrum and are skipped */
+   const long long hops_per_spectrum = (long long)(cfg->fft_overlap_factor) * cfg->averaged_ffts;
+   long long hop = (long long)(first_sample / cfg->fft_overlap_points) - (cfg->fft_overlap_factor - 1);
+   long long spectrum_hop = 0;
+
    /* clear our old results */
    reset_spectrum();
+   reset_PCal();
+
+   /* one record per spectrum with its start time, and the FFTs and valid samples integrated */
+   const bufrecord_t no_record = { -1.0, 0, 0, false };
+   const size_t max_records = complete ? size_t(cfg->max_spectra_per_buffer + 1) : 1;
+   for (int s=0; s<cfg->num_sources; s++) {
+      buf_out[s]->getRecords().assign(max_records, no_record);
+      if (bufon_out != NULL) {
+         bufon_out[s]->getRecords().assign(max_records, no_record);
+      }
+   }
 
    /* start performance timing */
    times[1] = 0.0; times[2] = 0.0; times[3] = 0.0;
@@ -395,11 +857,53 @@ void TaskCoreIPP::doMaths()
 
       IppStatus status;
 
+      /* skip the FFTs that cross a spectrum boundary or start before the first sample */
+      int  pos = int(hop % hops_per_spectrum);
+      if ((hop < 0) || (pos >= cfg->averaged_overlapped_ffts)) {
+         for (int rs=0; rs<cfg->num_sources; rs++) {
+            src[rs] += cfg->raw_overlap_bytes;
+         }
+         min_raw_remaining -= cfg->raw_overlap_bytes;
+         hop++;
+         continue;
+      }
+      bool nonoverlapped = ((pos % cfg->fft_overlap_factor) == 0);
+      spectrum_hop = hop - pos;
+
+      /* the part of the switching cycle this FFT falls into, all FFTs are OFF without switching */
+      SwitchState state = switch_state(hop * cfg->fft_overlap_points);
+
+      /* the phase bin of the folding this FFT is added to */
+      int fbin = (buffold_out != NULL) ? fold_bin(hop * cfg->fft_overlap_points) : 0;
+
       times[2] = Helpers::getSysSeconds();
 
       /* windowed FFT for every source */
       for (int rs=0; rs<(cfg->num_sources); rs++) {
 
+         /* absolute index of the first sample of this FFT */
+         swsint64_t sample = hop * cfg->fft_overlap_points;
+
+         /* the spectrum starts with the time of its first FFT, its non-overlapped FFTs count the samples */
+         if ((pos == 0) || (nonoverlapped && (state != SwitchBlank))) {
+            double t;
+            bool   valid = sample_time(buf_in[rs], sample, t);
+            size_t rec   = complete ? size_t(num_spectra_calculated) : 0;
+            if (pos == 0) {
+               buf_out[rs]->getRecords()[rec].time_s = t;
+               if (bufon_out != NULL) {
+                  bufon_out[rs]->getRecords()[rec].time_s = t;
+               }
+            }
+            if (nonoverlapped && (state != SwitchBlank)) {
+               bufrecord_t& r = ((state == SwitchOn) ? bufon_out[rs] : buf_out[rs])->getRecords()[rec];
+               r.ffts++;
+               if (valid) {
+                  r.valid_samples += cfg->fft_points;
+               }
+            }
+         }
+
          /* unpack the samples */
          if (rs == 0) {
              unpacker->extract_samples(src[rs], unpacked_re, cfg->fft_points, cfg->use_channel_file1);
@@ -407,44 +911,108 @@ void TaskCoreIPP::doMaths()
              unpacker->extract_samples(src[rs], unpacked_re, cfg->fft_points, cfg->use_channel_file2);
          }
 
+         /* downconvert the carrier for the tracking loop from non-overlapped input data sets */
+         if (cfg->costas_loop && nonoverlapped) {
+            downconvert_carrier(unpacked_re, out_costas[rs], sample);
+            out_costas[rs] += cfg->costas_blocks_per_fft;
+         }
+
+         /* sampler statistics from the non-overlapped input data sets, every sample is counted once */
+         if ((bufstates_out != NULL) && nonoverlapped) {
+            DataUnpacker::count_states(unpacked_re, cfg->fft_points, cfg->bits_per_sample, out_states[rs]);
+         }
+         if ((buftpow_out != NULL) && nonoverlapped) {
+            for (int b=0; b<cfg->tpow_blocks_per_fft; b++) {
+               Ipp64f p;
+               Ipp32f const* block = unpacked_re + b*cfg->tpow_block_len;
+               ippsDotProd_32f64f(block, block, cfg->tpow_block_len, &p);
+               out_tpow[rs][b] = Ipp32f(p);
+            }
+            out_tpow[rs] += cfg->tpow_blocks_per_fft;
+         }
+
          /* advance the data but keep some overlap */
          src[rs] += cfg->raw_overlap_bytes;
 
-         /* detect phase calibration tones on non-overlapped input data sets */
-         if (cfg->extract_PCal) {
-            if ((curr_ffts % cfg->fft_overlap_factor) == 0) {
-                 extract_PCal(unpacked_re, out_pcal[rs], cfg->fft_points);
-            }
+         /* detect phase calibration tones on non-overlapped input data sets, these are contiguous;
+          * the phase is referenced to the absolute sample index so that partial results from
+          * several cores and buffers line up and can simply be summed in combineResults()
+          */
+         if (cfg->extract_PCal && !cfg->pcal_from_fft && nonoverlapped) {
+            pcal[rs]->adjustSampleOffset(size_t(sample % cfg->pcal_rotatorlen));
+            pcal[rs]->extractAndIntegrate(unpacked_re, cfg->fft_points);
          }
-          /* Costas loop */
-          if (cfg->costas_loop) {
-          //    status = ippsMul_32fc(windowgct, unpacked_re, cfg->fft_points);
-          }
-         // ippsReal_32fc(unpacked_re, output, points);
-         // ippsSqr_32f(temput,output,points);
 
          /* window the data */
          status = ippsMul_32f_I(windowfct, unpacked_re, cfg->fft_points);
 
          /* FFT */
-         status = ippsDFTFwd_RToPerm_32f(unpacked_re, (Ipp32f*)fft_result_reim[rs], fftSpecHandle, fftWorkbuffer);
-         if(status != ippStsNoErr) {
-            *log << "ippsDFT compute error: " << status << " " << ippGetStatusString(status) << endl;
+         if (!sparse || !cfg->sparse_goertzel) {
+            status = ippsDFTFwd_RToPerm_32f(unpacked_re, (Ipp32f*)fft_result_reim[rs], fftSpecHandle, fftWorkbuffer);
+            if(status != ippStsNoErr) {
+               *log << "ippsDFT compute error: " << status << " " << ippGetStatusString(status) << endl;
+            }
          }
          total_ffts++;
+
+         /* or pick the phase calibration tones out of the same non-overlapped FFTs */
+         if (cfg->extract_PCal && cfg->pcal_from_fft && nonoverlapped) {
+            extract_PCal_fft(fft_result_reim[rs], pcal_fft_acc[rs], sample);
+         }
          curr_ffts++;
 
+         /* FFTs across a switching transition are left out of the spectra */
+         if (state == SwitchBlank) {
+            blanked_ffts++;
+            continue;
+         }
+         Ipp32f* acc = (state == SwitchOn) ? out_on[rs] : out_auto[rs];
+
+         /* sparse bins: evaluate or pick the selected bins, then accumulate their power */
+         if (sparse) {
+            if (cfg->sparse_goertzel) {
+               goertzel_bank(unpacked_re, sparse_reim[rs]);
+            } else {
+               gather_sparse_bins(fft_result_reim[rs], sparse_reim[rs]);
+            }
+            status = ippsPowerSpectr_32fc(sparse_reim[rs], fft_powspec[rs], cfg->out_points);
+            status = ippsAdd_32f_I(fft_powspec[rs], acc, cfg->out_points);
+            if ((bufsk_out != NULL) && nonoverlapped) {
+               status = ippsAdd_32f_I(fft_powspec[rs], out_sk[rs], cfg->out_points);
+               status = ippsAddProduct_32f(fft_powspec[rs], fft_powspec[rs], out_sk[rs] + cfg->out_points, cfg->out_points);
+            }
+            if (buffold_out != NULL) {
+               status = ippsAdd_32f_I(fft_powspec[rs], out_fold[rs] + fbin*cfg->out_points, cfg->out_points);
+            }
+            continue;
+         }
+
          /* autocorrelate */
          Ipp32f re0  = fft_result_reim[rs][0].re; // DC
          Ipp32f reN2 = fft_result_reim[rs][0].im; // Packed Nyquist
          status = ippsPowerSpectr_32fc((Ipp32fc*)fft_result_reim[rs], fft_powspec[rs], cfg->fft_ssb_points-1);
 
          /* accumulate, take DC and Nyquist into account separately */
-         Ipp32f accRe0  = out_auto[rs][0]                     + re0*re0;
-         Ipp32f accReN2 = out_auto[rs][cfg->fft_ssb_points-1] + reN2*reN2;
-         status = ippsAdd_32f_I(fft_powspec[rs], out_auto[rs], cfg->fft_ssb_points-1);
-         out_auto[rs][0] = accRe0;
-         out_auto[rs][cfg->fft_ssb_points-1] = accReN2;
+         Ipp32f accRe0  = acc[0]                     + re0*re0;
+         Ipp32f accReN2 = acc[cfg->fft_ssb_points-1] + reN2*reN2;
+         status = ippsAdd_32f_I(fft_powspec[rs], acc, cfg->fft_ssb_points-1);
+         acc[0] = accRe0;
+         acc[cfg->fft_ssb_points-1] = accReN2;
+
+         /* the power of this FFT including DC and Nyquist, for the products below */
+         fft_powspec[rs][0] = re0*re0;
+         fft_powspec[rs][cfg->fft_ssb_points-1] = reN2*reN2;
+
+         /* spectral kurtosis: sum of the power and of its square over the independent, non-overlapped FFTs */
+         if ((bufsk_out != NULL) && nonoverlapped) {
+            status = ippsAdd_32f_I(fft_powspec[rs], out_sk[rs], cfg->fft_ssb_points);
+            status = ippsAddProduct_32f(fft_powspec[rs], fft_powspec[rs], out_sk[rs] + cfg->fft_ssb_points, cfg->fft_ssb_points);
+         }
+
+         /* folding: the spectrum of the phase bin of this FFT */
+         if (buffold_out != NULL) {
+            status = ippsAdd_32f_I(fft_powspec[rs], out_fold[rs] + fbin*cfg->fft_ssb_points, cfg->fft_ssb_points);
+         }
 
       }// all sources
 
@@ -453,9 +1021,9 @@ void TaskCoreIPP::doMaths()
       /* raw_overlap_bytes taken from all sources */
       min_raw_remaining -= cfg->raw_overlap_bytes;
 
-      /* accumulate cross-spectrum between all sources */
+      /* accumulate cross-spectrum between all sources, with switching only in the OFF state */
       int xp_i=0;
-      for (int xp=0; xp<cfg->num_xpols; xp++) {
+      for (int xp=0; (xp<cfg->num_xpols) && (state == SwitchOff); xp++) {
 
          /* get the next source-source pair, ignore permutations e.g. {0,1}=={1,0} */
          int xp_j = xp_i + 1;
@@ -464,6 +1032,13 @@ void TaskCoreIPP::doMaths()
          }
          // cerr << " xpol pair {"<<xp_i<<","<<xp_j<<"} " << endl << flush;
 
+         /* sparse bins are plain complex values without packed DC and Nyquist */
+         if (sparse) {
+            status = ippsConj_32fc(sparse_reim[xp_j], fft_conj_reim, cfg->out_points);
+            status = ippsAddProduct_32fc(sparse_reim[xp_i], fft_conj_reim, out_xpol[xp], cfg->out_points);
+            continue;
+         }
+
          /* get DC and Nyquist */
          Ipp32f re0_srcI  = fft_result_reim[xp_i][0].re; // DC
          Ipp32f reN2_srcI = fft_result_reim[xp_i][0].im; // Packed Nyquist
@@ -486,28 +1061,59 @@ void TaskCoreIPP::doMaths()
 
       }
 
-      /* when enough overlapped FFTs have been integrated, store the results */
+      /* when the last overlapped FFT of a spectrum has been integrated, store the results */
       num_ffts_accumulated++; // per source
-      if (num_ffts_accumulated >= cfg->core_overlapped_ffts) {
+      hop++;
+      if (complete && (pos == cfg->averaged_overlapped_ffts - 1)) {
+         Ipp32f  scale_off = spectrum_scale_Re, scale_on = 0.0f;
+         if (bufon_out != NULL) {
+            switch_scales(spectrum_hop, scale_off, scale_on);
+         }
+         Ipp32fc scale_xpol = { scale_off, 0.0f };
+         if (buffold_out != NULL) {
+            fold_scales(spectrum_hop);
+         }
          for (int rs=0; rs<cfg->num_sources; rs++) {
-            status = ippsMulC_32f_I(spectrum_scale_Re, out_auto[rs], cfg->fft_ssb_points);
-            out_auto[rs] += cfg->fft_ssb_points;
+            status = ippsMulC_32f_I(scale_off, out_auto[rs], cfg->out_points);
+            if (cfg->peak_detect) {
+               swspeak_t* peak = ((swspeak_t*)bufpeak_out[rs]->getData()) + num_peaks;
+               Ipp32f*    win  = ((Ipp32f*)bufpeakwin_out[rs]->getData()) + num_peaks*cfg->peak_window_points;
+               detectPeak(out_auto[rs], peak, (cfg->peak_window_points > 0) ? win : NULL);
+            }
+            out_auto[rs] += cfg->out_points;
+            if (bufsk_out != NULL) {
+               out_sk[rs] += 2*cfg->out_points;
+            }
+            if (bufstates_out != NULL) {
+               out_states[rs] += cfg->sampler_states;
+            }
+            if (bufon_out != NULL) {
+               status = ippsMulC_32f_I(scale_on, out_on[rs], cfg->out_points);
+               out_on[rs] += cfg->out_points;
+            }
+            if (buffold_out != NULL) {
+               for (int b=0; b<cfg->fold_bins; b++) {
+                  status = ippsMulC_32f_I(fold_scale[b], out_fold[rs] + b*cfg->out_points, cfg->out_points);
+               }
+               out_fold[rs] += cfg->fold_bins*cfg->out_points;
+            }
          }
          for (int xp=0; xp<cfg->num_xpols; xp++) {
-            status = ippsMulC_32fc_I(spectrum_scale_ReIm, out_xpol[xp], cfg->fft_ssb_points);
-            out_xpol[xp] += cfg->fft_ssb_points;
+            status = ippsMulC_32fc_I(scale_xpol, out_xpol[xp], cfg->out_points);
+            out_xpol[xp] += cfg->out_points;
          }
-         for (int rs=0; rs<cfg->num_sources; rs++) {
-            out_pcal[rs] += cfg->pcal_tonebins;
+         if (cfg->extract_PCal) {
+            for (int rs=0; rs<cfg->num_sources; rs++) {
+               final_PCal(rs, out_pcal[rs]);
+               out_pcal[rs] += cfg->pcal_tonebins;
+            }
+            reset_PCal();
          }
          num_spectra_calculated++;
          num_ffts_accumulated = 0;
-
-         /* hop over the overlapping remainder between integrated spectra boundaries */
-         for (int rs=0; rs<cfg->num_sources; rs++) {
-            src[rs] += (cfg->raw_fullfft_bytes - cfg->raw_overlap_bytes);
+         if (cfg->peak_detect) {
+            num_peaks++;
          }
-         min_raw_remaining -= (cfg->raw_fullfft_bytes - cfg->raw_overlap_bytes);
       }
 
    }// source buffer(s) have raw bytes left
@@ -516,19 +1122,102 @@ void TaskCoreIPP::doMaths()
    times[1] = Helpers::getSysSeconds();
    total_runtime += (times[1]-times[0]);
 
-   if (num_ffts_accumulated > 0) {
+   if (!complete) {
+      /* a sub-spectrum, scaled like the full spectrum so that the sum of all sub-spectra is the average */
+      Ipp32f  scale_off = spectrum_scale_Re, scale_on = 0.0f;
+      if (bufon_out != NULL) {
+         switch_scales(spectrum_hop, scale_off, scale_on);
+      }
+      Ipp32fc scale_xpol = { scale_off, 0.0f };
+      if (buffold_out != NULL) {
+         fold_scales(spectrum_hop);
+      }
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         ippsMulC_32f_I(scale_off, out_auto[rs], cfg->out_points);
+         if (bufon_out != NULL) {
+            ippsMulC_32f_I(scale_on, out_on[rs], cfg->out_points);
+         }
+         for (int b=0; (buffold_out != NULL) && (b<cfg->fold_bins); b++) {
+            ippsMulC_32f_I(fold_scale[b], out_fold[rs] + b*cfg->out_points, cfg->out_points);
+         }
+      }
+      for (int xp=0; xp<cfg->num_xpols; xp++) {
+         ippsMulC_32fc_I(scale_xpol, out_xpol[xp], cfg->out_points);
+      }
+      if (cfg->extract_PCal) {
+         for (int rs=0; rs<cfg->num_sources; rs++) {
+            final_PCal(rs, out_pcal[rs]);
+         }
+      }
+      num_spectra_calculated = 1;
+      num_ffts_accumulated   = 0;
+   } else if (num_ffts_accumulated > 0) {
       *log << "IPP core " << rank << " write partial: " << num_ffts_accumulated << " unused FFTs, "
            << "this should not happen except at early EOF!" << endl <<  flush;
       /* Write partial spectra as well (potential "bug" for multicore combining though...) */
+      if (cfg->extract_PCal) {
+         for (int rs=0; rs<cfg->num_sources; rs++) {
+            final_PCal(rs, out_pcal[rs]);
+         }
+      }
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         buf_out[rs]->getRecords()[num_spectra_calculated].partial = true;
+         if (bufon_out != NULL) {
+            bufon_out[rs]->getRecords()[num_spectra_calculated].partial = true;
+         }
+      }
+      /* the peak file keeps one record per written spectrum, its power and noise get the
+         scale of a complete spectrum by averaging a copy over the FFTs that were accumulated */
+      if (cfg->peak_detect) {
+         Ipp32f scale_partial = Ipp32f(1.0/num_ffts_accumulated);
+         for (int rs=0; rs<cfg->num_sources; rs++) {
+            swspeak_t* peak = ((swspeak_t*)bufpeak_out[rs]->getData()) + num_peaks;
+            Ipp32f*    win  = ((Ipp32f*)bufpeakwin_out[rs]->getData()) + num_peaks*cfg->peak_window_points;
+            ippsMulC_32f(out_auto[rs], scale_partial, fft_powspec[rs], cfg->out_points);
+            detectPeak(fft_powspec[rs], peak, (cfg->peak_window_points > 0) ? win : NULL);
+         }
+         num_peaks++;
+      }
       num_spectra_calculated++;
    }
 
-   /* Set length of output buffers to match nr of written spectra */
+   /* Reduce complete spectra to the bin ranges kept by each sink, sub-spectra get reduced after combining */
    for (int rs=0; rs<cfg->num_sources; rs++) {
-      buf_out[rs]->setLength(cfg->fft_bytes_ssb * num_spectra_calculated);
+      size_t floats = cfg->out_points;
+      if (complete && (cfg->out_selection[rs] != NULL)) {
+         floats = cfg->out_selection[rs]->reduce((Ipp32f*)buf_out[rs]->getData(), num_spectra_calculated, 1);
+      }
+      buf_out[rs]->setLength(sizeof(Ipp32f) * floats * num_spectra_calculated);
+      if (bufon_out != NULL) {
+         if (complete && (cfg->out_selection[rs] != NULL)) {
+            cfg->out_selection[rs]->reduce((Ipp32f*)bufon_out[rs]->getData(), num_spectra_calculated, 1);
+         }
+         bufon_out[rs]->setLength(sizeof(Ipp32f) * floats * num_spectra_calculated);
+      }
+      if (buffold_out != NULL) {
+         /* the phase bins of a spectrum are reduced like fold_bins spectra */
+         if (complete && (cfg->out_selection[rs] != NULL)) {
+            cfg->out_selection[rs]->reduce((Ipp32f*)buffold_out[rs]->getData(), cfg->fold_bins*num_spectra_calculated, 1);
+         }
+         buffold_out[rs]->setLength(sizeof(Ipp32f) * floats * cfg->fold_bins * num_spectra_calculated);
+      }
    }
    for (int xp=0; xp<cfg->num_xpols; xp++) {
-      bufxpol_out[xp]->setLength(cfg->fft_bytes_xpol * num_spectra_calculated);
+      size_t floats = 2 * cfg->out_points;
+      if (complete && (cfg->out_selection[cfg->num_sources + xp] != NULL)) {
+         floats = cfg->out_selection[cfg->num_sources + xp]->reduce((Ipp32f*)bufxpol_out[xp]->getData(), num_spectra_calculated, 2);
+      }
+      bufxpol_out[xp]->setLength(sizeof(Ipp32f) * floats * num_spectra_calculated);
+   }
+   if (bufsk_out != NULL) {
+      /* the power and power^2 sums of a spectrum are reduced like two spectra */
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         size_t floats = cfg->out_points;
+         if (complete && (cfg->out_selection[rs] != NULL)) {
+            floats = cfg->out_selection[rs]->reduce((Ipp32f*)bufsk_out[rs]->getData(), 2*num_spectra_calculated, 1);
+         }
+         bufsk_out[rs]->setLength(sizeof(Ipp32f) * 2 * floats * num_spectra_calculated);
+      }
    }
 
    /* Output the PCal results */
@@ -540,6 +1229,71 @@ void TaskCoreIPP::doMaths()
       }
    }
 
+   /* Output the peaks found in complete spectra */
+   if (cfg->peak_detect) {
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         bufpeak_out[rs]->setLength(sizeof(swspeak_t) * num_peaks);
+         bufpeakwin_out[rs]->setLength(sizeof(Ipp32f) * cfg->peak_window_points * num_peaks);
+      }
+   }
+
+   /* Output the sampler statistics */
+   if (bufstates_out != NULL) {
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         bufstates_out[rs]->setLength(sizeof(swsint64_t) * cfg->sampler_states * num_spectra_calculated);
+      }
+   }
+   if (buftpow_out != NULL) {
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         Ipp32f* base = (Ipp32f*)(buftpow_out[rs]->getData());
+         buftpow_out[rs]->setLength(sizeof(Ipp32f) * (out_tpow[rs] - base));
+      }
+   }
+
+   /* Output the carrier downconversion blocks for the tracking loop */
+   if (cfg->costas_loop) {
+      for (int rs=0; rs<cfg->num_sources; rs++) {
+         Ipp32fc* base = (Ipp32fc*)(bufcostas_out[rs]->getData());
+         bufcostas_out[rs]->setLength(sizeof(Ipp32fc) * (out_costas[rs] - base));
+      }
+   }
+
+   /* The records of the results: one per spectrum, the other outputs follow the power spectra */
+   for (int rs=0; rs<cfg->num_sources; rs++) {
+      std::vector<bufrecord_t>& recs = buf_out[rs]->getRecords();
+      recs.resize(num_spectra_calculated);
+      if (cfg->extract_PCal) {
+         bufpcal_out[rs]->getRecords() = recs;
+      }
+      if (cfg->peak_detect) {
+         bufpeak_out[rs]->getRecords().assign(recs.begin(), recs.begin() + std::min(num_peaks, num_spectra_calculated));
+      }
+      if (bufsk_out != NULL) {
+         bufsk_out[rs]->getRecords() = recs;
+      }
+      if (bufstates_out != NULL) {
+         bufstates_out[rs]->getRecords() = recs;
+      }
+      if (bufon_out != NULL) {
+         bufon_out[rs]->getRecords().resize(num_spectra_calculated);
+      }
+      if (buffold_out != NULL) {
+         buffold_out[rs]->getRecords() = recs;
+      }
+   }
+   for (int xp=0; xp<cfg->num_xpols; xp++) {
+      bufxpol_out[xp]->getRecords() = buf_out[0]->getRecords();
+   }
+
+#ifdef DEBUG_ALLOC_CHECK
+   /* after the first buffers, the hot path must not allocate anything */
+   if ((num_runs > 2) && (thread_allocs != allocs_before)) {
+      *log << "IPP core " << rank << " allocated " << (thread_allocs - allocs_before)
+           << " times in run " << num_runs << endl << flush;
+      assert(thread_allocs == allocs_before);
+   }
+#endif
+
    #if 0
    std::ostringstream stats;
    double dT   = (times[1]-times[0]);
@@ -561,137 +1315,287 @@ void TaskCoreIPP::doMaths()
 
 
 /**
- * Fill out a vector with the specified window function.
- * @param output where to place the values
- * @param type   type of window function
- * @param points how many points
+ * Find the part of the switching cycle that one FFT falls into.
+ * The ON part comes first in each cycle, the cycle is at switch_phase at sample 0.
+ * @return SwitchState  SwitchOn or SwitchOff, or SwitchBlank if the FFT spans a transition
+ * @param  sample       absolute index of the first FFT input sample
  */
-void TaskCoreIPP::generate_windowfunction(Ipp32f* output, WindowFunctionType type, int points)
+TaskCoreIPP::SwitchState TaskCoreIPP::switch_state(swsint64_t sample) const
 {
-   switch (type) {
-        case None:
-            // no windowing: currently implemented as *1.0 rectangular windowing...
-            ippsSet_32f(1, output, points);
-            break;
-        case Cosine:
-            for (int i=0; i<points; i++) {
-                output[i] = cos( M_PI * (Ipp32f(i) - 0.5*Ipp32f(points) + 0.5) / Ipp32f(points));
-            }
-            break;
-        case Cosine2:
-            for (int i=0; i<points; i++) {
-                Ipp64f w = cos( M_PI * (Ipp32f(i) - 0.5*Ipp32f(points) + 0.5) / Ipp32f(points));
-                output[i] = w*w;
-            }
-            break;
-        case Hamming:
-            ippsSet_32f(1, output, points);
-            ippsWinHamming_32f_I(output, points);
-            break;
-        case Blackman:
-            ippsSet_32f(1, output, points);
-            ippsWinBlackman_32f_I(output, points, 0.5 /* alpha, hardcoded for now... */);
-            break;
-        case Hann:
-            ippsSet_32f(1, output, points);
-            ippsWinHann_32f_I(output, points);
-            break;
-        default:
-            ippsSet_32f(1, output, points);
-            cerr << "TaskCore: unsupported window function " << type << ", reverting to None." << endl;
-            break;
+   if (cfg->switch_period_samples <= 0) {
+      return SwitchOff;
    }
-   return;
+   double p = fmod(double(sample) + cfg->switch_phase_samples, cfg->switch_period_samples);
+   double e = p + cfg->fft_points;
+   if (e <= cfg->switch_on_samples) {
+      return SwitchOn;
+   }
+   if ((p >= cfg->switch_on_samples) && (e <= cfg->switch_period_samples)) {
+      return SwitchOff;
+   }
+   return SwitchBlank;
 }
 
+
 /**
- * Fill out a vector with the specified window function for the Costas loop.
- * @param output where to place the values
- * @param sfreq   sampling frequency
- * @param points how many points
+ * Get the normalization of the OFF- and ON-state spectra of one integrated spectrum,
+ * from the number of its FFTs that fall into each state. The counts follow from the
+ * sample positions alone, so the cores that work on parts of the same spectrum agree.
+ * @param first_hop  index of the first overlapped FFT of the spectrum
+ * @param scale_off  output, 1/count of the OFF-state FFTs or 0 if there are none
+ * @param scale_on   output, 1/count of the ON-state FFTs or 0 if there are none
  */
-void TaskCoreIPP::generate_costaswindow(Ipp32fc* output, int sfreq, int points)
+void TaskCoreIPP::switch_scales(swsint64_t first_hop, Ipp32f& scale_off, Ipp32f& scale_on) const
 {
-    Ipp32fc casa = {0,1};
-   // Ipp32fc* soc = &casa;
-  //  Ipp32f test;
-
-    for (int i=0; i<points; i++) {
-        // ippsMulC_32fc(const Ipp32fc* pSrc, Ipp32fc val, Ipp32fc* pDst, int len);
-     //   test = ipp32f(points);
-//        ippsMulC_32fc(soc, Ipp32fc(sfreq * i / 4), output[i],2); // (sqrt(-1)* Ipp32f(sfreq) * Ipp32f(i)) / 4;
-    }
-    return;
+   int n_off = 0, n_on = 0;
+   for (int pos=0; pos<cfg->averaged_overlapped_ffts; pos++) {
+      SwitchState state = switch_state((first_hop + pos) * cfg->fft_overlap_points);
+      n_off += (state == SwitchOff);
+      n_on  += (state == SwitchOn);
+   }
+   scale_off = (n_off > 0) ? Ipp32f(1.0/n_off) : 0.0f;
+   scale_on  = (n_on > 0)  ? Ipp32f(1.0/n_on)  : 0.0f;
 }
 
+
 /**
- * Process samples and accumulate the detected phase calibration tone vector.
- * @param data    input samples
- * @param pcal    output pcal vector to which data will be accumulated
- * @param points  number of samples
+ * Find the phase bin of the folding that one FFT falls into, from the phase at its center.
+ * @return int     phase bin 0..fold_bins-1
+ * @param  sample  absolute index of the first FFT input sample
  */
-void TaskCoreIPP::extract_PCal(Ipp32f const* data, Ipp32fc* pcal, int points)
+int TaskCoreIPP::fold_bin(swsint64_t sample) const
 {
+   double n     = double(sample) + 0.5*cfg->fft_points - cfg->fold_epoch_samples;
+   double phase = n * (cfg->fold_f0 + 0.5 * cfg->fold_f1 * n);
+   int bin = int((phase - floor(phase)) * cfg->fold_bins);
+   return std::min(bin, cfg->fold_bins - 1);
+}
+
 
+/**
+ * Get the normalization of each phase bin of one folded spectrum into fold_scale[],
+ * from the number of its FFTs that fall into each bin. Like the switching counts,
+ * these follow from the sample positions alone.
+ * @param first_hop  index of the first overlapped FFT of the spectrum
+ */
+void TaskCoreIPP::fold_scales(swsint64_t first_hop)
+{
+   for (int b=0; b<cfg->fold_bins; b++) {
+      fold_count[b] = 0;
+   }
+   for (int pos=0; pos<cfg->averaged_overlapped_ffts; pos++) {
+      fold_count[fold_bin((first_hop + pos) * cfg->fft_overlap_points)]++;
+   }
+   for (int b=0; b<cfg->fold_bins; b++) {
+      fold_scale[b] = (fold_count[b] > 0) ? Ipp32f(1.0/fold_count[b]) : 0.0f;
+   }
+}
+
+/**
+ * Look up the time and validity of an input sample in the time marks of a raw buffer.
+ * Samples carried over from the preceding buffer continue the first run backwards.
+ * @return bool    False if the data source flagged the sample as invalid
+ * @param  raw     raw buffer of the source
+ * @param  sample  absolute index of the sample
+ * @param  t       output, time of the sample, negative if not known
+ */
+bool TaskCoreIPP::sample_time(Buffer* raw, swsint64_t sample, double& t) const
+{
+   std::vector<buftimemark_t>& marks = raw->getTimeMarks();
+   t = -1.0;
+   if (marks.empty()) {
+      return true;
+   }
+   double offset = (sample - first_sample) * cfg->rawbytes_per_channelsample;
+   size_t m = 0;
+   while (((m + 1) < marks.size()) && (double(marks[m+1].offset) <= offset)) {
+      m++;
+   }
+   if (marks[m].time_s >= 0) {
+      t = marks[m].time_s + (offset - marks[m].offset) / (cfg->rawbytes_per_channelsample * cfg->samplingfreq);
+   }
+   return marks[m].valid;
+}
+
+
+/**
+ * Mix samples down with the a-priori carrier NCO and integrate-and-dump
+ * them into blocks for the carrier tracking loop.
+ * @param data    input samples, fft_points long
+ * @param blocks  output, costas_blocks_per_fft complex values
+ * @param sample  absolute index of the first input sample
+ */
+void TaskCoreIPP::downconvert_carrier(Ipp32f const* data, Ipp32fc* blocks, swsint64_t sample)
+{
    /*
-    * Process an amount #fft_points of input samples. 
-    * The phase cal comb signal "n*1MHz+offsetHz" has a period of #pcal_rotatorlen
-    * input samples. This period must be less than #fft_points.
-    *
-    * An additional condition is that an integer multiple (#pcal_pulses_per_fft) 
-    * of #pcal_rotatorlen samples must fit evenly into the #fft_points input samples.
-    *
-    * Further, the #pcal_rotatorlen must be evenly divisible by twice the
-    * number of pcal tones present in the input signal bandwidth.
-    *
-    * The final output will contain a number #pcal_pulses of bins. 
-    * As an example, the output could be:
-    *
-    * ------------               8 MHz input bandwidth => 8 tones => 16 bins
-    *             \              value of output pcal tone bins, ideal case
-    *             ------------
-    * 0           7         15 
-    *
-    * If the upper half of bins is non-zero and the lower half is not
-    * a complex constant, then there has been some phase shift in the
-    * input signal -- presumably the amount of phase shift is different 
-    * at different tone frequencies.
-    * The amount of phase shift can be detected by comparing/dividing
-    * the actual output by the expected output of the ideal case.
-    * It is possible to detect changes in the phase shift, too, by 
-    * comparing the integrated output at say 20s intervals.
-    *
-    * The principle: 
-    * - the phase calibration multi-tone signal is detected by multiplying 
-    *   every segment of #pcal_rotatorlen input samples with an a-priori 
-    *   complex-valued multitone vector 
-    * - the product is further folded down into one segment that is 
-    *   #pcal_pulses complex samples long
-    * - each of these segments is added to an accumulator
-    * - the accumulator is output and reset to zero at every boundary 
-    *   of a new dynamic spectrum (say, in 20 data-second intervals)
+    * The NCO of one block is a shared table that starts at phase 0. The dot
+    * product of every block is rotated to the exact phase of its absolute
+    * sample index in double precision, so the NCO never drifts and all cores
+    * produce blocks that the loop in TaskDispatcher can simply concatenate.
     */
+   const int      len   = cfg->costas_block_len;
+   const double   rfreq = cfg->costas_carrier_hz / cfg->samplingfreq;
+   Ipp32fc const* nco   = tables->getCarrierNCO();
+   for (int b=0; b<cfg->costas_blocks_per_fft; b++) {
+      Ipp32fc z;
+      double cycles = fmod(double(sample + swsint64_t(b*len)) * rfreq, 1.0);
+      double c = cos(2*M_PI * cycles), s = sin(2*M_PI * cycles);
+      ippsDotProd_32f32fc(data + b*len, nco, len, &z);
+      blocks[b].re = Ipp32f(z.re*c - z.im*s);
+      blocks[b].im = Ipp32f(z.re*s + z.im*c);
+   }
 
-   Ipp32f const* src = data;
-   for (int n=0; n<points; n+=cfg->pcal_rotatorlen, src+=cfg->pcal_rotatorlen) {
-       ippsMul_32f32fc(/*A(32f)*/src, /*B(32fc)*/this->pcal_rotatevec, 
-                       /*dst(32fc)*/this->pcal_rotated, 
-                       /*len*/cfg->pcal_rotatorlen
-       );
-       Ipp32fc* pulse = this->pcal_rotated;
-       for (int p=0; p<(cfg->pcal_rotatorlen/cfg->pcal_tonebins); p++) {
-           ippsAdd_32fc_I(/*src*/pulse, /*srcdst*/pcal, cfg->pcal_tonebins);
-           pulse += cfg->pcal_tonebins;
-       }
+   /* the tone is exp(+iwt): for real-valued data the conjugate is sum(x*exp(-iwt)) */
+   ippsConj_32fc_I(blocks, cfg->costas_blocks_per_fft);
+   return;
+}
+
+/**
+ * Evaluate the DFT of the selected sparse bins with a bank of Goertzel filters.
+ * @param data    windowed input samples, fft_points long
+ * @param out     output, one complex value per sparse bin
+ */
+void TaskCoreIPP::goertzel_bank(Ipp32f const* data, Ipp32fc* out)
+{
+   const int     nb = cfg->sparse_bins.size();
+   const int     N  = cfg->fft_points;
+   const Ipp64f* c  = goertzel_coeff;
+   Ipp64f*       s1 = goertzel_s1;
+   Ipp64f*       s2 = goertzel_s2;
+   int n = 0;
+
+   /*
+    * All filters advance together, one input sample at a time, so the
+    * inner loop over bins is a plain vectorizable multiply-add. Two samples
+    * are done per pass with the roles of s1 and s2 swapped in between,
+    * which saves the copy s2=s1. Double precision keeps the recursion
+    * stable for long transforms and for bins near DC and Nyquist.
+    */
+   ippsZero_64f(s1, nb);
+   ippsZero_64f(s2, nb);
+   for (n=0; (n+1)<N; n+=2) {
+      const Ipp64f x0 = data[n];
+      const Ipp64f x1 = data[n+1];
+      for (int k=0; k<nb; k++) {
+         s2[k] = x0 + c[k]*s1[k] - s2[k];
+         s1[k] = x1 + c[k]*s2[k] - s1[k];
+      }
+   }
+   if (n < N) {
+      const Ipp64f x0 = data[n];
+      for (int k=0; k<nb; k++) {
+         Ipp64f s0 = x0 + c[k]*s1[k] - s2[k];
+         s2[k] = s1[k];
+         s1[k] = s0;
+      }
    }
 
-   // cerr << "PCal done: " << cfg->pcal_pulses_per_fft << " sample pieces of size " << cfg->pcal_rotatorlen
-   //     << ", folded into " << cfg->pcal_tonebins << " in " << cfg->pcal_pulses << " inner-loop steps." << endl;
-   // print_vec32fc(pcal, cfg->pcal_tonebins);
+   /* X[k] = sum x[n]*exp(-i*w*n), same convention as ippsDFTFwd */
+   for (int k=0; k<nb; k++) {
+      out[k].re = Ipp32f(s1[k]*goertzel_cos[k] - s2[k]);
+      out[k].im = Ipp32f(s1[k]*goertzel_sin[k]);
+   }
+   return;
+}
 
+/**
+ * Pick the selected sparse bins out of a full FFT result.
+ * @param fft     FFT output in IPP "Perm" packed format
+ * @param out     output, one complex value per sparse bin
+ */
+void TaskCoreIPP::gather_sparse_bins(Ipp32fc const* fft, Ipp32fc* out)
+{
+   const int nb      = cfg->sparse_bins.size();
+   const int nyquist = cfg->fft_ssb_points - 1;
+   for (int k=0; k<nb; k++) {
+      int bin = cfg->sparse_bins[k];
+      if (bin == 0) {
+         out[k].re = fft[0].re; // DC
+         out[k].im = 0;
+      } else if (bin == nyquist) {
+         out[k].re = fft[0].im; // packed Nyquist
+         out[k].im = 0;
+      } else {
+         out[k] = fft[bin];
+      }
+   }
    return;
 }
 
+/**
+ * Restart the phase calibration extraction at the start of a new spectrum.
+ */
+void TaskCoreIPP::reset_PCal()
+{
+   if (!cfg->extract_PCal) {
+      return;
+   }
+   for (int s=0; s<cfg->num_sources; s++) {
+      if (cfg->pcal_from_fft) {
+         ippsZero_32fc(pcal_fft_acc[s], cfg->pcal_tonebins);
+      } else {
+         pcal[s]->clear();
+      }
+   }
+}
+
+/**
+ * Pick the phase calibration tones out of one FFT result and accumulate them.
+ * The tones are rotated to the same phase reference at absolute sample 0 that
+ * the time-domain extractors use.
+ * @param fft     FFT output in IPP "Perm" packed format
+ * @param acc     accumulated tones, one complex value per tone
+ * @param sample  absolute index of the first FFT input sample
+ */
+void TaskCoreIPP::extract_PCal_fft(Ipp32fc const* fft, Ipp32fc* acc, swsint64_t sample)
+{
+   const int N = cfg->fft_points;
+   const int ntones = cfg->pcal_tonebins;
+   for (int t=0; t<ntones; t++) {
+      int bin = cfg->pcal_first_bin + t*cfg->pcal_bin_step;
+      if (bin == 0) {
+         pcal_fft_tmp[t].re = fft[0].re; // DC
+         pcal_fft_tmp[t].im = 0;
+      } else if (bin == N/2) {
+         pcal_fft_tmp[t].re = fft[0].im; // Packed Nyquist
+         pcal_fft_tmp[t].im = 0;
+      } else {
+         pcal_fft_tmp[t] = fft[bin];
+      }
+   }
+
+   /* tone k of an FFT starting at sample m has an extra phase of 2pi*k*m/N */
+   swsint64_t m = sample % N;
+   if (m != 0) {
+      double phi0 = -2*M_PI * double((swsint64_t(cfg->pcal_first_bin) * m) % N) / N;
+      double dphi = -2*M_PI * double((swsint64_t(cfg->pcal_bin_step) * m) % N) / N;
+      double rr = cos(phi0), ri = sin(phi0);
+      double sr = cos(dphi), si = sin(dphi);
+      for (int t=0; t<ntones; t++) {
+         double re = pcal_fft_tmp[t].re, im = pcal_fft_tmp[t].im;
+         pcal_fft_tmp[t].re = Ipp32f(re*rr - im*ri);
+         pcal_fft_tmp[t].im = Ipp32f(re*ri + im*rr);
+         double nr = rr*sr - ri*si;
+         ri = rr*si + ri*sr;
+         rr = nr;
+      }
+   }
+   ippsAdd_32fc_I(pcal_fft_tmp, acc, ntones);
+}
+
+/**
+ * Produce the phase calibration result of the current spectrum.
+ * @param s    source index
+ * @param out  output, one complex value per tone
+ */
+void TaskCoreIPP::final_PCal(int s, Ipp32fc* out)
+{
+   if (cfg->pcal_from_fft) {
+      ippsMulC_32fc(pcal_fft_acc[s], pcal_fft_scale, out, cfg->pcal_tonebins);
+   } else {
+      pcal[s]->getFinalPCal(out);
+   }
+}
 
 
 #ifdef UNIT_TEST_TCIPP
@@ -25,6 +25,8 @@
 #include "TaskCore.h"
 #include "Helpers.h"
 #include "DataUnpackerFactory.h"
+#include "BinSelection.h"
+#include "SharedTables.h"
 
 #include "PhaseCal/PCal.h"
 
@@ -101,12 +103,32 @@ public:
     */
    int combineResults(Buffer** outbuf, Buffer** pcalbuf);
 
+   /**
+    * @return true, the worker threads sum up the sub-spectra of all cores
+    */
+   bool reducesResults() { return true; }
+
+   /**
+    * Sum this core's share of the bins of the sub-spectra from all cores into the
+    * assembled spectra, and finish this core's share of the sinks of the spectra that
+    * were completed. Call only from worker thread, all cores take part.
+    */
+   void reduceResults();
+
   /**
     * Reset buffer to 0.0 floats
     * @param buf     Buffer to reset
     */
    void resetBuffer(Buffer* buf);
 
+   /**
+    * Find the strongest peak in the search band of a complete integrated spectrum.
+    * @param spectrum Power spectrum with all computed points
+    * @param peak     Output peak record
+    * @param window   Output for the points around the peak, or NULL
+    */
+   void detectPeak(swsfloat_t const* spectrum, swspeak_t* peak, swsfloat_t* window);
+
 private:
 
    swspect_settings_t* cfg;                           // referenced run settings
@@ -114,27 +136,55 @@ private:
 
    DataUnpacker*       unpacker;                      // depends on the input data format
 
-   Ipp32f*             unpacked_re;                   // input samples unpacked from raw data
-   Ipp32f*             windowfct;                     // input window function
-   Ipp32fc*            windowgct;                     // Costas-loop window function
-   Ipp32fc**           fft_result_reim;               // full-length FFT/DFT output
-   Ipp32fc*            fft_conj_reim;                 // single-sideband FFT/DFT output, complex conjugate
-
-   Ipp32fc*            pcal_rotatevec;                // complex vector that input samples are rotated with before accumulation
-   Ipp32fc*            pcal_rotated;                  // temporary processing vector
-
-   Ipp32f**            fft_powspec;                   // fft power spectrum, temporary
+   Ipp32f*             unpacked_re;                   // in the arena: input samples unpacked from raw data
+   SharedTables*       tables;                        // read-only tables shared by the cores of a NUMA node
+   Ipp32f const*       windowfct;                     // input window function, from the shared tables
+   Ipp32fc**           out_costas;                    // write positions in the carrier downconversion output
+   Ipp32fc**           fft_result_reim;               // in the arena: full-length FFT/DFT output
+   Ipp32fc*            fft_conj_reim;                 // in the arena: single-sideband FFT/DFT output, complex conjugate
+
+   PCal**              pcal;                          // phase calibration tone extractors, one per source
+   Ipp32fc**           pcal_fft_acc;                  // or: phase calibration tones accumulated from FFT bins
+   Ipp32fc*            pcal_fft_tmp;                  // tones of a single FFT
+   Ipp32fc             pcal_fft_scale;                // normalization of the tones from FFT bins
+
+   Ipp32f**            fft_powspec;                   // in the arena: fft power spectrum, temporary
+
+   Buffer*             arena_buf;                     // the arena below, on the NUMA node of the core
+   char*               arena;                         // per-buffer working state of doMaths() and the FFT buffers, allocated once in prepare()
+   char**              src_pos;                       // in the arena: read positions in the raw input of each source
+   Ipp32f**            out_auto;                      // in the arena: write positions in the output spectra
+   Ipp32f**            out_on;                        // in the arena: write positions in the ON-state spectra of the switching
+   Ipp32f**            out_fold;                      // in the arena: write positions in the folded spectra
+   Ipp32fc**           out_xpol;
+   Ipp32fc**           out_pcal;
+   Ipp32f**            out_sk;                        // in the arena: write positions in the spectral kurtosis sums
+   swsint64_t**        out_states;                    // in the arena: write positions in the quantisation state histograms
+   Ipp32f**            out_tpow;                      // in the arena: write positions in the total power blocks
+   size_t*             raw_remaining;                 // in the arena: raw bytes left of each source
+
+   Ipp32fc**           sparse_reim;                   // sparse-bin mode: complex values of the selected bins
+   Ipp64f*             goertzel_coeff;                // Goertzel bank: 2*cos(w) of each selected bin
+   Ipp64f*             goertzel_cos;                  // Goertzel bank: cos(w) and sin(w) for the final complex value
+   Ipp64f*             goertzel_sin;
+   Ipp64f*             goertzel_s1;                   // Goertzel bank: recursion state
+   Ipp64f*             goertzel_s2;
    int                 num_ffts_accumulated;
    int                 num_spectra_calculated;
 
    Ipp32f              spectrum_scale_Re;             // normalization factor for the accumulated spectrum
    Ipp32fc             spectrum_scale_ReIm;
+   Ipp32f*             fold_scale;                    // normalization of each phase bin of the folded spectra
+   int*                fold_count;                    // FFTs in each phase bin, temporary
 
    double              total_runtime;
    long                total_ffts;
+   long                blanked_ffts;                  // FFTs left out because they span a switching transition
+   long                num_runs;                      // how many raw buffers this core was given so far
+   swsint64_t          first_sample;                  // absolute index of the first sample in the current raw buffer
 
    IppsDFTSpec_R_32f*  fftSpecHandle;                 // Intel IPP DFT handles
-   Ipp8u*              fftWorkbuffer;
+   Ipp8u*              fftWorkbuffer;                 // in the arena: work space of the DFT
 
    pthread_t           wthread;                       // worker thread ID
    bool                terminate_worker;              // signal to worker thread
@@ -143,6 +193,14 @@ private:
    Buffer**            buf_out;                       // call argument for doMaths() etc
    Buffer**            bufxpol_out;
    Buffer**            bufpcal_out;
+   Buffer**            bufcostas_out;
+   Buffer**            bufpeak_out;
+   Buffer**            bufpeakwin_out;
+   Buffer**            bufsk_out;
+   Buffer**            bufstates_out;
+   Buffer**            buftpow_out;
+   Buffer**            bufon_out;
+   Buffer**            buffold_out;
 
 public:
    pthread_mutex_t     mmutex;
@@ -152,27 +210,94 @@ public:
 
 private:
 
+   enum SwitchState { SwitchOff, SwitchOn, SwitchBlank };
+
    /**
     * Reset the buffers with integrated spectra to 0
     */
    void reset_spectrum();
 
    /**
-    * Fill out a vector with the specified window function.
-    * @param output where to place the values
-    * @param type   type of window function
-    * @param points how many points
+    * Find the part of the switching cycle that one FFT falls into.
+    * @return SwitchState  SwitchOn or SwitchOff, or SwitchBlank if the FFT spans a transition
+    * @param  sample       absolute index of the first FFT input sample
+    */
+   SwitchState switch_state(swsint64_t sample) const;
+
+   /**
+    * Get the normalization of the OFF- and ON-state spectra of one integrated spectrum,
+    * from the number of its FFTs that fall into each state.
+    * @param first_hop  index of the first overlapped FFT of the spectrum
+    * @param scale_off  output, 1/count of the OFF-state FFTs or 0 if there are none
+    * @param scale_on   output, 1/count of the ON-state FFTs or 0 if there are none
+    */
+   void switch_scales(swsint64_t first_hop, Ipp32f& scale_off, Ipp32f& scale_on) const;
+
+   /**
+    * Find the phase bin of the folding that one FFT falls into, from the phase at its center.
+    * @return int     phase bin 0..fold_bins-1
+    * @param  sample  absolute index of the first FFT input sample
+    */
+   int fold_bin(swsint64_t sample) const;
+
+   /**
+    * Get the normalization of each phase bin of one folded spectrum into fold_scale[],
+    * from the number of its FFTs that fall into each bin.
+    * @param first_hop  index of the first overlapped FFT of the spectrum
+    */
+   void fold_scales(swsint64_t first_hop);
+
+   /**
+    * Look up the time and validity of an input sample in the time marks of a raw buffer.
+    * @return bool    False if the data source flagged the sample as invalid
+    * @param  raw     raw buffer of the source
+    * @param  sample  absolute index of the sample
+    * @param  t       output, time of the sample, negative if not known
+    */
+   bool sample_time(Buffer* raw, swsint64_t sample, double& t) const;
+
+   /**
+    * Mix samples down with the a-priori carrier NCO and integrate-and-dump
+    * them into blocks for the carrier tracking loop.
+    * @param data    input samples, fft_points long
+    * @param blocks  output, costas_blocks_per_fft complex values
+    * @param sample  absolute index of the first input sample
+    */
+   void downconvert_carrier(Ipp32f const* data, Ipp32fc* blocks, swsint64_t sample);
+
+   /**
+    * Evaluate the DFT of the selected sparse bins with a bank of Goertzel filters.
+    * @param data    windowed input samples, fft_points long
+    * @param out     output, one complex value per sparse bin
     */
-   void generate_windowfunction(Ipp32f* output, WindowFunctionType type, int points);
-   void generate_costaswindow(Ipp32fc* output, int samplingfreq, int points);
-    
+   void goertzel_bank(Ipp32f const* data, Ipp32fc* out);
+
+   /**
+    * Pick the selected sparse bins out of a full FFT result.
+    * @param fft     FFT output in IPP "Perm" packed format
+    * @param out     output, one complex value per sparse bin
+    */
+   void gather_sparse_bins(Ipp32fc const* fft, Ipp32fc* out);
+
+   /**
+    * Restart the phase calibration extraction at the start of a new spectrum.
+    */
+   void reset_PCal();
+
+   /**
+    * Pick the phase calibration tones out of one FFT result and accumulate them.
+    * @param fft     FFT output in IPP "Perm" packed format
+    * @param acc     accumulated tones, one complex value per tone
+    * @param sample  absolute index of the first FFT input sample
+    */
+   void extract_PCal_fft(Ipp32fc const* fft, Ipp32fc* acc, swsint64_t sample);
+
    /**
-    * Process samples and accumulate the detected phase calibration tone vector.
-    * @param data    input samples
-    * @param pcal    output pcal vector to which data will be accumulated
-    * @param points  number of samples
+    * Produce the phase calibration result of the current spectrum.
+    * @param s    source index
+    * @param out  output, one complex value per tone
     */
-   void extract_PCal(Ipp32f const* data, Ipp32fc* pcal, int points);
+   void final_PCal(int s, Ipp32fc* out);
 
 };
 
@@ -253,6 +253,16 @@ bool IniParser::getKeyValue(const char* key, float& value) const
    return rc;
 }
 
+bool IniParser::getKeyValue(const char* key, double& value) const
+{
+   std::string strvalue;
+   bool rc = getKeyValue(key, strvalue);
+   if (rc) {
+      value = atof(strvalue.c_str());
+   }
+   return rc;
+}
+
 bool IniParser::getKeyValue(const char* key, bool& value) const
 {
    std::string strvalue;
@@ -92,6 +92,7 @@ class IniParser {
     bool getKeyValue(const char*, int& value) const;
     bool getKeyValue(const char*, size_t& value) const;
     bool getKeyValue(const char*, float& value) const;
+    bool getKeyValue(const char*, double& value) const;
     bool getKeyValue(const char*, bool&) const;
 
 };
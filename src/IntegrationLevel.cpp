@@ -0,0 +1,325 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "IntegrationLevel.h"
+#include "BinSelection.h"
+
+#include <cstring>
+#include <limits>
+
+/**
+ * Prepare the accumulators of one level.
+ * @param settings Pointer to the global settings
+ * @param factor   How many base spectra go into one spectrum of this level
+ * @param sinks    Output sinks of this level, in the same order as the base spectrum sinks
+ * @param weightsinks  Per base sink the output of the number of spectra averaged in each point, or NULL
+ */
+IntegrationLevel::IntegrationLevel(swspect_settings_t* settings, int factor, std::vector<DataSink*> const& sinks,
+                                   std::vector<DataSink*> const& weightsinks)
+{
+   this->cfg    = settings;
+   this->factor = factor;
+   this->sinks  = sinks;
+   this->weightsinks = weightsinks;
+   this->weightsinks.resize(sinks.size(), NULL);
+   for (size_t sk=0; sk<sinks.size(); sk++) {
+      /* sinks get spectra that may already be reduced to the kept bins */
+      int    fpp = (int(sk) < cfg->num_sources) ? 1 : 2;
+      size_t n   = (cfg->out_selection[sk] != NULL) ? cfg->out_selection[sk]->getLength() : cfg->out_points;
+      floats.push_back(n * fpp);
+      accu.push_back(new Buffer(n * fpp * sizeof(swsfloat_t)));
+      memset(accu.back()->getData(), 0, accu.back()->getAllocated());
+      used.push_back(new Buffer(n * fpp * sizeof(swsfloat_t)));
+      memset(used.back()->getData(), 0, used.back()->getAllocated());
+      count.push_back(0);
+   }
+}
+
+/**
+ * Release the accumulators
+ */
+IntegrationLevel::~IntegrationLevel()
+{
+   for (size_t sk=0; sk<accu.size(); sk++) {
+      delete accu[sk];
+      delete used[sk];
+   }
+}
+
+/**
+ * Add base spectra that were written to a base sink, and write out
+ * every completed spectrum of this level. A partial spectrum from
+ * the end of the data is not an average and is left out. Different
+ * base sinks may be added concurrently.
+ * @param sink     Index of the base sink
+ * @param spectra  Buffer with one or more spectra as written to the base sink, not yet flagged
+ * @param flags    One byte per point of the spectra, nonzero to leave the point out, or NULL
+ */
+void IntegrationLevel::add(int sink, Buffer* spectra, Buffer* flags)
+{
+   size_t      n   = floats[sink];
+   size_t      num = spectra->getLength() / (n * sizeof(swsfloat_t));
+   swsfloat_t* in  = (swsfloat_t*)spectra->getData();
+   swsfloat_t* acc = (swsfloat_t*)accu[sink]->getData();
+   swsfloat_t* w   = (swsfloat_t*)used[sink]->getData();
+   unsigned char const* fl = NULL;
+   if ((flags != NULL) && (flags->getLength() >= num*n)) {
+      fl = (unsigned char const*)flags->getData();
+   }
+   std::vector<bufrecord_t>& recs = spectra->getRecords();
+   std::vector<bufrecord_t>& sum  = accu[sink]->getRecords();
+
+   for (size_t s=0; s<num; s++, in+=n) {
+      if ((recs.size() == num) && recs[s].partial) {
+         continue;
+      }
+
+      /* the longer spectrum starts with the time of its first base spectrum, and adds up their integration */
+      if (recs.size() == num) {
+         if (count[sink] == 0) {
+            sum.assign(1, recs[s]);
+         } else if (!sum.empty()) {
+            sum[0].valid_samples += recs[s].valid_samples;
+            sum[0].ffts          += recs[s].ffts;
+         }
+      } else if (count[sink] == 0) {
+         sum.clear();
+      }
+      unsigned char const* skip = (fl != NULL) ? (fl + s*n) : NULL;
+      for (size_t i=0; i<n; i++) {
+         if ((skip == NULL) || !skip[i]) {
+            acc[i] += in[i];
+            w[i]   += 1.0f;
+         }
+      }
+      if (++count[sink] < factor) {
+         continue;
+      }
+
+      /* base spectra are averages, so is the longer spectrum, over the unflagged base spectra of each point */
+      const swsfloat_t mark = (cfg->sk_flag_mode == SKFlagNaN) ? std::numeric_limits<swsfloat_t>::quiet_NaN() : 0.0f;
+      for (size_t i=0; i<n; i++) {
+         acc[i] = (w[i] > 0.0f) ? (acc[i] / w[i]) : mark;
+      }
+      accu[sink]->setLength(n * sizeof(swsfloat_t));
+      sinks[sink]->write(accu[sink]);
+      if (weightsinks[sink] != NULL) {
+         used[sink]->setLength(n * sizeof(swsfloat_t));
+         used[sink]->getRecords() = sum;
+         weightsinks[sink]->write(used[sink]);
+      }
+      memset(acc, 0, n * sizeof(swsfloat_t));
+      memset(w, 0, n * sizeof(swsfloat_t));
+      count[sink] = 0;
+   }
+}
+
+/**
+ * Close the sinks. Spectra of this level that were not completed are dropped.
+ * @return int     Number of incomplete spectra that were dropped
+ */
+int IntegrationLevel::close()
+{
+   int dropped = 0;
+   for (size_t sk=0; sk<sinks.size(); sk++) {
+      if (count[sk] > 0) { dropped++; }
+      sinks[sk]->close();
+      if (weightsinks[sk] != NULL) {
+         weightsinks[sk]->close();
+      }
+   }
+   return dropped;
+}
+
+
+#ifdef UNIT_TEST_INTEGRATIONLEVEL
+// g++ -Wall -DUNIT_TEST_INTEGRATIONLEVEL=1 IntegrationLevel.cpp BinSelection.cpp Buffer.cpp Helpers.cpp -o leveltest
+#include <cmath>
+#include <iostream>
+
+class LevelTestSink : public DataSink {
+  public:
+   int open(std::string uri) { return 0; }
+   size_t write(Buffer* buf) {
+      swsfloat_t const* v = (swsfloat_t const*)buf->getData();
+      data.push_back(std::vector<swsfloat_t>(v, v + buf->getLength()/sizeof(swsfloat_t)));
+      records.push_back(buf->getRecords());
+      return buf->getLength();
+   }
+   int close() { return 0; }
+   std::vector<std::vector<swsfloat_t> > data;
+   std::vector<std::vector<bufrecord_t> > records;
+};
+
+/* fill spectra first..first+num-1 of a power sink and a cross-pol sink, the value of
+ * point i of spectrum s is s*100+i, and the records count samples and FFTs like s */
+static void level_test_fill(Buffer& power, Buffer& xpol, int first, int num, size_t n, bool partial_last)
+{
+   swsfloat_t* pw = (swsfloat_t*)power.getData();
+   swsfloat_t* xp = (swsfloat_t*)xpol.getData();
+   power.getRecords().clear();
+   xpol.getRecords().clear();
+   for (int s=0; s<num; s++) {
+      bool partial = partial_last && (s == num-1);
+      for (size_t i=0; i<n; i++) {
+         pw[s*n + i]       = partial ? 1e6f : swsfloat_t((first+s)*100 + i);
+         xp[2*(s*n + i)]   = partial ? 1e6f : swsfloat_t((first+s)*100 + i);
+         xp[2*(s*n + i)+1] = partial ? 1e6f : -swsfloat_t((first+s)*100 + i);
+      }
+      bufrecord_t rec = { double(first+s), size_t(1000 + first+s), 10 + first+s, partial };
+      power.getRecords().push_back(rec);
+      xpol.getRecords().push_back(rec);
+   }
+   power.setLength(num * n * sizeof(swsfloat_t));
+   xpol.setLength(2 * num * n * sizeof(swsfloat_t));
+}
+
+/* compare the k-th written spectrum of a sink against the average of the base spectra first..first+factor-1 */
+static int level_test_check(LevelTestSink const& sink, size_t k, int first, int factor, size_t n, int fpp)
+{
+   int errors = 0;
+   if ((sink.data.size() <= k) || (sink.data[k].size() != n*fpp) || (sink.records[k].size() != 1)) {
+      std::cerr << "spectrum " << k << " of the level is missing or has the wrong size" << std::endl;
+      return 1;
+   }
+   for (size_t i=0; i<n; i++) {
+      double mean = (first + (factor-1)/2.0)*100 + i;
+      for (int c=0; c<fpp; c++) {
+         double expect = (c == 0) ? mean : -mean;
+         if (fabs(sink.data[k][fpp*i + c] - expect) > 1e-3) {
+            std::cerr << "level spectrum " << k << " point " << i << " is " << sink.data[k][fpp*i + c]
+                      << " instead of " << expect << std::endl;
+            errors++;
+         }
+      }
+   }
+   bufrecord_t const& rec = sink.records[k][0];
+   size_t samples = 0;
+   int    ffts    = 0;
+   for (int s=first; s<first+factor; s++) {
+      samples += 1000 + s;
+      ffts    += 10 + s;
+   }
+   if ((rec.time_s != first) || (rec.valid_samples != samples) || (rec.ffts != ffts) || rec.partial) {
+      std::cerr << "level spectrum " << k << " has time " << rec.time_s << ", " << rec.valid_samples
+                << " samples and " << rec.ffts << " FFTs instead of " << first << ", " << samples
+                << " and " << ffts << std::endl;
+      errors++;
+   }
+   return errors;
+}
+
+int main(int argc, char** argv)
+{
+   const size_t n = 5;
+   const int factor = 3;
+   int errors = 0;
+
+   swspect_settings_t s;
+   s.num_sources  = 1;
+   s.out_points   = n;
+   s.sk_flag_mode = SKFlagNaN;
+   s.out_selection.assign(2, (BinSelection*)NULL);
+
+   LevelTestSink power_sink, xpol_sink, weight_sink;
+   std::vector<DataSink*> sinks, wsinks;
+   sinks.push_back(&power_sink);
+   sinks.push_back(&xpol_sink);
+   wsinks.push_back(&weight_sink);
+   wsinks.push_back(NULL);
+   IntegrationLevel level(&s, factor, sinks, wsinks);
+
+   /* nothing is written before factor base spectra are in, also when they come in several buffers */
+   Buffer power(4 * n * sizeof(swsfloat_t)), xpol(8 * n * sizeof(swsfloat_t));
+   level_test_fill(power, xpol, 0, 2, n, false);
+   level.add(0, &power);
+   level.add(1, &xpol);
+   if (!power_sink.data.empty() || !xpol_sink.data.empty()) {
+      std::cerr << "level was written after " << 2 << " of " << factor << " base spectra" << std::endl;
+      errors++;
+   }
+
+   /* four more make two level spectra */
+   level_test_fill(power, xpol, 2, 4, n, false);
+   level.add(0, &power);
+   level.add(1, &xpol);
+   errors += level_test_check(power_sink, 0, 0, factor, n, 1);
+   errors += level_test_check(power_sink, 1, 3, factor, n, 1);
+   errors += level_test_check(xpol_sink,  0, 0, factor, n, 2);
+   errors += level_test_check(xpol_sink,  1, 3, factor, n, 2);
+
+   /* two complete spectra and a partial one from EOF do not make a level spectrum */
+   level_test_fill(power, xpol, 6, 3, n, true);
+   level.add(0, &power);
+   level.add(1, &xpol);
+   if ((power_sink.data.size() != 2) || (xpol_sink.data.size() != 2)) {
+      std::cerr << "the partial EOF spectrum completed a level spectrum" << std::endl;
+      errors++;
+   }
+
+   /* after one more the partial spectrum is left out of the average */
+   level_test_fill(power, xpol, 8, 1, n, false);
+   level.add(0, &power);
+   level.add(1, &xpol);
+   errors += level_test_check(power_sink, 2, 6, factor, n, 1);
+   errors += level_test_check(xpol_sink,  2, 6, factor, n, 2);
+
+   /* flagged points are averaged over the unflagged spectra only, or marked if there are none */
+   Buffer flags(4 * n);
+   unsigned char* fl = (unsigned char*)flags.getData();
+   level_test_fill(power, xpol, 9, 3, n, false);
+   memset(fl, 0, 3*n);
+   fl[0*n + 1] = 1;
+   fl[0*n + 2] = 1;
+   fl[1*n + 2] = 1;
+   fl[2*n + 2] = 1;
+   flags.setLength(3*n);
+   level.add(0, &power, &flags);
+   if ((power_sink.data.size() != 4) || (weight_sink.data.size() != 4)) {
+      std::cerr << "flagged level spectrum or its weights are missing" << std::endl;
+      errors++;
+   } else {
+      std::vector<swsfloat_t> const& p = power_sink.data[3];
+      std::vector<swsfloat_t> const& w = weight_sink.data[3];
+      if ((fabs(p[0] - 1000.0) > 1e-3) || (fabs(p[1] - 1051.0) > 1e-3) || !std::isnan(p[2])) {
+         std::cerr << "flagged level spectrum is " << p[0] << " " << p[1] << " " << p[2] << std::endl;
+         errors++;
+      }
+      if ((w[0] != 3.0f) || (w[1] != 2.0f) || (w[2] != 0.0f) || (weight_sink.records[3].size() != 1)) {
+         std::cerr << "weights of the flagged level spectrum are " << w[0] << " " << w[1] << " " << w[2] << std::endl;
+         errors++;
+      }
+   }
+   if (weight_sink.data.size() != power_sink.data.size()) {
+      std::cerr << "weights were written " << weight_sink.data.size() << " times for "
+                << power_sink.data.size() << " level spectra" << std::endl;
+      errors++;
+   }
+
+   /* every level spectrum was completed */
+   if (level.close() != 0) {
+      std::cerr << "close() dropped incomplete spectra of a level that had none" << std::endl;
+      errors++;
+   }
+
+   std::cerr << "IntegrationLevel test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,87 @@
+#ifndef INTEGRATIONLEVEL_H
+#define INTEGRATIONLEVEL_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+#include "DataSink.h"
+
+#include <vector>
+
+/**
+  * class IntegrationLevel
+  * A longer integration time that is an integer multiple of the base
+  * FFTIntegrationTimeSec. Every base spectrum that is written out is
+  * passed to each level, by the TaskDispatcher or, for spectra assembled
+  * from several cores, by the worker that finishes it. The level sums
+  * them up and writes the averaged longer spectrum to its own sinks once
+  * enough are in. Points flagged by the spectral kurtosis are left out of
+  * the average, and how many base spectra each point averages is written
+  * to the weight sinks.
+  */
+
+class IntegrationLevel
+{
+public:
+   /**
+    * Prepare the accumulators of one level.
+    * @param settings Pointer to the global settings
+    * @param factor   How many base spectra go into one spectrum of this level
+    * @param sinks    Output sinks of this level, in the same order as the base spectrum sinks
+    * @param weightsinks  Per base sink the output of the number of spectra averaged in each point, or NULL
+    */
+   IntegrationLevel(swspect_settings_t* settings, int factor, std::vector<DataSink*> const& sinks,
+                    std::vector<DataSink*> const& weightsinks);
+
+   /**
+    * Release the accumulators
+    */
+   ~IntegrationLevel();
+
+   /**
+    * Add base spectra that were written to a base sink, and write out
+    * every completed spectrum of this level. A partial spectrum from
+    * the end of the data is not an average and is left out. Different
+    * base sinks may be added concurrently.
+    * @param sink     Index of the base sink
+    * @param spectra  Buffer with one or more spectra as written to the base sink, not yet flagged
+    * @param flags    One byte per point of the spectra, nonzero to leave the point out, or NULL
+    */
+   void add(int sink, Buffer* spectra, Buffer* flags = NULL);
+
+   /**
+    * Close the sinks. Spectra of this level that were not completed are dropped.
+    * @return int     Number of incomplete spectra that were dropped
+    */
+   int close();
+
+private:
+   swspect_settings_t* cfg;
+   int factor;                        // base spectra per spectrum of this level
+   std::vector<DataSink*> sinks;      // per base sink the sink of this level
+   std::vector<DataSink*> weightsinks; // per base sink the sink of the points' weights, or NULL
+   std::vector<Buffer*> accu;         // per base sink the running sum
+   std::vector<Buffer*> used;         // per base sink and float the number of summed unflagged base spectra
+   std::vector<int> count;            // per base sink the number of summed base spectra
+   std::vector<size_t> floats;        // per base sink the floats in one written spectrum
+};
+
+#endif // INTEGRATIONLEVEL_H
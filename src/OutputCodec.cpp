@@ -0,0 +1,252 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "OutputCodec.h"
+#include <cstring>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+/**
+ * Convert float32 values to IEEE float16, rounding to nearest even.
+ * Values beyond the float16 range become +-inf.
+ * @param in   input values
+ * @param out  output values
+ * @param n    number of values
+ */
+void OutputCodec::to_float16(float const* in, uint16_t* out, size_t n)
+{
+   const uint32_t denorm_magic = ((127 - 15) + (23 - 10) + 1) << 23;
+   for (size_t i=0; i<n; i++) {
+      uint32_t x;
+      memcpy(&x, &in[i], sizeof(x));
+      uint16_t sign = (x >> 16) & 0x8000;
+      x &= 0x7FFFFFFF;
+
+      uint16_t h;
+      if (x >= 0x7F800000) {
+         /* inf stays inf, NaN stays a quiet NaN */
+         h = (x > 0x7F800000) ? 0x7E00 : 0x7C00;
+      } else if (x >= 0x477FF000) {
+         /* rounds to beyond 65504 */
+         h = 0x7C00;
+      } else if (x < 0x38800000) {
+         /* float16 subnormal or zero: let the FPU round at the right bit position */
+         float f, magic;
+         memcpy(&f, &x, sizeof(f));
+         memcpy(&magic, &denorm_magic, sizeof(magic));
+         f += magic;
+         uint32_t r;
+         memcpy(&r, &f, sizeof(r));
+         h = uint16_t(r - denorm_magic);
+      } else {
+         /* normal: rebias the exponent and round the dropped 13 mantissa bits to even */
+         uint32_t odd = (x >> 13) & 1;
+         x += (uint32_t(15 - 127) << 23) + 0xFFF + odd;
+         h = uint16_t(x >> 13);
+      }
+      out[i] = sign | h;
+   }
+}
+
+
+/**
+ * Convert float32 values to bfloat16, rounding to nearest even.
+ * @param in   input values
+ * @param out  output values
+ * @param n    number of values
+ */
+void OutputCodec::to_bfloat16(float const* in, uint16_t* out, size_t n)
+{
+   for (size_t i=0; i<n; i++) {
+      uint32_t x;
+      memcpy(&x, &in[i], sizeof(x));
+      if ((x & 0x7FFFFFFF) > 0x7F800000) {
+         out[i] = uint16_t((x >> 16) | 0x0040);
+      } else {
+         x += 0x7FFF + ((x >> 16) & 1);
+         out[i] = uint16_t(x >> 16);
+      }
+   }
+}
+
+
+/**
+ * Byte-shuffle an array: first the byte 0 of all elements, then byte 1, ...
+ * @param in         input elements
+ * @param out        output, same size as the input
+ * @param n          number of elements
+ * @param elembytes  bytes per element
+ */
+void OutputCodec::shuffle(char const* in, char* out, size_t n, size_t elembytes)
+{
+   for (size_t b=0; b<elembytes; b++) {
+      char const* src = in + b;
+      char* dst = out + b*n;
+      for (size_t i=0; i<n; i++) {
+         dst[i] = *src;
+         src += elembytes;
+      }
+   }
+}
+
+
+/**
+ * @return true if the program was built with LZ4 support
+ */
+bool OutputCodec::have_lz4()
+{
+#ifdef HAVE_LZ4
+   return true;
+#else
+   return false;
+#endif
+}
+
+
+/**
+ * @return Worst-case output size of compress() for the given input size
+ */
+size_t OutputCodec::compress_bound(size_t bytes)
+{
+#ifdef HAVE_LZ4
+   return LZ4_compressBound(int(bytes));
+#else
+   return bytes;
+#endif
+}
+
+
+/**
+ * Compress with LZ4.
+ * @return Number of compressed bytes, or 0 if the data did not get smaller
+ * @param in     input data
+ * @param out    output of at least compress_bound(bytes)
+ * @param bytes  input size
+ */
+size_t OutputCodec::compress(char const* in, char* out, size_t bytes)
+{
+#ifdef HAVE_LZ4
+   int n = LZ4_compress_default(in, out, int(bytes), int(compress_bound(bytes)));
+   if ((n <= 0) || (size_t(n) >= bytes)) {
+      return 0;
+   }
+   return size_t(n);
+#else
+   return 0;
+#endif
+}
+
+
+#ifdef UNIT_TEST_CODEC
+// g++ -Wall -DUNIT_TEST_CODEC=1 OutputCodec.cpp -o codectest
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+static float from_float16(uint16_t h)
+{
+   int   e = (h >> 10) & 0x1F;
+   int   m = h & 0x3FF;
+   float v;
+   if (e == 0)       { v = std::ldexp(float(m), -24); }
+   else if (e == 31) { v = (m == 0) ? INFINITY : NAN; }
+   else              { v = std::ldexp(float(m + 1024), e - 25); }
+   return (h & 0x8000) ? -v : v;
+}
+
+static float from_bfloat16(uint16_t b)
+{
+   uint32_t x = uint32_t(b) << 16;
+   float v;
+   memcpy(&v, &x, sizeof(v));
+   return v;
+}
+
+int main(int argc, char** argv)
+{
+   int errors = 0;
+
+   /* values that float16 holds exactly, rounding to even, overflow and subnormals */
+   const float    in[]  = { 0.0f, 1.0f, -2.5f, 65504.0f, 6.103515625e-5f, 5.9604645e-8f,
+                            1.0f + 1.0f/2048, 1.0f + 3.0f/2048, 65520.0f, 1e-9f, INFINITY };
+   const uint16_t out[] = { 0x0000, 0x3C00, 0xC100, 0x7BFF, 0x0400, 0x0001,
+                            0x3C00, 0x3C02, 0x7C00, 0x0000, 0x7C00 };
+   const size_t   n     = sizeof(in) / sizeof(float);
+   uint16_t h[n];
+   OutputCodec::to_float16(in, h, n);
+   for (size_t i=0; i<n; i++) {
+      if (h[i] != out[i]) {
+         std::cerr << "float16 of " << in[i] << " is 0x" << std::hex << h[i] << " instead of 0x" << out[i] << std::dec << std::endl;
+         errors++;
+      }
+   }
+   float nan = NAN;
+   OutputCodec::to_float16(&nan, h, 1);
+   if (!std::isnan(from_float16(h[0]))) {
+      std::cerr << "float16 of NaN is not NaN" << std::endl;
+      errors++;
+   }
+
+   /* round trip of random spectral values, within half a unit in the last place */
+   const size_t nr = 100000;
+   float*    v  = new float[nr];
+   uint16_t* vh = new uint16_t[nr];
+   uint16_t* vb = new uint16_t[nr];
+   srand(1);
+   for (size_t i=0; i<nr; i++) {
+      v[i] = std::ldexp(float(rand()) / RAND_MAX + 0.5f, (rand() % 35) - 20) * ((rand() & 1) ? 1 : -1);
+   }
+   OutputCodec::to_float16(v, vh, nr);
+   OutputCodec::to_bfloat16(v, vb, nr);
+   for (size_t i=0; i<nr; i++) {
+      float eh = std::fabs(from_float16(vh[i]) - v[i]) / std::fabs(v[i]);
+      float eb = std::fabs(from_bfloat16(vb[i]) - v[i]) / std::fabs(v[i]);
+      if ((std::fabs(v[i]) >= 6.103515625e-5f) && (eh > 1.0f/2048)) {
+         std::cerr << "float16 round trip of " << v[i] << " gives " << from_float16(vh[i]) << std::endl;
+         errors++;
+      }
+      if (eb > 1.0f/256) {
+         std::cerr << "bfloat16 round trip of " << v[i] << " gives " << from_bfloat16(vb[i]) << std::endl;
+         errors++;
+      }
+   }
+
+   /* byte-shuffle and back */
+   char* sh = new char[nr * sizeof(float)];
+   char const* raw = (char const*)v;
+   OutputCodec::shuffle(raw, sh, nr, sizeof(float));
+   for (size_t i=0; i<nr; i++) {
+      for (size_t b=0; b<sizeof(float); b++) {
+         if (sh[b*nr + i] != raw[i*sizeof(float) + b]) {
+            errors++;
+         }
+      }
+   }
+
+   delete[] sh;
+   delete[] vb;
+   delete[] vh;
+   delete[] v;
+   std::cerr << "OutputCodec test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
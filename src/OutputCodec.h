@@ -0,0 +1,84 @@
+#ifndef OUTPUTCODEC_H
+#define OUTPUTCODEC_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include <cstddef>
+#include <stdint.h>
+
+/**
+  * class OutputCodec
+  * Conversions that make the written spectra smaller: float32 to the
+  * 16-bit float16 (IEEE half) or bfloat16 formats, and a lossless
+  * byte-shuffle plus LZ4 compression of whole records.
+  */
+
+class OutputCodec
+{
+public:
+   /**
+    * Convert float32 values to IEEE float16, rounding to nearest even.
+    * Values beyond the float16 range become +-inf.
+    * @param in   input values
+    * @param out  output values
+    * @param n    number of values
+    */
+   static void to_float16(float const* in, uint16_t* out, size_t n);
+
+   /**
+    * Convert float32 values to bfloat16, rounding to nearest even.
+    * @param in   input values
+    * @param out  output values
+    * @param n    number of values
+    */
+   static void to_bfloat16(float const* in, uint16_t* out, size_t n);
+
+   /**
+    * Byte-shuffle an array: first the byte 0 of all elements, then byte 1, ...
+    * Neighbouring spectral points share their upper bytes, the shuffle
+    * turns those into long runs that compress well.
+    * @param in         input elements
+    * @param out        output, same size as the input
+    * @param n          number of elements
+    * @param elembytes  bytes per element
+    */
+   static void shuffle(char const* in, char* out, size_t n, size_t elembytes);
+
+   /**
+    * @return true if the program was built with LZ4 support
+    */
+   static bool have_lz4();
+
+   /**
+    * @return Worst-case output size of compress() for the given input size
+    */
+   static size_t compress_bound(size_t bytes);
+
+   /**
+    * Compress with LZ4.
+    * @return Number of compressed bytes, or 0 if the data did not get smaller
+    * @param in     input data
+    * @param out    output of at least compress_bound(bytes)
+    * @param bytes  input size
+    */
+   static size_t compress(char const* in, char* out, size_t bytes);
+};
+
+#endif // OUTPUTCODEC_H
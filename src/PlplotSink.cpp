@@ -23,6 +23,7 @@
 #include <fstream>
 #include <string>
 #include <cmath>
+#include <algorithm>
 
 #ifdef PLFLT
 #warn "PLPlot settings are for 'double', should be 'float'!"
@@ -60,7 +61,7 @@ size_t PlpotSink::write(Buffer *buf)
 
    float* src = (float*) buf->getData();
    float  ppeak = -1e9, npeak = 1e9;
-   size_t len = settings->fft_ssb_points; // len = buf->getLength() / (sizeof(float));
+   size_t len = std::min((size_t)settings->out_points, buf->getLength() / sizeof(float)); // less with OutputBinRanges
 
    float xscale;
    std::string xlabel("FFT point");
@@ -70,7 +71,11 @@ size_t PlpotSink::write(Buffer *buf)
    xlabel = std::string("Video BW in MHz");
 
    for (size_t i=0; i<len; i++) {
-      xdata[i] = xscale*PLFLT(i);
+      if (settings->sparse_bins.empty()) {
+         xdata[i] = xscale*PLFLT(i);
+      } else {
+         xdata[i] = xscale*PLFLT(settings->sparse_bins[i]);
+      }
       // ydata[i] = log10(abs(*(src+0))); // Re, skip Im if data is {Re,Im}
       // src += 2;
       if (*src == 0.0f) {
@@ -26,6 +26,7 @@
 #include "LogFile.h"
 
 #include <vector>
+#include <pthread.h>
 
 #if defined(INTEL_IPP)
    #define PLATFORM_MAX_RAW_BUF_SIZE_MB     32
@@ -35,6 +36,14 @@
    #define PLATFORM_MAX_RAW_BUF_SIZE_MB     16
 #endif
 
+// Cost of a real-valued FFT per sample and log2(points), relative to the one multiply-add
+// per sample and bin of a Goertzel filter. Used to choose between the two in sparse-bin mode.
+#define SPARSE_FFT_COST_PER_LOG2    1.0
+
+// Points on either side of a detected spectral peak that are left out of the noise
+// statistics, wide enough for the main lobe of the window functions.
+#define PEAK_EXCLUDE_POINTS         3
+
 typedef float               swsfloat_t;
 typedef unsigned long long  swsint64_t;
 
@@ -42,15 +51,32 @@ typedef struct _swscomplex_t {
    swsfloat_t re, im;
 } swscomplex_t;
 
+typedef struct _swspeak_t {
+   double     freq;          // interpolated peak frequency in Hz
+   swsfloat_t bin;           // interpolated peak position in FFT bins
+   swsfloat_t power;         // interpolated peak power
+   swsfloat_t noise;         // mean power in the search band away from the peak
+   swsfloat_t noise_rms;     // rms of the power in the search band away from the peak
+   swsfloat_t snr;           // (power - noise) / noise_rms
+   int        window_bin;    // FFT bin of the first point in the peak window output, -1 without window
+} swspeak_t;
+
 enum WindowFunctionType { None, Cosine, Cosine2, Hamming, Hann, Blackman };
-enum OutputFormat { Ascii, Binary };
+enum OutputFormat { Ascii, Binary, Container };
+enum SamplePrecision { Float32, Float16, BFloat16 };
+enum RebinMode { RebinSum, RebinMean, RebinMax };
+enum SKFlagMode { SKFlagNone, SKFlagNaN, SKFlagZero };
 enum InputFormat  { Unknown=-1, RawSigned, RawUnsigned, Mk5B, iBOB, VDIF, VLBA, MKIV, Mark5B, Maxim };
 
 class DataSink;
 class DataSource;
 class Buffer;
+class BinSelection;
 class LogFile;
 class TeeStream;
+class IntegrationLevel;
+class SpectrumRebin;
+class SpectralKurtosis;
 
 // ------------------------------------------------------------------------
 //   Settings Struct
@@ -61,15 +87,25 @@ typedef struct swspect_settings_tt {
    // -- command line / INI : calculation parameters
 
    int num_cores;                // max number of CPU cores to use
+   std::vector<int> core_cpu_first; // CPU set of each core's worker thread as a range of CPU numbers,
+   std::vector<int> core_cpu_last;  // core c uses range c modulo the number of ranges, empty to not pin
+   std::vector<int> core_numa_node; // NUMA node of the CPUs of each core, -1 if unknown or not pinned
+   bool use_hugepages;           // true to place large buffers on 2 MB huge pages
+   int fft_threads;              // threads that cooperate inside each FFT of a core, 1 for a single thread
 
    size_t fft_points;            // number of FFT/DFT points
    swsfloat_t fft_integ_seconds; // seconds of data integrated into a "dynamic spectrum"
+   std::vector<int> integ_levels;// extra longer integration times, as multiples of fft_integ_seconds
+   std::vector<int> rebin_factors; // sorted power-of-two factors of the extra coarser-resolution outputs
+   RebinMode rebin_mode;         // how the points of each group are combined in the coarser outputs
    int fft_overlap_factor;       // add (fft_points/fft_overlap_factor) new samples to each next overlapped FFT
    WindowFunctionType wf_type;   // window function to be used for FFT/DFT
+   std::vector<int> sparse_bins; // sorted FFT bins to compute in the sparse-bin mode, empty for full spectra
 
    int bits_per_sample;          // raw input data bits per sample (1,2,4,8,16,...)
    bool channelorder_increasing; // how the channels are ordered, channel#0 in MSB or channel#0 in LSB of first byte
    int seconds_to_skip;          // skip ahead in the input data by x seconds
+   int source_date_mjd;          // approximate MJD of the recording for truncated MJDs in headers, 0 for the input file date
 
    int source_channels;          // number of channels in the data source(s) (CH)
    int use_channel_file1;        // which one of the source channel(s) in input file 1 to use in calcs (1..CH)
@@ -82,8 +118,31 @@ typedef struct swspect_settings_tt {
    size_t max_rawbuf_size;       // the max size in Megabyte to use for each raw input source
 
    bool extract_PCal;            // true to extract the phase of the multitone phase-cal signal
+   bool pcal_from_fft;           // true to pick the phase-cal tones out of the FFT output when they fall onto bins
    bool calc_Xpol;               // true to calculate cross-polarization
-   bool costas_loop;             // true to calculate the Costas Loop for S/C signal with a carrier
+   bool costas_loop;             // true to track a S/C carrier with a Costas loop or PLL
+   bool costas_suppressed_carrier;  // true for a Costas loop (suppressed-carrier BPSK), false for a PLL
+   double costas_carrier_hz;        // a-priori carrier frequency in Hz within the sampled band
+   swsfloat_t costas_loop_bw_hz;    // one-sided loop noise bandwidth in Hz
+   swsfloat_t costas_update_rate_hz;// loop update rate in Hz, i.e. rate of the integrate-and-dump blocks
+   swsfloat_t costas_output_rate_hz;// rate in Hz of the output phase/frequency time series
+   bool peak_detect;             // true to find the strongest peak in each integrated spectrum
+   double peak_search_lo_hz;     // frequency band in Hz that is searched for the peak
+   double peak_search_hi_hz;
+   bool peak_gaussian;           // true for Gaussian, false for parabolic sub-bin interpolation of the peak
+   int peak_window_bins;         // also output the points within +-bins around each peak, 0 for none
+   bool sampler_stats;           // true to count the quantisation state occupancy during every integrated spectrum
+   swsfloat_t tpow_rate_hz;      // rate in Hz of the total power time series, 0 for none
+   bool spectral_kurtosis;       // true to output the spectral kurtosis estimator of every integrated spectrum
+   swsfloat_t sk_threshold;      // flag bins whose estimator deviates from 1 by more than this many sigma
+   SKFlagMode sk_flag_mode;      // how flagged bins are marked in the written power spectra
+   double switch_period_s;       // period in seconds of the noise diode or other ON/OFF switching, 0 for none
+   double switch_phase;          // phase of the switching cycle at the first sample, in periods (0..1)
+   double switch_on_fraction;    // part of each cycle in the ON state, the ON state comes first
+   int fold_bins;                // number of phase bins of the folded spectra, 0 for no folding
+   double fold_period_s;         // folding period in seconds at the epoch
+   double fold_period_dot;       // derivative of the folding period, in seconds per second
+   double fold_epoch_s;          // time of phase 0 in seconds after the first sample
    bool use_live_plot;           // plot the data in addition to writing to an output sink
 
    std::string basefilename1_pattern;  // base output file name with path and placeholders
@@ -94,6 +153,19 @@ typedef struct swspect_settings_tt {
    std::vector<DataSource*> sources;   // all input data sources (can be either one or two)
    std::vector<DataSink*>   sinks;     // all output data sinks (can be one, two or with cross-pol three)
    std::vector<DataSink*>   pcalsinks; // all additional PCal signal output sinks
+   std::vector<DataSink*>   costassinks; // all carrier tracking output sinks
+   std::vector<DataSink*>   peaksinks;   // all spectral peak output sinks
+   std::vector<DataSink*>   peakwinsinks; // all output sinks for the spectrum window around the peak
+   std::vector<BinSelection*> out_selection; // per spectrum sink the kept bin ranges, or NULL to keep all bins
+   std::vector<DataSink*>   levelsinks; // spectrum sinks of the extra integration levels, [level*num_sinks + sink]
+   std::vector<DataSink*>   rebinsinks; // spectrum sinks of the coarser resolutions, [factor*num_sinks + sink]
+   std::vector<DataSink*>   levelweightsinks; // with SK flagging the base spectra in each point of levelsinks, else NULL
+   std::vector<DataSink*>   rebinweightsinks; // with SK flagging the unflagged points in each point of rebinsinks, else NULL
+   std::vector<DataSink*>   sksinks;    // spectral kurtosis output sinks, one per source
+   std::vector<DataSink*>   statesinks; // quantisation state histogram output sinks, one per source
+   std::vector<DataSink*>   tpowsinks;  // total power time series output sinks, one per source
+   std::vector<DataSink*>   onsinks;    // ON-state spectrum sinks of the switching, one per source
+   std::vector<DataSink*>   foldsinks;  // phase-binned spectrum sinks of the folding, one per source
 
    int num_sources;
    int num_sinks;
@@ -102,6 +174,11 @@ typedef struct swspect_settings_tt {
    InputFormat  sourceformat;
    std::string  sourceformat_str;
    OutputFormat sinkformat;
+   int sink_queue_len;           // buffers queued per output sink for its writer thread, 0 to write synchronously
+   int sink_flush_writes;        // flush the output sinks after every N writes, 0 for no limit
+   double sink_flush_seconds;    // flush the output sinks at least every N seconds, 0 for no limit
+   SamplePrecision sink_precision; // precision of the written float and complex data
+   bool sink_compress;           // byte-shuffle and LZ4-compress each record of the Container format
 
    // -- internal parameters
 
@@ -112,6 +189,30 @@ typedef struct swspect_settings_tt {
 
    Buffer***  outbuffersPCal;  // pointers to #cores of #sources output buffers - PCal detection results
 
+   Buffer***  outbuffersCostas; // pointers to #cores of #sources output buffers - carrier downconverted blocks
+
+   Buffer***  outbuffersPeak;   // pointers to #cores of #sources output buffers - spectral peaks
+   Buffer***  outbuffersPeakWin; // pointers to #cores of #sources output buffers - spectrum windows around the peaks
+   Buffer***  outbuffersSK;     // pointers to #cores of #sources output buffers - sum of power and of power^2 per bin
+   Buffer***  outbuffersStates; // pointers to #cores of #sources output buffers - quantisation state histograms
+   Buffer***  outbuffersTPow;   // pointers to #cores of #sources output buffers - total power blocks
+   Buffer***  outbuffersOn;     // pointers to #cores of #sources output buffers - ON-state spectra of the switching
+   Buffer***  outbuffersFold;   // pointers to #cores of #sources output buffers - fold_bins spectra per integrated spectrum
+
+   Buffer***  combinedSpectra;  // ring of [#slots][#sinks] spectra assembled from the sub-spectra of several cores
+   Buffer***  combinedPCal;     // ring of [#slots][#sources] PCal results assembled likewise
+   Buffer***  combinedSK;       // ring of [#slots][#sources] spectral kurtosis sums assembled likewise
+   Buffer***  combinedStates;   // ring of [#slots][#sources] quantisation state histograms assembled likewise
+   Buffer***  combinedOn;       // ring of [#slots][#sources] ON-state spectra assembled likewise
+   Buffer***  combinedFold;     // ring of [#slots][#sources] folded spectra assembled likewise
+   Buffer***  combinedPeak;     // ring of [#slots][#sources] spectral peaks of the assembled spectra
+   Buffer***  combinedPeakWin;  // ring of [#slots][#sources] spectrum windows around those peaks
+   int        combined_slots;   // slots in the ring, i.e. spectra being assembled or waiting to be written
+   pthread_barrier_t* reduce_barrier; // all cores meet here before they sum up the sub-spectra
+   IntegrationLevel** levels;   // longer integration times built from the written spectra, one per integ_levels entry
+   SpectrumRebin*     rebin;    // coarser resolutions built from the written spectra, or NULL
+   SpectralKurtosis*  kurtosis; // RFI estimator and flagging of the power spectra, or NULL
+
    // -- "derived" parameters
 
    std::string basefilename1;  // placeholders filled, final string prepended to all output file names
@@ -122,33 +223,63 @@ typedef struct swspect_settings_tt {
    swsfloat_t df;              // FFT bin frequency resolution
 
    int averaged_ffts;            // how many non-overlapped FFTs have to be added for one spectrum
-   int averaged_overlapped_ffts; // the overlapped FFTs every CPU core has to do for one full/partial spectrum
+   int averaged_overlapped_ffts; // how many overlapped FFTs are added for one spectrum
 
    int fft_overlap_points;       // number of samples in the fresh-data part in overlapped DFT/FFT
    int fft_ssb_points;           // single sideband points including Nyquist (fft_points/2 + 1)
+   int out_points;               // points in one output spectrum, fft_ssb_points or the number of sparse bins
+   bool sparse_goertzel;         // true to evaluate sparse bins with a Goertzel bank, false to pick them from a full FFT
 
    double rawbytes_per_channelsample; // input bytes consumed to get a single sample from a channel
    size_t raw_fullfft_bytes;          // raw bytes needed to get enough samples to do a full FFT
    size_t raw_overlap_bytes;          // raw bytes needed to shift in fresh samples for an overlapped FFT
+   size_t raw_carry_bytes;            // raw bytes from the end of a raw buffer carried to the front of the next one
    size_t fft_bytes;                  // real-valued double-sideband spectrum output bytes (sizeof(real)*fftpoints)
-   size_t fft_bytes_ssb;              // real-valued single-sideband spectrum output bytes (sizeof(real)*(fftpoints/2+1))
+   size_t fft_bytes_ssb;              // real-valued single-sideband spectrum output bytes (sizeof(real)*out_points)
    size_t fft_bytes_xpol;             // complex-valued single-sideband cross spectrum output bytes (2*fft_bytes_ssb)
 
-   size_t rawbuf_size;                // how large chunks of raw data per each TaskCore to allocate
+   size_t rawbuf_size;                // how large chunks of raw data per each TaskCore to allocate, a multiple of raw_overlap_bytes
    int max_spectra_per_buffer;        // maximum number of spectra from one raw buffer processing pass
    int max_specffts_per_buffer;       // maximum number of non-overlapped FFTs out of #averaged_ffts that
                                       // can be done on one raw buffer (if several spectra fit, the value
-                                      // is ==averaged_ffts)
+                                      // is ==averaged_ffts, if a spectrum needs several buffers it is rounded down)
    int max_buffers_per_spectrum;      // the other way round, how many raw bufs are needed at most for
                                       // one spectrum
    int core_overlapped_ffts;          // number of overlapped FFTs of one spectrum a core can do (=1..averaged_overlapped_ffts)
    int core_averaged_ffts;            // number of non-overlapped -"- ...
 
-   int pcal_tonebins;                 // bin count for final pcal tones result, fs MHz / f_pcal 1MHz
-   int pcal_rotatorlen;               // after how many bins the pcal signal repeats, given a pcal offset frequency Hz
-   int pcal_pulses;                   // how many _tonebins pulses fit into _veclen
-   int pcal_pulses_per_fft;           // how many _veclen vectors can be taken from input samples of one FFT
+   int pcal_tonebins;                 // number of pcal tones in the band, one complex value each in the result
+   int pcal_rotatorlen;               // after how many samples the pcal signal repeats, extraction phase is referenced to sample index modulo this
    size_t pcal_result_bytes;          // how many bytes needed for pcal_tonebins of complex numbers
+   int pcal_nbins;                    // normalization of the extracted tones, PCal::getNBins() of the extractor
+   int pcal_first_bin;                // FFT bin of the first pcal tone, when pcal_from_fft
+   int pcal_bin_step;                 // FFT bins between pcal tones, when pcal_from_fft
+
+   int costas_block_len;              // samples per integrate-and-dump block, divides fft_points
+   int costas_blocks_per_fft;         // how many blocks come from the samples of one FFT
+   int costas_output_decim;           // how many blocks go into one output point
+   size_t costas_result_bytes;        // how many bytes of blocks one raw buffer can produce
+
+   int sampler_states;                // quantisation states counted per source, see DataUnpacker::num_states()
+   int tpow_block_len;                // samples per total power block, divides fft_points
+   int tpow_blocks_per_fft;           // how many blocks come from the samples of one FFT
+   int tpow_output_decim;             // how many blocks go into one output point
+   size_t tpow_result_bytes;          // how many bytes of blocks one raw buffer can produce
+
+   double switch_period_samples;      // switching cycle in samples, 0 without switching
+   double switch_on_samples;          // ON part at the start of each cycle, in samples
+   double switch_phase_samples;       // position in the cycle of sample 0, in samples
+
+   double fold_epoch_samples;         // folding phase 0 at this sample index
+   double fold_f0;                    // folding frequency at the epoch, in cycles per sample
+   double fold_f1;                    // its derivative, in cycles per sample^2
+
+   int time_ref_mjd;                  // MJD of the time reference of the buffer and spectrum times, -1 without time stamps in the data
+   double time_ref_sec;               // seconds into that day, such that the first sample after skipping is at seconds_to_skip
+
+   int peak_first_point;              // search band for the peak, as indices into a computed spectrum
+   int peak_last_point;
+   int peak_window_points;            // points in the window around the peak, 0 without window output
 
    // -- text-based output files
 
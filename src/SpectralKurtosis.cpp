@@ -0,0 +1,333 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "SpectralKurtosis.h"
+#include "BinSelection.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+/**
+ * Prepare the estimator output.
+ * @param settings Pointer to the global settings
+ * @param sinks    SK output sinks, one per source
+ */
+SpectralKurtosis::SpectralKurtosis(swspect_settings_t* settings, std::vector<DataSink*> const& sinks)
+{
+   this->cfg   = settings;
+   this->sinks = sinks;
+   for (int s=0; s<cfg->num_sources; s++) {
+      skbuf.push_back(new Buffer(std::max(cfg->max_spectra_per_buffer, 1) * cfg->fft_bytes_ssb));
+      flags.push_back(new Buffer(std::max(cfg->max_spectra_per_buffer, 1) * cfg->out_points));
+      num_flagged.push_back(0);
+   }
+
+   /* M non-overlapped FFTs per spectrum, the estimator has a variance of
+    * 4M^2/((M-1)(M+2)(M+3)) for Gaussian noise */
+   double M = cfg->averaged_ffts;
+   sk_scale = (M + 1.0) / (M - 1.0);
+   sk_limit = cfg->sk_threshold * sqrt(4.0*M*M / ((M - 1.0) * (M + 2.0) * (M + 3.0)));
+
+   /* the points of each output that hold the real-valued DC and Nyquist bins */
+   real_bin.resize(cfg->num_sources);
+   for (int s=0; s<cfg->num_sources; s++) {
+      BinSelection const* sel = cfg->out_selection[s];
+      int n = (sel != NULL) ? sel->getLength() : cfg->out_points;
+      real_bin[s].resize(n);
+      for (int i=0; i<n; i++) {
+         int bin = (sel != NULL) ? sel->getBin(i) : (cfg->sparse_bins.empty() ? i : cfg->sparse_bins[i]);
+         real_bin[s][i] = (bin == 0) || (bin == (cfg->fft_ssb_points - 1));
+      }
+   }
+}
+
+/**
+ * Release the output buffers
+ */
+SpectralKurtosis::~SpectralKurtosis()
+{
+   for (size_t s=0; s<skbuf.size(); s++) {
+      delete skbuf[s];
+      delete flags[s];
+   }
+}
+
+/**
+ * Compute the estimator of spectra, write it out, and mark the points
+ * that are to be flagged. The spectra are left as they are until flag().
+ * Different sources may be done concurrently.
+ * @return int     Number of points that were flagged
+ * @param  source  Index of the source
+ * @param  moments S1 and S2 of each spectrum, both as written to the sink of the source
+ * @param  spectra Buffer with the matching power spectra
+ */
+int SpectralKurtosis::apply(int source, Buffer* moments, Buffer* spectra)
+{
+   size_t n   = (cfg->out_selection[source] != NULL) ? cfg->out_selection[source]->getLength() : cfg->out_points;
+   size_t num = spectra->getLength() / (n * sizeof(swsfloat_t));
+   const double M = cfg->averaged_ffts;
+   int flagged = 0;
+
+   flags[source]->setLength(0);
+   if ((moments->getLength() < 2*num*n*sizeof(swsfloat_t)) || (skbuf[source]->getAllocated() < num*n*sizeof(swsfloat_t))
+       || (flags[source]->getAllocated() < num*n)) {
+      return 0;
+   }
+
+   swsfloat_t const* s1 = (swsfloat_t const*)moments->getData();
+   swsfloat_t*       sk = (swsfloat_t*)skbuf[source]->getData();
+   unsigned char*    fl = (unsigned char*)flags[source]->getData();
+   memset(fl, 0, num*n);
+   std::vector<bufrecord_t> const& recs = moments->getRecords();
+   for (size_t s=0; s<num; s++, s1+=2*n, sk+=n, fl+=n) {
+      swsfloat_t const* s2 = s1 + n;
+
+      /* a spectrum cut short at the end of the data has fewer FFTs, its estimator is not tested */
+      double Ms = M, scale = sk_scale;
+      if ((recs.size() == num) && (recs[s].ffts > 0) && (recs[s].ffts < M)) {
+         Ms    = recs[s].ffts;
+         scale = (Ms > 1.0) ? ((Ms + 1.0) / (Ms - 1.0)) : 0.0;
+      }
+      bool test = (Ms >= M);
+
+      for (size_t i=0; i<n; i++) {
+         /* bins without power carry no information and are not flagged */
+         if (s1[i] <= 0.0f) {
+            sk[i] = 1.0f;
+            continue;
+         }
+         double r = double(s2[i]) / (double(s1[i]) * double(s1[i]));
+         sk[i] = swsfloat_t(scale * (Ms*r - 1.0));
+         if (test && !real_bin[source][i] && (fabs(sk[i] - 1.0) > sk_limit)) {
+            flagged++;
+            fl[i] = 1;
+         }
+      }
+   }
+   flags[source]->setLength(num * n);
+   skbuf[source]->setLength(num * n * sizeof(swsfloat_t));
+   sinks[source]->write(skbuf[source]);
+
+   num_flagged[source] += flagged;
+   return flagged;
+}
+
+/**
+ * Mark the flagged points of the spectra of the last apply() in place.
+ * @param  source  Index of the source
+ * @param  spectra Buffer with the power spectra that were passed to apply()
+ */
+void SpectralKurtosis::flag(int source, Buffer* spectra)
+{
+   if (cfg->sk_flag_mode == SKFlagNone) {
+      return;
+   }
+   const swsfloat_t mark = (cfg->sk_flag_mode == SKFlagNaN) ? std::numeric_limits<swsfloat_t>::quiet_NaN() : 0.0f;
+   swsfloat_t*          sp = (swsfloat_t*)spectra->getData();
+   unsigned char const* fl = (unsigned char const*)flags[source]->getData();
+   size_t n = std::min(flags[source]->getLength(), spectra->getLength() / sizeof(swsfloat_t));
+   for (size_t i=0; i<n; i++) {
+      if (fl[i]) {
+         sp[i] = mark;
+      }
+   }
+}
+
+/**
+ * Close the sinks.
+ * @return long    Number of points that were flagged in total
+ */
+long SpectralKurtosis::close()
+{
+   long flagged = 0;
+   for (size_t i=0; i<sinks.size(); i++) {
+      sinks[i]->close();
+   }
+   for (size_t s=0; s<num_flagged.size(); s++) {
+      flagged += num_flagged[s];
+   }
+   return flagged;
+}
+
+
+#ifdef UNIT_TEST_SPECTRALKURTOSIS
+// g++ -Wall -DUNIT_TEST_SPECTRALKURTOSIS=1 SpectralKurtosis.cpp BinSelection.cpp Buffer.cpp Helpers.cpp -o sktest
+#include <cstdlib>
+#include <iostream>
+
+class SKTestSink : public DataSink {
+  public:
+   SKTestSink() : writes(0) { }
+   int open(std::string uri) { return 0; }
+   size_t write(Buffer* buf) {
+      swsfloat_t const* v = (swsfloat_t const*)buf->getData();
+      data.assign(v, v + buf->getLength()/sizeof(swsfloat_t));
+      writes++;
+      return buf->getLength();
+   }
+   int close() { return 0; }
+   std::vector<swsfloat_t> data;
+   int writes;
+};
+
+/* complex Gaussian noise of unit power plus a carrier of the given amplitude */
+static double sk_test_power(double amplitude)
+{
+   double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+   double r  = sqrt(-log(u1));
+   double re = r * cos(2*M_PI*u2) + amplitude;
+   double im = r * sin(2*M_PI*u2);
+   return re*re + im*im;
+}
+
+int main(int argc, char** argv)
+{
+   const int M = 256, n = 64, num = 400;
+   const int cw_bin = 10, pulsed_bin = 20;
+   int errors = 0;
+
+   swspect_settings_t s;
+   s.num_sources            = 1;
+   s.averaged_ffts          = M;
+   s.fft_ssb_points         = n;
+   s.out_points             = n;
+   s.fft_bytes_ssb          = n * sizeof(swsfloat_t);
+   s.max_spectra_per_buffer = num;
+   s.sk_threshold           = 3.0;
+   s.sk_flag_mode           = SKFlagNaN;
+   s.out_selection.push_back(NULL);
+
+   SKTestSink sink;
+   std::vector<DataSink*> sinks(1, &sink);
+   SpectralKurtosis sk(&s, sinks);
+
+   /* S1 and S2 of M FFTs, a carrier in DC, Nyquist and one bin, and a pulse in 1 of 8 FFTs in another,
+    * the last spectrum was cut short after M/2 FFTs */
+   Buffer moments(2 * num * n * sizeof(swsfloat_t));
+   Buffer spectra(num * n * sizeof(swsfloat_t));
+   swsfloat_t* mo = (swsfloat_t*)moments.getData();
+   swsfloat_t* sp = (swsfloat_t*)spectra.getData();
+   srand(1);
+   for (int sn=0; sn<num; sn++) {
+      bufrecord_t rec = { 0.0, 0, (sn == num-1) ? M/2 : M, false };
+      moments.getRecords().push_back(rec);
+      for (int i=0; i<n; i++) {
+         double s1 = 0.0, s2 = 0.0;
+         for (int f=0; f<rec.ffts; f++) {
+            double a = 0.0;
+            if ((i == 0) || (i == n-1) || (i == cw_bin)) {
+               a = 10.0;
+            } else if ((i == pulsed_bin) && (f % 8 == 0)) {
+               a = 10.0;
+            }
+            double p = sk_test_power(a);
+            s1 += p;
+            s2 += p*p;
+         }
+         mo[2*sn*n + i]     = s1;
+         mo[2*sn*n + n + i] = s2;
+         sp[sn*n + i]       = s1 / rec.ffts;
+      }
+   }
+   moments.setLength(2 * num * n * sizeof(swsfloat_t));
+   spectra.setLength(num * n * sizeof(swsfloat_t));
+
+   sk.apply(0, &moments, &spectra);
+   if ((sink.writes != 1) || (sink.data.size() != size_t(num*n))) {
+      std::cerr << "estimator was written " << sink.writes << " times with " << sink.data.size() << " points" << std::endl;
+      return 1;
+   }
+
+   /* the estimator of the noise bins has a mean of 1 and the stated sigma */
+   swsfloat_t const*    est = &sink.data[0];
+   unsigned char const* fl  = (unsigned char const*)sk.getFlags(0)->getData();
+   const double sigma = sqrt(4.0*M*M / ((M - 1.0) * (M + 2.0) * (M + 3.0)));
+   double sum = 0.0, sum2 = 0.0;
+   int count = 0, noise_flagged = 0;
+   for (int sn=0; sn<num-1; sn++) {
+      for (int i=1; i<n-1; i++) {
+         if ((i == cw_bin) || (i == pulsed_bin)) {
+            continue;
+         }
+         double d = est[sn*n + i] - 1.0;
+         sum  += d;
+         sum2 += d*d;
+         count++;
+         noise_flagged += fl[sn*n + i];
+      }
+   }
+   double mean = 1.0 + sum/count;
+   double std  = sqrt(sum2/count - (sum/count)*(sum/count));
+   if (fabs(mean - 1.0) > 5.0*sigma/sqrt(double(count))) {
+      std::cerr << "mean estimator of noise is " << mean << ", expected 1 +- " << sigma/sqrt(double(count)) << std::endl;
+      errors++;
+   }
+   if (fabs(std/sigma - 1.0) > 0.05) {
+      std::cerr << "estimator of noise has sigma " << std << " instead of " << sigma << std::endl;
+      errors++;
+   }
+   /* the estimator has a longer upper tail than a Gaussian, more than its 0.3% fall beyond 3 sigma */
+   if (noise_flagged > 0.01*count) {
+      std::cerr << noise_flagged << " of " << count << " noise points were flagged" << std::endl;
+      errors++;
+   }
+
+   /* the carrier and the pulse are flagged in every complete spectrum, DC and Nyquist never,
+    * and nothing in the short spectrum */
+   for (int sn=0; sn<num; sn++) {
+      bool complete = (sn < num-1);
+      if (fl[sn*n + cw_bin] != complete) {
+         std::cerr << "carrier in spectrum " << sn << " has SK " << est[sn*n + cw_bin] << " and flag " << int(fl[sn*n + cw_bin]) << std::endl;
+         errors++;
+      }
+      if (fl[sn*n + pulsed_bin] != complete) {
+         std::cerr << "pulse in spectrum " << sn << " has SK " << est[sn*n + pulsed_bin] << " and flag " << int(fl[sn*n + pulsed_bin]) << std::endl;
+         errors++;
+      }
+      if (fl[sn*n] || fl[sn*n + n-1]) {
+         std::cerr << "DC or Nyquist of spectrum " << sn << " were flagged" << std::endl;
+         errors++;
+      }
+   }
+   for (int i=0; i<n; i++) {
+      errors += fl[(num-1)*n + i];
+   }
+
+   /* flag() marks exactly the flagged points */
+   sk.flag(0, &spectra);
+   for (int i=0; i<num*n; i++) {
+      if (bool(std::isnan(sp[i])) != bool(fl[i])) {
+         std::cerr << "point " << i << " is " << sp[i] << " with flag " << int(fl[i]) << std::endl;
+         errors++;
+      }
+   }
+   long total = sk.close();
+   if (total != noise_flagged + 2*(num-1)) {
+      std::cerr << "close() counts " << total << " flagged points instead of " << noise_flagged + 2*(num-1) << std::endl;
+      errors++;
+   }
+
+   std::cerr << "SpectralKurtosis test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
@@ -0,0 +1,101 @@
+#ifndef SPECTRALKURTOSIS_H
+#define SPECTRALKURTOSIS_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+#include "DataSink.h"
+
+#include <vector>
+
+/**
+  * class SpectralKurtosis
+  * RFI detection from the spectral kurtosis estimator. The cores accumulate
+  * the sum of the power S1 and of the squared power S2 of every bin over the
+  * M non-overlapped FFTs of a spectrum. From these the generalized estimator
+  *   SK = (M+1)/(M-1) * (M*S2/S1^2 - 1)
+  * is 1 for Gaussian noise, and deviates for impulsive or continuous-wave
+  * interference. Bins where it deviates by more than the threshold are
+  * flagged in the written power spectrum. The real-valued DC and Nyquist
+  * bins have an SK of about 2 for noise and are never flagged, neither
+  * are the bins of an incomplete spectrum at the end of the data. The
+  * longer integrations and coarser resolutions average the unflagged
+  * points only, so the flags are applied to the spectra after these.
+  */
+
+class SpectralKurtosis
+{
+public:
+   /**
+    * Prepare the estimator output.
+    * @param settings Pointer to the global settings
+    * @param sinks    SK output sinks, one per source
+    */
+   SpectralKurtosis(swspect_settings_t* settings, std::vector<DataSink*> const& sinks);
+
+   /**
+    * Release the output buffers
+    */
+   ~SpectralKurtosis();
+
+   /**
+    * Compute the estimator of spectra, write it out, and mark the points
+    * that are to be flagged. The spectra are left as they are until flag().
+    * Different sources may be done concurrently.
+    * @return int     Number of points that were flagged
+    * @param  source  Index of the source
+    * @param  moments S1 and S2 of each spectrum, both as written to the sink of the source
+    * @param  spectra Buffer with the matching power spectra
+    */
+   int apply(int source, Buffer* moments, Buffer* spectra);
+
+   /**
+    * @return Per point of the spectra of the last apply() one byte, nonzero if the
+    *         point is flagged, or NULL if flagging leaves the spectra as they are
+    * @param  source  Index of the source
+    */
+   Buffer* getFlags(int source) { return (cfg->sk_flag_mode == SKFlagNone) ? NULL : flags[source]; }
+
+   /**
+    * Mark the flagged points of the spectra of the last apply() in place.
+    * @param  source  Index of the source
+    * @param  spectra Buffer with the power spectra that were passed to apply()
+    */
+   void flag(int source, Buffer* spectra);
+
+   /**
+    * Close the sinks.
+    * @return long    Number of points that were flagged in total
+    */
+   long close();
+
+private:
+   swspect_settings_t* cfg;
+   std::vector<DataSink*> sinks;      // per source the SK sink
+   std::vector<Buffer*> skbuf;        // per source the estimator of the spectra of one buffer
+   std::vector<Buffer*> flags;        // per source one byte per point of the spectra of one buffer, nonzero if flagged
+   std::vector< std::vector<bool> > real_bin; // per source, the points that are the DC or Nyquist bin
+   double  sk_scale;                  // (M+1)/(M-1)
+   double  sk_limit;                  // largest accepted deviation of SK from 1
+   std::vector<long> num_flagged;     // per source the points flagged so far
+};
+
+#endif // SPECTRALKURTOSIS_H
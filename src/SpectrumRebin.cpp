@@ -0,0 +1,452 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "SpectrumRebin.h"
+#include "BinSelection.h"
+
+#include <algorithm>
+#include <limits>
+
+/**
+ * Prepare the pyramid buffers.
+ * @param settings Pointer to the global settings, rebin_factors must be sorted powers of two
+ * @param sinks    Output sinks, [factor*num_sinks + sink] in the order of the base spectrum sinks
+ * @param weightsinks  Outputs of the number of unflagged points in each group, indexed like sinks, or NULL
+ */
+SpectrumRebin::SpectrumRebin(swspect_settings_t* settings, std::vector<DataSink*> const& sinks,
+                             std::vector<DataSink*> const& weightsinks)
+{
+   this->cfg   = settings;
+   this->sinks = sinks;
+   this->weightsinks = weightsinks;
+   this->weightsinks.resize(sinks.size(), NULL);
+   for (int sk=0; sk<cfg->num_sinks; sk++) {
+      /* sinks get spectra that may already be reduced to the kept bins */
+      points.push_back((cfg->out_selection[sk] != NULL) ? cfg->out_selection[sk]->getLength() : cfg->out_points);
+   }
+
+   /* one 2x step per power of two up to the largest factor */
+   int largest = cfg->rebin_factors.empty() ? 1 : cfg->rebin_factors.back();
+   for (int f=2, step=0; f<=largest; f*=2, step++) {
+      int written = -1;
+      for (size_t i=0; i<cfg->rebin_factors.size(); i++) {
+         if (cfg->rebin_factors[i] == f) { written = int(i); }
+      }
+      step_sink.push_back(written);
+      for (int sk=0; sk<cfg->num_sinks; sk++) {
+         int    fpp = (sk < cfg->num_sources) ? 1 : 2;
+         size_t n   = std::max(cfg->max_spectra_per_buffer, 1) * (points[sk] / f) * fpp;
+         steps.push_back(new Buffer(std::max(n, size_t(1)) * sizeof(swsfloat_t)));
+      }
+   }
+
+   /* the buffers for flagged spectra are only made when flags come in */
+   wsteps.resize(steps.size(), NULL);
+   outs.resize(cfg->num_sinks, NULL);
+}
+
+/**
+ * Release the pyramid buffers
+ */
+SpectrumRebin::~SpectrumRebin()
+{
+   for (size_t i=0; i<steps.size(); i++) {
+      delete steps[i];
+      delete wsteps[i];
+   }
+   for (size_t i=0; i<outs.size(); i++) {
+      delete outs[i];
+   }
+}
+
+/**
+ * Rebin spectra that were written to a base sink and write the results
+ * to the sinks of every factor. Different base sinks may be done concurrently.
+ * @param sink     Index of the base sink
+ * @param spectra  Buffer with one or more spectra as written to the base sink, not yet flagged
+ * @param flags    One byte per point of power spectra, nonzero to leave the point out, or NULL
+ */
+void SpectrumRebin::add(int sink, Buffer* spectra, Buffer* flags)
+{
+   int         fpp = (sink < cfg->num_sources) ? 1 : 2;
+   size_t      n   = points[sink];
+   size_t      num = spectra->getLength() / (n * fpp * sizeof(swsfloat_t));
+   swsfloat_t* in  = (swsfloat_t*)spectra->getData();
+   swsfloat_t* inw = NULL;
+   bool flagged = (flags != NULL) && (fpp == 1) && (flags->getLength() >= num * n);
+   const swsfloat_t mark = (cfg->sk_flag_mode == SKFlagNaN) ? std::numeric_limits<swsfloat_t>::quiet_NaN() : 0.0f;
+
+   for (size_t step=0; step<step_sink.size() && n>=2; step++) {
+      size_t  idx    = step*cfg->num_sinks + sink;
+      size_t  outlen = num * (n / 2) * fpp * sizeof(swsfloat_t);
+      Buffer* out    = reserve(steps, idx, outlen);
+      int     wsink  = step_sink[step]*cfg->num_sinks + sink;
+      if (!flagged) {
+         n  = halve(in, (swsfloat_t*)out->getData(), n, num, fpp);
+         in = (swsfloat_t*)out->getData();
+         out->setLength(outlen);
+         out->getRecords() = spectra->getRecords();
+         if (step_sink[step] >= 0) {
+            sinks[wsink]->write(out);
+         }
+         continue;
+      }
+
+      /* with flags the pyramid holds the sums or maxima of the unflagged points and their number */
+      Buffer* outw = reserve(wsteps, idx, outlen);
+      n   = halve_flagged(in, inw, (unsigned char const*)flags->getData(), (swsfloat_t*)out->getData(), (swsfloat_t*)outw->getData(), n, num);
+      in  = (swsfloat_t*)out->getData();
+      inw = (swsfloat_t*)outw->getData();
+      out->setLength(outlen);
+      outw->setLength(outlen);
+      if (step_sink[step] < 0) {
+         continue;
+      }
+
+      /* write the sum scaled up to the whole group, the mean or the maximum, and mark groups without unflagged points */
+      Buffer*     res   = reserve(outs, sink, outlen);
+      swsfloat_t* r     = (swsfloat_t*)res->getData();
+      swsfloat_t  group = swsfloat_t(size_t(2) << step);
+      for (size_t i=0; i<num*n; i++) {
+         if (inw[i] <= 0.0f) {
+            r[i] = mark;
+         } else if (cfg->rebin_mode == RebinSum) {
+            r[i] = in[i] * (group / inw[i]);
+         } else if (cfg->rebin_mode == RebinMean) {
+            r[i] = in[i] / inw[i];
+         } else {
+            r[i] = in[i];
+         }
+      }
+      res->setLength(outlen);
+      res->getRecords() = spectra->getRecords();
+      sinks[wsink]->write(res);
+      if (weightsinks[wsink] != NULL) {
+         outw->getRecords() = spectra->getRecords();
+         weightsinks[wsink]->write(outw);
+      }
+   }
+}
+
+/**
+ * Make sure that a pyramid buffer can hold a number of bytes.
+ * @return The buffer
+ * @param  bufs    Pyramid buffers
+ * @param  i       Index of the buffer
+ * @param  bytes   Number of bytes needed
+ */
+Buffer* SpectrumRebin::reserve(std::vector<Buffer*>& bufs, size_t i, size_t bytes)
+{
+   if ((bufs[i] == NULL) || (bufs[i]->getAllocated() < bytes)) {
+      /* first use, or more spectra per buffer than planned for */
+      delete bufs[i];
+      bufs[i] = new Buffer(std::max(bytes, size_t(1)));
+   }
+   return bufs[i];
+}
+
+/**
+ * Combine pairs of neighbouring points of a series of spectra.
+ * @return Number of points per output spectrum
+ * @param  in       First input spectrum, later spectra follow back to back
+ * @param  out      Output spectra, back to back
+ * @param  points   Points per input spectrum
+ * @param  num      Number of spectra
+ * @param  fpp      Floats per point, 1 for power spectra and 2 for complex cross spectra
+ */
+size_t SpectrumRebin::halve(swsfloat_t const* in, swsfloat_t* out, size_t points, size_t num, int fpp) const
+{
+   size_t half = points / 2;
+   size_t nin  = points * fpp;
+   size_t nout = half * fpp;
+
+   for (size_t s=0; s<num; s++, in+=nin, out+=nout) {
+      if (fpp == 1) {
+         /* plain loops over pairs, the compiler vectorises these */
+         switch (cfg->rebin_mode) {
+            case RebinSum:
+               for (size_t i=0; i<half; i++) { out[i] = in[2*i] + in[2*i+1]; }
+               break;
+            case RebinMean:
+               for (size_t i=0; i<half; i++) { out[i] = 0.5f * (in[2*i] + in[2*i+1]); }
+               break;
+            case RebinMax:
+               for (size_t i=0; i<half; i++) { out[i] = std::max(in[2*i], in[2*i+1]); }
+               break;
+         }
+      } else {
+         /* complex points: sums per component, the maximum is the point of larger magnitude */
+         switch (cfg->rebin_mode) {
+            case RebinSum:
+               for (size_t i=0; i<half; i++) {
+                  out[2*i]   = in[4*i]   + in[4*i+2];
+                  out[2*i+1] = in[4*i+1] + in[4*i+3];
+               }
+               break;
+            case RebinMean:
+               for (size_t i=0; i<half; i++) {
+                  out[2*i]   = 0.5f * (in[4*i]   + in[4*i+2]);
+                  out[2*i+1] = 0.5f * (in[4*i+1] + in[4*i+3]);
+               }
+               break;
+            case RebinMax:
+               for (size_t i=0; i<half; i++) {
+                  swsfloat_t m0 = in[4*i]*in[4*i]     + in[4*i+1]*in[4*i+1];
+                  swsfloat_t m1 = in[4*i+2]*in[4*i+2] + in[4*i+3]*in[4*i+3];
+                  int k = (m1 > m0) ? 2 : 0;
+                  out[2*i]   = in[4*i+k];
+                  out[2*i+1] = in[4*i+k+1];
+               }
+               break;
+         }
+      }
+   }
+   return half;
+}
+
+/**
+ * Combine pairs of neighbouring points of a series of power spectra, leaving out
+ * the flagged points. Sums and means add up the unflagged points, maxima take the
+ * largest unflagged point.
+ * @return Number of points per output spectrum
+ * @param  in       First input spectrum, later spectra follow back to back
+ * @param  inw      Unflagged points in each input point, or NULL for one each
+ * @param  inflags  Flags of the input points if inw is NULL
+ * @param  out      Output spectra, back to back
+ * @param  outw     Unflagged points in each output point
+ * @param  points   Points per input spectrum
+ * @param  num      Number of spectra
+ */
+size_t SpectrumRebin::halve_flagged(swsfloat_t const* in, swsfloat_t const* inw, unsigned char const* inflags,
+                                    swsfloat_t* out, swsfloat_t* outw, size_t points, size_t num) const
+{
+   size_t half = points / 2;
+   for (size_t s=0; s<num; s++) {
+      for (size_t i=0; i<half; i++) {
+         swsfloat_t a  = in[2*i], b = in[2*i+1];
+         swsfloat_t wa = (inw != NULL) ? inw[2*i]   : (inflags[2*i]   ? 0.0f : 1.0f);
+         swsfloat_t wb = (inw != NULL) ? inw[2*i+1] : (inflags[2*i+1] ? 0.0f : 1.0f);
+         outw[i] = wa + wb;
+         if (cfg->rebin_mode == RebinMax) {
+            out[i] = (wa <= 0.0f) ? ((wb > 0.0f) ? b : 0.0f) : (((wb > 0.0f) && (b > a)) ? b : a);
+         } else {
+            out[i] = ((wa > 0.0f) ? a : 0.0f) + ((wb > 0.0f) ? b : 0.0f);
+         }
+      }
+      in   += points;
+      out  += half;
+      outw += half;
+      if (inw != NULL) {
+         inw += points;
+      } else {
+         inflags += points;
+      }
+   }
+   return half;
+}
+
+/**
+ * Close the sinks.
+ */
+void SpectrumRebin::close()
+{
+   for (size_t i=0; i<sinks.size(); i++) {
+      sinks[i]->close();
+      if (weightsinks[i] != NULL) {
+         weightsinks[i]->close();
+      }
+   }
+}
+
+
+#ifdef UNIT_TEST_SPECTRUMREBIN
+// g++ -Wall -DUNIT_TEST_SPECTRUMREBIN=1 SpectrumRebin.cpp BinSelection.cpp Buffer.cpp Helpers.cpp -o rebintest
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+
+class RebinTestSink : public DataSink {
+  public:
+   RebinTestSink() : writes(0) { }
+   int open(std::string uri) { return 0; }
+   size_t write(Buffer* buf) {
+      swsfloat_t const* v = (swsfloat_t const*)buf->getData();
+      data.assign(v, v + buf->getLength()/sizeof(swsfloat_t));
+      records = buf->getRecords().size();
+      writes++;
+      return buf->getLength();
+   }
+   int close() { return 0; }
+   std::vector<swsfloat_t> data;
+   size_t records;
+   int writes;
+};
+
+/* compare one output of the pyramid against the directly combined groups of f points */
+static int rebin_test_check(RebinTestSink const& sink, swsfloat_t const* in, unsigned char const* fl,
+                            size_t n, size_t num, int fpp, int f, RebinMode mode, char const* what)
+{
+   size_t groups = n / f;
+   int errors = 0;
+   if ((sink.writes != 1) || (sink.data.size() != num*groups*fpp) || (sink.records != num)) {
+      std::cerr << what << " x" << f << ": " << sink.writes << " writes of " << sink.data.size()
+                << " floats and " << sink.records << " records" << std::endl;
+      return 1;
+   }
+   for (size_t s=0; s<num; s++) {
+      for (size_t g=0; g<groups; g++) {
+         double re = 0.0, im = 0.0, mag = -1.0;
+         int used = 0;
+         for (int k=0; k<f; k++) {
+            size_t i = s*n + g*f + k;
+            if ((fl != NULL) && fl[i]) {
+               continue;
+            }
+            double pr = in[fpp*i], pi = (fpp == 2) ? in[fpp*i+1] : 0.0;
+            if (mode == RebinMax) {
+               double m = (fpp == 2) ? (pr*pr + pi*pi) : pr;
+               if ((used == 0) || (m > mag)) { mag = m; re = pr; im = pi; }
+            } else {
+               re += pr;
+               im += pi;
+            }
+            used++;
+         }
+         if (mode == RebinMean) {
+            re /= used;
+            im /= used;
+         } else if ((mode == RebinSum) && (used > 0)) {
+            re *= double(f) / used;
+            im *= double(f) / used;
+         }
+         swsfloat_t const* o = &sink.data[(s*groups + g)*fpp];
+         bool bad = (fabs(o[0] - re) > 1e-5*(fabs(re) + 1.0));
+         if (fpp == 2) {
+            bad = bad || (fabs(o[1] - im) > 1e-5*(fabs(im) + 1.0));
+         }
+         if (used == 0) {
+            bad = !std::isnan(o[0]);
+         }
+         if (bad) {
+            std::cerr << what << " x" << f << " spectrum " << s << " group " << g << " is " << o[0]
+                      << " instead of " << re << std::endl;
+            errors++;
+         }
+      }
+   }
+   return errors;
+}
+
+int main(int argc, char** argv)
+{
+   /* a power sink and a cross-pol sink with 37 points, so that every factor drops a tail,
+    * and factor 4 is only an unwritten step of the pyramid */
+   const size_t n = 37, num = 3;
+   const int factors[] = { 2, 8 };
+   const RebinMode modes[] = { RebinSum, RebinMean, RebinMax };
+   const char* names[] = { "sum", "mean", "max" };
+   int errors = 0;
+
+   swspect_settings_t s;
+   s.num_sources            = 1;
+   s.num_sinks              = 2;
+   s.out_points             = n;
+   s.max_spectra_per_buffer = num;
+   s.sk_flag_mode           = SKFlagNaN;
+   s.rebin_factors.assign(factors, factors + 2);
+   s.out_selection.assign(2, (BinSelection*)NULL);
+
+   Buffer power(num * n * sizeof(swsfloat_t));
+   Buffer xpol(2 * num * n * sizeof(swsfloat_t));
+   Buffer flags(num * n);
+   swsfloat_t*    pw = (swsfloat_t*)power.getData();
+   swsfloat_t*    xp = (swsfloat_t*)xpol.getData();
+   unsigned char* fl = (unsigned char*)flags.getData();
+   srand(1);
+   for (size_t i=0; i<num*n; i++) {
+      pw[i]     = swsfloat_t(rand()) / RAND_MAX;
+      xp[2*i]   = swsfloat_t(rand()) / RAND_MAX - 0.5f;
+      xp[2*i+1] = swsfloat_t(rand()) / RAND_MAX - 0.5f;
+      fl[i]     = (rand() % 4 == 0);
+   }
+   /* one group of 8 without unflagged points */
+   for (size_t i=8; i<16; i++) {
+      fl[i] = 1;
+   }
+   for (size_t r=0; r<num; r++) {
+      bufrecord_t rec = { double(r), 1000, 16, false };
+      power.getRecords().push_back(rec);
+      xpol.getRecords().push_back(rec);
+   }
+   power.setLength(num * n * sizeof(swsfloat_t));
+   xpol.setLength(2 * num * n * sizeof(swsfloat_t));
+   flags.setLength(num * n);
+
+   for (int m=0; m<3; m++) {
+      s.rebin_mode = modes[m];
+
+      /* unflagged power and cross-pol spectra */
+      std::vector<RebinTestSink> out(4);
+      std::vector<DataSink*> sinks, wsinks;
+      for (int i=0; i<4; i++) {
+         sinks.push_back(&out[i]);
+      }
+      SpectrumRebin rebin(&s, sinks, wsinks);
+      rebin.add(0, &power);
+      rebin.add(1, &xpol);
+      for (int f=0; f<2; f++) {
+         errors += rebin_test_check(out[f*2],   pw, NULL, n, num, 1, factors[f], modes[m], names[m]);
+         errors += rebin_test_check(out[f*2+1], xp, NULL, n, num, 2, factors[f], modes[m], names[m]);
+      }
+
+      /* flagged power spectra, with the number of unflagged points of each group */
+      std::vector<RebinTestSink> fout(4), wout(4);
+      std::vector<DataSink*> fsinks, fwsinks;
+      for (int i=0; i<4; i++) {
+         fsinks.push_back(&fout[i]);
+         fwsinks.push_back((i % 2 == 0) ? &wout[i] : NULL);
+      }
+      SpectrumRebin frebin(&s, fsinks, fwsinks);
+      frebin.add(0, &power, &flags);
+      for (int f=0; f<2; f++) {
+         errors += rebin_test_check(fout[f*2], pw, fl, n, num, 1, factors[f], modes[m], names[m]);
+         size_t groups = n / factors[f];
+         for (size_t g=0; (wout[f*2].data.size() == num*groups) && (g<num*groups); g++) {
+            int used = 0;
+            for (int k=0; k<factors[f]; k++) {
+               used += !fl[(g/groups)*n + (g%groups)*factors[f] + k];
+            }
+            if (wout[f*2].data[g] != used) {
+               std::cerr << names[m] << " x" << factors[f] << " group " << g << " has weight "
+                         << wout[f*2].data[g] << " instead of " << used << std::endl;
+               errors++;
+            }
+         }
+         if (wout[f*2].data.size() != num*groups) {
+            std::cerr << names[m] << " x" << factors[f] << " weights have " << wout[f*2].data.size() << " points" << std::endl;
+            errors++;
+         }
+      }
+   }
+
+   std::cerr << "SpectrumRebin test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
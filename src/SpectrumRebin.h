@@ -0,0 +1,118 @@
+#ifndef SPECTRUMREBIN_H
+#define SPECTRUMREBIN_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+#include "DataSink.h"
+
+#include <vector>
+
+/**
+  * class SpectrumRebin
+  * Quick-look copies of the written spectra at a coarser frequency resolution.
+  * Groups of 2^k consecutive points are combined into one point by their sum,
+  * mean or maximum. All requested factors are built as a pyramid, each 2x step
+  * from the previous one, so the whole set costs less than one extra pass over
+  * the spectrum. Trailing points that do not fill a whole group are dropped.
+  * Points flagged by the spectral kurtosis are left out of their group, and
+  * how many points each group combines is written to the weight sinks.
+  */
+
+class SpectrumRebin
+{
+public:
+   /**
+    * Prepare the pyramid buffers.
+    * @param settings Pointer to the global settings, rebin_factors must be sorted powers of two
+    * @param sinks    Output sinks, [factor*num_sinks + sink] in the order of the base spectrum sinks
+    * @param weightsinks  Outputs of the number of unflagged points in each group, indexed like sinks, or NULL
+    */
+   SpectrumRebin(swspect_settings_t* settings, std::vector<DataSink*> const& sinks,
+                 std::vector<DataSink*> const& weightsinks);
+
+   /**
+    * Release the pyramid buffers
+    */
+   ~SpectrumRebin();
+
+   /**
+    * Rebin spectra that were written to a base sink and write the results
+    * to the sinks of every factor. Different base sinks may be done concurrently.
+    * @param sink     Index of the base sink
+    * @param spectra  Buffer with one or more spectra as written to the base sink, not yet flagged
+    * @param flags    One byte per point of power spectra, nonzero to leave the point out, or NULL
+    */
+   void add(int sink, Buffer* spectra, Buffer* flags = NULL);
+
+   /**
+    * Close the sinks.
+    */
+   void close();
+
+private:
+   /**
+    * Combine pairs of neighbouring points of a series of spectra.
+    * @return Number of points per output spectrum
+    * @param  in       First input spectrum, later spectra follow back to back
+    * @param  out      Output spectra, back to back
+    * @param  points   Points per input spectrum
+    * @param  num      Number of spectra
+    * @param  fpp      Floats per point, 1 for power spectra and 2 for complex cross spectra
+    */
+   size_t halve(swsfloat_t const* in, swsfloat_t* out, size_t points, size_t num, int fpp) const;
+
+   /**
+    * Combine pairs of neighbouring points of a series of power spectra, leaving out
+    * the flagged points. Sums and means add up the unflagged points, maxima take the
+    * largest unflagged point.
+    * @return Number of points per output spectrum
+    * @param  in       First input spectrum, later spectra follow back to back
+    * @param  inw      Unflagged points in each input point, or NULL for one each
+    * @param  inflags  Flags of the input points if inw is NULL
+    * @param  out      Output spectra, back to back
+    * @param  outw     Unflagged points in each output point
+    * @param  points   Points per input spectrum
+    * @param  num      Number of spectra
+    */
+   size_t halve_flagged(swsfloat_t const* in, swsfloat_t const* inw, unsigned char const* inflags,
+                        swsfloat_t* out, swsfloat_t* outw, size_t points, size_t num) const;
+
+   /**
+    * Make sure that a pyramid buffer can hold a number of bytes.
+    * @return The buffer
+    * @param  bufs    Pyramid buffers
+    * @param  i       Index of the buffer
+    * @param  bytes   Number of bytes needed
+    */
+   static Buffer* reserve(std::vector<Buffer*>& bufs, size_t i, size_t bytes);
+
+   swspect_settings_t* cfg;
+   std::vector<DataSink*> sinks;      // per factor and base sink the rebinned sink
+   std::vector<DataSink*> weightsinks; // per factor and base sink the sink of the group weights, or NULL
+   std::vector<Buffer*> steps;        // per 2x step and base sink the rebinned spectra, [step*num_sinks + sink]
+   std::vector<Buffer*> wsteps;       // with flags per 2x step and base sink the unflagged points of each group
+   std::vector<Buffer*> outs;         // with flags per base sink the spectra to write, scaled from the group sums
+   std::vector<int> step_sink;        // per 2x step the index of its factor in rebin_factors, or -1 if not written
+   std::vector<size_t> points;        // per base sink the points in one written spectrum
+};
+
+#endif // SPECTRUMREBIN_H
@@ -0,0 +1,158 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "TaskCore.h"
+#include "Buffer.h"
+#include "BinSelection.h"
+#include "IntegrationLevel.h"
+#include "SpectrumRebin.h"
+#include "SpectralKurtosis.h"
+
+#include <vector>
+
+/**
+ * Add the record of one sub-spectrum to the record of the assembled spectrum.
+ * @param part      sub-spectrum of one core
+ * @param combined  assembled spectrum
+ */
+static void merge_record(Buffer* part, Buffer* combined)
+{
+   std::vector<bufrecord_t>& from = part->getRecords();
+   std::vector<bufrecord_t>& into = combined->getRecords();
+   if (from.empty()) {
+      return;
+   }
+   if (into.empty()) {
+      bufrecord_t none = { -1.0, 0, 0, false };
+      into.push_back(none);
+   }
+   double t = from[0].time_s;
+   if ((t >= 0) && ((into[0].time_s < 0) || (t < into[0].time_s))) {
+      into[0].time_s = t;
+   }
+   into[0].valid_samples += from[0].valid_samples;
+   into[0].ffts          += from[0].ffts;
+   into[0].partial        = into[0].partial || from[0].partial;
+}
+
+/**
+ * Add the records of the sub-spectra of one core to the records of the assembled
+ * spectrum. Only the core with the first FFT of the spectrum knows its start time,
+ * so the order the cores finish in does not matter; the FFTs and valid samples add up.
+ * @param set      Pointer to the global settings
+ * @param core     Index of the core whose output buffers hold the sub-spectra
+ * @param slot     Ring slot of the assembled spectrum
+ * @param sink     Index of the spectrum sink, for sources also their other results
+ */
+void TaskCore::assembleRecords(swspect_settings_t* set, int core, int slot, int sink)
+{
+   int c = core, s = sink;
+
+   if (s >= set->num_sources) {
+      merge_record(set->outbuffersXpol[c][s - set->num_sources], set->combinedSpectra[slot][s]);
+      return;
+   }
+   merge_record(set->outbuffers[c][s], set->combinedSpectra[slot][s]);
+   if (set->extract_PCal) {
+      merge_record(set->outbuffersPCal[c][s], set->combinedPCal[slot][s]);
+   }
+   if (set->spectral_kurtosis) {
+      merge_record(set->outbuffersSK[c][s], set->combinedSK[slot][s]);
+   }
+   if (set->sampler_stats) {
+      merge_record(set->outbuffersStates[c][s], set->combinedStates[slot][s]);
+   }
+   if (set->switch_period_s > 0) {
+      merge_record(set->outbuffersOn[c][s], set->combinedOn[slot][s]);
+   }
+   if (set->fold_bins > 0) {
+      merge_record(set->outbuffersFold[c][s], set->combinedFold[slot][s]);
+   }
+}
+
+/**
+ * Prepare one sink of a completely assembled spectrum for writing: find its peak,
+ * keep only the selected bins, flag it by spectral kurtosis, and add it to the
+ * longer integration levels and the coarser resolutions.
+ * @param set      Pointer to the global settings
+ * @param slot     Ring slot of the assembled spectrum
+ * @param sink     Index of the spectrum sink
+ */
+void TaskCore::finishSpectrum(swspect_settings_t* set, int slot, int sink)
+{
+   int     sk       = sink;
+   bool    source   = (sk < set->num_sources);
+   Buffer* spectrum = set->combinedSpectra[slot][sk];
+
+   /* the peak search runs over all computed points */
+   if (set->peak_detect && source) {
+      Buffer*     peak = set->combinedPeak[slot][sk];
+      swsfloat_t* win  = (set->peak_window_points > 0) ? (swsfloat_t*)set->combinedPeakWin[slot][sk]->getData() : NULL;
+      detectPeak((swsfloat_t*)spectrum->getData(), (swspeak_t*)peak->getData(), win);
+      peak->getRecords() = spectrum->getRecords();
+   }
+
+   spectrum->setLength(source ? set->fft_bytes_ssb : set->fft_bytes_xpol);
+   if (set->out_selection[sk] != NULL) {
+      int    fpp    = source ? 1 : 2;
+      size_t floats = set->out_selection[sk]->reduce((swsfloat_t*)spectrum->getData(), 1, fpp);
+      spectrum->setLength(floats * sizeof(swsfloat_t));
+   }
+   Buffer* flags = NULL;
+   if ((set->kurtosis != NULL) && source) {
+      Buffer* sums   = set->combinedSK[slot][sk];
+      size_t  floats = 2 * set->out_points;
+      if (set->out_selection[sk] != NULL) {
+         floats = 2 * set->out_selection[sk]->reduce((swsfloat_t*)sums->getData(), 2, 1);
+      }
+      sums->setLength(floats * sizeof(swsfloat_t));
+      set->kurtosis->apply(sk, sums, spectrum);
+      flags = set->kurtosis->getFlags(sk);
+      resetBuffer(sums);
+   }
+
+   /* the longer integrations and coarser resolutions leave the flagged points out themselves */
+   for (size_t l=0; l<set->integ_levels.size(); l++) {
+      set->levels[l]->add(sk, spectrum, flags);
+   }
+   if (set->rebin != NULL) {
+      set->rebin->add(sk, spectrum, flags);
+   }
+   if ((set->kurtosis != NULL) && source) {
+      set->kurtosis->flag(sk, spectrum);
+   }
+
+   if ((set->switch_period_s > 0) && source) {
+      Buffer* on     = set->combinedOn[slot][sk];
+      size_t  floats = set->out_points;
+      if (set->out_selection[sk] != NULL) {
+         floats = set->out_selection[sk]->reduce((swsfloat_t*)on->getData(), 1, 1);
+      }
+      on->setLength(floats * sizeof(swsfloat_t));
+   }
+   if ((set->fold_bins > 0) && source) {
+      Buffer* folded = set->combinedFold[slot][sk];
+      size_t  floats = set->out_points;
+      if (set->out_selection[sk] != NULL) {
+         floats = set->out_selection[sk]->reduce((swsfloat_t*)folded->getData(), set->fold_bins, 1);
+      }
+      folded->setLength(set->fold_bins * floats * sizeof(swsfloat_t));
+   }
+}
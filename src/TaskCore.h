@@ -80,12 +80,49 @@ public:
     */
    virtual int combineResults(Buffer** outbuf, Buffer** pcalbuf) { return 0; }
 
+   /**
+    * @return true if the worker threads of the cores themselves sum up the sub-spectra
+    *         of all cores into the settings' combinedSpectra and combinedPCal ring and
+    *         finish the completed spectra, so that the dispatcher must not call
+    *         combineResults(), assembleRecords() or finishSpectrum()
+    */
+   virtual bool reducesResults() { return false; }
+
   /**
     * Reset buffer to 0.0 floats
     * @param buf     Buffer to reset
     */
    virtual void resetBuffer(Buffer* buf) { return; }
 
+   /**
+    * Find the strongest peak in the search band of a complete integrated spectrum.
+    * @param spectrum Power spectrum with all computed points
+    * @param peak     Output peak record
+    * @param window   Output for the points around the peak, or NULL
+    */
+   virtual void detectPeak(swsfloat_t const* spectrum, swspeak_t* peak, swsfloat_t* window) { return; }
+
+   /**
+    * Add the records of the sub-spectra of one core to the records of the assembled
+    * spectrum. Only the core with the first FFT of the spectrum knows its start time,
+    * so the order the cores finish in does not matter; the FFTs and valid samples add up.
+    * @param set      Pointer to the global settings
+    * @param core     Index of the core whose output buffers hold the sub-spectra
+    * @param slot     Ring slot of the assembled spectrum
+    * @param sink     Index of the spectrum sink, for sources also their other results
+    */
+   void assembleRecords(swspect_settings_t* set, int core, int slot, int sink);
+
+   /**
+    * Prepare one sink of a completely assembled spectrum for writing: find its peak,
+    * keep only the selected bins, flag it by spectral kurtosis, and add it to the
+    * longer integration levels and the coarser resolutions.
+    * @param set      Pointer to the global settings
+    * @param slot     Ring slot of the assembled spectrum
+    * @param sink     Index of the spectrum sink
+    */
+   void finishSpectrum(swspect_settings_t* set, int slot, int sink);
+
 };
 
 #endif // TASKCORE_H
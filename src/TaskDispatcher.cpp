@@ -19,9 +19,11 @@
 **************************************************************************/
 
 #include "TaskDispatcher.h"
+#include "BinSelection.h"
 #include "Helpers.h"
 
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <algorithm>
 
@@ -50,7 +52,8 @@ TaskDispatcher::TaskDispatcher(swspect_settings_t* settings)
    for (int c=0; c<(set->num_cores); c++) {
       for (int s=0; s<(set->num_sources); s++) {
          int dblbuf_nr = 0;
-         (set->sources[s])->read (set->rawbuffers[c][dblbuf_nr][s]);
+         carry_over((c > 0) ? set->rawbuffers[c-1][dblbuf_nr][s] : NULL, set->rawbuffers[c][dblbuf_nr][s]);
+         (set->sources[s])->read (set->rawbuffers[c][dblbuf_nr][s], chunk_bytes(c));
       }
    }
 
@@ -64,21 +67,120 @@ TaskDispatcher::TaskDispatcher(swspect_settings_t* settings)
    }
    *log << endl;
 
-   /* Prepare the buffers we might need for assembling sub-spectra together */
-   this->corecombined_spectra = new Buffer*[set->num_sinks];
-   size_t peak_size           = std::max(set->fft_bytes_xpol, set->fft_bytes_ssb);
-   for (int cc=0; cc < (set->num_sinks); cc++) {
-      corecombined_spectra[cc] = new Buffer(peak_size);
-      corecombined_spectra[cc]->setLength(peak_size);
-      cores[0]->resetBuffer(corecombined_spectra[cc]);
+   /* Prepare the ring of buffers for assembling sub-spectra together: one round of cores
+    * touches at most num_cores/max_buffers_per_spectrum+2 spectra, and the spectra
+    * completed in one round are written out during the next round */
+   set->combined_slots = 1;
+   if (set->max_buffers_per_spectrum > 1) {
+      set->combined_slots = 2 * (set->num_cores / set->max_buffers_per_spectrum + 2);
+   }
+   set->combinedSpectra = new Buffer**[set->combined_slots];
+   set->combinedPCal    = new Buffer**[set->combined_slots];
+   set->combinedSK      = set->spectral_kurtosis ? new Buffer**[set->combined_slots] : NULL;
+   set->combinedStates  = set->sampler_stats ? new Buffer**[set->combined_slots] : NULL;
+   set->combinedOn      = (set->switch_period_s > 0) ? new Buffer**[set->combined_slots] : NULL;
+   set->combinedFold    = (set->fold_bins > 0) ? new Buffer**[set->combined_slots] : NULL;
+   set->combinedPeak    = set->peak_detect ? new Buffer**[set->combined_slots] : NULL;
+   set->combinedPeakWin = set->peak_detect ? new Buffer**[set->combined_slots] : NULL;
+   size_t peak_size     = std::max(set->fft_bytes_xpol, set->fft_bytes_ssb);
+   for (int slot=0; slot<(set->combined_slots); slot++) {
+      set->combinedSpectra[slot] = new Buffer*[set->num_sinks];
+      for (int cc=0; cc < (set->num_sinks); cc++) {
+         set->combinedSpectra[slot][cc] = new Buffer(peak_size);
+         cores[0]->resetBuffer(set->combinedSpectra[slot][cc]);
+      }
+      set->combinedPCal[slot] = new Buffer*[set->num_sources];
+      for (int cp=0; cp<(set->num_sources); cp++) {
+         set->combinedPCal[slot][cp] = new Buffer(set->pcal_result_bytes);
+         cores[0]->resetBuffer(set->combinedPCal[slot][cp]);
+      }
+      if (set->spectral_kurtosis) {
+         set->combinedSK[slot] = new Buffer*[set->num_sources];
+         for (int cs=0; cs<(set->num_sources); cs++) {
+            set->combinedSK[slot][cs] = new Buffer(2 * set->fft_bytes_ssb);
+            cores[0]->resetBuffer(set->combinedSK[slot][cs]);
+         }
+      }
+      if (set->sampler_stats) {
+         set->combinedStates[slot] = new Buffer*[set->num_sources];
+         for (int cs=0; cs<(set->num_sources); cs++) {
+            set->combinedStates[slot][cs] = new Buffer(set->sampler_states * sizeof(swsint64_t));
+            cores[0]->resetBuffer(set->combinedStates[slot][cs]);
+         }
+      }
+      if (set->switch_period_s > 0) {
+         set->combinedOn[slot] = new Buffer*[set->num_sources];
+         for (int cs=0; cs<(set->num_sources); cs++) {
+            set->combinedOn[slot][cs] = new Buffer(set->fft_bytes_ssb);
+            cores[0]->resetBuffer(set->combinedOn[slot][cs]);
+         }
+      }
+      if (set->fold_bins > 0) {
+         set->combinedFold[slot] = new Buffer*[set->num_sources];
+         for (int cs=0; cs<(set->num_sources); cs++) {
+            set->combinedFold[slot][cs] = new Buffer(set->fold_bins * set->fft_bytes_ssb);
+            cores[0]->resetBuffer(set->combinedFold[slot][cs]);
+         }
+      }
+      if (set->peak_detect) {
+         set->combinedPeak[slot]    = new Buffer*[set->num_sources];
+         set->combinedPeakWin[slot] = new Buffer*[set->num_sources];
+         for (int cs=0; cs<(set->num_sources); cs++) {
+            set->combinedPeak[slot][cs]    = new Buffer(sizeof(swspeak_t));
+            set->combinedPeakWin[slot][cs] = new Buffer(std::max(set->peak_window_points, 1) * sizeof(swsfloat_t));
+            set->combinedPeak[slot][cs]->setLength(sizeof(swspeak_t));
+            set->combinedPeakWin[slot][cs]->setLength(set->peak_window_points * sizeof(swsfloat_t));
+         }
+      }
+   }
+   set->reduce_barrier = new pthread_barrier_t;
+   pthread_barrier_init(set->reduce_barrier, NULL, set->num_cores);
+
+   /* Prepare the carrier tracking loops that continue over the blocks from all cores */
+   this->costas        = NULL;
+   this->costas_points = NULL;
+   if (set->costas_loop) {
+      size_t max_blocks  = set->costas_result_bytes / sizeof(swscomplex_t);
+      size_t max_points  = max_blocks / set->costas_output_decim + 1;
+      this->costas        = new CostasLoop*[set->num_sources];
+      this->costas_points = new Buffer*[set->num_sources];
+      for (int s=0; s<(set->num_sources); s++) {
+         costas[s]        = new CostasLoop(set);
+         costas_points[s] = new Buffer(max_points * sizeof(swscostas_point_t));
+      }
+   }
+
+   /* Prepare the total power averaging that continues over the blocks from all cores */
+   this->tpow        = NULL;
+   this->tpow_points = NULL;
+   if (set->tpow_rate_hz > 0) {
+      size_t max_points = set->tpow_result_bytes / sizeof(swsfloat_t) / set->tpow_output_decim + 1;
+      this->tpow        = new TotalPower*[set->num_sources];
+      this->tpow_points = new Buffer*[set->num_sources];
+      for (int s=0; s<(set->num_sources); s++) {
+         tpow[s]        = new TotalPower(set);
+         tpow_points[s] = new Buffer(max_points * sizeof(swsfloat_t));
+      }
+   }
+
+   /* Prepare the longer integration levels, each with its own set of spectrum sinks */
+   set->levels = new IntegrationLevel*[set->integ_levels.size()];
+   for (size_t l=0; l<set->integ_levels.size(); l++) {
+      std::vector<DataSink*> lsinks(set->levelsinks.begin() + l*set->num_sinks, set->levelsinks.begin() + (l+1)*set->num_sinks);
+      std::vector<DataSink*> wsinks(set->levelweightsinks.begin() + l*set->num_sinks, set->levelweightsinks.begin() + (l+1)*set->num_sinks);
+      set->levels[l] = new IntegrationLevel(set, set->integ_levels[l], lsinks, wsinks);
+   }
+
+   /* Prepare the spectral kurtosis estimator */
+   set->kurtosis = NULL;
+   if (set->spectral_kurtosis) {
+      set->kurtosis = new SpectralKurtosis(set, set->sksinks);
    }
 
-   /* Prepare the buffers we might need for assemblin Phase Cal subresults together */
-   this->corecombined_pcals   = new Buffer*[set->num_sources];
-   for (int cp=0; cp<(set->num_sources); cp++) {
-      corecombined_pcals[cp] = new Buffer(set->pcal_result_bytes);
-      corecombined_pcals[cp]->setLength(set->pcal_result_bytes);
-      cores[0]->resetBuffer(corecombined_pcals[cp]);
+   /* Prepare the pyramid of coarser resolutions */
+   set->rebin = NULL;
+   if (!set->rebin_factors.empty()) {
+      set->rebin = new SpectrumRebin(set, set->rebinsinks, set->rebinweightsinks);
    }
 
    return;
@@ -94,10 +196,12 @@ void TaskDispatcher::run()
    int  ncores    = set->num_cores;
    int  chunk_nr  = 0;
    int  dblbuf_nr = 0;
+   long num_rounds = 0;
    bool gotEOF    = false;
    bool wroteSome = false;
 
    int num_combined  = 0;
+   long num_assembled = 0;
    int total_spectra = 0;
    int total_spectra_prev  = 0;
    int total_corecompleted = 0;
@@ -124,49 +228,66 @@ void TaskDispatcher::run()
                        );
       }
 
-      /* pre-fill the next raw input buffers */
+      /* meanwhile write out the spectra assembled in the previous round */
+      if (!completed_slots.empty()) {
+         total_spectra += completed_slots.size();
+         wroteSome = true;
+         write_completed();
+      }
+
+      /* pre-fill the next raw input buffers, continuing the data of the buffers in the
+       * previous core or, for the first core, the last core of the current round */
       for (int c=0; c<ncores; c++) {
          for (int s=0; s<set->num_sources; s++) {
-            (set->sources[s])->read (set->rawbuffers[c][(dblbuf_nr+1)%2][s]);
+            Buffer* prev = (c > 0) ? set->rawbuffers[c-1][(dblbuf_nr+1)%2][s] : set->rawbuffers[ncores-1][dblbuf_nr][s];
+            carry_over(prev, set->rawbuffers[c][(dblbuf_nr+1)%2][s]);
+            (set->sources[s])->read (set->rawbuffers[c][(dblbuf_nr+1)%2][s], chunk_bytes(swsint64_t(num_rounds + 1)*ncores + c));
          }
       }
 
       /* wait for calculations to complete and write out results on the go */
-      wroteSome = false;
       for (int c=0; c<ncores; c++) {
 
          /* wait for one new result */
          int numcompleted = cores[c]->join();
          total_corecompleted += numcompleted;
 
+         /* continue tracking the carrier through the blocks of this core */
+         if (set->costas_loop) {
+            for (int s=0; s<set->num_sources; s++) {
+               if (costas[s]->track(set->outbuffersCostas[c][s], costas_points[s]) > 0) {
+                  set->costassinks[s]->write(costas_points[s]);
+               }
+            }
+         }
+
+         /* continue the total power series through the blocks of this core */
+         if (set->tpow_rate_hz > 0) {
+            for (int s=0; s<set->num_sources; s++) {
+               if (tpow[s]->integrate(set->outbuffersTPow[c][s], tpow_points[s]) > 0) {
+                  set->tpowsinks[s]->write(tpow_points[s]);
+               }
+            }
+         }
+
          /* write it directly to sinks or combine into common results? */
          if (set->max_buffers_per_spectrum > 1) {
 
-            /* subspectra from cores, assemble into common specrum */
-            cores[c]->combineResults(corecombined_spectra, corecombined_pcals);
+            /* subspectra from cores, the workers already added them into the common
+             * spectrum in the ring, or else assemble them here */
+            int slot = (num_assembled / set->max_buffers_per_spectrum) % set->combined_slots;
+            if (!cores[c]->reducesResults()) {
+               cores[c]->combineResults(set->combinedSpectra[slot], set->combinedPCal[slot]);
+               for (int sk=0; sk<set->num_sinks; sk++) {
+                  cores[c]->assembleRecords(set, c, slot, sk);
+               }
+            }
 
-            /* write completed assembled spectrum */
+            /* completed assembled spectrum is written during the next round */
+            num_assembled++;
             num_combined++;
             if (num_combined == set->max_buffers_per_spectrum) {
-
-                for (int sk=0; sk<set->num_sinks; sk++) {
-                   set->sinks[sk]->write(corecombined_spectra[sk]);
-                   cores[0]->resetBuffer(corecombined_spectra[sk]);
-                }
-
-                if (set->extract_PCal) {
-                   for (int pc=0; pc<set->num_sources; pc++) {
-                       #if 0
-                       cerr << endl << "Source " << pc << " pcal: ";
-                       Helpers::print_vecCplx((float*)corecombined_pcals[pc]->getData(), set->pcal_tonebins);
-                       #endif
-                       set->pcalsinks[pc]->write(corecombined_pcals[pc]);
-                       cores[0]->resetBuffer(corecombined_pcals[pc]);
-                   }
-                }
-
-                total_spectra++;
-                wroteSome    = true;
+                completed_slots.push_back(slot);
                 num_combined = 0;
             }
 
@@ -174,11 +295,46 @@ void TaskDispatcher::run()
 
             /* one or more full spectra from cores, write out */
             for (int sk=0; sk<set->num_sinks && sk<set->num_sources; sk++) {
+               /* the longer integrations and coarser resolutions leave the flagged points out themselves */
+               Buffer* flags = NULL;
+               if (set->kurtosis != NULL) {
+                  set->kurtosis->apply(sk, set->outbuffersSK[c][sk], set->outbuffers[c][sk]);
+                  flags = set->kurtosis->getFlags(sk);
+               }
+               for (size_t l=0; l<set->integ_levels.size(); l++) {
+                  set->levels[l]->add(sk, set->outbuffers[c][sk], flags);
+               }
+               if (set->rebin != NULL) {
+                  set->rebin->add(sk, set->outbuffers[c][sk], flags);
+               }
+               if (set->kurtosis != NULL) {
+                  set->kurtosis->flag(sk, set->outbuffers[c][sk]);
+               }
                set->sinks[sk]->write(set->outbuffers[c][sk]);
+               if (set->switch_period_s > 0) {
+                  set->onsinks[sk]->write(set->outbuffersOn[c][sk]);
+               }
+               if (set->fold_bins > 0) {
+                  set->foldsinks[sk]->write(set->outbuffersFold[c][sk]);
+               }
             }
             for (int xp=0; xp<set->num_xpols; xp++) {
                int xpolsink = set->num_sources + xp;
                set->sinks[xpolsink]->write(set->outbuffersXpol[c][xp]);
+               for (size_t l=0; l<set->integ_levels.size(); l++) {
+                  set->levels[l]->add(xpolsink, set->outbuffersXpol[c][xp]);
+               }
+               if (set->rebin != NULL) {
+                  set->rebin->add(xpolsink, set->outbuffersXpol[c][xp]);
+               }
+            }
+            if (set->peak_detect) {
+               for (int s=0; s<set->num_sources; s++) {
+                  set->peaksinks[s]->write(set->outbuffersPeak[c][s]);
+                  if (set->peak_window_points > 0) {
+                     set->peakwinsinks[s]->write(set->outbuffersPeakWin[c][s]);
+                  }
+               }
             }
             if (set->extract_PCal) {
                for (int pc=0; pc<set->num_sources; pc++) {
@@ -190,6 +346,11 @@ void TaskDispatcher::run()
                    cores[0]->resetBuffer(set->outbuffersPCal[c][pc]);
                }
             }
+            if (set->sampler_stats) {
+               for (int s=0; s<set->num_sources; s++) {
+                  set->statesinks[s]->write(set->outbuffersStates[c][s]);
+               }
+            }
             total_spectra += set->max_spectra_per_buffer;
             wroteSome = true;
          }
@@ -197,6 +358,7 @@ void TaskDispatcher::run()
 
       /* throughput statistics */
       if (wroteSome) {
+         wroteSome  = false;
          times[3]   = times[2];
          times[2]   = Helpers::getSysSeconds();
          double dT  = times[2] - times[3];
@@ -214,6 +376,7 @@ void TaskDispatcher::run()
 
       /* continue with the next buffered data */
       dblbuf_nr = (dblbuf_nr+1)%2;
+      num_rounds++;
 
       /* combined check for EOF on all of the input sources */
       for (int s=0; s<set->num_sources; s++) {
@@ -227,6 +390,10 @@ void TaskDispatcher::run()
       }
 
    } while (!gotEOF);
+   if (!completed_slots.empty()) {
+      total_spectra += completed_slots.size();
+      write_completed();
+   }
    times[1] = Helpers::getSysSeconds();
    cerr << endl;
 
@@ -237,15 +404,158 @@ void TaskDispatcher::run()
    for (int i=0; i<set->num_sinks; i++) {
       set->sinks[i]->close();
    }
+   for (size_t l=0; l<set->integ_levels.size(); l++) {
+      int dropped = set->levels[l]->close();
+      if (dropped > 0) {
+         *log << "TaskDispatcher: dropped the incomplete last spectrum of the "
+              << set->integ_levels[l] << "-fold integration level" << endl;
+      }
+   }
+   if (set->rebin != NULL) {
+      set->rebin->close();
+   }
+   if (set->kurtosis != NULL) {
+      long flagged = set->kurtosis->close();
+      *log << "TaskDispatcher: spectral kurtosis flagged " << flagged << " spectral points" << endl;
+   }
    if (set->extract_PCal) {
       for (int pc=0; pc<set->num_sources; pc++) {
          set->pcalsinks[pc]->close();
       }
    }
+   if (set->costas_loop) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->costassinks[s]->close();
+      }
+   }
+   if (set->sampler_stats) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->statesinks[s]->close();
+      }
+   }
+   if (set->switch_period_s > 0) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->onsinks[s]->close();
+      }
+   }
+   if (set->fold_bins > 0) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->foldsinks[s]->close();
+      }
+   }
+   if (set->tpow_rate_hz > 0) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->tpowsinks[s]->close();
+      }
+   }
+   if (set->peak_detect) {
+      for (int s=0; s<set->num_sources; s++) {
+         set->peaksinks[s]->close();
+         if (set->peak_window_points > 0) {
+            set->peakwinsinks[s]->close();
+         }
+      }
+   }
    *log << "TaskDispatcher completed, time delta " << (times[1] - times[0]) << "s." << endl;
    return;
 }
 
+/**
+ * Write out the spectra assembled from several core sub-spectra
+ * that have been completed, then clear their ring slots.
+ */
+void TaskDispatcher::write_completed()
+{
+   for (size_t i=0; i<completed_slots.size(); i++) {
+      int      slot    = completed_slots[i];
+      Buffer** spectra = set->combinedSpectra[slot];
+      Buffer** pcals   = set->combinedPCal[slot];
+
+      /* the workers finish the spectra while they assemble them, unless they can't */
+      if (!cores[0]->reducesResults()) {
+         for (int sk=0; sk<set->num_sinks; sk++) {
+            cores[0]->finishSpectrum(set, slot, sk);
+         }
+      }
+
+      if (set->peak_detect) {
+         for (int s=0; s<set->num_sources; s++) {
+            set->peaksinks[s]->write(set->combinedPeak[slot][s]);
+            if (set->peak_window_points > 0) {
+               set->peakwinsinks[s]->write(set->combinedPeakWin[slot][s]);
+            }
+         }
+      }
+
+      for (int sk=0; sk<set->num_sinks; sk++) {
+         set->sinks[sk]->write(spectra[sk]);
+         if ((set->switch_period_s > 0) && (sk < set->num_sources)) {
+            set->onsinks[sk]->write(set->combinedOn[slot][sk]);
+            cores[0]->resetBuffer(set->combinedOn[slot][sk]);
+         }
+         if ((set->fold_bins > 0) && (sk < set->num_sources)) {
+            set->foldsinks[sk]->write(set->combinedFold[slot][sk]);
+            cores[0]->resetBuffer(set->combinedFold[slot][sk]);
+         }
+         cores[0]->resetBuffer(spectra[sk]);
+      }
+
+      if (set->extract_PCal) {
+         for (int pc=0; pc<set->num_sources; pc++) {
+             #if 0
+             cerr << endl << "Source " << pc << " pcal: ";
+             Helpers::print_vecCplx((float*)pcals[pc]->getData(), set->pcal_tonebins);
+             #endif
+             pcals[pc]->setLength(set->pcal_result_bytes);
+             set->pcalsinks[pc]->write(pcals[pc]);
+             cores[0]->resetBuffer(pcals[pc]);
+         }
+      }
+
+      if (set->sampler_stats) {
+         for (int s=0; s<set->num_sources; s++) {
+            Buffer* states = set->combinedStates[slot][s];
+            states->setLength(set->sampler_states * sizeof(swsint64_t));
+            set->statesinks[s]->write(states);
+            cores[0]->resetBuffer(states);
+         }
+      }
+   }
+   completed_slots.clear();
+}
+
+/**
+ * Size of a raw input chunk. Chunks of a spectrum that spans several
+ * buffers may differ by one overlap step.
+ * @return Number of raw bytes to read into the chunk
+ * @param  chunk  Number of the chunk, counted over all cores
+ */
+size_t TaskDispatcher::chunk_bytes(swsint64_t chunk) const
+{
+   swsint64_t hops = Helpers::chunk_first_hop(set, chunk + 1) - Helpers::chunk_first_hop(set, chunk);
+   return size_t(hops) * set->raw_overlap_bytes;
+}
+
+/**
+ * Copy the tail of the preceding raw data into the head room of a raw buffer
+ * that is about to be filled, so that FFTs continue across the boundary.
+ * @param prev  raw buffer with the preceding data, or NULL at the start of the stream
+ * @param next  raw buffer to prepend the tail to
+ */
+void TaskDispatcher::carry_over(Buffer* prev, Buffer* next)
+{
+   size_t n = set->raw_carry_bytes;
+   if ((n == 0) || (next->getHeadroom() < n)) {
+      return;
+   }
+   if (prev == NULL) {
+      memset(next->getData() - n, 0, n);
+      return;
+   }
+
+   /* a short buffer at EOF still has the older carried data right in front of it */
+   memcpy(next->getData() - n, prev->getData() + prev->getLength() - n, n);
+}
 
 #ifdef UNIT_TEST_TD
 int main(int argc, char** argv)
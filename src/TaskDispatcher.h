@@ -22,6 +22,13 @@
 
 #include "Settings.h"
 #include "TaskCore.h"
+#include "CostasLoop.h"
+#include "TotalPower.h"
+#include "IntegrationLevel.h"
+#include "SpectrumRebin.h"
+#include "SpectralKurtosis.h"
+
+#include <vector>
 
 #define VERBOSE 0
 
@@ -78,8 +85,37 @@ private:
    swspect_settings_t *set;           // settings to run with, incl. preallocated buffers, open files, ...
 
    TaskCore **cores;                  // platform-specific computing "cores"
-   Buffer   **corecombined_spectra;   // help buffers used for assembling together several core sub-spectrum results
-   Buffer   **corecombined_pcals;     // help buffers used for assembling together several core Phase Cal detection results
+   std::vector<int> completed_slots;  // ring slots with fully assembled spectra, waiting to be written
+
+   CostasLoop **costas;               // carrier tracking loops, one per source, fed in buffer order
+   Buffer   **costas_points;          // output time series of the carrier tracking loops
+
+   TotalPower **tpow;                 // total power averaging, one per source, fed in buffer order
+   Buffer   **tpow_points;            // output time series of the total power
+
+private:
+
+   /**
+    * Write out the spectra assembled from several core sub-spectra
+    * that have been completed, then clear their ring slots.
+    */
+   void write_completed();
+
+   /**
+    * Size of a raw input chunk. Chunks of a spectrum that spans several
+    * buffers may differ by one overlap step.
+    * @return Number of raw bytes to read into the chunk
+    * @param  chunk  Number of the chunk, counted over all cores
+    */
+   size_t chunk_bytes(swsint64_t chunk) const;
+
+   /**
+    * Copy the tail of the preceding raw data into the head room of a raw buffer
+    * that is about to be filled, so that FFTs continue across the boundary.
+    * @param prev  raw buffer with the preceding data, or NULL at the start of the stream
+    * @param next  raw buffer to prepend the tail to
+    */
+   void carry_over(Buffer* prev, Buffer* next);
 
 };
 
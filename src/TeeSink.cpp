@@ -76,6 +76,21 @@ size_t TeeSink::write(Buffer *buf)
     return max_written;
 }
 
+/**
+ * Flush all sinks
+ * @return int Returns 0 on success, otherwise the number of sinks that failed
+ */
+int TeeSink::flush()
+{
+    int fails = 0;
+    std::vector<DataSink*>::iterator it = sinks.begin();
+    while (it != sinks.end()) {
+        if ((*it)->flush() != 0) { fails++; }
+        ++it;
+    }
+    return fails;
+}
+
 /**
 * Close the resource
 * @return int Returns 0 on success
@@ -90,6 +105,20 @@ int TeeSink::close()
     return 0;
 }
 
+/**
+ * Pass the data description on to all sinks
+ * @param key   Name of the property
+ * @param value Value of the property
+ */
+void TeeSink::setMetadata(std::string const& key, std::string const& value)
+{
+    std::vector<DataSink*>::iterator it = sinks.begin();
+    while (it != sinks.end()) {
+        (*it)->setMetadata(key, value);
+        ++it;
+    }
+}
+
 #ifdef UNIT_TEST_TSINK
 int main(int argc, char** argv)
 {
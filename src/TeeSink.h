@@ -52,12 +52,25 @@ public:
     */
    size_t write(Buffer *buf);
 
+   /**
+    * Flush all sinks
+    * @return int Returns 0 on success, otherwise the number of sinks that failed
+    */
+   int flush();
+
    /**
     * Close the resource
     * @return int Returns 0 on success
     */
    int close();
 
+   /**
+    * Pass the data description on to all sinks
+    * @param key   Name of the property
+    * @param value Value of the property
+    */
+   void setMetadata(std::string const& key, std::string const& value);
+
 private:
    std::vector<DataSink*> sinks;
    swspect_settings_t* settings;
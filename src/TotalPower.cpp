@@ -0,0 +1,143 @@
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+
+#include "TotalPower.h"
+
+/**
+ * Prepare the averaging from the settings.
+ * @param settings Pointer to the global settings
+ */
+TotalPower::TotalPower(swspect_settings_t* settings)
+{
+   cfg = settings;
+   acc_power = 0.0;
+   acc_count = 0;
+}
+
+/**
+ * Average a series of blocks into output points. Points that do not fit
+ * into the output buffer are kept and placed first by the next call.
+ * @return int      Number of output points placed into the output buffer
+ * @param  blocks   Buffer with float sums of squared samples, one per block, from a TaskCore
+ * @param  points   Buffer to receive the float mean power of each output point
+ */
+int TotalPower::integrate(Buffer* blocks, Buffer* points)
+{
+   swsfloat_t const* in  = (swsfloat_t const*)blocks->getData();
+   swsfloat_t*       out = (swsfloat_t*)points->getData();
+   size_t nin  = blocks->getLength() / sizeof(swsfloat_t);
+   size_t nmax = points->getAllocated() / sizeof(swsfloat_t);
+   size_t nout = 0;
+
+   /* points left over from the last call come first, the series stays in order */
+   while ((nout < pending.size()) && (nout < nmax)) {
+      out[nout] = pending[nout];
+      nout++;
+   }
+   pending.erase(pending.begin(), pending.begin() + nout);
+
+   for (size_t k=0; k<nin; k++) {
+      acc_power += in[k];
+      acc_count++;
+      if (acc_count >= cfg->tpow_output_decim) {
+         swsfloat_t p = swsfloat_t(acc_power / (double(acc_count) * cfg->tpow_block_len));
+         if (nout < nmax) {
+            out[nout] = p;
+            nout++;
+         } else {
+            pending.push_back(p);
+         }
+         acc_power = 0.0;
+         acc_count = 0;
+      }
+   }
+
+   points->setLength(nout * sizeof(swsfloat_t));
+   return nout;
+}
+
+
+#ifdef UNIT_TEST_TOTALPOWER
+// g++ -Wall -DUNIT_TEST_TOTALPOWER=1 TotalPower.cpp Buffer.cpp Helpers.cpp -o tpowtest
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+/* pass blocks first..first+num-1 of a series in which block k holds the value k */
+static int tpow_test_run(TotalPower& tp, Buffer& points, int first, int num)
+{
+   Buffer blocks(std::max(num, 1) * sizeof(swsfloat_t));
+   swsfloat_t* b = (swsfloat_t*)blocks.getData();
+   for (int k=0; k<num; k++) {
+      b[k] = swsfloat_t(first + k);
+   }
+   blocks.setLength(num * sizeof(swsfloat_t));
+   return tp.integrate(&blocks, &points);
+}
+
+/* compare the points of the last call against output points first..first+num-1 */
+static int tpow_test_check(Buffer& points, int n, int first, int num, int decim, int blocklen)
+{
+   swsfloat_t const* p = (swsfloat_t const*)points.getData();
+   int errors = 0;
+   if ((n != num) || (points.getLength() != num*sizeof(swsfloat_t))) {
+      std::cerr << "got " << n << " points instead of " << num << std::endl;
+      return 1;
+   }
+   for (int j=0; j<num; j++) {
+      /* the mean of blocks decim*(first+j) to decim*(first+j+1)-1, per sample */
+      double expect = (decim*(first + j) + (decim - 1)/2.0) / blocklen;
+      if (fabs(p[j] - expect) > 1e-5*expect) {
+         std::cerr << "point " << first + j << " is " << p[j] << " instead of " << expect << std::endl;
+         errors++;
+      }
+   }
+   return errors;
+}
+
+int main(int argc, char** argv)
+{
+   const int decim = 4, blocklen = 2;
+   int errors = 0;
+
+   swspect_settings_t s;
+   s.tpow_output_decim = decim;
+   s.tpow_block_len    = blocklen;
+   TotalPower tp(&s);
+   Buffer points(8 * sizeof(swsfloat_t));
+
+   /* calls that end in the middle of a point carry their blocks over to the next call */
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 0, 6), 0, 1, decim, blocklen);
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 6, 7), 1, 2, decim, blocklen);
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 13, 2), 3, 0, decim, blocklen);
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 15, 1), 3, 1, decim, blocklen);
+
+   /* an output buffer for one point keeps the other points for the next calls */
+   Buffer one(sizeof(swsfloat_t));
+   errors += tpow_test_check(one, tpow_test_run(tp, one, 16, 12), 4, 1, decim, blocklen);
+   errors += tpow_test_check(one, tpow_test_run(tp, one, 28, 0), 5, 1, decim, blocklen);
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 28, 10), 6, 3, decim, blocklen);
+   errors += tpow_test_check(points, tpow_test_run(tp, points, 38, 2), 9, 1, decim, blocklen);
+
+   std::cerr << "TotalPower test: " << errors << " errors" << std::endl;
+   return (errors > 0) ? 1 : 0;
+}
+#endif
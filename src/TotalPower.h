@@ -0,0 +1,63 @@
+#ifndef TOTALPOWER_H
+#define TOTALPOWER_H
+/************************************************************************
+ * IBM Cell / Intel Software Spectrometer
+ * Copyright (C) 2008 Jan Wagner
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA
+**************************************************************************/
+
+#include "Settings.h"
+#include "Buffer.h"
+
+#include <vector>
+
+/**
+  * class TotalPower
+  * Time series of the total power of one source, the equivalent of a
+  * detector behind the sampler. The TaskCore sums the squared samples of
+  * its non-overlapped FFT inputs in short blocks. The blocks are averaged
+  * here into output points at the requested cadence, in buffer order so
+  * that the series is continuous across all cores and buffers.
+  */
+
+class TotalPower
+{
+public:
+   /**
+    * Prepare the averaging from the settings.
+    * @param settings Pointer to the global settings
+    */
+   TotalPower(swspect_settings_t* settings);
+
+   /**
+    * Average a series of blocks into output points. Points that do not fit
+    * into the output buffer are kept and placed first by the next call.
+    * @return int      Number of output points placed into the output buffer
+    * @param  blocks   Buffer with float sums of squared samples, one per block, from a TaskCore
+    * @param  points   Buffer to receive the float mean power of each output point
+    */
+   int integrate(Buffer* blocks, Buffer* points);
+
+private:
+   swspect_settings_t* cfg;
+
+   double acc_power;       // summed squared samples of the current output point
+   int    acc_count;       // blocks in the current output point
+   std::vector<swsfloat_t> pending; // completed points that did not fit into the last output buffer
+};
+
+#endif // TOTALPOWER_H
@@ -21,6 +21,7 @@
 #include "VSIBSource.h"
 #include <string>
 #include <iostream>
+#include <algorithm>
 using std::cerr;
 using std::endl;
 
@@ -42,15 +43,16 @@ int VSIBSource::open(std::string uri)
 }
 
 /**
- * Try to fill the entire bufferspace with new data and return the number of bytes actually read
+ * Try to fill the bufferspace with new data and return the number of bytes actually read
  * @return int    Returns the amount of bytes read
  * @param  bspace Pointer to Buffer to fill out
+ * @param  nbytes Number of bytes to read, at most the allocated size of the buffer
  */
-int VSIBSource::read(Buffer* buf)
+int VSIBSource::read(Buffer* buf, size_t nbytes)
 {
    int nread;
    char *dst   = buf->getData();
-   int nwanted = buf->getAllocated();
+   int nwanted = std::min(nbytes, buf->getAllocated());
    /* read the data */
    while (nwanted>0) {
       nread = ::read(fvsib, dst, nwanted);
@@ -58,7 +60,7 @@ int VSIBSource::read(Buffer* buf)
       nwanted -= nread;
    }
    /* set buffer size */
-   nwanted = buf->getAllocated();
+   nwanted = std::min(nbytes, buf->getAllocated());
    buf->setLength(nwanted);
    /* check for "EOF" */
    if ((unsigned long)nwanted > totalBytesWanted) {
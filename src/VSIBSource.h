@@ -59,11 +59,12 @@ public:
    int open(std::string uri);
 
    /**
-    * Tries to fill the entire buffer with new data and return the number of bytes actually read
+    * Tries to fill the buffer with new data and return the number of bytes actually read
     * @return int    Returns number of bytes read
     * @param  bspace Try to read enough data to fill buffer, return amount of bytes read
+    * @param  nbytes Number of bytes to read, at most the allocated size of the buffer
     */
-   int read(Buffer *buf);
+   int read(Buffer *buf, size_t nbytes);
 
    /**
     * Close the file
@@ -0,0 +1,128 @@
+% [data, hdr, idx] = read_swcontainer(fn, k)
+%    Reads spectra from a SWSpectrometer output file in the Container format
+%    (SinkFormat = Container). Only the header, the index and the requested
+%    records are read, not the rest of the file.
+%  Inputs:
+%    fn   = input file and path
+%  Optional:
+%    k    = indices of the records to read (1..N), default: all records
+%  Outputs:
+%    data = one record per column; float32 spectra are real, complex64 spectra
+%           complex, also when written as float16 or bfloat16; other record
+%           types are returned as raw uint8 bytes. LZ4-compressed records
+%           (SinkCompression = lz4) cannot be decoded here.
+%    hdr  = struct with the header fields and the metadata text
+%    idx  = struct array with offset, bytes, time_s and weight of each record;
+%           with time-stamped input data time_s counts from the time_ref_mjd
+%           and time_ref_s entries of the metadata
+%
+function [data, hdr, idx] = read_swcontainer(fn, k)
+
+    fd = fopen(fn, 'rb', 'l');
+    if (fd < 0),
+       error('Could not open %s', fn);
+    end
+
+    % Fixed header at the start of the first page
+    hdr.magic        = char(fread(fd, [1 8], 'uint8'));
+    if (~strcmp(hdr.magic(1:6), 'SWSPEC')),
+       fclose(fd);
+       error('%s is not a SWSpectrometer container file', fn);
+    end
+    hdr.version      = fread(fd, 1, 'int32');
+    hdr.header_bytes = fread(fd, 1, 'int32');
+    hdr.index_offset = fread(fd, 1, 'uint64');
+    hdr.num_records  = fread(fd, 1, 'uint64');
+    hdr.record_bytes = fread(fd, 1, 'uint64');
+    hdr.record_stride= fread(fd, 1, 'uint64');
+    hdr.points       = fread(fd, 1, 'uint64');
+    hdr.datatype     = fread(fd, 1, 'int32');   % 1=float32, 2=complex64, 3=struct
+    hdr.source       = fread(fd, 1, 'int32');   % 0 for cross-pol
+    hdr.channel      = fread(fd, 1, 'int32');
+    hdr.window_type  = fread(fd, 1, 'int32');
+    hdr.fft_points   = fread(fd, 1, 'uint64');
+    hdr.samplingfreq = fread(fd, 1, 'float64');
+    hdr.integration_s= fread(fd, 1, 'float64');
+    hdr.start_s      = fread(fd, 1, 'float64');
+    hdr.ffts_per_record    = fread(fd, 1, 'int32');
+    hdr.fft_overlap_factor = fread(fd, 1, 'int32');
+    hdr.bits_per_sample    = fread(fd, 1, 'int32');
+    hdr.precision          = fread(fd, 1, 'int32');   % 0=float32, 1=float16, 2=bfloat16
+    hdr.codec              = fread(fd, 1, 'int32');   % 0=none, 1=byte-shuffle+LZ4
+    fread(fd, 1, 'int32');
+    txt = char(fread(fd, [1 hdr.header_bytes-128], 'uint8'));
+    hdr.metadata = txt(1:min([find(txt==0, 1)-1, length(txt)]));
+
+    % Record index, or the fixed record layout of a file that was not closed
+    if (hdr.index_offset > 0),
+       fseek(fd, hdr.index_offset, 'bof');
+       raw = fread(fd, [4 hdr.num_records], 'uint64=>uint64');
+       fseek(fd, hdr.index_offset, 'bof');
+       flt = fread(fd, [4 hdr.num_records], 'float64');
+       offsets = double(raw(1,:));
+       bytes   = double(raw(2,:));
+       times   = flt(3,:);
+       weights = flt(4,:);
+    elseif (hdr.record_stride > 0),
+       fseek(fd, 0, 'eof');
+       n = floor((ftell(fd) - hdr.header_bytes) / hdr.record_stride);
+       offsets = hdr.header_bytes + (0:n-1) * hdr.record_stride;
+       bytes   = repmat(hdr.record_bytes, 1, n);
+       times   = hdr.start_s + (0:n-1) * hdr.integration_s;
+       weights = repmat(hdr.ffts_per_record, 1, n);
+    else
+       fclose(fd);
+       error('%s has neither a record index nor fixed-size records', fn);
+    end
+    idx = struct('offset', num2cell(offsets), 'bytes', num2cell(bytes), ...
+                 'time_s', num2cell(times), 'weight', num2cell(weights));
+
+    % Requested records only
+    if (nargin < 2),
+       k = 1:length(offsets);
+    end
+    if (any(k < 1) || any(k > length(offsets))),
+       fclose(fd);
+       error('Record index out of range 1..%u', length(offsets));
+    end
+    data = [];
+    for ii = 1:length(k),
+       fseek(fd, offsets(k(ii)), 'bof');
+       if ((hdr.codec ~= 0) && ((hdr.record_bytes == 0) || (bytes(k(ii)) < hdr.record_bytes))),
+          % record_bytes is the uncompressed size, without it compressed records are not recognized
+          fclose(fd);
+          error('Record %u is LZ4-compressed or of unknown size', k(ii));
+       end
+       if ((hdr.datatype == 1) || (hdr.datatype == 2)),
+          if (hdr.precision == 0),
+             rec = fread(fd, [bytes(k(ii))/4 1], 'float32');
+          else
+             rec = from_half(fread(fd, [bytes(k(ii))/2 1], 'uint16=>uint32'), hdr.precision);
+          end
+          if (hdr.datatype == 2),
+             rec = rec(1:2:end) + 1i*rec(2:2:end);
+          end
+       else
+          rec = fread(fd, [bytes(k(ii)) 1], 'uint8=>uint8');
+       end
+       data(1:length(rec), ii) = rec;
+    end
+    fclose(fd);
+
+end
+
+% Expand float16 (precision 1) or bfloat16 (precision 2) bit patterns to doubles
+function v = from_half(u, precision)
+    if (precision == 2),
+       v = double(typecast(bitshift(u, 16), 'single'));
+       return;
+    end
+    s = double(bitshift(u, -15));
+    e = double(bitand(bitshift(u, -10), 31));
+    m = double(bitand(u, 1023));
+    v = (2.^(e-15)) .* (1 + m/1024);
+    v(e == 0)  = (2^-14) * m(e == 0) / 1024;
+    v(e == 31 & m == 0) = Inf;
+    v(e == 31 & m ~= 0) = NaN;
+    v = v .* (1 - 2*s);
+end
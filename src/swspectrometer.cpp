@@ -23,6 +23,7 @@
 #include "TaskDispatcher.h"
 #include "Buffer.h"
 #include "Settings.h"
+#include <unistd.h>  // before FileSource.h, which redefines __cplusplus around mark5access.h
 
 #include "DataSource.h"
 #include "DataSink.h"
@@ -35,9 +36,15 @@
 #include "PlplotSink.h"
 #endif
 #include "Helpers.h"
+#include "BinSelection.h"
+#include "CostasLoop.h"
+#include "OutputCodec.h"
 
 #include "IniParser.h"
 #include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
 
 using std::endl;
 using std::cerr;
@@ -67,9 +74,12 @@ int main(int argc, char* argv[])
    /* Set default options */
    swspect_settings_t sset;
    sset.num_cores           = 1;
+   sset.use_hugepages       = false;
+   sset.fft_threads         = 1;
    sset.max_rawbuf_size     = PLATFORM_MAX_RAW_BUF_SIZE_MB*1024*1024;
    sset.fft_points          = 320000;
    sset.fft_integ_seconds   = 20;
+   sset.rebin_mode          = RebinMean;
    sset.wf_type             = Cosine2;
    sset.fft_overlap_factor  = 2;       // 50% overlap
    sset.samplingfreq        = 16e6;    // 16 MHz
@@ -81,12 +91,41 @@ int main(int argc, char* argv[])
    sset.use_channel_file1   = 1;
    sset.use_channel_file2   = 1;
    sset.seconds_to_skip     = 0;
+   sset.source_date_mjd     = 0;
+   sset.time_ref_mjd        = -1;
+   sset.time_ref_sec        = 0.0;
    sset.extract_PCal        = false;
+   sset.pcal_from_fft       = false;
    sset.use_live_plot       = false;
    sset.calc_Xpol           = false;
    sset.costas_loop         = false;
+   sset.costas_suppressed_carrier = true;
+   sset.costas_carrier_hz     = 0.0;
+   sset.costas_loop_bw_hz     = 10.0;
+   sset.costas_update_rate_hz = 1000.0;
+   sset.costas_output_rate_hz = 10.0;
+   sset.peak_detect         = false;
+   sset.peak_gaussian       = false;
+   sset.peak_window_bins    = 0;
+   sset.sampler_stats       = false;
+   sset.tpow_rate_hz        = 0.0;
+   sset.spectral_kurtosis   = false;
+   sset.sk_threshold        = 3.0;
+   sset.sk_flag_mode        = SKFlagNone;
+   sset.switch_period_s     = 0.0;
+   sset.switch_phase        = 0.0;
+   sset.switch_on_fraction  = 0.5;
+   sset.fold_bins           = 0;
+   sset.fold_period_s       = 0.0;
+   sset.fold_period_dot     = 0.0;
+   sset.fold_epoch_s        = 0.0;
    sset.sourceformat_str    = std::string("RawSigned");
    sset.sinkformat          = Binary;
+   sset.sink_queue_len      = 8;
+   sset.sink_flush_writes   = 0;
+   sset.sink_flush_seconds  = 1.0;
+   sset.sink_precision      = Float32;
+   sset.sink_compress       = false;
    sset.basefilename1_pattern = std::string("ProjDate_StationID_Instrument_ScanNo_\%fftpoints\%_\%integrtime\%_\%channel\%");
    sset.basefilename2_pattern = std::string("");
 
@@ -100,17 +139,47 @@ int main(int argc, char* argv[])
 
    /* Load individual keys */
    std::string keyval;
+   std::string sparse_bins_str, sparse_freqs_str, sparse_method_str("Auto");
+   std::string binranges_all, binranges[3];
+   std::string binranges_key[3] = { "OutputBinRanges", "OutputBinRanges", "OutputBinRanges" };
+   std::string peak_band_str, peak_interp_str("Parabolic");
+   std::string integ_levels_str;
+   std::string rebin_factors_str;
+   std::string core_cpus_str;
    iniParser.getKeyValue("NumCPUCores", sset.num_cores);
+   iniParser.getKeyValue("CoreCPUs", core_cpus_str);
+   iniParser.getKeyValue("HugePages", sset.use_hugepages);
+   iniParser.getKeyValue("ThreadsPerFFT", sset.fft_threads);
    if (iniParser.getKeyValue("MaxSourceBufferMB", sset.max_rawbuf_size)) {
       sset.max_rawbuf_size *= 1024*1024/2; // MByte, double-buffered
    }
 
    iniParser.getKeyValue("FFTpoints", sset.fft_points);
    iniParser.getKeyValue("FFTIntegrationTimeSec", sset.fft_integ_seconds);
+   iniParser.getKeyValue("ExtraIntegrationTimesSec", integ_levels_str);
+   iniParser.getKeyValue("RebinFactors", rebin_factors_str);
+   if (iniParser.getKeyValue("RebinMode", keyval)) {
+      if (Helpers::cicompare(keyval, std::string("sum")) == Helpers::FullMatch) {
+         sset.rebin_mode = RebinSum;
+      } else if (Helpers::cicompare(keyval, std::string("max")) == Helpers::FullMatch) {
+         sset.rebin_mode = RebinMax;
+      } else if (Helpers::cicompare(keyval, std::string("mean")) != Helpers::FullMatch) {
+         cerr << "Error: RebinMode must be sum, mean or max" << endl;
+         return -1;
+      }
+   }
    iniParser.getKeyValue("FFToverlapFactor", sset.fft_overlap_factor);
    if (iniParser.getKeyValue("WindowType", keyval)) {
       sset.wf_type = Helpers::parse_Windowing(keyval.c_str());
    }
+   iniParser.getKeyValue("SparseBins", sparse_bins_str);
+   iniParser.getKeyValue("SparseFrequenciesHz", sparse_freqs_str);
+   iniParser.getKeyValue("SparseMethod", sparse_method_str);
+   iniParser.getKeyValue("OutputBinRanges", binranges_all);
+   binranges[0] = binranges[1] = binranges[2] = binranges_all;
+   if (iniParser.getKeyValue("OutputBinRanges1", binranges[0])) { binranges_key[0] = "OutputBinRanges1"; }
+   if (iniParser.getKeyValue("OutputBinRanges2", binranges[1])) { binranges_key[1] = "OutputBinRanges2"; }
+   if (iniParser.getKeyValue("OutputBinRangesX", binranges[2])) { binranges_key[2] = "OutputBinRangesX"; }
 
    if (iniParser.getKeyValue("BandwidthHz", sset.samplingfreq)) {
       sset.samplingfreq *= 2.0; // fs=2*BW
@@ -119,6 +188,7 @@ int main(int argc, char* argv[])
 
    iniParser.getKeyValue("SourceFormat", sset.sourceformat_str);
    iniParser.getKeyValue("SourceSkipSeconds", sset.seconds_to_skip);
+   iniParser.getKeyValue("SourceDateMJD", sset.source_date_mjd);
    iniParser.getKeyValue("BitsPerSample", sset.bits_per_sample);
    iniParser.getKeyValue("ChannelOrderIncreasing", sset.channelorder_increasing);
    iniParser.getKeyValue("SourceChannels", sset.source_channels);
@@ -127,13 +197,67 @@ int main(int argc, char* argv[])
    iniParser.getKeyValue("UseFile2Channel", sset.use_channel_file2);
 
    iniParser.getKeyValue("ExtractPCal", sset.extract_PCal);
+   iniParser.getKeyValue("PCalFromFFT", sset.pcal_from_fft);
    iniParser.getKeyValue("PlotProgress", sset.use_live_plot);
    iniParser.getKeyValue("DoCrossPolarization", sset.calc_Xpol);
    iniParser.getKeyValue("DoCostasLoop",sset.costas_loop);
+   iniParser.getKeyValue("CostasSuppressedCarrier", sset.costas_suppressed_carrier);
+   iniParser.getKeyValue("CostasCarrierHz", sset.costas_carrier_hz);
+   iniParser.getKeyValue("CostasLoopBandwidthHz", sset.costas_loop_bw_hz);
+   iniParser.getKeyValue("CostasUpdateRateHz", sset.costas_update_rate_hz);
+   iniParser.getKeyValue("CostasOutputRateHz", sset.costas_output_rate_hz);
+   iniParser.getKeyValue("DoPeakDetection", sset.peak_detect);
+   iniParser.getKeyValue("PeakSearchHz", peak_band_str);
+   iniParser.getKeyValue("PeakInterpolation", peak_interp_str);
+   iniParser.getKeyValue("PeakWindowBins", sset.peak_window_bins);
+   iniParser.getKeyValue("DoSamplerStats", sset.sampler_stats);
+   iniParser.getKeyValue("TotalPowerRateHz", sset.tpow_rate_hz);
+   iniParser.getKeyValue("DoSpectralKurtosis", sset.spectral_kurtosis);
+   iniParser.getKeyValue("SKThresholdSigma", sset.sk_threshold);
+   if (iniParser.getKeyValue("SKFlagging", keyval)) {
+      if (Helpers::cicompare(keyval, std::string("NaN")) == Helpers::FullMatch) {
+         sset.sk_flag_mode = SKFlagNaN;
+      } else if (Helpers::cicompare(keyval, std::string("zero")) == Helpers::FullMatch) {
+         sset.sk_flag_mode = SKFlagZero;
+      } else if (Helpers::cicompare(keyval, std::string("none")) != Helpers::FullMatch) {
+         cerr << "Error: SKFlagging must be none, NaN or zero" << endl;
+         return -1;
+      }
+   }
+   iniParser.getKeyValue("SwitchingPeriodSec", sset.switch_period_s);
+   iniParser.getKeyValue("SwitchingPhase", sset.switch_phase);
+   iniParser.getKeyValue("SwitchingOnFraction", sset.switch_on_fraction);
+   iniParser.getKeyValue("FoldBins", sset.fold_bins);
+   iniParser.getKeyValue("FoldPeriodSec", sset.fold_period_s);
+   iniParser.getKeyValue("FoldPeriodDerivative", sset.fold_period_dot);
+   iniParser.getKeyValue("FoldEpochSec", sset.fold_epoch_s);
 
    iniParser.getKeyValue("SinkFormat", keyval);
    if (Helpers::cicompare(keyval, std::string("ASCII")) == Helpers::FullMatch) {
       sset.sinkformat = Ascii;
+   } else if (Helpers::cicompare(keyval, std::string("Container")) == Helpers::FullMatch) {
+      sset.sinkformat = Container;
+   }
+   iniParser.getKeyValue("SinkQueueLength", sset.sink_queue_len);
+   iniParser.getKeyValue("SinkFlushEvery", sset.sink_flush_writes);
+   iniParser.getKeyValue("SinkFlushSeconds", sset.sink_flush_seconds);
+   if (iniParser.getKeyValue("SinkPrecision", keyval)) {
+      if (Helpers::cicompare(keyval, std::string("float16")) == Helpers::FullMatch) {
+         sset.sink_precision = Float16;
+      } else if (Helpers::cicompare(keyval, std::string("bfloat16")) == Helpers::FullMatch) {
+         sset.sink_precision = BFloat16;
+      } else if (Helpers::cicompare(keyval, std::string("float32")) != Helpers::FullMatch) {
+         cerr << "Error: SinkPrecision must be float32, float16 or bfloat16" << endl;
+         return -1;
+      }
+   }
+   if (iniParser.getKeyValue("SinkCompression", keyval)) {
+      if (Helpers::cicompare(keyval, std::string("lz4")) == Helpers::FullMatch) {
+         sset.sink_compress = true;
+      } else if (Helpers::cicompare(keyval, std::string("none")) != Helpers::FullMatch) {
+         cerr << "Error: SinkCompression must be none or lz4" << endl;
+         return -1;
+      }
    }
    if (!iniParser.getKeyValue("BaseFilename1", sset.basefilename1_pattern)) {
       cerr << "Error: BaseFilename1 setting is missing from the INI file!" << endl;
@@ -153,6 +277,69 @@ int main(int argc, char* argv[])
       cerr << "Error: UseFile2Channel setting " << sset.use_channel_file2 << " is an invalid channel number" << endl;
       return -1;
    }
+   if (sset.costas_loop && ((sset.costas_carrier_hz <= 0) || (sset.costas_carrier_hz >= 0.5*sset.samplingfreq))) {
+      cerr << "Error: CostasCarrierHz " << sset.costas_carrier_hz << " must lie inside the " << 0.5*sset.samplingfreq << " Hz band" << endl;
+      return -1;
+   }
+   if (sset.costas_loop && ((sset.costas_update_rate_hz <= 0) || (sset.costas_output_rate_hz <= 0))) {
+      cerr << "Error: CostasUpdateRateHz and CostasOutputRateHz must be positive" << endl;
+      return -1;
+   }
+   if (sset.fft_threads < 1) {
+      cerr << "Error: ThreadsPerFFT must be at least 1" << endl;
+      return -1;
+   }
+   if ((sset.sink_queue_len < 0) || (sset.sink_flush_writes < 0) || (sset.sink_flush_seconds < 0)) {
+      cerr << "Error: SinkQueueLength, SinkFlushEvery and SinkFlushSeconds must not be negative" << endl;
+      return -1;
+   }
+   if (sset.sink_compress && !OutputCodec::have_lz4()) {
+      cerr << "Error: SinkCompression = lz4 but the program was built without LZ4 (FLAG_HAVE_LZ4 in the Makefile)" << endl;
+      return -1;
+   }
+   if (sset.sink_compress && (sset.sinkformat != Container)) {
+      cerr << "Error: SinkCompression = lz4 needs SinkFormat = Container" << endl;
+      return -1;
+   }
+   if ((sset.sink_precision != Float32) && (sset.sinkformat == Ascii)) {
+      cerr << "Warning: SinkPrecision does not apply to the ASCII output format" << endl;
+   }
+   if ((sset.num_cores * sset.fft_threads) > sysconf(_SC_NPROCESSORS_ONLN)) {
+      cerr << "Warning: NumCPUCores x ThreadsPerFFT = " << (sset.num_cores * sset.fft_threads)
+           << " threads exceeds the " << sysconf(_SC_NPROCESSORS_ONLN) << " online CPUs" << endl;
+   }
+   if (sset.tpow_rate_hz < 0) {
+      cerr << "Error: TotalPowerRateHz must not be negative" << endl;
+      return -1;
+   }
+   if (sset.spectral_kurtosis && (sset.sk_threshold <= 0)) {
+      cerr << "Error: SKThresholdSigma must be positive" << endl;
+      return -1;
+   }
+   if (sset.switch_period_s < 0) {
+      cerr << "Error: SwitchingPeriodSec must not be negative" << endl;
+      return -1;
+   }
+   if ((sset.switch_period_s > 0) && ((sset.switch_on_fraction <= 0) || (sset.switch_on_fraction >= 1))) {
+      cerr << "Error: SwitchingOnFraction must be between 0 and 1" << endl;
+      return -1;
+   }
+   if ((sset.switch_period_s > 0) && sset.spectral_kurtosis) {
+      cerr << "Error: DoSpectralKurtosis cannot be combined with switching, the estimator assumes a constant power level" << endl;
+      return -1;
+   }
+   if ((sset.fold_bins < 0) || ((sset.fold_bins > 0) && (sset.fold_period_s <= 0))) {
+      cerr << "Error: folding needs FoldBins >= 0 and a positive FoldPeriodSec" << endl;
+      return -1;
+   }
+   if ((sset.fold_bins > 0) && (sset.switch_period_s > 0)) {
+      cerr << "Error: FoldBins cannot be combined with switching" << endl;
+      return -1;
+   }
+   if (sset.peak_detect && (sset.peak_window_bins < 0)) {
+      cerr << "Error: PeakWindowBins must not be negative" << endl;
+      return -1;
+   }
    if (sset.calc_Xpol && (argc != 4)) {
       cerr << "Warning: only one of two input files provided, disabling cross-pol spectrum calculation." << endl;
       sset.calc_Xpol = false;
@@ -171,64 +358,305 @@ int main(int argc, char* argv[])
    sset.rawbytes_per_channelsample = (sset.bits_per_sample * sset.source_channels) / 8.0;
    sset.raw_fullfft_bytes    = int(sset.fft_points * sset.rawbytes_per_channelsample);
    sset.raw_overlap_bytes    = int(sset.fft_overlap_points * sset.rawbytes_per_channelsample);
+   sset.raw_carry_bytes      = sset.raw_fullfft_bytes - sset.raw_overlap_bytes;
    sset.fft_bytes            = sset.fft_points * sizeof(swsfloat_t);
-   sset.fft_bytes_ssb        = sset.fft_ssb_points * sizeof(swsfloat_t);
+   if (sset.spectral_kurtosis && (sset.averaged_ffts < 2)) {
+      cerr << "Error: spectral kurtosis needs at least 2 non-overlapped FFTs per integrated spectrum" << endl;
+      return -1;
+   }
+
+   /* Derive the sparse-bin mode: sorted list of the FFT bins to compute */
+   std::vector<double> rfrom, rto;
+   if (Helpers::parse_Ranges(sparse_bins_str.c_str(), rfrom, rto) > 0) {
+       for (size_t r=0; r<rfrom.size(); r++) {
+           for (int bin=int(ceil(rfrom[r])); bin<=int(floor(rto[r])); bin++) {
+               sset.sparse_bins.push_back(bin);
+           }
+       }
+   }
+   if (Helpers::parse_Ranges(sparse_freqs_str.c_str(), rfrom, rto) > 0) {
+       for (size_t r=0; r<rfrom.size(); r++) {
+           for (int bin=int(floor(rfrom[r]/sset.df + 0.5)); bin<=int(floor(rto[r]/sset.df + 0.5)); bin++) {
+               sset.sparse_bins.push_back(bin);
+           }
+       }
+   }
+   std::sort(sset.sparse_bins.begin(), sset.sparse_bins.end());
+   sset.sparse_bins.erase(std::unique(sset.sparse_bins.begin(), sset.sparse_bins.end()), sset.sparse_bins.end());
+   while (!sset.sparse_bins.empty() && (sset.sparse_bins.back() >= sset.fft_ssb_points)) {
+       sset.sparse_bins.pop_back();
+   }
+   while (!sset.sparse_bins.empty() && (sset.sparse_bins.front() < 0)) {
+       sset.sparse_bins.erase(sset.sparse_bins.begin());
+   }
+   if (sset.sparse_bins.empty()) {
+       sset.out_points      = sset.fft_ssb_points;
+       sset.sparse_goertzel = false;
+   } else {
+       // a Goertzel filter costs about one multiply-add per sample and bin, a FFT about
+       // SPARSE_FFT_COST_PER_LOG2 of them per sample and log2(points)
+       double goertzel_cost = sset.sparse_bins.size();
+       double fft_cost      = SPARSE_FFT_COST_PER_LOG2 * log2(double(sset.fft_points));
+       sset.out_points      = sset.sparse_bins.size();
+       if (Helpers::cicompare(sparse_method_str, std::string("Goertzel")) == Helpers::FullMatch) {
+           sset.sparse_goertzel = true;
+       } else if (Helpers::cicompare(sparse_method_str, std::string("FFT")) == Helpers::FullMatch) {
+           sset.sparse_goertzel = false;
+       } else {
+           sset.sparse_goertzel = (goertzel_cost < fft_cost);
+       }
+   }
+   sset.fft_bytes_ssb        = sset.out_points * sizeof(swsfloat_t);
    sset.fft_bytes_xpol       = 2 * sset.fft_bytes_ssb; // complex data but single-sideband
 
+   /* Derive the extra integration levels as whole multiples of the base integration time */
+   if (Helpers::parse_Ranges(integ_levels_str.c_str(), rfrom, rto) > 0) {
+       for (size_t r=0; r<rfrom.size(); r++) {
+           int factor = int(floor(rfrom[r]/sset.fft_integ_seconds + 0.5));
+           if (factor < 2) {
+               cerr << "Warning: ignoring extra integration time " << rfrom[r] << "s, it is not longer than "
+                    << sset.fft_integ_seconds << "s" << endl;
+               continue;
+           }
+           if (fabs(factor*sset.fft_integ_seconds - rfrom[r]) > 1e-3*rfrom[r]) {
+               cerr << "Warning: extra integration time " << rfrom[r] << "s rounded to "
+                    << factor*sset.fft_integ_seconds << "s" << endl;
+           }
+           sset.integ_levels.push_back(factor);
+       }
+   }
+   std::sort(sset.integ_levels.begin(), sset.integ_levels.end());
+   sset.integ_levels.erase(std::unique(sset.integ_levels.begin(), sset.integ_levels.end()), sset.integ_levels.end());
+
+   /* Derive the coarser output resolutions as power-of-two groups of written points */
+   if (Helpers::parse_Ranges(rebin_factors_str.c_str(), rfrom, rto) > 0) {
+       for (size_t r=0; r<rfrom.size(); r++) {
+           int factor = int(floor(rfrom[r] + 0.5));
+           if ((factor < 2) || ((factor & (factor - 1)) != 0) || (fabs(factor - rfrom[r]) > 1e-6)) {
+               cerr << "Error: rebin factor " << rfrom[r] << " is not a power of two of at least 2" << endl;
+               return -1;
+           }
+           if (factor > int(sset.out_points)) {
+               cerr << "Warning: ignoring rebin factor " << factor << ", it is larger than the "
+                    << sset.out_points << " computed points" << endl;
+               continue;
+           }
+           sset.rebin_factors.push_back(factor);
+       }
+   }
+   std::sort(sset.rebin_factors.begin(), sset.rebin_factors.end());
+   sset.rebin_factors.erase(std::unique(sset.rebin_factors.begin(), sset.rebin_factors.end()), sset.rebin_factors.end());
+
+   /* Derive the peak search band as a range of computed points, by default the whole spectrum */
+   sset.peak_search_lo_hz  = 0.0;
+   sset.peak_search_hi_hz  = 0.5 * sset.samplingfreq;
+   sset.peak_first_point   = 0;
+   sset.peak_last_point    = -1;
+   sset.peak_window_points = 0;
+   if (sset.peak_detect) {
+       if (Helpers::parse_Ranges(peak_band_str.c_str(), rfrom, rto) > 0) {
+           sset.peak_search_lo_hz = rfrom[0];
+           sset.peak_search_hi_hz = rto[0];
+       }
+       sset.peak_gaussian = (Helpers::cicompare(peak_interp_str, std::string("Gaussian")) == Helpers::FullMatch);
+       for (int i=sset.out_points-1; i>=0; i--) {
+           double f = sset.df * (sset.sparse_bins.empty() ? i : sset.sparse_bins[i]);
+           if ((f >= sset.peak_search_lo_hz) && (f <= sset.peak_search_hi_hz)) {
+               if (sset.peak_last_point < 0) { sset.peak_last_point = i; }
+               sset.peak_first_point = i;
+           }
+       }
+       if (sset.peak_last_point < 0) {
+           cerr << "Error: PeakSearchHz " << sset.peak_search_lo_hz << "-" << sset.peak_search_hi_hz
+                << " contains none of the computed bins" << endl;
+           return -1;
+       }
+       if (sset.peak_window_bins > 0) {
+           sset.peak_window_points = std::min(2*sset.peak_window_bins + 1, sset.out_points);
+       }
+   }
+
    /* Derive some PCal extraction parameters */
    if (sset.extract_PCal) {
-       sset.pcal_tonebins   = sset.samplingfreq / sset.pcalharmonicshz;
-       sset.pcal_rotatorlen = sset.samplingfreq / Helpers::gcd(sset.samplingfreq, sset.pcaloffsethz);
-       sset.pcal_pulses     = sset.pcal_rotatorlen / sset.pcal_tonebins;
-       sset.pcal_result_bytes   = sset.pcal_tonebins * 2*sizeof(float);
-       sset.pcal_pulses_per_fft = sset.fft_points / sset.pcal_rotatorlen;
-       if ((sset.fft_points % sset.pcal_rotatorlen) != 0) {
-           cerr << "Warning: disabling PCal extraction because " << sset.pcal_rotatorlen << "-length vectors did not fit evenly into " 
-                << sset.fft_points << " DFT points." << endl;
-           sset.extract_PCal = false;
+       // the same tone count as PCal::getLength() of the extractors in the cores
+       double bw = 0.5 * sset.samplingfreq;
+       if (sset.pcaloffsethz == 0) {
+           sset.pcal_tonebins = int(floor(bw / sset.pcalharmonicshz));
+       } else {
+           sset.pcal_tonebins = int(floor((bw - sset.pcaloffsethz) / sset.pcalharmonicshz)) + 1;
+       }
+       long long fs = (long long)sset.samplingfreq;
+       long long Np = fs / Helpers::gcd(fs, (long long)sset.pcalharmonicshz);
+       long long No = (sset.pcaloffsethz == 0) ? 1 : fs / Helpers::gcd(fs, (long long)sset.pcaloffsethz);
+       sset.pcal_rotatorlen   = int((No / Helpers::gcd(No, Np)) * Np);
+       sset.pcal_result_bytes = sset.pcal_tonebins * 2*sizeof(float);
+       // the same normalization as PCal::getNBins() of the extractor PCal::getNew() would pick
+       sset.pcal_nbins        = int(((sset.pcaloffsethz != 0) && ((No % Np) == 0)) ? No : Np);
+
+       // tones can be picked straight out of the FFT output when all of them sit exactly on bins,
+       // the window leaks exactly nothing at the tone spacing, and a full FFT is computed at all;
+       // only the rectangular window and the periodic Cosine2 (nonzero at offsets 0 and 1 only) do,
+       // Cosine and the symmetric IPP windows leak into every bin offset
+       double first_bin = sset.pcaloffsethz / sset.df;
+       double bin_step  = sset.pcalharmonicshz / sset.df;
+       int min_step = 0;
+       switch (sset.wf_type) {
+           case None:     min_step = 1; break;
+           case Cosine2:  min_step = 2; break;
+           default:       min_step = 0; break;
+       }
+       sset.pcal_first_bin = int(floor(first_bin + 0.5));
+       sset.pcal_bin_step  = int(floor(bin_step + 0.5));
+       bool aligned = (fabs(first_bin - sset.pcal_first_bin) < 1e-6) && (fabs(bin_step - sset.pcal_bin_step) < 1e-6);
+       if ((min_step == 0) || ((sset.pcal_bin_step < min_step) && (sset.pcal_tonebins > 1))) {
+           aligned = false;
+       }
+       if (!sset.sparse_bins.empty() && sset.sparse_goertzel) {
+           aligned = false;
        }
+       sset.pcal_from_fft = sset.pcal_from_fft && aligned;
    } else {
-       sset.pcal_tonebins   = 0;
-       sset.pcal_rotatorlen = 0;
-       sset.pcal_pulses     = 0;
-       sset.pcal_result_bytes   = 0;
-       sset.pcal_pulses_per_fft = 0;
+       sset.pcal_tonebins     = 0;
+       sset.pcal_rotatorlen   = 0;
+       sset.pcal_result_bytes = 0;
+       sset.pcal_nbins        = 0;
+       sset.pcal_from_fft     = false;
+   }
+
+   /* Derive the carrier tracking loop parameters: integrate-and-dump blocks must tile the FFT input */
+   if (sset.costas_loop) {
+       int target = int(sset.samplingfreq / sset.costas_update_rate_hz);
+       target = std::max(1, std::min(target, (int)sset.fft_points));
+       while ((sset.fft_points % target) != 0) {
+           target--;
+       }
+       sset.costas_block_len      = target;
+       sset.costas_blocks_per_fft = sset.fft_points / sset.costas_block_len;
+       sset.costas_update_rate_hz = sset.samplingfreq / sset.costas_block_len;
+       sset.costas_output_decim   = std::max(1, int(sset.costas_update_rate_hz / sset.costas_output_rate_hz + 0.5));
+       sset.costas_output_rate_hz = sset.costas_update_rate_hz / sset.costas_output_decim;
+       if ((sset.costas_loop_bw_hz / sset.costas_update_rate_hz) > 0.1) {
+           cerr << "Warning: Costas loop bandwidth " << sset.costas_loop_bw_hz << " Hz is large compared to the "
+                << sset.costas_update_rate_hz << " Hz update rate, the loop may be unstable." << endl;
+       }
+   } else {
+       sset.costas_block_len      = 0;
+       sset.costas_blocks_per_fft = 0;
+       sset.costas_output_decim   = 0;
+   }
+
+   /* Derive the total power blocks the same way, they tile the FFT input and are averaged to the output rate */
+   if (sset.tpow_rate_hz > 0) {
+       int target = int(sset.samplingfreq / sset.tpow_rate_hz);
+       target = std::max(1, std::min(target, (int)sset.fft_points));
+       while ((sset.fft_points % target) != 0) {
+           target--;
+       }
+       sset.tpow_block_len      = target;
+       sset.tpow_blocks_per_fft = sset.fft_points / sset.tpow_block_len;
+       sset.tpow_output_decim   = std::max(1, int(sset.samplingfreq / (sset.tpow_rate_hz * sset.tpow_block_len) + 0.5));
+       sset.tpow_rate_hz        = sset.samplingfreq / (double(sset.tpow_block_len) * sset.tpow_output_decim);
+   } else {
+       sset.tpow_block_len      = 0;
+       sset.tpow_blocks_per_fft = 0;
+       sset.tpow_output_decim   = 0;
+   }
+
+   /* Derive the switching cycle in samples, an FFT must fit into each of its ON and OFF parts.
+    * FFTs across a transition are left out rather than split: a masked part would have a cut
+    * window, with a broader response and more leakage than the FFTs it is added to. */
+   if (sset.switch_period_s > 0) {
+       sset.switch_period_samples = sset.switch_period_s * sset.samplingfreq;
+       sset.switch_on_samples     = sset.switch_on_fraction * sset.switch_period_samples;
+       sset.switch_phase_samples  = (sset.switch_phase - floor(sset.switch_phase)) * sset.switch_period_samples;
+       double shortest = std::min(sset.switch_on_samples, sset.switch_period_samples - sset.switch_on_samples);
+       if (shortest < sset.fft_points) {
+           cerr << "Error: the ON and OFF parts of the " << sset.switch_period_s << "s switching cycle must each be at least "
+                << sset.fft_points << " samples long" << endl;
+           return -1;
+       }
+       if (sset.switch_period_s > sset.fft_integ_seconds) {
+           cerr << "Warning: switching period " << sset.switch_period_s << "s is longer than the "
+                << sset.fft_integ_seconds << "s integration time, some spectra will lack one of the states" << endl;
+       }
+   } else {
+       sset.switch_period_samples = 0;
+       sset.switch_on_samples     = 0;
+       sset.switch_phase_samples  = 0;
+   }
+
+   /* Derive the folding phase polynomial in samples: phase(n) = f0*(n-n0) + f1*(n-n0)^2/2,
+    * each FFT goes to one phase bin as a whole and so must not be longer than a bin */
+   if (sset.fold_bins > 0) {
+       sset.fold_epoch_samples = sset.fold_epoch_s * sset.samplingfreq;
+       sset.fold_f0 = 1.0 / (sset.fold_period_s * sset.samplingfreq);
+       sset.fold_f1 = -sset.fold_period_dot / (sset.fold_period_s * sset.fold_period_s * sset.samplingfreq * sset.samplingfreq);
+       if ((sset.fft_points * sset.dt) > (sset.fold_period_s / sset.fold_bins)) {
+           cerr << "Error: the " << sset.fft_points * sset.dt << "s FFTs are longer than the "
+                << sset.fold_period_s / sset.fold_bins << "s phase bins, use fewer FoldBins or a shorter FFT" << endl;
+           return -1;
+       }
+   } else {
+       sset.fold_epoch_samples = 0;
+       sset.fold_f0 = 0;
+       sset.fold_f1 = 0;
+   }
+
+   /* Quantisation states told apart by the unpackers, wider data is counted by its upper 8 bits */
+   sset.sampler_states = 1 << std::min(sset.bits_per_sample, 8);
+
+   /* CPU sets of the cores, and the NUMA node of each set for placing the buffers of that core */
+   std::vector<double> cfrom, cto;
+   if (Helpers::parse_Ranges(core_cpus_str.c_str(), cfrom, cto) > 0) {
+       for (size_t r=0; r<cfrom.size(); r++) {
+           sset.core_cpu_first.push_back(int(cfrom[r]));
+           sset.core_cpu_last.push_back(int(cto[r]));
+       }
+   }
+   for (int c=0; c<sset.num_cores; c++) {
+       int node = -1;
+       if (!sset.core_cpu_first.empty()) {
+           size_t r = c % sset.core_cpu_first.size();
+           node = Helpers::cpu_numa_node(sset.core_cpu_first[r]);
+           if (node != Helpers::cpu_numa_node(sset.core_cpu_last[r])) {
+               node = -1; // set spans several nodes
+           }
+       }
+       sset.core_numa_node.push_back(node);
    }
 
    /* Normalize the maximum buf size by #cores */
    sset.max_rawbuf_size = sset.max_rawbuf_size / sset.num_cores;
 
-   /* Determine raw buf size: even split accross CPU cores, size-limited by MaxSourceBufferMB */
+   /* Determine raw buf size: even split accross CPU cores, size-limited by MaxSourceBufferMB.
+    * The tail of each raw buffer is carried to the front of the next one, so overlapped
+    * FFTs continue across buffer boundaries and the size only has to be a multiple of
+    * raw_overlap_bytes. Spectra must still start at a buffer boundary. */
+   int hops_per_spectrum = sset.fft_overlap_factor * sset.averaged_ffts;
    size_t tent_rawbuf_size = sset.raw_fullfft_bytes * sset.averaged_ffts;
    if (tent_rawbuf_size > sset.max_rawbuf_size) {
-      // spectrum input too big -- start with just 1 FFT and many buffers, then keep
-      // doubling FFTs and reducing buffers until MaxSourceBufferMB is best filled
-      // (this could also be computed with log2()'s instead of the loop)
+      // spectrum input too big -- split it into the fewest buffers that fit into
+      // MaxSourceBufferMB, the buffers of one spectrum differ by one overlap step at most
+      int max_hops = std::max(1, int(sset.max_rawbuf_size / sset.raw_overlap_bytes));
       sset.max_spectra_per_buffer   = 0;
-      sset.max_specffts_per_buffer  = 1;
-      sset.max_buffers_per_spectrum = sset.averaged_ffts;
-      tent_rawbuf_size              = sset.raw_fullfft_bytes;
-      while ((tent_rawbuf_size <= sset.max_rawbuf_size) && ((sset.max_buffers_per_spectrum % 2) == 0)) {
-          tent_rawbuf_size *= 2;
-          sset.max_buffers_per_spectrum /= 2;
-          sset.max_specffts_per_buffer *= 2;
-      }
+      sset.max_buffers_per_spectrum = std::max(2, (hops_per_spectrum + max_hops - 1) / max_hops);
+      tent_rawbuf_size              = ((hops_per_spectrum + sset.max_buffers_per_spectrum - 1) / sset.max_buffers_per_spectrum) * sset.raw_overlap_bytes;
+      sset.max_specffts_per_buffer  = std::max(1, sset.averaged_ffts / sset.max_buffers_per_spectrum);
    } else {
-      // one full spectrum input fits -- now try to fit even more spectra
-      sset.max_spectra_per_buffer   = 1;
-      sset.max_specffts_per_buffer  = sset.averaged_ffts;
+      // one full spectrum input fits -- now fit as many spectra as possible
+      sset.max_spectra_per_buffer   = sset.max_rawbuf_size / tent_rawbuf_size;
+      sset.max_specffts_per_buffer  = sset.averaged_ffts; // used for single-spectrum scaling
       sset.max_buffers_per_spectrum = 0;
-      while ((2*tent_rawbuf_size) <= sset.max_rawbuf_size) {
-          tent_rawbuf_size *= 2;
-          sset.max_spectra_per_buffer *= 2;
-          // sset.max_specffts_per_buffer: used for single-spectrum scaling, don't double it
-      }
+      tent_rawbuf_size             *= sset.max_spectra_per_buffer;
    }
    sset.rawbuf_size = tent_rawbuf_size;
 
    /* Derive some per-core parameters from the settings and the memory allocation */
+   sset.averaged_overlapped_ffts = hops_per_spectrum - (sset.fft_overlap_factor - 1);
    sset.core_averaged_ffts   = sset.max_specffts_per_buffer;
-   sset.core_overlapped_ffts = sset.fft_overlap_factor*sset.max_specffts_per_buffer - (sset.fft_overlap_factor - 1);
+   sset.core_overlapped_ffts = std::min(sset.averaged_overlapped_ffts, int(sset.rawbuf_size / sset.raw_overlap_bytes));
+   sset.costas_result_bytes  = (sset.rawbuf_size / sset.raw_fullfft_bytes + 1) * sset.costas_blocks_per_fft * sizeof(swscomplex_t);
+   sset.tpow_result_bytes    = (sset.rawbuf_size / sset.raw_fullfft_bytes + 1) * sset.tpow_blocks_per_fft * sizeof(swsfloat_t);
 
    /* Prepare log files */
    sset.basefilename1 = cfg_to_filename(sset.basefilename1_pattern, sset, 1);
@@ -252,12 +680,35 @@ int main(int argc, char* argv[])
    std::string uri_pcal1(sset.basefilename1 + "_pcal.bin");
    std::string uri_pcal2(sset.basefilename2 + "_pcal.bin");
    std::string uri_outputX(sset.basefilename1 + "_xpol_swspec.bin");
+   std::string uri_costas1(sset.basefilename1 + "_costas.bin");
+   std::string uri_costas2(sset.basefilename2 + "_costas.bin");
+   std::string uri_peak[2]    = { sset.basefilename1 + "_peak.bin", sset.basefilename2 + "_peak.bin" };
+   std::string uri_peakwin[2] = { sset.basefilename1 + "_peakwin.bin", sset.basefilename2 + "_peakwin.bin" };
+   std::string uri_sk[2]      = { sset.basefilename1 + "_sk_swspec.bin", sset.basefilename2 + "_sk_swspec.bin" };
+   std::string uri_states[2]  = { sset.basefilename1 + "_states.bin", sset.basefilename2 + "_states.bin" };
+   std::string uri_tpow[2]    = { sset.basefilename1 + "_tpow.bin", sset.basefilename2 + "_tpow.bin" };
+   std::string uri_on[2]      = { sset.basefilename1 + "_on_swspec.bin", sset.basefilename2 + "_on_swspec.bin" };
+   std::string uri_fold[2]    = { sset.basefilename1 + "_fold_swspec.bin", sset.basefilename2 + "_fold_swspec.bin" };
 
    /* Display config */
    *out << "Config file  : " << uri_inifile << endl;
    *out << "Input file 1 : " << uri_input1 << endl;
    *out << "Input file 2 : " << uri_input2 << endl;
-   *out << "Core setup   : " << sset.num_cores << " parallel processing thread(s)" << endl;
+   *out << "Core setup   : " << sset.num_cores << " parallel processing thread(s)";
+   if (!sset.core_cpu_first.empty()) {
+       *out << ", pinned to CPUs " << core_cpus_str << " (NUMA nodes";
+       for (int c=0; c<sset.num_cores; c++) {
+           *out << " " << sset.core_numa_node[c];
+       }
+       *out << ")";
+   }
+   if (sset.fft_threads > 1) {
+       *out << ", " << sset.fft_threads << " threads per FFT";
+   }
+   if (sset.use_hugepages) {
+       *out << ", huge pages";
+   }
+   *out << endl;
    *out << "File format  : " << sset.bits_per_sample << " bits/sample, "
                              << sset.source_channels << " channels, selected "
                              << "channel " << (sset.use_channel_file1+1) << " of input 1, "
@@ -269,17 +720,121 @@ int main(int argc, char* argv[])
                              << sset.averaged_ffts << "-fold averaging "
                              << "(" << (sset.averaged_ffts * sset.fft_points) / sset.samplingfreq << "s), "
                              << 100.0*(1.0 - 1.0/sset.fft_overlap_factor) << "% overlap" << endl;
+   if (!sset.integ_levels.empty()) {
+       *out << "Extra integr : ";
+       for (size_t l=0; l<sset.integ_levels.size(); l++) {
+           *out << (l ? ", " : "") << sset.integ_levels[l]*sset.fft_integ_seconds << "s (" << sset.integ_levels[l] << "-fold)";
+       }
+       *out << " summed from the written spectra" << endl;
+   }
+   if (!sset.rebin_factors.empty()) {
+       const char* modes[3] = { "sum", "mean", "max" };
+       *out << "Rebinned     : ";
+       for (size_t r=0; r<sset.rebin_factors.size(); r++) {
+           *out << (r ? ", " : "") << sset.rebin_factors[r] << "-fold";
+       }
+       *out << " coarser, " << modes[sset.rebin_mode] << " of each group of written points" << endl;
+   }
+   if (!sset.sparse_bins.empty()) {
+       *out << "Sparse bins  : " << sset.out_points << " bins from " << sset.sparse_bins.front()
+            << " to " << sset.sparse_bins.back() << " ("
+            << sset.sparse_bins.front()*sset.df << " Hz to " << sset.sparse_bins.back()*sset.df << " Hz), "
+            << (sset.sparse_goertzel ? "Goertzel bank" : "picked from full DFT") << endl;
+   }
    *out << "PCal extract : ";
    if (sset.extract_PCal) { 
        *out << "on, " << sset.pcaloffsethz << " Hz offset, "
-            << sset.pcal_tonebins << " bins, period " 
-            << sset.pcal_rotatorlen << ", " << sset.pcal_pulses_per_fft << " pulses per DFT" << endl;  
+            << sset.pcal_tonebins << " tones, period " 
+            << sset.pcal_rotatorlen << " samples, "
+            << (sset.pcal_from_fft ? "from FFT bins" : "time domain") << endl;
    } else { 
        *out << "off"<< endl;  
    }
    *out << "Cross-pol    : ";
    if (sset.calc_Xpol) { *out<<"on"<<endl; } else { *out<<"off"<<endl; }
-   if (sset.costas_loop) { *out<<"Spacecraft signal without carrier, using Costas loop"<<endl;} else {}
+   *out << "Carrier loop : ";
+   if (sset.costas_loop) {
+       *out << (sset.costas_suppressed_carrier ? "Costas" : "PLL") << ", "
+            << sset.costas_carrier_hz << " Hz a-priori, "
+            << sset.costas_loop_bw_hz << " Hz loop bandwidth, "
+            << sset.costas_update_rate_hz << " Hz updates (" << sset.costas_block_len << "-sample blocks), "
+            << sset.costas_output_rate_hz << " Hz output" << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Peak search  : ";
+   if (sset.peak_detect) {
+       *out << sset.peak_search_lo_hz << " Hz to " << sset.peak_search_hi_hz << " Hz (points "
+            << sset.peak_first_point << " to " << sset.peak_last_point << "), "
+            << (sset.peak_gaussian ? "Gaussian" : "parabolic") << " interpolation";
+       if (sset.peak_window_points > 0) {
+           *out << ", " << sset.peak_window_points << "-point window output";
+       }
+       *out << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Sampler      : ";
+   if (sset.sampler_stats || (sset.tpow_rate_hz > 0)) {
+       if (sset.sampler_stats) {
+           *out << sset.sampler_states << "-state histogram per spectrum";
+       }
+       if (sset.tpow_rate_hz > 0) {
+           *out << (sset.sampler_stats ? ", " : "") << "total power at " << sset.tpow_rate_hz << " Hz ("
+                << sset.tpow_output_decim << " x " << sset.tpow_block_len << "-sample blocks)";
+       }
+       *out << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Kurtosis     : ";
+   if (sset.spectral_kurtosis) {
+       const char* flagging[3] = { "not marked", "marked NaN", "set to zero" };
+       *out << "from " << sset.averaged_ffts << " non-overlapped FFTs, bins beyond " << sset.sk_threshold
+            << " sigma are " << flagging[sset.sk_flag_mode] << " in the spectra" << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Switching    : ";
+   if (sset.switch_period_s > 0) {
+       *out << "period " << sset.switch_period_s << "s, " << 100*sset.switch_on_fraction << "% ON from phase "
+            << sset.switch_phase << ", OFF in the normal spectra, ON in <basename>_on_swspec.bin, FFTs across "
+            << "the transitions are left out, about " << std::min(100.0, 200.0 * sset.fft_points / sset.switch_period_samples)
+            << "% of the data" << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Folding      : ";
+   if (sset.fold_bins > 0) {
+       double ramMB_fold = sset.num_cores * sset.num_sources * std::max(sset.max_spectra_per_buffer, 1)
+                         * sset.fold_bins * sset.fft_bytes_ssb / (1024.0*1024.0);
+       *out << sset.fold_bins << " phase bins, period " << sset.fold_period_s << "s";
+       if (sset.fold_period_dot != 0) {
+           *out << " changing by " << sset.fold_period_dot << "s/s";
+       }
+       *out << ", epoch " << sset.fold_epoch_s << "s, " << ramMB_fold << " MByte of accumulators" << endl;
+   } else {
+       *out << "off" << endl;
+   }
+   *out << "Output write : ";
+   if (sset.sink_queue_len > 0) {
+       *out << "writer thread per file, " << sset.sink_queue_len << " queued buffers";
+   } else {
+       *out << "synchronous";
+   }
+   if (sset.sink_flush_writes > 0) {
+       *out << ", flush every " << sset.sink_flush_writes << " writes";
+   }
+   if (sset.sink_flush_seconds > 0) {
+       *out << ", flush every " << sset.sink_flush_seconds << "s";
+   }
+   if (sset.sink_precision != Float32) {
+       *out << ", " << ((sset.sink_precision == Float16) ? "float16" : "bfloat16") << " spectra";
+   }
+   if (sset.sink_compress) {
+       *out << ", byte-shuffle+LZ4";
+   }
+   *out << endl;
    *out << "Raw buffers  : " << (sset.rawbuf_size/1024.0) << " kB per source" << endl;
    if (sset.max_buffers_per_spectrum > 0) {
        *out << "Buffer use   : 1 averaged spectrum consumes "
@@ -312,6 +867,12 @@ int main(int argc, char* argv[])
           return -1; 
       }
    }
+   if (sset.costas_loop) {
+      if (!addOpenSink(uri_costas1, sset.costassinks, sset)) { 
+          *out << "Error: could not addOpenSink() " << uri_costas1 << endl;
+          return -1; 
+      }
+   }
 
    /* Open input 2 data, output 2 spectrum and output 2 pcal */
    if (argc == 4) {
@@ -336,6 +897,12 @@ int main(int argc, char* argv[])
              return -1; 
          }
       }
+      if (sset.costas_loop) {
+         if (!addOpenSink(uri_costas2, sset.costassinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_costas2 << endl;
+             return -1; 
+         }
+      }
    }
 
    /* Open output xpol */
@@ -360,6 +927,256 @@ int main(int argc, char* argv[])
    sset.num_sources = sset.sources.size();
    sset.num_sinks   = sset.sinks.size();
 
+   /* Describe the phase-cal and carrier tracking outputs of each source */
+   for (int s=0; s<sset.num_sources; s++) {
+      std::string channel = Helpers::itoa(((s == 0) ? sset.use_channel_file1 : sset.use_channel_file2) + 1);
+      if (sset.extract_PCal) {
+         std::ostringstream tint;
+         tint << sset.fft_integ_seconds;
+         sset.pcalsinks[s]->setMetadata("datatype", "complex64");
+         sset.pcalsinks[s]->setMetadata("points_per_spectrum", Helpers::itoa(sset.pcal_tonebins));
+         sset.pcalsinks[s]->setMetadata("integration_s", tint.str());
+         sset.pcalsinks[s]->setMetadata("source", Helpers::itoa(s + 1));
+         sset.pcalsinks[s]->setMetadata("channel", channel);
+      }
+      if (sset.costas_loop) {
+         std::ostringstream tint;
+         tint << (double(sset.costas_output_decim) * sset.costas_block_len) / sset.samplingfreq;
+         sset.costassinks[s]->setMetadata("datatype", "swscostas_point_t {float64 time, freq, phase; float32 amplitude, lock}");
+         sset.costassinks[s]->setMetadata("record_bytes", Helpers::itoa(sizeof(swscostas_point_t)));
+         sset.costassinks[s]->setMetadata("integration_s", tint.str());
+         sset.costassinks[s]->setMetadata("source", Helpers::itoa(s + 1));
+         sset.costassinks[s]->setMetadata("channel", channel);
+      }
+   }
+
+   /* Open the spectral peak outputs of each source */
+   if (sset.peak_detect) {
+      for (int s=0; s<sset.num_sources; s++) {
+         if (!addOpenSink(uri_peak[s], sset.peaksinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_peak[s] << endl;
+             return -1;
+         }
+         sset.peaksinks[s]->setMetadata("datatype", "swspeak_t {float64 freq; float32 bin, power, noise, noise_rms, snr; int32 window_bin}");
+         sset.peaksinks[s]->setMetadata("search_band_hz", peak_band_str.empty() ? std::string("all") : peak_band_str);
+         sset.peaksinks[s]->setMetadata("interpolation", sset.peak_gaussian ? "Gaussian" : "parabolic");
+         sset.peaksinks[s]->setMetadata("record_bytes", Helpers::itoa(sizeof(swspeak_t)));
+         sset.peaksinks[s]->setMetadata("source", Helpers::itoa(s + 1));
+         if (sset.peak_window_points > 0) {
+            if (!addOpenSink(uri_peakwin[s], sset.peakwinsinks, sset)) {
+                *out << "Error: could not addOpenSink() " << uri_peakwin[s] << endl;
+                return -1;
+            }
+            sset.peakwinsinks[s]->setMetadata("datatype", "float32");
+            sset.peakwinsinks[s]->setMetadata("points_per_spectrum", Helpers::itoa(sset.peak_window_points));
+            sset.peakwinsinks[s]->setMetadata("source", Helpers::itoa(s + 1));
+         }
+      }
+   }
+
+   /* Select the bin ranges kept by each spectrum sink and describe the sink contents */
+   for (int sk=0; sk<sset.num_sinks; sk++) {
+      bool xpol = (sk >= sset.num_sources);
+      std::string const& ranges = xpol ? binranges[2] : binranges[sk];
+      BinSelection* sel = NULL;
+      if (!ranges.empty()) {
+         sel = new BinSelection(&sset, ranges);
+         if (!sel->isValid()) {
+            *out << "Error: could not parse " << binranges_key[xpol ? 2 : sk] << " = '" << ranges << "' as a list of bin ranges" << endl;
+            return -1;
+         }
+         if (sel->getLength() == 0) {
+            *out << "Error: output bin ranges '" << ranges << "' contain none of the computed bins" << endl;
+            return -1;
+         }
+         *out << "Output bins  : " << (xpol ? std::string("cross-pol") : ("file " + Helpers::itoa(sk+1)))
+              << " keeps " << sel->getLength() << " of " << sset.out_points << " points, bins " << sel->describe() << endl;
+      }
+      sset.out_selection.push_back(sel);
+      describeSpectrumSink(sset.sinks[sk], sset, sk, sel);
+   }
+
+   /* Open the spectrum sinks of every extra integration level, in the same order as the base sinks;
+    * with flagging by spectral kurtosis each point averages only its unflagged base spectra, and
+    * their number is written next to the spectra */
+   bool sk_weights = sset.spectral_kurtosis && (sset.sk_flag_mode != SKFlagNone);
+   for (size_t l=0; l<sset.integ_levels.size(); l++) {
+      std::ostringstream tint;
+      tint << sset.integ_levels[l] * sset.fft_integ_seconds;
+      for (int sk=0; sk<sset.num_sinks; sk++) {
+         bool xpol = (sk >= sset.num_sources);
+         std::string uri;
+         if (xpol) {
+            uri = sset.basefilename1 + "_" + tint.str() + "s_xpol_swspec.bin";
+         } else {
+            uri = ((sk == 0) ? sset.basefilename1 : sset.basefilename2) + "_" + tint.str() + "s_swspec.bin";
+         }
+         if (!addOpenSink(uri, sset.levelsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.levelsinks.back(), sset, sk, sset.out_selection[sk]);
+         sset.levelsinks.back()->setMetadata("integration_s", tint.str());
+         sset.levelsinks.back()->setMetadata("ffts_per_spectrum", Helpers::itoa(sset.integ_levels[l] * sset.averaged_overlapped_ffts));
+         if (!sk_weights || xpol) {
+            sset.levelweightsinks.push_back(NULL);
+            continue;
+         }
+         uri = ((sk == 0) ? sset.basefilename1 : sset.basefilename2) + "_" + tint.str() + "s_weights_swspec.bin";
+         if (!addOpenSink(uri, sset.levelweightsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.levelweightsinks.back(), sset, sk, sset.out_selection[sk]);
+         sset.levelweightsinks.back()->setMetadata("integration_s", tint.str());
+         sset.levelweightsinks.back()->setMetadata("weights", "number of unflagged base spectra averaged in each point");
+      }
+   }
+
+   /* Open the spectrum sinks of every coarser resolution, in the same order as the base sinks */
+   for (size_t r=0; r<sset.rebin_factors.size(); r++) {
+      const char* modes[3] = { "sum", "mean", "max" };
+      int factor = sset.rebin_factors[r];
+      for (int sk=0; sk<sset.num_sinks; sk++) {
+         bool xpol = (sk >= sset.num_sources);
+         int  n    = (sset.out_selection[sk] != NULL) ? sset.out_selection[sk]->getLength() : int(sset.out_points);
+         if (n < factor) {
+            *out << "Error: rebin factor " << factor << " is larger than the " << n << " points of output " << (sk+1) << endl;
+            return -1;
+         }
+
+         /* groups of neighbouring points must be neighbouring bins, the points of the tail are dropped */
+         BinSelection all(&sset, "0-" + Helpers::itoa(sset.fft_ssb_points - 1));
+         BinSelection const* sel = (sset.out_selection[sk] != NULL) ? sset.out_selection[sk] : &all;
+         if (!sel->isContiguous()) {
+            *out << "Error: RebinFactors needs one gapless range of bins in output " << (sk+1)
+                 << ", it has bins " << sel->describe() << endl;
+            return -1;
+         }
+         int first = sel->getBin(0);
+         int last  = first + (n / factor) * factor - 1;
+         std::string uri;
+         if (xpol) {
+            uri = sset.basefilename1 + "_rebin" + Helpers::itoa(factor) + "_xpol_swspec.bin";
+         } else {
+            uri = ((sk == 0) ? sset.basefilename1 : sset.basefilename2) + "_rebin" + Helpers::itoa(factor) + "_swspec.bin";
+         }
+         if (!addOpenSink(uri, sset.rebinsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.rebinsinks.back(), sset, sk, sset.out_selection[sk]);
+         sset.rebinsinks.back()->setMetadata("points_per_spectrum", Helpers::itoa(n / factor));
+         sset.rebinsinks.back()->setMetadata("bin_ranges", Helpers::itoa(first) + "-" + Helpers::itoa(last));
+         sset.rebinsinks.back()->setMetadata("rebin_factor", Helpers::itoa(factor));
+         sset.rebinsinks.back()->setMetadata("rebin_mode", modes[sset.rebin_mode]);
+         if (!sk_weights || xpol) {
+            sset.rebinweightsinks.push_back(NULL);
+            continue;
+         }
+         uri = ((sk == 0) ? sset.basefilename1 : sset.basefilename2) + "_rebin" + Helpers::itoa(factor) + "_weights_swspec.bin";
+         if (!addOpenSink(uri, sset.rebinweightsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.rebinweightsinks.back(), sset, sk, sset.out_selection[sk]);
+         sset.rebinweightsinks.back()->setMetadata("points_per_spectrum", Helpers::itoa(n / factor));
+         sset.rebinweightsinks.back()->setMetadata("bin_ranges", Helpers::itoa(first) + "-" + Helpers::itoa(last));
+         sset.rebinweightsinks.back()->setMetadata("rebin_factor", Helpers::itoa(factor));
+         sset.rebinweightsinks.back()->setMetadata("weights", "number of unflagged points combined in each point");
+      }
+   }
+
+   /* Open the sampler statistics outputs of each source */
+   for (int s=0; s<sset.num_sources; s++) {
+      std::string channel = Helpers::itoa(((s == 0) ? sset.use_channel_file1 : sset.use_channel_file2) + 1);
+      if (sset.sampler_stats) {
+         std::ostringstream tint;
+         tint << sset.fft_integ_seconds;
+         if (!addOpenSink(uri_states[s], sset.statesinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_states[s] << endl;
+             return -1;
+         }
+         sset.statesinks.back()->setMetadata("datatype", "uint64 count of each quantisation state, lowest state first");
+         sset.statesinks.back()->setMetadata("record_bytes", Helpers::itoa(sset.sampler_states * sizeof(swsint64_t)));
+         sset.statesinks.back()->setMetadata("integration_s", tint.str());
+         sset.statesinks.back()->setMetadata("source", Helpers::itoa(s + 1));
+         sset.statesinks.back()->setMetadata("channel", channel);
+      }
+      if (sset.tpow_rate_hz > 0) {
+         std::ostringstream tint;
+         tint << 1.0 / sset.tpow_rate_hz;
+         if (!addOpenSink(uri_tpow[s], sset.tpowsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_tpow[s] << endl;
+             return -1;
+         }
+         sset.tpowsinks.back()->setMetadata("datatype", "float32");
+         sset.tpowsinks.back()->setMetadata("points_per_spectrum", "1");
+         sset.tpowsinks.back()->setMetadata("integration_s", tint.str());
+         sset.tpowsinks.back()->setMetadata("source", Helpers::itoa(s + 1));
+         sset.tpowsinks.back()->setMetadata("channel", channel);
+      }
+   }
+
+   /* Open the spectral kurtosis outputs of each source */
+   if (sset.spectral_kurtosis) {
+      std::ostringstream thr;
+      thr << sset.sk_threshold;
+      for (int s=0; s<sset.num_sources; s++) {
+         if (!addOpenSink(uri_sk[s], sset.sksinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_sk[s] << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.sksinks.back(), sset, s, sset.out_selection[s]);
+         sset.sksinks.back()->setMetadata("ffts_per_spectrum", Helpers::itoa(sset.averaged_ffts));
+         sset.sksinks.back()->setMetadata("sk_threshold_sigma", thr.str());
+      }
+   }
+
+   /* Open the ON-state spectrum outputs of each source */
+   if (sset.switch_period_s > 0) {
+      std::ostringstream period, phase, frac;
+      period << sset.switch_period_s;
+      phase << sset.switch_phase;
+      frac << sset.switch_on_fraction;
+      for (int s=0; s<sset.num_sources; s++) {
+         if (!addOpenSink(uri_on[s], sset.onsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_on[s] << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.onsinks.back(), sset, s, sset.out_selection[s]);
+         sset.onsinks.back()->setMetadata("switch_state", "ON");
+         sset.onsinks.back()->setMetadata("switch_period_s", period.str());
+         sset.onsinks.back()->setMetadata("switch_phase", phase.str());
+         sset.onsinks.back()->setMetadata("switch_on_fraction", frac.str());
+      }
+      for (int s=0; s<sset.num_sources; s++) {
+         sset.sinks[s]->setMetadata("switch_state", "OFF");
+      }
+   }
+
+   /* Open the folded spectrum outputs of each source, one record holds the spectra of all phase bins */
+   if (sset.fold_bins > 0) {
+      std::ostringstream period, pdot, epoch;
+      period << std::setprecision(15) << sset.fold_period_s;
+      pdot << sset.fold_period_dot;
+      epoch << std::setprecision(15) << sset.fold_epoch_s;
+      for (int s=0; s<sset.num_sources; s++) {
+         int n = (sset.out_selection[s] != NULL) ? sset.out_selection[s]->getLength() : int(sset.out_points);
+         if (!addOpenSink(uri_fold[s], sset.foldsinks, sset)) {
+             *out << "Error: could not addOpenSink() " << uri_fold[s] << endl;
+             return -1;
+         }
+         describeSpectrumSink(sset.foldsinks.back(), sset, s, sset.out_selection[s]);
+         sset.foldsinks.back()->setMetadata("points_per_spectrum", Helpers::itoa(n * sset.fold_bins));
+         sset.foldsinks.back()->setMetadata("points_per_phase_bin", Helpers::itoa(n));
+         sset.foldsinks.back()->setMetadata("fold_bins", Helpers::itoa(sset.fold_bins));
+         sset.foldsinks.back()->setMetadata("fold_period_s", period.str());
+         sset.foldsinks.back()->setMetadata("fold_period_derivative", pdot.str());
+         sset.foldsinks.back()->setMetadata("fold_epoch_s", epoch.str());
+      }
+   }
+
    /*
     * Create the double-buffered raw input bufs
     * To make cross-pol spectra each core needs data from all source files.
@@ -370,13 +1187,14 @@ int main(int argc, char* argv[])
    double ramMB_1source = 2 * sset.num_cores * sset.rawbuf_size/(1024.0*1024.0);
    double ramMB_total   = ramMB_1source * sset.sources.size();
    *out << "Raw buffers  : " << ramMB_total << " MByte in total with double-buffering" << endl;
+   Buffer::setUseHugePages(sset.use_hugepages);
    sset.rawbuffers = new Buffer***[sset.num_cores];
    for (int c=0; c<sset.num_cores; c++) {
       sset.rawbuffers[c] = new Buffer**[2];
       for (int b=0; b<2; b++) {
          sset.rawbuffers[c][b] = new Buffer*[sset.num_sources];
          for (int s=0; s<sset.num_sources; s++) {
-            sset.rawbuffers[c][b][s] = new Buffer(sset.rawbuf_size);
+            sset.rawbuffers[c][b][s] = new Buffer(sset.rawbuf_size, sset.raw_carry_bytes, sset.core_numa_node[c]);
          }
       }
    }
@@ -400,15 +1218,104 @@ int main(int argc, char* argv[])
    for (int c=0; c<sset.num_cores; c++) {
       sset.outbuffers[c] = new Buffer*[sset.num_sources];
       for (int s=0; s<sset.num_sources; s++) {
-         sset.outbuffers[c][s] = new Buffer(outbuf_size_auto);
+         sset.outbuffers[c][s] = new Buffer(outbuf_size_auto, 0, sset.core_numa_node[c]);
       }
       sset.outbuffersXpol[c] = new Buffer*[sset.num_xpols];
       for (int x=0; x<sset.num_xpols; x++) {
-         sset.outbuffersXpol[c][x] = new Buffer(outbuf_size_xpol);
+         sset.outbuffersXpol[c][x] = new Buffer(outbuf_size_xpol, 0, sset.core_numa_node[c]);
       }
       sset.outbuffersPCal[c] = new Buffer*[sset.num_sources];
       for (int s=0; s<sset.num_sources; s++) {
-         sset.outbuffersPCal[c][s] = new Buffer(outbuf_size_pcal);
+         sset.outbuffersPCal[c][s] = new Buffer(outbuf_size_pcal, 0, sset.core_numa_node[c]);
+      }
+   }
+
+   /* The carrier downconversion blocks of each core go to the tracking loop in the TaskDispatcher */
+   sset.outbuffersCostas = NULL;
+   if (sset.costas_loop) {
+      sset.outbuffersCostas = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersCostas[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersCostas[c][s] = new Buffer(sset.costas_result_bytes, 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+
+   /* The peaks found in the spectra, one record and one window per spectrum, plus one for a partial spectrum at EOF */
+   sset.outbuffersPeak    = NULL;
+   sset.outbuffersPeakWin = NULL;
+   if (sset.peak_detect) {
+      int nspectra = std::max(sset.max_spectra_per_buffer, 1) + 1;
+      sset.outbuffersPeak    = new Buffer**[sset.num_cores];
+      sset.outbuffersPeakWin = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersPeak[c]    = new Buffer*[sset.num_sources];
+         sset.outbuffersPeakWin[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersPeak[c][s]    = new Buffer(nspectra * sizeof(swspeak_t), 0, sset.core_numa_node[c]);
+            sset.outbuffersPeakWin[c][s] = new Buffer(nspectra * std::max(sset.peak_window_points, 1) * sizeof(swsfloat_t), 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+
+   /* The quantisation state histogram of each spectrum, and the total power blocks for the TaskDispatcher */
+   sset.outbuffersStates = NULL;
+   sset.outbuffersTPow   = NULL;
+   if (sset.sampler_stats) {
+      size_t outbuf_size_states = std::max(sset.max_spectra_per_buffer, 1) * sset.sampler_states * sizeof(swsint64_t);
+      sset.outbuffersStates = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersStates[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersStates[c][s] = new Buffer(outbuf_size_states, 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+   if (sset.tpow_rate_hz > 0) {
+      sset.outbuffersTPow = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersTPow[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersTPow[c][s] = new Buffer(sset.tpow_result_bytes, 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+
+   /* The ON-state spectra of the switching, laid out like the normal spectra */
+   sset.outbuffersOn = NULL;
+   if (sset.switch_period_s > 0) {
+      sset.outbuffersOn = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersOn[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersOn[c][s] = new Buffer(outbuf_size_auto, 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+
+   /* The folded spectra, fold_bins spectra laid out like the normal ones per integrated spectrum */
+   sset.outbuffersFold = NULL;
+   if (sset.fold_bins > 0) {
+      sset.outbuffersFold = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersFold[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersFold[c][s] = new Buffer(sset.fold_bins * outbuf_size_auto, 0, sset.core_numa_node[c]);
+         }
+      }
+   }
+
+   /* The spectral kurtosis sums, power and power^2 of every point of each spectrum */
+   sset.outbuffersSK = NULL;
+   if (sset.spectral_kurtosis) {
+      size_t outbuf_size_sk = std::max(sset.max_spectra_per_buffer, 1) * 2 * sset.fft_bytes_ssb;
+      sset.outbuffersSK = new Buffer**[sset.num_cores];
+      for (int c=0; c<sset.num_cores; c++) {
+         sset.outbuffersSK[c] = new Buffer*[sset.num_sources];
+         for (int s=0; s<sset.num_sources; s++) {
+            sset.outbuffersSK[c][s] = new Buffer(outbuf_size_sk, 0, sset.core_numa_node[c]);
+         }
       }
    }
    *out << endl;
@@ -481,6 +1388,42 @@ bool addOpenPlotSink(std::string const& uri, std::vector<DataSink*>& sinks, swsp
 #endif
 }
 
+/**
+ * Helper to attach the description of a spectrum output to its sink.
+ */
+void describeSpectrumSink(DataSink* sink, swspect_settings_t const& set, int sk, BinSelection const* sel)
+{
+   bool xpol = (sk >= set.num_sources);
+   std::ostringstream fs, bw, tint;
+   fs << set.fft_points;
+   bw << 0.5*set.samplingfreq;
+   tint << set.fft_integ_seconds;
+
+   /* without an output selection the sink gets all computed bins */
+   BinSelection all((swspect_settings_t*)&set, "0-" + Helpers::itoa(set.fft_ssb_points - 1));
+   if (sel == NULL) {
+      sel = &all;
+   }
+
+   sink->setMetadata("fft_points", fs.str());
+   sink->setMetadata("bandwidth_hz", bw.str());
+   sink->setMetadata("integration_s", tint.str());
+   sink->setMetadata("datatype", xpol ? "complex64" : "float32");
+   sink->setMetadata("points_per_spectrum", Helpers::itoa(sel->getLength()));
+   sink->setMetadata("bin_ranges", sel->describe());
+   sink->setMetadata("ffts_per_spectrum", Helpers::itoa(set.averaged_overlapped_ffts));
+   sink->setMetadata("source", xpol ? std::string("0") : Helpers::itoa(sk + 1));
+   sink->setMetadata("channel", xpol ? std::string("0") : Helpers::itoa(((sk == 0) ? set.use_channel_file1 : set.use_channel_file2) + 1));
+
+   /* the record times are seconds after this reference, from the time stamps of the input data */
+   if (set.time_ref_mjd >= 0) {
+      std::ostringstream tref;
+      tref << std::fixed << std::setprecision(9) << set.time_ref_sec;
+      sink->setMetadata("time_ref_mjd", Helpers::itoa(set.time_ref_mjd));
+      sink->setMetadata("time_ref_s", tref.str());
+   }
+}
+
 /**
  * Return a file name created from 'pattern' filled out with SWspectrometer settings.
  */
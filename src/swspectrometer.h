@@ -30,11 +30,13 @@ extern char          __BUILD_NUMBER;
 
 class DataSource;
 class DataSink;
+class BinSelection;
 
 // helpers
 bool addOpenSource(std::string const&, std::vector<DataSource*>&, swspect_settings_t&);
 bool addOpenSink  (std::string const&, std::vector<DataSink*>&, swspect_settings_t&);
 bool addOpenPlotSink(std::string const&, std::vector<DataSink*>&, swspect_settings_t&, std::string const&);
+void describeSpectrumSink(DataSink*, swspect_settings_t const&, int, BinSelection const*);
 std::string cfg_to_filename(std::string, swspect_settings_t const&, int);
 
 #endif // SWSPECTROMETER_H